@@ -0,0 +1,88 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Minimal set of Windows types needed to compile the header-only
+// containers in sys/ as plain user-mode C on Linux or macOS.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define VOID                void
+typedef void*               PVOID;
+typedef uint8_t             UCHAR;
+typedef UCHAR               BOOLEAN;
+typedef BOOLEAN*            PBOOLEAN;
+typedef int32_t             LONG;
+typedef uint32_t            ULONG;
+typedef ULONG*              PULONG;
+typedef uint64_t            ULONGLONG;
+typedef uint64_t            ULONG64;
+typedef uint16_t            WCHAR;
+typedef const WCHAR*        PCWSTR;
+
+#ifndef TRUE
+#define TRUE                1
+#define FALSE               0
+#endif
+
+#define FORCEINLINE         static inline __attribute__((always_inline))
+#define FIELD_OFFSET(type, field)   ((LONG)offsetof(type, field))
+#define RtlZeroMemory(Destination, Length)  memset((Destination), 0, (Length))
+#define RtlCopyMemory(Destination, Source, Length)  memcpy((Destination), (Source), (Length))
+#define RtlEqualMemory(Destination, Source, Length) (!memcmp((Destination), (Source), (Length)))
+
+//
+// Monotonic time stamp in nanoseconds
+//
+static inline ULONGLONG BenchNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ULONGLONG)ts.tv_sec * 1000000000ULL + (ULONGLONG)ts.tv_nsec;
+}
+
+//
+// Small deterministic generator (xorshift32), so runs are comparable
+//
+static inline ULONG BenchRandom(ULONG* state)
+{
+    ULONG x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
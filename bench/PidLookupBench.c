@@ -0,0 +1,158 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+//
+// Compares system PID whitelist lookups: the original linked list
+// (PID_LIST_CONTAINS), the sorted array alone (binary search) and the
+// sorted array with its two-level bitmap index (PID_SET_CONTAINS).
+//
+// Build and run from this directory:
+//
+//   cc -O2 -I../sys PidLookupBench.c -o PidLookupBench && ./PidLookupBench
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "BenchTypes.h"
+#include "PidList.h"
+#include "PidSet.h"
+
+//
+// Highest PID handed out; real systems stay well below this
+//
+#define BENCH_PID_RANGE     0x40000
+
+#define BENCH_QUERIES       (1 << 20)
+
+static volatile ULONG BenchSink;
+
+static double BenchList(PPID_LIST_NODE* list, const ULONG* queries, ULONG count)
+{
+    ULONGLONG start = BenchNow();
+    ULONG hits = 0;
+    ULONG i;
+
+    for (i = 0; i < count; i++) {
+        hits += PID_LIST_CONTAINS(list, queries[i], NULL);
+    }
+
+    BenchSink = hits;
+
+    return (double)(BenchNow() - start) / count;
+}
+
+static double BenchSet(PPID_SET set, const ULONG* queries, ULONG count)
+{
+    ULONGLONG start = BenchNow();
+    ULONG hits = 0;
+    ULONG i;
+
+    for (i = 0; i < count; i++) {
+        hits += PID_SET_CONTAINS(set, queries[i]);
+    }
+
+    BenchSink = hits;
+
+    return (double)(BenchNow() - start) / count;
+}
+
+int main(int argc, char* argv[])
+{
+    static const ULONG sizes[] = { 10, 30, 100, 300, 1000, 3000, 10000 };
+    ULONG seed = 0x48474448;
+    ULONG* pids;
+    ULONG* queries;
+    ULONG queryCount;
+    ULONG s, i;
+
+    queryCount = (argc > 1) ? (ULONG)strtoul(argv[1], NULL, 0) : BENCH_QUERIES;
+
+    pids = malloc(sizeof(ULONG) * sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    queries = malloc(sizeof(ULONG) * queryCount);
+
+    if (pids == NULL || queries == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    printf("%8s %14s %14s %14s %12s\n",
+        "pids", "list ns/op", "array ns/op", "bitmap ns/op", "bitmap KB");
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        PPID_LIST_NODE list = PID_LIST_CREATE();
+        PPID_SET set;
+        PPID_BITMAP bitmap;
+        double tList, tArray, tBitmap;
+        ULONG leaves = 0;
+
+        for (i = 0; i < sizes[s]; i++) {
+            pids[i] = (BenchRandom(&seed) % (BENCH_PID_RANGE / 4) + 1) * 4;
+            PID_LIST_PUSH(&list, pids[i], TRUE);
+        }
+
+        set = PID_SET_MERGE(NULL, pids, sizes[s]);
+
+        //
+        // Half of the queries hit, the rest are random (mostly misses)
+        //
+        for (i = 0; i < queryCount; i++) {
+            queries[i] = (i & 1)
+                ? pids[BenchRandom(&seed) % sizes[s]]
+                : (BenchRandom(&seed) % (BENCH_PID_RANGE / 4) + 1) * 4;
+        }
+
+        //
+        // The list is quadratic to probe at the larger sizes, so it gets
+        // fewer queries; results are per lookup either way
+        //
+        tList = BenchList(&list, queries, sizes[s] > 1000 ? queryCount / 16 : queryCount);
+
+        bitmap = set->Bitmap;
+        set->Bitmap = NULL;
+        tArray = BenchSet(set, queries, queryCount);
+        set->Bitmap = bitmap;
+
+        tBitmap = BenchSet(set, queries, queryCount);
+
+        for (i = 0; i < PID_BITMAP_DIRECTORY_SIZE; i++) {
+            leaves += (bitmap != NULL && bitmap->Directory[i] != NULL);
+        }
+
+        printf("%8u %14.2f %14.2f %14.2f %12.1f\n",
+            sizes[s], tList, tArray, tBitmap,
+            (sizeof(PID_BITMAP) + leaves * PID_BITMAP_LEAF_ULONGS * sizeof(ULONG)) / 1024.0);
+
+        PID_SET_DESTROY(&set);
+        PID_LIST_DESTROY(&list);
+    }
+
+    free(queries);
+    free(pids);
+
+    return 0;
+}
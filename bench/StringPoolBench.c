@@ -0,0 +1,221 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+//
+// Measures the identity string pool (STRING_POOL) against every device
+// keeping private copies of its IDs: memory held, and the cost of
+// interning a device's strings on arrival and releasing them on removal.
+//
+// The devices mimic HID collections: a handful of pad models, each
+// exposing up to three collections, so device and hardware IDs repeat
+// across devices while instance IDs are unique.
+//
+// Build and run from this directory:
+//
+//   cc -O2 -I../sys StringPoolBench.c -o StringPoolBench && ./StringPoolBench
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "BenchTypes.h"
+#include "StringPool.h"
+
+#define BENCH_MODELS            12
+
+#define BENCH_COLLECTIONS       3
+
+#define BENCH_HARDWARE_IDS      5
+
+#define BENCH_MAX_LENGTH        64
+
+//
+// Device, instance and hardware IDs of one device
+//
+#define BENCH_STRINGS           (2 + BENCH_HARDWARE_IDS)
+
+//
+// Replug rounds per size, each removes and re-adds one random device
+//
+#define BENCH_REPLUGS           (1 << 16)
+
+typedef struct _BENCH_DEVICE
+{
+    WCHAR Strings[BENCH_STRINGS][BENCH_MAX_LENGTH];
+
+    ULONG Lengths[BENCH_STRINGS];
+
+    PCWSTR Pooled[BENCH_STRINGS];
+
+} BENCH_DEVICE, *PBENCH_DEVICE;
+
+static ULONG BenchWiden(WCHAR* out, const char* format, ULONG a, ULONG b, ULONG c)
+{
+    char narrow[BENCH_MAX_LENGTH];
+    int length = snprintf(narrow, sizeof(narrow), format, a, b, c);
+    int i;
+
+    for (i = 0; i <= length; i++) {
+        out[i] = (WCHAR)narrow[i];
+    }
+
+    return (ULONG)length;
+}
+
+static VOID BenchDescribe(PBENCH_DEVICE device, ULONG index)
+{
+    ULONG model = index % BENCH_MODELS;
+    ULONG vid = 0x045E + model * 0x111;
+    ULONG pid = 0x0200 + model * 0x31;
+    ULONG col = (index / BENCH_MODELS) % BENCH_COLLECTIONS + 1;
+    WCHAR (*s)[BENCH_MAX_LENGTH] = device->Strings;
+    ULONG* l = device->Lengths;
+
+    l[0] = BenchWiden(s[0], "HID\\VID_%04X&PID_%04X&Col%02u", vid, pid, col);
+    l[1] = BenchWiden(s[1], "7&%X&0&%04X", index * 0x2F1D3, index, 0);
+    l[2] = BenchWiden(s[2], "HID\\VID_%04X&PID_%04X&REV_0100&Col%02u", vid, pid, col);
+    l[3] = BenchWiden(s[3], "HID\\VID_%04X&PID_%04X&Col%02u", vid, pid, col);
+    l[4] = BenchWiden(s[4], "HID_DEVICE_SYSTEM_GAME", 0, 0, 0);
+    l[5] = BenchWiden(s[5], "HID_DEVICE_UP:0001_U:%04X", col == 1 ? 5 : 4, 0, 0);
+    l[6] = BenchWiden(s[6], "HID_DEVICE", 0, 0, 0);
+}
+
+static BOOLEAN BenchArrive(PSTRING_POOL pool, PBENCH_DEVICE device)
+{
+    ULONG i;
+
+    for (i = 0; i < BENCH_STRINGS; i++) {
+        device->Pooled[i] = STRING_POOL_INTERN(pool, device->Strings[i], device->Lengths[i]);
+
+        if (device->Pooled[i] == NULL) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static VOID BenchRemove(PSTRING_POOL pool, PBENCH_DEVICE device)
+{
+    ULONG i;
+
+    for (i = 0; i < BENCH_STRINGS; i++) {
+        STRING_POOL_RELEASE(pool, device->Pooled[i]);
+        device->Pooled[i] = NULL;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    static const ULONG sizes[] = { 8, 32, 128, 512, 2048, 8192 };
+    ULONG seed = 0x48475350;
+    PBENCH_DEVICE devices;
+    ULONG replugs;
+    ULONG s, i;
+
+    replugs = (argc > 1) ? (ULONG)strtoul(argv[1], NULL, 0) : BENCH_REPLUGS;
+
+    devices = calloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1], sizeof(BENCH_DEVICE));
+
+    if (devices == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    printf("%8s %8s %12s %12s %8s %12s %12s %12s\n",
+        "devices", "strings", "pooled KB", "private KB", "saved", "intern ns", "release ns", "replug ns");
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        PSTRING_POOL pool = STRING_POOL_CREATE(64);
+        ULONGLONG start;
+        double tIntern, tRelease, tReplug;
+        double pooled, unpooled;
+        ULONG strings;
+
+        if (pool == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+
+        for (i = 0; i < sizes[s]; i++) {
+            BenchDescribe(&devices[i], i);
+        }
+
+        start = BenchNow();
+
+        for (i = 0; i < sizes[s]; i++) {
+            if (!BenchArrive(pool, &devices[i])) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+        }
+
+        tIntern = (double)(BenchNow() - start) / ((double)sizes[s] * BENCH_STRINGS);
+
+        //
+        // Private copies are what each device held before pooling: its
+        // strings back to back, terminators included
+        //
+        strings = pool->Strings;
+        pooled = pool->PooledBytes / 1024.0;
+        unpooled = pool->UnpooledBytes / 1024.0;
+
+        start = BenchNow();
+
+        for (i = 0; i < replugs; i++) {
+            PBENCH_DEVICE device = &devices[BenchRandom(&seed) % sizes[s]];
+
+            BenchRemove(pool, device);
+            BenchArrive(pool, device);
+        }
+
+        tReplug = (double)(BenchNow() - start) / replugs;
+
+        start = BenchNow();
+
+        for (i = 0; i < sizes[s]; i++) {
+            BenchRemove(pool, &devices[i]);
+        }
+
+        tRelease = (double)(BenchNow() - start) / ((double)sizes[s] * BENCH_STRINGS);
+
+        if (pool->Strings != 0 || pool->References != 0) {
+            fprintf(stderr, "pool not empty after releasing every device\n");
+            return 1;
+        }
+
+        printf("%8u %8u %12.1f %12.1f %7.1f%% %12.2f %12.2f %12.2f\n",
+            sizes[s], strings, pooled, unpooled, 100.0 * (1.0 - pooled / unpooled),
+            tIntern, tRelease, tReplug);
+
+        STRING_POOL_DESTROY(&pool);
+    }
+
+    free(devices);
+
+    return 0;
+}
@@ -0,0 +1,563 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+//
+// Microbenchmarks for every container registered in VerdictStores.h:
+// lookup (hit and miss), insert and remove at sizes 1 to 100k, plus
+// lookups from concurrent readers behind a reader/writer lock (shared
+// for pure readers, exclusive if the lookup modifies the structure).
+//
+// Iteration counts grow until a run takes at least --min-time seconds,
+// the same way Google Benchmark does, and --format=json emits its JSON
+// layout so existing tooling (compare.py etc.) can consume the results.
+//
+// Build and run from this directory:
+//
+//   cc -O2 -I../sys VerdictBench.c -lpthread -o VerdictBench && ./VerdictBench
+//
+// Options: --format=console|json  --filter=<substring>  --min-time=<seconds>
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "VerdictStores.h"
+
+//
+// Entries added/removed per timed batch in the insert and remove runs
+//
+#define BENCH_BATCH_MAX     64
+
+//
+// Lookups cycle through this many precomputed keys
+//
+#define BENCH_QUERY_COUNT   4096
+
+static const ULONG BenchSizes[] = { 1, 10, 100, 1000, 10000, 100000 };
+static const ULONG BenchThreads[] = { 2, 4, 8 };
+
+typedef enum _BENCH_FORMAT
+{
+    BenchFormatConsole,
+    BenchFormatJson
+
+} BENCH_FORMAT;
+
+static BENCH_FORMAT BenchFormat = BenchFormatConsole;
+static const char* BenchFilter = NULL;
+static double BenchMinTime = 0.1;
+static ULONG BenchResultCount = 0;
+
+static volatile ULONG BenchSink;
+
+//
+// One populated store and its key material
+//
+typedef struct _BENCH_FIXTURE
+{
+    const BENCH_STORE* Store;
+
+    PVOID Instance;
+
+    ULONG Size;
+
+    //
+    // Members first, then PIDs guaranteed to be absent
+    //
+    PULONG Pids;
+
+    ULONG HitQueries[BENCH_QUERY_COUNT];
+
+    ULONG MissQueries[BENCH_QUERY_COUNT];
+
+    ULONG Batch;
+
+    ULONG Cursor;
+
+    pthread_rwlock_t Lock;
+
+} BENCH_FIXTURE, *PBENCH_FIXTURE;
+
+//
+// Wall and process CPU time of the measured sections only
+//
+typedef struct _BENCH_TIMING
+{
+    ULONGLONG Real;
+
+    ULONGLONG Cpu;
+
+} BENCH_TIMING;
+
+typedef BENCH_TIMING (*PFN_BENCH_RUN)(PBENCH_FIXTURE fixture, ULONG iterations, ULONG threads);
+
+typedef struct _BENCH_READER
+{
+    PBENCH_FIXTURE Fixture;
+
+    ULONG Iterations;
+
+    ULONG Offset;
+
+    pthread_barrier_t* Barrier;
+
+} BENCH_READER;
+
+static ULONGLONG BenchCpuNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return (ULONGLONG)ts.tv_sec * 1000000000ULL + (ULONGLONG)ts.tv_nsec;
+}
+
+static VOID BenchStart(BENCH_TIMING* mark)
+{
+    mark->Cpu = BenchCpuNow();
+    mark->Real = BenchNow();
+}
+
+static VOID BenchStop(const BENCH_TIMING* mark, BENCH_TIMING* total)
+{
+    total->Real += BenchNow() - mark->Real;
+    total->Cpu += BenchCpuNow() - mark->Cpu;
+}
+
+static BOOLEAN BenchBuildFixture(PBENCH_FIXTURE fixture, const BENCH_STORE* store, ULONG size, ULONG* seed)
+{
+    ULONG pool = size * 2 + BENCH_BATCH_MAX * 2;
+    ULONG i, j, temp;
+
+    fixture->Store = store;
+    fixture->Size = size;
+    fixture->Batch = size < BENCH_BATCH_MAX ? size : BENCH_BATCH_MAX;
+    fixture->Cursor = 0;
+    fixture->Pids = malloc(sizeof(ULONG) * pool);
+    fixture->Instance = store->Create(size + BENCH_BATCH_MAX);
+
+    if (fixture->Pids == NULL || fixture->Instance == NULL) {
+        return FALSE;
+    }
+
+    //
+    // Shuffled range of valid (multiple of four) PIDs, so the members
+    // and the misses are drawn from the same distribution
+    //
+    for (i = 0; i < pool; i++) {
+        fixture->Pids[i] = (i + 2) * 4;
+    }
+
+    for (i = pool - 1; i > 0; i--) {
+        j = BenchRandom(seed) % (i + 1);
+        temp = fixture->Pids[i];
+        fixture->Pids[i] = fixture->Pids[j];
+        fixture->Pids[j] = temp;
+    }
+
+    for (i = 0; i < size; i++) {
+        if (!store->Insert(fixture->Instance, fixture->Pids[i], (BOOLEAN)(i & 1))) {
+            return FALSE;
+        }
+    }
+
+    for (i = 0; i < BENCH_QUERY_COUNT; i++) {
+        fixture->HitQueries[i] = fixture->Pids[BenchRandom(seed) % size];
+        fixture->MissQueries[i] = fixture->Pids[size + BenchRandom(seed) % (pool - size)];
+    }
+
+    pthread_rwlock_init(&fixture->Lock, NULL);
+
+    return TRUE;
+}
+
+static VOID BenchDestroyFixture(PBENCH_FIXTURE fixture)
+{
+    if (fixture->Instance != NULL) {
+        fixture->Store->Destroy(fixture->Instance);
+        pthread_rwlock_destroy(&fixture->Lock);
+    }
+
+    free(fixture->Pids);
+    fixture->Pids = NULL;
+    fixture->Instance = NULL;
+}
+
+static BENCH_TIMING BenchRunLookup(PBENCH_FIXTURE fixture, const ULONG* queries, ULONG iterations)
+{
+    const BENCH_STORE* store = fixture->Store;
+    BENCH_TIMING mark, total = { 0, 0 };
+    ULONG hits = 0;
+    ULONG i;
+
+    BenchStart(&mark);
+
+    for (i = 0; i < iterations; i++) {
+        hits += store->Lookup(fixture->Instance, queries[i & (BENCH_QUERY_COUNT - 1)], NULL);
+    }
+
+    BenchStop(&mark, &total);
+
+    BenchSink = hits;
+
+    return total;
+}
+
+static BENCH_TIMING BenchRunLookupHit(PBENCH_FIXTURE fixture, ULONG iterations, ULONG threads)
+{
+    (void)threads;
+
+    return BenchRunLookup(fixture, fixture->HitQueries, iterations);
+}
+
+static BENCH_TIMING BenchRunLookupMiss(PBENCH_FIXTURE fixture, ULONG iterations, ULONG threads)
+{
+    (void)threads;
+
+    return BenchRunLookup(fixture, fixture->MissQueries, iterations);
+}
+
+//
+// Iterations count single inserts; each batch of fresh PIDs is removed
+// again outside of the timed section to keep the size constant
+//
+static BENCH_TIMING BenchRunInsert(PBENCH_FIXTURE fixture, ULONG iterations, ULONG threads)
+{
+    const BENCH_STORE* store = fixture->Store;
+    PULONG fresh = &fixture->Pids[fixture->Size];
+    BENCH_TIMING mark, total = { 0, 0 };
+    ULONG done, batch, i;
+
+    (void)threads;
+
+    for (done = 0; done < iterations; done += batch) {
+        batch = iterations - done < fixture->Batch ? iterations - done : fixture->Batch;
+
+        BenchStart(&mark);
+        for (i = 0; i < batch; i++) {
+            store->Insert(fixture->Instance, fresh[i], TRUE);
+        }
+        BenchStop(&mark, &total);
+
+        for (i = 0; i < batch; i++) {
+            store->Remove(fixture->Instance, fresh[i]);
+        }
+    }
+
+    return total;
+}
+
+//
+// Removes a batch of members and puts them back untimed, rotating
+// through the member range
+//
+static BENCH_TIMING BenchRunRemove(PBENCH_FIXTURE fixture, ULONG iterations, ULONG threads)
+{
+    const BENCH_STORE* store = fixture->Store;
+    BENCH_TIMING mark, total = { 0, 0 };
+    ULONG done, batch, i;
+    PULONG members;
+
+    (void)threads;
+
+    for (done = 0; done < iterations; done += batch) {
+        batch = iterations - done < fixture->Batch ? iterations - done : fixture->Batch;
+
+        if (fixture->Cursor + batch > fixture->Size) {
+            fixture->Cursor = 0;
+        }
+
+        members = &fixture->Pids[fixture->Cursor];
+        fixture->Cursor += batch;
+
+        BenchStart(&mark);
+        for (i = 0; i < batch; i++) {
+            store->Remove(fixture->Instance, members[i]);
+        }
+        BenchStop(&mark, &total);
+
+        for (i = 0; i < batch; i++) {
+            store->Insert(fixture->Instance, members[i], TRUE);
+        }
+    }
+
+    return total;
+}
+
+static void* BenchReaderThread(void* context)
+{
+    BENCH_READER* reader = context;
+    PBENCH_FIXTURE fixture = reader->Fixture;
+    const BENCH_STORE* store = fixture->Store;
+    ULONG hits = 0;
+    ULONG i;
+
+    pthread_barrier_wait(reader->Barrier);
+
+    for (i = 0; i < reader->Iterations; i++) {
+        if (store->LookupWrites)
+            pthread_rwlock_wrlock(&fixture->Lock);
+        else
+            pthread_rwlock_rdlock(&fixture->Lock);
+
+        hits += store->Lookup(fixture->Instance,
+            fixture->HitQueries[(reader->Offset + i) & (BENCH_QUERY_COUNT - 1)], NULL);
+
+        pthread_rwlock_unlock(&fixture->Lock);
+    }
+
+    BenchSink = hits;
+
+    pthread_barrier_wait(reader->Barrier);
+
+    return NULL;
+}
+
+//
+// Iterations are split evenly across the readers, the result is wall
+// time so items_per_second reflects the aggregate throughput
+//
+static BENCH_TIMING BenchRunConcurrentLookup(PBENCH_FIXTURE fixture, ULONG iterations, ULONG threads)
+{
+    pthread_t handles[8];
+    BENCH_READER readers[8];
+    pthread_barrier_t barrier;
+    BENCH_TIMING mark, total = { 0, 0 };
+    ULONG i;
+
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+
+    for (i = 0; i < threads; i++) {
+        readers[i].Fixture = fixture;
+        readers[i].Iterations = iterations / threads + (i < iterations % threads);
+        readers[i].Offset = i * (BENCH_QUERY_COUNT / threads);
+        readers[i].Barrier = &barrier;
+        pthread_create(&handles[i], NULL, BenchReaderThread, &readers[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    BenchStart(&mark);
+    pthread_barrier_wait(&barrier);
+    BenchStop(&mark, &total);
+
+    for (i = 0; i < threads; i++) {
+        pthread_join(handles[i], NULL);
+    }
+
+    pthread_barrier_destroy(&barrier);
+
+    return total;
+}
+
+static VOID BenchReport(const char* name, ULONG threads, ULONGLONG iterations, double realNs, double cpuNs)
+{
+    if (BenchFormat == BenchFormatJson) {
+        printf("%s    {\n", BenchResultCount ? ",\n" : "");
+        printf("      \"name\": \"%s\",\n", name);
+        printf("      \"run_name\": \"%s\",\n", name);
+        printf("      \"run_type\": \"iteration\",\n");
+        printf("      \"threads\": %u,\n", threads);
+        printf("      \"iterations\": %llu,\n", (unsigned long long)iterations);
+        printf("      \"real_time\": %.4f,\n", realNs);
+        printf("      \"cpu_time\": %.4f,\n", cpuNs);
+        printf("      \"time_unit\": \"ns\",\n");
+        printf("      \"items_per_second\": %.1f\n", 1e9 / realNs);
+        printf("    }");
+    }
+    else {
+        printf("%-44s %12.2f ns %12.2f ns %12llu %12.4gM/s\n",
+            name, realNs, cpuNs, (unsigned long long)iterations, 1e3 / realNs);
+    }
+
+    BenchResultCount++;
+}
+
+static VOID BenchRun(PBENCH_FIXTURE fixture, const char* name, PFN_BENCH_RUN run, ULONG threads)
+{
+    ULONGLONG iterations = 1;
+    BENCH_TIMING timing;
+    double multiplier;
+
+    if (BenchFilter != NULL && strstr(name, BenchFilter) == NULL) {
+        return;
+    }
+
+    for (;;) {
+        timing = run(fixture, (ULONG)iterations, threads);
+
+        if (timing.Real >= BenchMinTime * 1e9 || iterations >= 0x40000000) {
+            break;
+        }
+
+        //
+        // Aim slightly past the target, at most 10x per step
+        //
+        multiplier = timing.Real ? BenchMinTime * 1.4e9 / timing.Real : 10;
+        multiplier = multiplier > 10 ? 10 : (multiplier < 2 ? 2 : multiplier);
+        iterations = (ULONGLONG)(iterations * multiplier);
+    }
+
+    BenchReport(name, threads, iterations, (double)timing.Real / iterations, (double)timing.Cpu / iterations);
+}
+
+//
+// Same scripted operations against every store before anything gets
+// timed; a structure that disagrees isn't worth measuring
+//
+static BOOLEAN BenchConformance(const BENCH_STORE* store)
+{
+    PVOID instance = store->Create(256);
+    BOOLEAN allowed = FALSE;
+    BOOLEAN ok = instance != NULL;
+    ULONG i;
+
+    //
+    // Starts above SYSTEM_PID, which PID_LIST refuses to remove
+    //
+    for (i = 2; ok && i <= 101; i++) {
+        ok = store->Insert(instance, i * 4, TRUE);
+    }
+
+    for (i = 2; ok && i <= 101; i += 2) {
+        ok = store->Remove(instance, i * 4);
+    }
+
+    for (i = 2; ok && i <= 101; i++) {
+        ok = store->Lookup(instance, i * 4, &allowed) == ((i & 1) != 0);
+    }
+
+    ok = ok && !store->Lookup(instance, 404 * 4, NULL) && !store->Remove(instance, 404 * 4);
+
+    if (instance != NULL) {
+        store->Destroy(instance);
+    }
+
+    return ok;
+}
+
+static BOOLEAN BenchParse(int argc, char* argv[])
+{
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--format=json") == 0)
+            BenchFormat = BenchFormatJson;
+        else if (strcmp(argv[i], "--format=console") == 0)
+            BenchFormat = BenchFormatConsole;
+        else if (strncmp(argv[i], "--filter=", 9) == 0)
+            BenchFilter = argv[i] + 9;
+        else if (strncmp(argv[i], "--min-time=", 11) == 0)
+            BenchMinTime = strtod(argv[i] + 11, NULL);
+        else
+            return FALSE;
+    }
+
+    return BenchMinTime > 0;
+}
+
+int main(int argc, char* argv[])
+{
+    static BENCH_FIXTURE fixture;
+    const BENCH_STORE* store;
+    char name[128];
+    ULONG seed = 0x48474448;
+    time_t now = time(NULL);
+    char date[32];
+    int failures = 0;
+    ULONG s, t;
+    size_t i;
+
+    if (!BenchParse(argc, argv)) {
+        fprintf(stderr, "usage: %s [--format=console|json] [--filter=<substring>] [--min-time=<seconds>]\n", argv[0]);
+        return 1;
+    }
+
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+    if (BenchFormat == BenchFormatJson) {
+        printf("{\n  \"context\": {\n");
+        printf("    \"date\": \"%s\",\n", date);
+        printf("    \"executable\": \"%s\",\n", argv[0]);
+        printf("    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+        printf("    \"library_build_type\": \"release\"\n");
+        printf("  },\n  \"benchmarks\": [\n");
+    }
+    else {
+        printf("%-44s %15s %15s %12s %14s\n", "Benchmark", "Time", "CPU", "Iterations", "Items");
+    }
+
+    for (i = 0; i < sizeof(BenchStores) / sizeof(BenchStores[0]); i++) {
+        store = &BenchStores[i];
+
+        if (!BenchConformance(store)) {
+            fprintf(stderr, "%s: conformance check failed, skipped\n", store->Name);
+            failures++;
+            continue;
+        }
+
+        for (s = 0; s < sizeof(BenchSizes) / sizeof(BenchSizes[0]); s++) {
+            if (BenchSizes[s] + BENCH_BATCH_MAX > store->MaxSize) {
+                continue;
+            }
+
+            if (!BenchBuildFixture(&fixture, store, BenchSizes[s], &seed)) {
+                fprintf(stderr, "%s/%u: setup failed\n", store->Name, BenchSizes[s]);
+                BenchDestroyFixture(&fixture);
+                failures++;
+                continue;
+            }
+
+            snprintf(name, sizeof(name), "%s/Lookup/hit/%u", store->Name, BenchSizes[s]);
+            BenchRun(&fixture, name, BenchRunLookupHit, 1);
+
+            snprintf(name, sizeof(name), "%s/Lookup/miss/%u", store->Name, BenchSizes[s]);
+            BenchRun(&fixture, name, BenchRunLookupMiss, 1);
+
+            snprintf(name, sizeof(name), "%s/Insert/%u", store->Name, BenchSizes[s]);
+            BenchRun(&fixture, name, BenchRunInsert, 1);
+
+            snprintf(name, sizeof(name), "%s/Remove/%u", store->Name, BenchSizes[s]);
+            BenchRun(&fixture, name, BenchRunRemove, 1);
+
+            for (t = 0; t < sizeof(BenchThreads) / sizeof(BenchThreads[0]); t++) {
+                snprintf(name, sizeof(name), "%s/Lookup/hit/%u/threads:%u",
+                    store->Name, BenchSizes[s], BenchThreads[t]);
+                BenchRun(&fixture, name, BenchRunConcurrentLookup, BenchThreads[t]);
+            }
+
+            BenchDestroyFixture(&fixture);
+        }
+    }
+
+    if (BenchFormat == BenchFormatJson) {
+        printf("\n  ]\n}\n");
+    }
+
+    return failures ? 2 : 0;
+}
@@ -0,0 +1,254 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Common interface over the PID/verdict containers in sys/ so
+// VerdictBench.c can measure them side by side. A new structure gets
+// benchmarked by writing its adapter here and adding it to BenchStores.
+//
+
+#include "BenchTypes.h"
+#include "PidList.h"
+#include "PidSet.h"
+#include "VerdictCache.h"
+
+typedef struct _BENCH_STORE
+{
+    const char* Name;
+
+    //
+    // Largest number of entries the structure can hold
+    //
+    ULONG MaxSize;
+
+    //
+    // Lookups modify the structure (LRU, counters), so concurrent
+    // readers need an exclusive lock instead of a shared one
+    //
+    BOOLEAN LookupWrites;
+
+    PVOID (*Create)(ULONG capacity);
+
+    VOID (*Destroy)(PVOID store);
+
+    BOOLEAN (*Insert)(PVOID store, ULONG pid, BOOLEAN allowed);
+
+    BOOLEAN (*Remove)(PVOID store, ULONG pid);
+
+    BOOLEAN (*Lookup)(PVOID store, ULONG pid, BOOLEAN* allowed);
+
+} BENCH_STORE, *PBENCH_STORE;
+
+//
+// PID_LIST: unsorted singly linked list with a terminating sentinel
+//
+
+static PVOID BenchListCreate(ULONG capacity)
+{
+    PPID_LIST_NODE* head = malloc(sizeof(PPID_LIST_NODE));
+
+    (void)capacity;
+
+    if (head != NULL) {
+        *head = PID_LIST_CREATE();
+    }
+
+    return head;
+}
+
+static VOID BenchListDestroy(PVOID store)
+{
+    PID_LIST_DESTROY((PPID_LIST_NODE*)store);
+    free(store);
+}
+
+static BOOLEAN BenchListInsert(PVOID store, ULONG pid, BOOLEAN allowed)
+{
+    return PID_LIST_PUSH((PPID_LIST_NODE*)store, pid, allowed);
+}
+
+static BOOLEAN BenchListRemove(PVOID store, ULONG pid)
+{
+    return PID_LIST_REMOVE_BY_PID((PPID_LIST_NODE*)store, pid);
+}
+
+static BOOLEAN BenchListLookup(PVOID store, ULONG pid, BOOLEAN* allowed)
+{
+    return PID_LIST_CONTAINS((PPID_LIST_NODE*)store, pid, allowed);
+}
+
+//
+// PID_SET: immutable sorted array plus bitmap index, every change
+// rebuilds the set (copy-on-write, as the control device does)
+//
+
+static PVOID BenchSetCreate(ULONG capacity)
+{
+    PPID_SET* set = malloc(sizeof(PPID_SET));
+
+    (void)capacity;
+
+    if (set != NULL) {
+        *set = NULL;
+    }
+
+    return set;
+}
+
+static VOID BenchSetDestroy(PVOID store)
+{
+    PID_SET_DESTROY((PPID_SET*)store);
+    free(store);
+}
+
+static BOOLEAN BenchSetInsert(PVOID store, ULONG pid, BOOLEAN allowed)
+{
+    PPID_SET* set = store;
+    PPID_SET merged = PID_SET_MERGE(*set, &pid, 1);
+
+    (void)allowed;
+
+    if (merged == NULL) {
+        return FALSE;
+    }
+
+    PID_SET_DESTROY(set);
+    *set = merged;
+
+    return TRUE;
+}
+
+static BOOLEAN BenchSetRemove(PVOID store, ULONG pid)
+{
+    PPID_SET* set = store;
+    PPID_SET reduced;
+    ULONG i, k = 0;
+
+    if (!PID_SET_CONTAINS(*set, pid)) {
+        return FALSE;
+    }
+
+    reduced = PID_SET_ALLOCATE((*set)->Count - 1);
+
+    if (reduced == NULL) {
+        return FALSE;
+    }
+
+    for (i = 0; i < (*set)->Count; i++) {
+        if ((*set)->Pids[i] != pid) {
+            reduced->Pids[k++] = (*set)->Pids[i];
+        }
+    }
+
+    reduced->Count = k;
+    reduced->Bitmap = PID_BITMAP_BUILD(reduced->Pids, k);
+
+    PID_SET_DESTROY(set);
+    *set = reduced;
+
+    return TRUE;
+}
+
+static BOOLEAN BenchSetLookup(PVOID store, ULONG pid, BOOLEAN* allowed)
+{
+    //
+    // Membership only, every contained PID is allowed
+    //
+    if (!PID_SET_CONTAINS(*(PPID_SET*)store, pid)) {
+        return FALSE;
+    }
+
+    if (allowed != NULL) {
+        *allowed = TRUE;
+    }
+
+    return TRUE;
+}
+
+//
+// VERDICT_CACHE: fixed-capacity hash map with LRU, sized to the
+// requested capacity so nothing gets evicted during a run
+//
+
+static PVOID BenchCacheCreate(ULONG capacity)
+{
+    return VERDICT_CACHE_CREATE(capacity ? capacity : 1, 0);
+}
+
+static VOID BenchCacheDestroy(PVOID store)
+{
+    PVERDICT_CACHE cache = store;
+
+    VERDICT_CACHE_DESTROY(&cache);
+}
+
+static BOOLEAN BenchCacheInsert(PVOID store, ULONG pid, BOOLEAN allowed)
+{
+    return VERDICT_CACHE_INSERT((PVERDICT_CACHE)store, pid, allowed, 0);
+}
+
+static BOOLEAN BenchCacheRemove(PVOID store, ULONG pid)
+{
+    return VERDICT_CACHE_REMOVE((PVERDICT_CACHE)store, pid);
+}
+
+static BOOLEAN BenchCacheLookup(PVOID store, ULONG pid, BOOLEAN* allowed)
+{
+    return VERDICT_CACHE_LOOKUP((PVERDICT_CACHE)store, pid, 0, allowed);
+}
+
+//
+// VERDICT_CACHE read through VERDICT_CACHE_PEEK, as create requests do:
+// no LRU reordering, so lookups can share the lock
+//
+
+static BOOLEAN BenchCachePeek(PVOID store, ULONG pid, BOOLEAN* allowed)
+{
+    return VERDICT_CACHE_PEEK((PVERDICT_CACHE)store, pid, 0, allowed);
+}
+
+static const BENCH_STORE BenchStores[] =
+{
+    {
+        "PidList", (ULONG)-1, FALSE,
+        BenchListCreate, BenchListDestroy, BenchListInsert, BenchListRemove, BenchListLookup
+    },
+    {
+        "PidSet", PID_SET_MAX_COUNT, FALSE,
+        BenchSetCreate, BenchSetDestroy, BenchSetInsert, BenchSetRemove, BenchSetLookup
+    },
+    {
+        "VerdictCache", VERDICT_CACHE_MAX_CAPACITY, TRUE,
+        BenchCacheCreate, BenchCacheDestroy, BenchCacheInsert, BenchCacheRemove, BenchCacheLookup
+    },
+    {
+        "VerdictCachePeek", VERDICT_CACHE_MAX_CAPACITY, FALSE,
+        BenchCacheCreate, BenchCacheDestroy, BenchCacheInsert, BenchCacheRemove, BenchCachePeek
+    },
+};
@@ -0,0 +1,800 @@
+/*
+* OpenMetrics exporter for HidCerberus.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+//
+// Every scrape refreshes the driver snapshot through the query callback
+// and renders the whole exposition into one preallocated text buffer
+// sized for MaxDevices at creation. Counters of devices beyond that are
+// left out rather than growing the buffer. Rendering is serialized by a
+// lock; recording callback latencies and queue depth is lock-free and
+// safe from any number of threads.
+//
+// Driver histograms are exported with bucket bounds at every other power
+// of two of the driver's log-linear layout (0.8us, 3.2us, ... 214.7s);
+// those fall on bucket boundaries, so the cumulative counts are exact.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <ntddk.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "HidGuardian.h"
+#include "LatencyHistogram.h"
+#include "HidCerberusMetrics.h"
+
+#ifdef _WIN32
+typedef SOCKET HC_SOCKET;
+typedef SRWLOCK HC_METRICS_LOCK;
+#define HC_INVALID_SOCKET                   INVALID_SOCKET
+#define HC_SEND_FLAGS                       0
+#define HcMetricsCloseSocket(s)             closesocket(s)
+#define HcMetricsLockInitialize(l)          InitializeSRWLock(l)
+#define HcMetricsLockDelete(l)
+#define HcMetricsLockAcquire(l)             AcquireSRWLockExclusive(l)
+#define HcMetricsLockRelease(l)             ReleaseSRWLockExclusive(l)
+#else
+typedef int HC_SOCKET;
+typedef pthread_mutex_t HC_METRICS_LOCK;
+#define HC_INVALID_SOCKET                   (-1)
+#define HC_SEND_FLAGS                       MSG_NOSIGNAL
+#define HcMetricsCloseSocket(s)             close(s)
+#define HcMetricsLockInitialize(l)          pthread_mutex_init((l), NULL)
+#define HcMetricsLockDelete(l)              pthread_mutex_destroy(l)
+#define HcMetricsLockAcquire(l)             pthread_mutex_lock(l)
+#define HcMetricsLockRelease(l)             pthread_mutex_unlock(l)
+#endif
+
+#define HC_METRICS_MAX_DEVICES              0x400
+#define HC_METRICS_LINE_MAX                 160
+#define HC_METRICS_PATH_MAX                 512
+
+//
+// Histogram bounds are 8 << (2 * i) ticks for i below this
+//
+#define HC_METRICS_BOUND_COUNT              15
+
+//
+// Header, service and device count lines
+//
+#define HC_METRICS_FIXED_LINES              128
+
+#define HC_METRICS_EOF                      "# EOF\n"
+
+typedef struct _HC_METRICS_T
+{
+    PFN_HC_METRICS_QUERY Query;
+
+    PVOID QueryContext;
+
+    ULONG MaxDevices;
+
+    //
+    // Serializes rendering and everything below that is only touched
+    // while rendering
+    //
+    HC_METRICS_LOCK Lock;
+
+    //
+    // Recorded by the library's threads
+    //
+    HIDGUARDIAN_LATENCY_HISTOGRAM Callbacks;
+
+    volatile LONG QueueDepth;
+
+    volatile LONG QueueHighWater;
+
+    volatile LONG Stop;
+
+    ULONG64 Scrapes;
+
+    ULONG64 QueryFailures;
+
+    //
+    // Driver snapshot of the current scrape
+    //
+    PHIDGUARDIAN_PERF_COUNTERS Counters;
+
+    ULONG CountersSize;
+
+    HIDGUARDIAN_LATENCY_HISTOGRAMS Latency;
+
+    HIDGUARDIAN_LATENCY_HISTOGRAM Scratch;
+
+    HIDGUARDIAN_DEVICE_ADD_STATS DeviceAdd;
+
+    HIDGUARDIAN_DISCONNECT_STATS Disconnect;
+
+    PCHAR Text;
+
+    ULONG TextCapacity;
+
+    ULONG TextLength;
+
+    CHAR TempPath[HC_METRICS_PATH_MAX];
+
+    CHAR Request[1024];
+
+    CHAR Header[256];
+
+} HC_METRICS;
+
+typedef struct _HC_METRICS_COUNTER
+{
+    PCSTR Name;
+
+    PCSTR Help;
+
+    BOOLEAN IsGauge;
+
+    size_t Offset;
+
+} HC_METRICS_COUNTER;
+
+static const HC_METRICS_COUNTER HcMetricsCounters[] =
+{
+    { "hidguardian_opens", "Create requests received",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, Opens) },
+    { "hidguardian_system_pid_hits", "Requests allowed because of a whitelisted system PID",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, SystemPidHits) },
+    { "hidguardian_sticky_hits", "Sticky cache lookups that found a verdict",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, StickyHits) },
+    { "hidguardian_sticky_misses", "Sticky cache lookups that found no verdict",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, StickyMisses) },
+    { "hidguardian_default_allowed", "Requests allowed by the default action",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, DefaultAllowed) },
+    { "hidguardian_default_denied", "Requests denied by the default action",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, DefaultDenied) },
+    { "hidguardian_notifications_missed", "Requests Cerberus couldn't be notified about",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, NotificationsMissed) },
+    { "hidguardian_verdicts_received", "Decisions received from Cerberus",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, VerdictsReceived) },
+    { "hidguardian_timeouts", "Pending requests dropped without a decision",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, Timeouts) },
+    { "hidguardian_pending_high_water", "Most requests seen waiting for pickup",
+        TRUE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, PendingHighWater) },
+    { "hidguardian_auth_high_water", "Most requests seen waiting for a decision",
+        TRUE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, AuthHighWater) },
+    { "hidguardian_rate_limited", "Opens over their process' open rate",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, RateLimited) },
+    { "hidguardian_queue_full", "Opens over the device's pending queue limit",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, QueueFull) },
+    { "hidguardian_excess_failed", "Excess opens failed as busy",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, ExcessFailed) },
+    { "hidguardian_excess_defaulted", "Excess opens resolved by the default action",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, ExcessDefaulted) },
+    { "hidguardian_excess_deferred", "Excess opens queued without notifying Cerberus",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, ExcessDeferred) },
+    { "hidguardian_not_ready", "Opens failed because the device's IDs couldn't be looked up",
+        FALSE, offsetof(HIDGUARDIAN_DEVICE_COUNTERS, NotReady) },
+};
+
+static const PCSTR HcMetricsPathNames[HIDGUARDIAN_ACCESS_PATH_COUNT] =
+{
+    "system", "system_pid", "cerberus", "sticky", "verdict", "default", "timeout", "limited"
+};
+
+//
+// Appends to the text buffer, keeping room for the terminating # EOF;
+// output that doesn't fit is cut at the last complete line
+//
+static VOID HcMetricsAppend(PHC_METRICS Metrics, PCSTR Format, ...)
+{
+    ULONG available = Metrics->TextCapacity - (ULONG)sizeof(HC_METRICS_EOF) - Metrics->TextLength;
+    va_list args;
+    int written;
+
+    va_start(args, Format);
+    written = vsnprintf(Metrics->Text + Metrics->TextLength, available + 1, Format, args);
+    va_end(args);
+
+    if (written < 0 || (ULONG)written > available) {
+        Metrics->Text[Metrics->TextLength] = '\0';
+        return;
+    }
+
+    Metrics->TextLength += (ULONG)written;
+}
+
+static VOID HcMetricsAppendFamily(PHC_METRICS Metrics, PCSTR Name, PCSTR Type, PCSTR Help)
+{
+    HcMetricsAppend(Metrics, "# TYPE %s %s\n# HELP %s %s.\n", Name, Type, Name, Help);
+}
+
+//
+// 100ns ticks as seconds, printed exactly
+//
+#define HC_METRICS_SECONDS_FORMAT           "%llu.%07llu"
+#define HC_METRICS_SECONDS(_ticks_)         (unsigned long long)((_ticks_) / 10000000), \
+                                            (unsigned long long)((_ticks_) % 10000000)
+
+//
+// Labels is either empty or a label list without braces
+//
+static VOID HcMetricsAppendHistogram(
+    PHC_METRICS Metrics,
+    PCSTR Name,
+    PCSTR Labels,
+    const HIDGUARDIAN_LATENCY_HISTOGRAM* Histogram
+)
+{
+    PCSTR separator = Labels[0] ? "," : "";
+    ULONG64 cumulative = 0;
+    ULONG64 bound;
+    ULONG bucket = 0;
+    ULONG i;
+
+    for (i = 0; i < HC_METRICS_BOUND_COUNT; i++)
+    {
+        bound = (ULONG64)HIDGUARDIAN_LATENCY_SUB_BUCKETS << (2 * i);
+
+        for (; bucket < HIDGUARDIAN_LATENCY_BUCKETS && LATENCY_HISTOGRAM_LOWER_BOUND(bucket) < bound; bucket++) {
+            cumulative += Histogram->Buckets[bucket];
+        }
+
+        HcMetricsAppend(Metrics, "%s_bucket{%s%sle=\"" HC_METRICS_SECONDS_FORMAT "\"} %llu\n",
+            Name, Labels, separator, HC_METRICS_SECONDS(bound), (unsigned long long)cumulative);
+    }
+
+    for (; bucket < HIDGUARDIAN_LATENCY_BUCKETS; bucket++) {
+        cumulative += Histogram->Buckets[bucket];
+    }
+
+    //
+    // The count is taken from the buckets so it matches +Inf even if
+    // the snapshot raced with recording
+    //
+    HcMetricsAppend(Metrics, "%s_bucket{%s%sle=\"+Inf\"} %llu\n",
+        Name, Labels, separator, (unsigned long long)cumulative);
+
+    if (Labels[0]) {
+        HcMetricsAppend(Metrics, "%s_count{%s} %llu\n%s_sum{%s} " HC_METRICS_SECONDS_FORMAT "\n",
+            Name, Labels, (unsigned long long)cumulative, Name, Labels, HC_METRICS_SECONDS(Histogram->Sum));
+    }
+    else {
+        HcMetricsAppend(Metrics, "%s_count %llu\n%s_sum " HC_METRICS_SECONDS_FORMAT "\n",
+            Name, (unsigned long long)cumulative, Name, HC_METRICS_SECONDS(Histogram->Sum));
+    }
+}
+
+static VOID HcMetricsRenderDriver(PHC_METRICS Metrics)
+{
+    PHIDGUARDIAN_DEVICE_COUNTERS_ENTRY entries;
+    HIDGUARDIAN_IDENTITY_POOL_STATS pool;
+    CHAR labels[32];
+    ULONG count;
+    ULONG i, k;
+
+    RtlZeroMemory(Metrics->Counters, Metrics->CountersSize);
+
+    if (Metrics->Query(Metrics->QueryContext, IOCTL_HIDGUARDIAN_GET_PERF_COUNTERS,
+        Metrics->Counters, Metrics->CountersSize))
+    {
+        entries = (PHIDGUARDIAN_DEVICE_COUNTERS_ENTRY)(Metrics->Counters + 1);
+        count = min(Metrics->Counters->EntryCount, Metrics->MaxDevices);
+
+        HcMetricsAppendFamily(Metrics, "hidguardian_devices", "gauge", "Guarded devices");
+        HcMetricsAppend(Metrics, "hidguardian_devices %u\n", Metrics->Counters->DeviceCount);
+
+        HcMetricsAppendFamily(Metrics, "hidguardian_memory_bytes", "gauge",
+            "Pool held by the driver for its filter devices");
+        HcMetricsAppend(Metrics, "hidguardian_memory_bytes %u\n", Metrics->Counters->MemoryUsage);
+
+        HcMetricsAppendFamily(Metrics, "hidguardian_device_memory_bytes", "gauge",
+            "Pool held by the driver for a guarded device");
+
+        for (i = 0; i < count; i++)
+        {
+            HcMetricsAppend(Metrics, "hidguardian_device_memory_bytes{device=\"%08X\"} %u\n",
+                entries[i].DeviceHash, entries[i].MemoryUsage);
+        }
+
+        for (k = 0; k < ARRAYSIZE(HcMetricsCounters); k++)
+        {
+            HcMetricsAppendFamily(Metrics, HcMetricsCounters[k].Name,
+                HcMetricsCounters[k].IsGauge ? "gauge" : "counter", HcMetricsCounters[k].Help);
+
+            for (i = 0; i < count; i++)
+            {
+                HcMetricsAppend(Metrics, "%s%s{device=\"%08X\"} %llu\n",
+                    HcMetricsCounters[k].Name, HcMetricsCounters[k].IsGauge ? "" : "_total",
+                    entries[i].DeviceHash,
+                    (unsigned long long)*(const ULONG64*)((const UCHAR*)&entries[i].Counters + HcMetricsCounters[k].Offset));
+            }
+        }
+    }
+    else {
+        Metrics->QueryFailures++;
+    }
+
+    RtlZeroMemory(&Metrics->Latency, sizeof(Metrics->Latency));
+
+    if (Metrics->Query(Metrics->QueryContext, IOCTL_HIDGUARDIAN_GET_LATENCY_HISTOGRAMS,
+        &Metrics->Latency, sizeof(Metrics->Latency))
+        && Metrics->Latency.BucketCount == HIDGUARDIAN_LATENCY_BUCKETS
+        && Metrics->Latency.SubBucketCount == HIDGUARDIAN_LATENCY_SUB_BUCKETS)
+    {
+        HcMetricsAppendFamily(Metrics, "hidguardian_open_latency_seconds", "histogram",
+            "Time from arrival to completion of create requests by resolution path");
+        HcMetricsAppend(Metrics, "# UNIT hidguardian_open_latency_seconds seconds\n");
+
+        for (i = 0; i < min(Metrics->Latency.PathCount, HIDGUARDIAN_ACCESS_PATH_COUNT); i++)
+        {
+            snprintf(labels, sizeof(labels), "path=\"%s\"", HcMetricsPathNames[i]);
+
+            HcMetricsAppendHistogram(Metrics, "hidguardian_open_latency_seconds",
+                labels, &Metrics->Latency.Global[i]);
+        }
+    }
+    else {
+        Metrics->QueryFailures++;
+    }
+
+    RtlZeroMemory(&pool, sizeof(pool));
+
+    if (Metrics->Query(Metrics->QueryContext, IOCTL_HIDGUARDIAN_GET_IDENTITY_POOL_STATS,
+        &pool, sizeof(pool)))
+    {
+        HcMetricsAppendFamily(Metrics, "hidguardian_identity_pool_strings", "gauge",
+            "Distinct device identity strings pooled");
+        HcMetricsAppend(Metrics, "hidguardian_identity_pool_strings %u\n", pool.Strings);
+
+        HcMetricsAppendFamily(Metrics, "hidguardian_identity_pool_references", "gauge",
+            "References to pooled identity strings held by filter devices");
+        HcMetricsAppend(Metrics, "hidguardian_identity_pool_references %u\n", pool.References);
+
+        HcMetricsAppendFamily(Metrics, "hidguardian_identity_pool_bytes", "gauge",
+            "Pool held for identity strings");
+        HcMetricsAppend(Metrics, "hidguardian_identity_pool_bytes %llu\n",
+            (unsigned long long)pool.PooledBytes);
+
+        HcMetricsAppendFamily(Metrics, "hidguardian_identity_pool_unpooled_bytes", "gauge",
+            "Memory the identity strings would take as private copies");
+        HcMetricsAppend(Metrics, "hidguardian_identity_pool_unpooled_bytes %llu\n",
+            (unsigned long long)pool.UnpooledBytes);
+    }
+    else {
+        Metrics->QueryFailures++;
+    }
+
+    RtlZeroMemory(&Metrics->DeviceAdd, sizeof(Metrics->DeviceAdd));
+
+    if (Metrics->Query(Metrics->QueryContext, IOCTL_HIDGUARDIAN_GET_DEVICE_ADD_STATS,
+        &Metrics->DeviceAdd, sizeof(Metrics->DeviceAdd)))
+    {
+        HcMetricsAppendFamily(Metrics, "hidguardian_device_add_seconds", "histogram",
+            "Time the driver spent adding a filter device");
+        HcMetricsAppend(Metrics, "# UNIT hidguardian_device_add_seconds seconds\n");
+        HcMetricsAppendHistogram(Metrics, "hidguardian_device_add_seconds", "", &Metrics->DeviceAdd.Add);
+
+        HcMetricsAppendFamily(Metrics, "hidguardian_identity_lookup_seconds", "histogram",
+            "Time looking up device and instance ID after the add took");
+        HcMetricsAppend(Metrics, "# UNIT hidguardian_identity_lookup_seconds seconds\n");
+        HcMetricsAppendHistogram(Metrics, "hidguardian_identity_lookup_seconds", "", &Metrics->DeviceAdd.Identity);
+
+        HcMetricsAppendFamily(Metrics, "hidguardian_identity_lookups", "counter",
+            "Device identity lookups by who ran them and their outcome");
+        HcMetricsAppend(Metrics, "hidguardian_identity_lookups_total{result=\"deferred\"} %llu\n",
+            (unsigned long long)Metrics->DeviceAdd.IdentitiesDeferred);
+        HcMetricsAppend(Metrics, "hidguardian_identity_lookups_total{result=\"on_demand\"} %llu\n",
+            (unsigned long long)Metrics->DeviceAdd.IdentitiesOnDemand);
+        HcMetricsAppend(Metrics, "hidguardian_identity_lookups_total{result=\"failed\"} %llu\n",
+            (unsigned long long)Metrics->DeviceAdd.IdentityFailures);
+    }
+    else {
+        Metrics->QueryFailures++;
+    }
+
+    RtlZeroMemory(&Metrics->Disconnect, sizeof(Metrics->Disconnect));
+
+    if (Metrics->Query(Metrics->QueryContext, IOCTL_HIDGUARDIAN_GET_DISCONNECT_STATS,
+        &Metrics->Disconnect, sizeof(Metrics->Disconnect)))
+    {
+        HcMetricsAppendFamily(Metrics, "hidguardian_disconnect_seconds", "histogram",
+            "Time resolving pending requests took after Cerberus left");
+        HcMetricsAppend(Metrics, "# UNIT hidguardian_disconnect_seconds seconds\n");
+        HcMetricsAppendHistogram(Metrics, "hidguardian_disconnect_seconds", "", &Metrics->Disconnect.Duration);
+
+        HcMetricsAppendFamily(Metrics, "hidguardian_disconnect_resolved", "counter",
+            "Pending requests resolved by cached verdict or default action after Cerberus left");
+        HcMetricsAppend(Metrics, "hidguardian_disconnect_resolved_total{verdict=\"allowed\"} %llu\n",
+            (unsigned long long)Metrics->Disconnect.RequestsAllowed);
+        HcMetricsAppend(Metrics, "hidguardian_disconnect_resolved_total{verdict=\"denied\"} %llu\n",
+            (unsigned long long)Metrics->Disconnect.RequestsDenied);
+    }
+    else {
+        Metrics->QueryFailures++;
+    }
+}
+
+static VOID HcMetricsRenderService(PHC_METRICS Metrics)
+{
+    RtlZeroMemory(&Metrics->Scratch, sizeof(Metrics->Scratch));
+    LATENCY_HISTOGRAM_MERGE(&Metrics->Scratch, &Metrics->Callbacks);
+
+    HcMetricsAppendFamily(Metrics, "hidcerberus_callback_latency_seconds", "histogram",
+        "Time the access request callback took to decide");
+    HcMetricsAppend(Metrics, "# UNIT hidcerberus_callback_latency_seconds seconds\n");
+    HcMetricsAppendHistogram(Metrics, "hidcerberus_callback_latency_seconds", "", &Metrics->Scratch);
+
+    HcMetricsAppendFamily(Metrics, "hidcerberus_queue_depth", "gauge",
+        "Access requests fetched from the driver and not answered yet");
+    HcMetricsAppend(Metrics, "hidcerberus_queue_depth %d\n", ReadNoFence(&Metrics->QueueDepth));
+
+    HcMetricsAppendFamily(Metrics, "hidcerberus_queue_high_water", "gauge",
+        "Most access requests seen in flight at once");
+    HcMetricsAppend(Metrics, "hidcerberus_queue_high_water %d\n", ReadNoFence(&Metrics->QueueHighWater));
+
+    HcMetricsAppendFamily(Metrics, "hidcerberus_driver_query_failures", "counter",
+        "Driver queries that failed while scraping");
+    HcMetricsAppend(Metrics, "hidcerberus_driver_query_failures_total %llu\n",
+        (unsigned long long)Metrics->QueryFailures);
+
+    HcMetricsAppendFamily(Metrics, "hidcerberus_scrapes", "counter", "Scrapes rendered");
+    HcMetricsAppend(Metrics, "hidcerberus_scrapes_total %llu\n", (unsigned long long)Metrics->Scrapes);
+}
+
+//
+// Must be called with the lock held
+//
+static ULONG HcMetricsRenderLocked(PHC_METRICS Metrics)
+{
+    Metrics->TextLength = 0;
+    Metrics->Scrapes++;
+
+    HcMetricsRenderDriver(Metrics);
+    HcMetricsRenderService(Metrics);
+
+    memcpy(Metrics->Text + Metrics->TextLength, HC_METRICS_EOF, sizeof(HC_METRICS_EOF));
+    Metrics->TextLength += (ULONG)sizeof(HC_METRICS_EOF) - 1;
+
+    return Metrics->TextLength;
+}
+
+HC_METRICS_API PHC_METRICS hc_metrics_create(
+    ULONG MaxDevices,
+    PFN_HC_METRICS_QUERY Query,
+    PVOID QueryContext
+)
+{
+    PHC_METRICS metrics;
+    ULONG lines;
+
+    if (Query == NULL) {
+        return NULL;
+    }
+
+    metrics = calloc(1, sizeof(HC_METRICS));
+
+    if (metrics == NULL) {
+        return NULL;
+    }
+
+    metrics->Query = Query;
+    metrics->QueryContext = QueryContext;
+    metrics->MaxDevices = max(1, min(MaxDevices, HC_METRICS_MAX_DEVICES));
+
+    metrics->CountersSize = (ULONG)(sizeof(HIDGUARDIAN_PERF_COUNTERS)
+        + metrics->MaxDevices * sizeof(HIDGUARDIAN_DEVICE_COUNTERS_ENTRY));
+
+    lines = HC_METRICS_FIXED_LINES
+        + metrics->MaxDevices * (ARRAYSIZE(HcMetricsCounters) + 1)
+        + (HIDGUARDIAN_ACCESS_PATH_COUNT + 3) * (HC_METRICS_BOUND_COUNT + 3);
+
+    metrics->TextCapacity = lines * HC_METRICS_LINE_MAX;
+
+    metrics->Counters = malloc(metrics->CountersSize);
+    metrics->Text = malloc(metrics->TextCapacity);
+
+    if (metrics->Counters == NULL || metrics->Text == NULL) {
+        free(metrics->Counters);
+        free(metrics->Text);
+        free(metrics);
+        return NULL;
+    }
+
+    HcMetricsLockInitialize(&metrics->Lock);
+
+    return metrics;
+}
+
+HC_METRICS_API VOID hc_metrics_destroy(PHC_METRICS Metrics)
+{
+    if (Metrics == NULL) {
+        return;
+    }
+
+    HcMetricsLockDelete(&Metrics->Lock);
+
+    free(Metrics->Counters);
+    free(Metrics->Text);
+    free(Metrics);
+}
+
+HC_METRICS_API VOID hc_metrics_record_callback(PHC_METRICS Metrics, ULONG64 Duration)
+{
+    LATENCY_HISTOGRAM_RECORD(&Metrics->Callbacks, Duration);
+}
+
+HC_METRICS_API VOID hc_metrics_queue_enter(PHC_METRICS Metrics)
+{
+    LONG depth = InterlockedIncrement(&Metrics->QueueDepth);
+    LONG high = ReadNoFence(&Metrics->QueueHighWater);
+
+    while (high < depth) {
+        LONG seen = InterlockedCompareExchange(&Metrics->QueueHighWater, depth, high);
+
+        if (seen == high)
+            break;
+
+        high = seen;
+    }
+}
+
+HC_METRICS_API VOID hc_metrics_queue_leave(PHC_METRICS Metrics)
+{
+    InterlockedDecrement(&Metrics->QueueDepth);
+}
+
+HC_METRICS_API ULONG hc_metrics_render(PHC_METRICS Metrics, PCSTR* Text)
+{
+    ULONG length;
+
+    HcMetricsLockAcquire(&Metrics->Lock);
+
+    length = HcMetricsRenderLocked(Metrics);
+    *Text = Metrics->Text;
+
+    HcMetricsLockRelease(&Metrics->Lock);
+
+    return length;
+}
+
+HC_METRICS_API BOOLEAN hc_metrics_write_file(PHC_METRICS Metrics, PCSTR Path)
+{
+    BOOLEAN ok = FALSE;
+    ULONG length;
+    int n;
+
+    HcMetricsLockAcquire(&Metrics->Lock);
+
+    n = snprintf(Metrics->TempPath, sizeof(Metrics->TempPath), "%s.tmp", Path);
+
+    if (n > 0 && (size_t)n < sizeof(Metrics->TempPath))
+    {
+        length = HcMetricsRenderLocked(Metrics);
+
+#ifdef _WIN32
+        {
+            HANDLE file = CreateFileA(Metrics->TempPath, GENERIC_WRITE, 0, NULL,
+                CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            DWORD written = 0;
+
+            if (file != INVALID_HANDLE_VALUE)
+            {
+                ok = WriteFile(file, Metrics->Text, length, &written, NULL) && written == length;
+                ok = CloseHandle(file) && ok;
+                ok = ok && MoveFileExA(Metrics->TempPath, Path, MOVEFILE_REPLACE_EXISTING);
+            }
+        }
+#else
+        {
+            int file = open(Metrics->TempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            ULONG offset = 0;
+            ssize_t written;
+
+            if (file >= 0)
+            {
+                while (offset < length
+                    && (written = write(file, Metrics->Text + offset, length - offset)) > 0) {
+                    offset += (ULONG)written;
+                }
+
+                ok = (close(file) == 0) && offset == length;
+                ok = ok && rename(Metrics->TempPath, Path) == 0;
+            }
+        }
+#endif
+    }
+
+    HcMetricsLockRelease(&Metrics->Lock);
+
+    return ok;
+}
+
+//
+// Waits up to TimeoutMs for Socket to become readable
+//
+static BOOLEAN HcMetricsWaitReadable(HC_SOCKET Socket, ULONG TimeoutMs)
+{
+    struct timeval timeout;
+    fd_set set;
+
+    FD_ZERO(&set);
+    FD_SET(Socket, &set);
+
+    timeout.tv_sec = TimeoutMs / 1000;
+    timeout.tv_usec = (TimeoutMs % 1000) * 1000;
+
+    return select((int)Socket + 1, &set, NULL, NULL, &timeout) > 0;
+}
+
+static BOOLEAN HcMetricsSendAll(HC_SOCKET Socket, PCSTR Buffer, ULONG Length)
+{
+    ULONG offset = 0;
+    int sent;
+
+    while (offset < Length)
+    {
+        sent = send(Socket, Buffer + offset, (int)(Length - offset), HC_SEND_FLAGS);
+
+        if (sent <= 0)
+            return FALSE;
+
+        offset += (ULONG)sent;
+    }
+
+    return TRUE;
+}
+
+//
+// Reads the request head and answers GET with a fresh scrape; the
+// request target is ignored, every path serves the metrics
+//
+static VOID HcMetricsRespond(PHC_METRICS Metrics, HC_SOCKET Client)
+{
+    ULONG received = 0;
+    ULONG length;
+    int n;
+
+    HcMetricsLockAcquire(&Metrics->Lock);
+
+    while (received < sizeof(Metrics->Request) - 1 && HcMetricsWaitReadable(Client, 1000))
+    {
+        n = recv(Client, Metrics->Request + received, (int)(sizeof(Metrics->Request) - 1 - received), 0);
+
+        if (n <= 0)
+            break;
+
+        received += (ULONG)n;
+        Metrics->Request[received] = '\0';
+
+        if (strstr(Metrics->Request, "\r\n\r\n") != NULL)
+            break;
+    }
+
+    if (received < 4 || strncmp(Metrics->Request, "GET ", 4) != 0)
+    {
+        n = snprintf(Metrics->Header, sizeof(Metrics->Header),
+            "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+
+        HcMetricsSendAll(Client, Metrics->Header, (ULONG)n);
+    }
+    else
+    {
+        length = HcMetricsRenderLocked(Metrics);
+
+        n = snprintf(Metrics->Header, sizeof(Metrics->Header),
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+            "Content-Length: %u\r\nConnection: close\r\n\r\n", length);
+
+        if (HcMetricsSendAll(Client, Metrics->Header, (ULONG)n)) {
+            HcMetricsSendAll(Client, Metrics->Text, length);
+        }
+    }
+
+    HcMetricsLockRelease(&Metrics->Lock);
+}
+
+HC_METRICS_API BOOLEAN hc_metrics_serve(PHC_METRICS Metrics, USHORT Port)
+{
+    struct sockaddr_in address;
+    HC_SOCKET listener;
+    HC_SOCKET client;
+    int reuse = 1;
+
+#ifdef _WIN32
+    WSADATA wsaData;
+
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        return FALSE;
+    }
+#endif
+
+    listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (listener == HC_INVALID_SOCKET) {
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return FALSE;
+    }
+
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(Port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 8) != 0)
+    {
+        HcMetricsCloseSocket(listener);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return FALSE;
+    }
+
+    //
+    // Poll for the stop flag between connections
+    //
+    while (!ReadNoFence(&Metrics->Stop))
+    {
+        if (!HcMetricsWaitReadable(listener, 200))
+            continue;
+
+        client = accept(listener, NULL, NULL);
+
+        if (client == HC_INVALID_SOCKET)
+            continue;
+
+        HcMetricsRespond(Metrics, client);
+        HcMetricsCloseSocket(client);
+    }
+
+    HcMetricsCloseSocket(listener);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+
+    return TRUE;
+}
+
+HC_METRICS_API VOID hc_metrics_stop(PHC_METRICS Metrics)
+{
+    InterlockedExchange(&Metrics->Stop, 1);
+}
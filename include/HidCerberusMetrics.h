@@ -0,0 +1,124 @@
+/*
+* OpenMetrics exporter for HidCerberus.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#ifndef HidCerberusMetrics_h__
+#define HidCerberusMetrics_h__
+
+//
+// Collects the driver's request path counters and open latency
+// histograms together with the library's own callback latency and queue
+// depth, and renders them in the OpenMetrics text format for a scraper
+// (served over HTTP on a loopback port) or a textfile collector (written
+// to a file). Every buffer is allocated by hc_metrics_create; refreshing
+// and rendering a scrape doesn't allocate.
+//
+// The driver is queried through a callback so the same code runs on top
+// of DeviceIoControl in HidCerberus and on top of the user-mode
+// simulation (sim/) on Linux.
+//
+
+
+#if defined(_WIN32) && !defined(HC_METRICS_STATIC)
+#ifdef HC_EXPORTS
+#define HC_METRICS_API __declspec(dllexport)
+#else
+#define HC_METRICS_API __declspec(dllimport)
+#endif
+#else
+#define HC_METRICS_API
+#endif
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef struct _HC_METRICS_T *PHC_METRICS;
+
+    //
+    // Issues IoControlCode against the control device without input and
+    // with the given output buffer, returns FALSE on failure
+    //
+    typedef
+        BOOLEAN
+        EVT_HC_METRICS_QUERY(
+            PVOID Context,
+            ULONG IoControlCode,
+            PVOID Buffer,
+            ULONG BufferLength
+        );
+
+    typedef EVT_HC_METRICS_QUERY *PFN_HC_METRICS_QUERY;
+
+    //
+    // MaxDevices limits the number of devices reported per scrape
+    //
+    HC_METRICS_API PHC_METRICS hc_metrics_create(
+        ULONG MaxDevices,
+        PFN_HC_METRICS_QUERY Query,
+        PVOID QueryContext
+    );
+
+    HC_METRICS_API VOID hc_metrics_destroy(PHC_METRICS Metrics);
+
+    //
+    // Time an access request callback took (100ns units)
+    //
+    HC_METRICS_API VOID hc_metrics_record_callback(PHC_METRICS Metrics, ULONG64 Duration);
+
+    //
+    // An access request was fetched from / answered to the driver
+    //
+    HC_METRICS_API VOID hc_metrics_queue_enter(PHC_METRICS Metrics);
+
+    HC_METRICS_API VOID hc_metrics_queue_leave(PHC_METRICS Metrics);
+
+    //
+    // Queries the driver and renders a scrape, *Text stays valid until the
+    // next call; returns the length of the text
+    //
+    HC_METRICS_API ULONG hc_metrics_render(PHC_METRICS Metrics, PCSTR* Text);
+
+    //
+    // Renders a scrape into Path (through a temporary file, so readers
+    // never see a partial one)
+    //
+    HC_METRICS_API BOOLEAN hc_metrics_write_file(PHC_METRICS Metrics, PCSTR Path);
+
+    //
+    // Answers HTTP requests on 127.0.0.1:Port with a fresh scrape until
+    // hc_metrics_stop is called; blocks, so run it on its own thread
+    //
+    HC_METRICS_API BOOLEAN hc_metrics_serve(PHC_METRICS Metrics, USHORT Port);
+
+    HC_METRICS_API VOID hc_metrics_stop(PHC_METRICS Metrics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HidCerberusMetrics_h__
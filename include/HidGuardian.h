@@ -67,11 +67,227 @@ DEFINE_GUID(GUID_DEVINTERFACE_HIDGUARDIAN,
                                                                     METHOD_BUFFERED,    \
                                                                     FILE_ANY_ACCESS)
 
+//
+// Completes when guarded devices arrived or went away. Without an output
+// buffer it completes empty on the next arrival; with one at least the
+// size of HIDGUARDIAN_DEVICE_CHANGES it returns the queued changes as
+// soon as there are any.
+// 
 #define IOCTL_HIDGUARDIAN_ARRIVAL_NOTIFICATION      CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
                                                                     IOCTL_INDEX + 0x04, \
                                                                     METHOD_BUFFERED,    \
                                                                     FILE_ANY_ACCESS)
 
+//
+// Used to query sticky verdict cache counters summed over all devices
+// 
+#define IOCTL_HIDGUARDIAN_GET_STICKY_CACHE_STATS    CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x05, \
+                                                                    METHOD_BUFFERED,    \
+                                                                    FILE_READ_ACCESS)
+
+//
+// Used to replace or extend the whole system PID whitelist in one call
+// 
+#define IOCTL_HIDGUARDIAN_SUBMIT_SYSTEM_PIDS        CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x06, \
+                                                                    METHOD_BUFFERED,    \
+                                                                    FILE_WRITE_ACCESS)
+
+//
+// Used to export system PIDs and all cached verdicts
+// 
+#define IOCTL_HIDGUARDIAN_GET_VERDICT_SNAPSHOT      CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x07, \
+                                                                    METHOD_OUT_DIRECT,  \
+                                                                    FILE_READ_ACCESS)
+
+//
+// Used to re-seed system PIDs and cached verdicts from a snapshot
+// 
+#define IOCTL_HIDGUARDIAN_RESTORE_VERDICT_SNAPSHOT  CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x08, \
+                                                                    METHOD_BUFFERED,    \
+                                                                    FILE_WRITE_ACCESS)
+
+//
+// Used to drain recorded access requests
+// 
+#define IOCTL_HIDGUARDIAN_GET_ACCESS_TRACE          CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x09, \
+                                                                    METHOD_OUT_DIRECT,  \
+                                                                    FILE_READ_ACCESS)
+
+//
+// Used to read request path counters of all guarded devices
+// 
+#define IOCTL_HIDGUARDIAN_GET_PERF_COUNTERS         CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x0A, \
+                                                                    METHOD_OUT_DIRECT,  \
+                                                                    FILE_READ_ACCESS)
+
+//
+// Used to read open latency histograms of all guarded devices
+// 
+#define IOCTL_HIDGUARDIAN_GET_LATENCY_HISTOGRAMS    CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x0B, \
+                                                                    METHOD_OUT_DIRECT,  \
+                                                                    FILE_READ_ACCESS)
+
+//
+// Used to drain per-stage timings of requests decided by Cerberus
+// 
+#define IOCTL_HIDGUARDIAN_GET_STAGE_TRACE           CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x0C, \
+                                                                    METHOD_OUT_DIRECT,  \
+                                                                    FILE_READ_ACCESS)
+
+//
+// Used to drain the binary event log of the request paths
+// 
+#define IOCTL_HIDGUARDIAN_GET_EVENTS                CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x0D, \
+                                                                    METHOD_OUT_DIRECT,  \
+                                                                    FILE_READ_ACCESS)
+
+//
+// Used to read the processes opening guarded devices most often (opens
+// settled by the system PID set or the sticky cache aren't counted)
+// 
+#define IOCTL_HIDGUARDIAN_GET_TOP_OPENERS           CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x0E, \
+                                                                    METHOD_BUFFERED,    \
+                                                                    FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+//
+// Used to query the string pool holding the identities of all devices
+// 
+#define IOCTL_HIDGUARDIAN_GET_IDENTITY_POOL_STATS   CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x0F, \
+                                                                    METHOD_BUFFERED,    \
+                                                                    FILE_READ_ACCESS)
+
+//
+// Used to read how long adding filter devices and looking up their
+// identity took
+// 
+#define IOCTL_HIDGUARDIAN_GET_DEVICE_ADD_STATS      CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x10, \
+                                                                    METHOD_BUFFERED,    \
+                                                                    FILE_READ_ACCESS)
+
+//
+// Used to list all filtered devices with identity and guard state in
+// one call
+// 
+#define IOCTL_HIDGUARDIAN_GET_DEVICES               CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x11, \
+                                                                    METHOD_BUFFERED,    \
+                                                                    FILE_READ_ACCESS)
+
+//
+// Used to read how long resolving pending requests took when Cerberus
+// went away
+// 
+#define IOCTL_HIDGUARDIAN_GET_DISCONNECT_STATS      CTL_CODE(FILE_DEVICE_HIDGUARDIAN,   \
+                                                                    IOCTL_INDEX + 0x12, \
+                                                                    METHOD_BUFFERED,    \
+                                                                    FILE_READ_ACCESS)
+
+#define HIDGUARDIAN_VERDICT_SNAPSHOT_VERSION        2
+
+#define HIDGUARDIAN_ACCESS_TRACE_VERSION            1
+
+#define HIDGUARDIAN_STAGE_TRACE_VERSION             1
+
+#define HIDGUARDIAN_EVENT_TRACE_VERSION             1
+
+#define HIDGUARDIAN_DEVICE_CHANGES_VERSION          1
+
+//
+// Types of HIDGUARDIAN_DEVICE_CHANGE records
+// 
+#define HIDGUARDIAN_DEVICE_ARRIVAL                  0x01
+#define HIDGUARDIAN_DEVICE_REMOVAL                  0x02
+
+#define HIDGUARDIAN_DEVICE_LIST_VERSION             1
+
+//
+// HIDGUARDIAN_DEVICE_INFO.Flags
+// 
+#define HIDGUARDIAN_DEVICE_GUARDED                  0x01    // Create requests are decided by Cerberus
+#define HIDGUARDIAN_DEVICE_GUARD_ACTIVE             0x02    // Sticky cache and pending queues exist
+#define HIDGUARDIAN_DEVICE_ALLOW_BY_DEFAULT         0x04    // Default action without Cerberus is allow
+#define HIDGUARDIAN_DEVICE_SHUTTING_DOWN            0x08    // Device is being removed
+
+//
+// Events of the binary event log and the meaning of Args[0..2]
+// 
+#define HIDGUARDIAN_EVENT_NONE                      0x00
+#define HIDGUARDIAN_EVENT_CREATE_ARRIVAL            0x01    // PID
+#define HIDGUARDIAN_EVENT_CREATE_RESOLVED           0x02    // PID, HIDGUARDIAN_ACCESS_PATH_*, allowed
+#define HIDGUARDIAN_EVENT_CREATE_HELD               0x03    // PID, pending requests
+#define HIDGUARDIAN_EVENT_CREATE_PENDING            0x04    // PID, pending requests
+#define HIDGUARDIAN_EVENT_NOTIFY_MISSED             0x05    // PID, NTSTATUS
+#define HIDGUARDIAN_EVENT_DEVICE_CONTROL            0x06    // IOCTL code, input length, output length
+#define HIDGUARDIAN_EVENT_PICKUP                    0x07    // Request ID, PID, hardware ID buffer length
+#define HIDGUARDIAN_EVENT_VERDICT_SCAN              0x08    // Request ID wanted, request ID found
+#define HIDGUARDIAN_EVENT_VERDICT                   0x09    // Request ID, PID, HIDGUARDIAN_EVENT_VERDICT_* flags
+#define HIDGUARDIAN_EVENT_NOTIFICATION              0x0A    // Held requests left, parked
+
+#define HIDGUARDIAN_EVENT_COUNT                     0x0B
+
+#define HIDGUARDIAN_EVENT_VERDICT_ALLOWED           0x00000001
+#define HIDGUARDIAN_EVENT_VERDICT_STICKY            0x00000002
+
+//
+// Stages of a create request on its way through the driver
+// 
+#define HIDGUARDIAN_STAGE_ARRIVAL                   0x00    // Entered CreateRequestsQueue
+#define HIDGUARDIAN_STAGE_PENDING                   0x01    // Moved to PendingCreateRequestsQueue
+#define HIDGUARDIAN_STAGE_NOTIFIED                  0x02    // Cerberus' notification completed
+#define HIDGUARDIAN_STAGE_PICKUP                    0x03    // Fetched by IOCTL_HIDGUARDIAN_GET_CREATE_REQUEST
+#define HIDGUARDIAN_STAGE_AUTH_QUEUED               0x04    // Moved to PendingAuthQueue
+#define HIDGUARDIAN_STAGE_VERDICT                   0x05    // Matched by IOCTL_HIDGUARDIAN_SET_CREATE_REQUEST
+#define HIDGUARDIAN_STAGE_COMPLETED                 0x06    // Sent to the lower driver or completed
+
+#define HIDGUARDIAN_STAGE_COUNT                     0x07
+
+//
+// How an access request got resolved
+// 
+#define HIDGUARDIAN_ACCESS_PATH_SYSTEM              0x00    // SYSTEM (PID 4)
+#define HIDGUARDIAN_ACCESS_PATH_SYSTEM_PID          0x01    // Whitelisted system PID
+#define HIDGUARDIAN_ACCESS_PATH_CERBERUS            0x02    // Cerberus itself
+#define HIDGUARDIAN_ACCESS_PATH_STICKY              0x03    // Cached verdict
+#define HIDGUARDIAN_ACCESS_PATH_VERDICT             0x04    // Decision by Cerberus
+#define HIDGUARDIAN_ACCESS_PATH_DEFAULT             0x05    // Default action
+#define HIDGUARDIAN_ACCESS_PATH_TIMEOUT             0x06    // Dropped without a decision
+#define HIDGUARDIAN_ACCESS_PATH_LIMITED             0x07    // Refused or defaulted by admission control, or refused as not ready
+
+#define HIDGUARDIAN_ACCESS_PATH_COUNT               0x08
+
+//
+// Latency histograms are log-linear over 100ns ticks: values below
+// HIDGUARDIAN_LATENCY_SUB_BUCKETS get a bucket each, every further power
+// of two is split into HIDGUARDIAN_LATENCY_SUB_BUCKETS equal buckets.
+// The last bucket also holds everything beyond its upper bound.
+// 
+#define HIDGUARDIAN_LATENCY_SUB_BUCKET_BITS         3
+#define HIDGUARDIAN_LATENCY_SUB_BUCKETS             (1 << HIDGUARDIAN_LATENCY_SUB_BUCKET_BITS)
+#define HIDGUARDIAN_LATENCY_BUCKETS                 240
+
+//
+// Flags for HIDGUARDIAN_SUBMIT_SYSTEM_PIDS and HIDGUARDIAN_VERDICT_SNAPSHOT
+// 
+#define HIDGUARDIAN_SYSTEM_PIDS_REPLACE             0x00000000
+#define HIDGUARDIAN_SYSTEM_PIDS_MERGE               0x00000001
+
+//
+// Flags for HIDGUARDIAN_TOP_OPENERS
+// 
+#define HIDGUARDIAN_TOP_OPENERS_RESET               0x00000001  // Start counting anew after reading
+
 
 #include <pshpack1.h>
 
@@ -143,4 +359,930 @@ typedef struct _HIDGUARDIAN_SUBMIT_SYSTEM_PID
 
 } HIDGUARDIAN_SUBMIT_SYSTEM_PID, *PHIDGUARDIAN_SUBMIT_SYSTEM_PID;
 
+#pragma warning(push)
+#pragma warning(disable:4200) // disable warnings for structures with zero length arrays.
+typedef struct _HIDGUARDIAN_SUBMIT_SYSTEM_PIDS
+{
+    //
+    // Size of packet including all PIDs
+    // 
+    IN ULONG Size;
+
+    //
+    // HIDGUARDIAN_SYSTEM_PIDS_REPLACE or HIDGUARDIAN_SYSTEM_PIDS_MERGE
+    // 
+    IN ULONG Flags;
+
+    //
+    // Number of entries in ProcessIds
+    // 
+    IN ULONG Count;
+
+    //
+    // PIDs to always whitelist
+    // 
+    IN ULONG ProcessIds[];
+
+} HIDGUARDIAN_SUBMIT_SYSTEM_PIDS, *PHIDGUARDIAN_SUBMIT_SYSTEM_PIDS;
+#pragma warning(pop)
+
+typedef struct _HIDGUARDIAN_STICKY_CACHE_STATS
+{
+    //
+    // Size of packet
+    // 
+    OUT ULONG Size;
+
+    //
+    // Number of filter devices the counters were collected from
+    // 
+    OUT ULONG DeviceCount;
+
+    //
+    // Maximum number of cached verdicts per device
+    // 
+    OUT ULONG Capacity;
+
+    //
+    // Lifetime of a cached verdict in seconds (0 = unlimited)
+    // 
+    OUT ULONG TtlSeconds;
+
+    //
+    // Verdicts currently cached across all devices
+    // 
+    OUT ULONG Occupancy;
+
+    //
+    // Lookups answered from the cache
+    // 
+    OUT ULONG64 Hits;
+
+    //
+    // Lookups not answered from the cache (including expired entries)
+    // 
+    OUT ULONG64 Misses;
+
+    //
+    // Verdicts added to the cache
+    // 
+    OUT ULONG64 Insertions;
+
+    //
+    // Entries dropped to make room for new ones
+    // 
+    OUT ULONG64 Evictions;
+
+    //
+    // Entries dropped because their lifetime ran out
+    // 
+    OUT ULONG64 Expirations;
+
+} HIDGUARDIAN_STICKY_CACHE_STATS, *PHIDGUARDIAN_STICKY_CACHE_STATS;
+
+//
+// Snapshot layout (packed, no padding):
+// 
+//   HIDGUARDIAN_VERDICT_SNAPSHOT
+//   ULONG SystemPids[SystemPidCount]
+//   HIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE records [DeviceCount]
+// 
+typedef struct _HIDGUARDIAN_VERDICT_SNAPSHOT
+{
+    //
+    // Size of the complete snapshot; if the supplied buffer is too
+    // small only this header is returned and Size holds the size needed
+    // 
+    IN OUT ULONG Size;
+
+    //
+    // HIDGUARDIAN_VERDICT_SNAPSHOT_VERSION
+    // 
+    IN OUT ULONG Version;
+
+    //
+    // On restore: HIDGUARDIAN_SYSTEM_PIDS_REPLACE or HIDGUARDIAN_SYSTEM_PIDS_MERGE
+    // 
+    IN ULONG Flags;
+
+    //
+    // Number of whitelisted system PIDs following the header
+    // 
+    IN OUT ULONG SystemPidCount;
+
+    //
+    // Number of device records following the system PIDs
+    // 
+    IN OUT ULONG DeviceCount;
+
+    //
+    // Reserved, must be zero
+    // 
+    IN OUT ULONG Reserved;
+
+    //
+    // System time the snapshot was taken at (100ns units since 1601); the
+    // time passed since then is added to the age of restored verdicts
+    // 
+    IN OUT ULONG64 Timestamp;
+
+} HIDGUARDIAN_VERDICT_SNAPSHOT, *PHIDGUARDIAN_VERDICT_SNAPSHOT;
+
+//
+// Record layout:
+// 
+//   HIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE
+//   WCHAR DeviceId[DeviceIdLength]
+//   WCHAR InstanceId[InstanceIdLength]
+//   HIDGUARDIAN_VERDICT_SNAPSHOT_ENTRY Entries[EntryCount]
+// 
+typedef struct _HIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE
+{
+    //
+    // Size of record including strings and entries
+    // 
+    IN OUT ULONG Size;
+
+    //
+    // Length of Device ID in characters, without terminator
+    // 
+    IN OUT USHORT DeviceIdLength;
+
+    //
+    // Length of Instance ID in characters, without terminator
+    // 
+    IN OUT USHORT InstanceIdLength;
+
+    //
+    // Number of cached verdicts, least recently used first
+    // 
+    IN OUT ULONG EntryCount;
+
+} HIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE, *PHIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE;
+
+typedef struct _HIDGUARDIAN_VERDICT_SNAPSHOT_ENTRY
+{
+    IN OUT ULONG ProcessId;
+
+    IN OUT BOOLEAN IsAllowed;
+
+    //
+    // Time the verdict has been cached (100ns units); restored verdicts
+    // keep it, so snapshots don't extend their lifetime
+    // 
+    IN OUT ULONG64 Age;
+
+} HIDGUARDIAN_VERDICT_SNAPSHOT_ENTRY, *PHIDGUARDIAN_VERDICT_SNAPSHOT_ENTRY;
+
+//
+// Trace layout (packed, no padding):
+// 
+//   HIDGUARDIAN_ACCESS_TRACE
+//   HIDGUARDIAN_ACCESS_RECORD Records[RecordCount]
+// 
+typedef struct _HIDGUARDIAN_ACCESS_TRACE
+{
+    //
+    // Size of header and records returned
+    // 
+    OUT ULONG Size;
+
+    //
+    // HIDGUARDIAN_ACCESS_TRACE_VERSION
+    // 
+    OUT ULONG Version;
+
+    //
+    // Size of one record, newer versions may append fields
+    // 
+    OUT ULONG RecordSize;
+
+    //
+    // Number of records following the header, oldest first
+    // 
+    OUT ULONG RecordCount;
+
+    //
+    // Records overwritten since the previous drain
+    // 
+    OUT ULONG DroppedCount;
+
+    //
+    // Records still buffered after this drain
+    // 
+    OUT ULONG RemainingCount;
+
+} HIDGUARDIAN_ACCESS_TRACE, *PHIDGUARDIAN_ACCESS_TRACE;
+
+typedef struct _HIDGUARDIAN_ACCESS_RECORD
+{
+    //
+    // Arrival of the create request (interrupt time, 100ns units)
+    // 
+    OUT ULONG64 Timestamp;
+
+    //
+    // FNV-1a hash of the device's Device ID and Instance ID; 0 for
+    // devices the driver hasn't looked those up for yet
+    // 
+    OUT ULONG DeviceHash;
+
+    //
+    // ID of the process requesting access
+    // 
+    OUT ULONG ProcessId;
+
+    //
+    // HIDGUARDIAN_ACCESS_PATH_*
+    // 
+    OUT UCHAR Path;
+
+    OUT BOOLEAN IsAllowed;
+
+    OUT BOOLEAN IsSticky;
+
+    OUT UCHAR Reserved;
+
+    //
+    // Time spent waiting for pickup by Cerberus (100ns units)
+    // 
+    OUT ULONG PendingTime;
+
+    //
+    // Time between pickup and verdict (100ns units)
+    // 
+    OUT ULONG AuthTime;
+
+} HIDGUARDIAN_ACCESS_RECORD, *PHIDGUARDIAN_ACCESS_RECORD;
+
+typedef struct _HIDGUARDIAN_STAGE_TRACE
+{
+    //
+    // Size of header and records returned
+    // 
+    OUT ULONG Size;
+
+    //
+    // HIDGUARDIAN_STAGE_TRACE_VERSION
+    // 
+    OUT ULONG Version;
+
+    //
+    // Size of one record, newer versions may append fields
+    // 
+    OUT ULONG RecordSize;
+
+    //
+    // Number of records following the header, oldest first
+    // 
+    OUT ULONG RecordCount;
+
+    //
+    // Records overwritten since the previous drain
+    // 
+    OUT ULONG DroppedCount;
+
+    //
+    // Records still buffered after this drain
+    // 
+    OUT ULONG RemainingCount;
+
+} HIDGUARDIAN_STAGE_TRACE, *PHIDGUARDIAN_STAGE_TRACE;
+
+typedef struct _HIDGUARDIAN_STAGE_RECORD
+{
+    //
+    // Arrival of the create request (interrupt time, 100ns units), same
+    // as the Timestamp of the matching HIDGUARDIAN_ACCESS_RECORD
+    // 
+    OUT ULONG64 ArrivalTime;
+
+    OUT ULONG DeviceHash;
+
+    OUT ULONG ProcessId;
+
+    //
+    // ID assigned by Cerberus on pickup (0 if never picked up)
+    // 
+    OUT ULONG RequestId;
+
+    //
+    // HIDGUARDIAN_ACCESS_PATH_VERDICT or HIDGUARDIAN_ACCESS_PATH_TIMEOUT
+    // 
+    OUT UCHAR Path;
+
+    OUT BOOLEAN IsAllowed;
+
+    //
+    // Bit (1 << HIDGUARDIAN_STAGE_*) set for every stage reached
+    // 
+    OUT UCHAR StageMask;
+
+    OUT UCHAR Reserved;
+
+    //
+    // Time of each stage relative to arrival (100ns units)
+    // 
+    OUT ULONG StageOffsets[HIDGUARDIAN_STAGE_COUNT];
+
+} HIDGUARDIAN_STAGE_RECORD, *PHIDGUARDIAN_STAGE_RECORD;
+
+typedef struct _HIDGUARDIAN_DEVICE_COUNTERS
+{
+    //
+    // Create requests received
+    // 
+    OUT ULONG64 Opens;
+
+    //
+    // Requests allowed because of a whitelisted system PID
+    // 
+    OUT ULONG64 SystemPidHits;
+
+    //
+    // Sticky cache lookups that did (not) find a verdict
+    // 
+    OUT ULONG64 StickyHits;
+
+    OUT ULONG64 StickyMisses;
+
+    //
+    // Requests resolved by the default action
+    // 
+    OUT ULONG64 DefaultAllowed;
+
+    OUT ULONG64 DefaultDenied;
+
+    //
+    // Requests Cerberus couldn't be notified about right away (no parked
+    // notification); they're held until it submits the next one
+    // 
+    OUT ULONG64 NotificationsMissed;
+
+    //
+    // Decisions received from Cerberus
+    // 
+    OUT ULONG64 VerdictsReceived;
+
+    //
+    // Pending requests dropped without a decision (Cerberus gone for good)
+    // 
+    OUT ULONG64 Timeouts;
+
+    //
+    // Largest number of requests seen waiting for pickup/decision
+    // 
+    OUT ULONG64 PendingHighWater;
+
+    OUT ULONG64 AuthHighWater;
+
+    //
+    // Opens over their process' rate or the device's pending queue limit
+    // 
+    OUT ULONG64 RateLimited;
+
+    OUT ULONG64 QueueFull;
+
+    //
+    // How those excess opens were handled
+    // 
+    OUT ULONG64 ExcessFailed;
+
+    OUT ULONG64 ExcessDefaulted;
+
+    OUT ULONG64 ExcessDeferred;
+
+    //
+    // Opens failed while Cerberus is around because the device's IDs
+    // couldn't be looked up
+    // 
+    OUT ULONG64 NotReady;
+
+} HIDGUARDIAN_DEVICE_COUNTERS, *PHIDGUARDIAN_DEVICE_COUNTERS;
+
+typedef struct _HIDGUARDIAN_DEVICE_COUNTERS_ENTRY
+{
+    //
+    // Same hash as HIDGUARDIAN_ACCESS_RECORD.DeviceHash
+    // 
+    OUT ULONG DeviceHash;
+
+    //
+    // Bytes of pool the driver holds for this device (context, identity,
+    // cache, counters and histograms; framework objects and the shared
+    // identity strings, see IOCTL_HIDGUARDIAN_GET_IDENTITY_POOL_STATS,
+    // excluded)
+    // 
+    OUT ULONG MemoryUsage;
+
+    OUT HIDGUARDIAN_DEVICE_COUNTERS Counters;
+
+} HIDGUARDIAN_DEVICE_COUNTERS_ENTRY, *PHIDGUARDIAN_DEVICE_COUNTERS_ENTRY;
+
+typedef struct _HIDGUARDIAN_PERF_COUNTERS
+{
+    //
+    // Size of header and entries returned
+    // 
+    OUT ULONG Size;
+
+    //
+    // Number of guarded devices
+    // 
+    OUT ULONG DeviceCount;
+
+    //
+    // Number of HIDGUARDIAN_DEVICE_COUNTERS_ENTRY following the header
+    // 
+    OUT ULONG EntryCount;
+
+    //
+    // Sum of MemoryUsage over all filter devices, the master included
+    // 
+    OUT ULONG MemoryUsage;
+
+    //
+    // Sum over all devices (maximum for the high-water marks)
+    // 
+    OUT HIDGUARDIAN_DEVICE_COUNTERS Totals;
+
+} HIDGUARDIAN_PERF_COUNTERS, *PHIDGUARDIAN_PERF_COUNTERS;
+
+typedef struct _HIDGUARDIAN_LATENCY_HISTOGRAM
+{
+    //
+    // Number of requests recorded
+    // 
+    OUT ULONG64 Count;
+
+    //
+    // Sum and maximum of all recorded latencies (100ns units)
+    // 
+    OUT ULONG64 Sum;
+
+    OUT ULONG64 Max;
+
+    OUT ULONG Buckets[HIDGUARDIAN_LATENCY_BUCKETS];
+
+} HIDGUARDIAN_LATENCY_HISTOGRAM, *PHIDGUARDIAN_LATENCY_HISTOGRAM;
+
+typedef struct _HIDGUARDIAN_DEVICE_LATENCY
+{
+    //
+    // Same hash as HIDGUARDIAN_ACCESS_RECORD.DeviceHash
+    // 
+    OUT ULONG DeviceHash;
+
+    OUT ULONG Reserved;
+
+    //
+    // One histogram per HIDGUARDIAN_ACCESS_PATH_*
+    // 
+    OUT HIDGUARDIAN_LATENCY_HISTOGRAM Paths[HIDGUARDIAN_ACCESS_PATH_COUNT];
+
+} HIDGUARDIAN_DEVICE_LATENCY, *PHIDGUARDIAN_DEVICE_LATENCY;
+
+typedef struct _HIDGUARDIAN_LATENCY_HISTOGRAMS
+{
+    //
+    // Size of header and entries returned
+    // 
+    OUT ULONG Size;
+
+    //
+    // HIDGUARDIAN_LATENCY_BUCKETS, HIDGUARDIAN_LATENCY_SUB_BUCKETS and
+    // HIDGUARDIAN_ACCESS_PATH_COUNT of the driver
+    // 
+    OUT ULONG BucketCount;
+
+    OUT ULONG SubBucketCount;
+
+    OUT ULONG PathCount;
+
+    //
+    // Number of guarded devices
+    // 
+    OUT ULONG DeviceCount;
+
+    //
+    // Number of HIDGUARDIAN_DEVICE_LATENCY following the header
+    // 
+    OUT ULONG EntryCount;
+
+    //
+    // All requests since the driver loaded, including devices since removed
+    // 
+    OUT HIDGUARDIAN_LATENCY_HISTOGRAM Global[HIDGUARDIAN_ACCESS_PATH_COUNT];
+
+} HIDGUARDIAN_LATENCY_HISTOGRAMS, *PHIDGUARDIAN_LATENCY_HISTOGRAMS;
+
+typedef struct _HIDGUARDIAN_EVENT_TRACE
+{
+    //
+    // Size of header and records returned
+    // 
+    OUT ULONG Size;
+
+    //
+    // HIDGUARDIAN_EVENT_TRACE_VERSION
+    // 
+    OUT ULONG Version;
+
+    //
+    // Size of one record, newer versions may append fields
+    // 
+    OUT ULONG RecordSize;
+
+    //
+    // Number of records following the header, grouped by processor and
+    // oldest first within each processor
+    // 
+    OUT ULONG RecordCount;
+
+    //
+    // Events overwritten since the previous drain
+    // 
+    OUT ULONG DroppedCount;
+
+    //
+    // Events still buffered after this drain
+    // 
+    OUT ULONG RemainingCount;
+
+    //
+    // Ticks per second of HIDGUARDIAN_EVENT_RECORD.Timestamp
+    // 
+    OUT ULONG64 Frequency;
+
+} HIDGUARDIAN_EVENT_TRACE, *PHIDGUARDIAN_EVENT_TRACE;
+
+typedef struct _HIDGUARDIAN_EVENT_RECORD
+{
+    //
+    // Performance counter value at the time of the event
+    // 
+    OUT ULONG64 Timestamp;
+
+    //
+    // Per processor, increments by one with every event written
+    // 
+    OUT ULONG Sequence;
+
+    //
+    // HIDGUARDIAN_EVENT_*
+    // 
+    OUT USHORT EventId;
+
+    OUT USHORT Processor;
+
+    //
+    // Same hash as HIDGUARDIAN_ACCESS_RECORD.DeviceHash
+    // 
+    OUT ULONG DeviceHash;
+
+    OUT ULONG Args[3];
+
+} HIDGUARDIAN_EVENT_RECORD, *PHIDGUARDIAN_EVENT_RECORD;
+
+typedef struct _HIDGUARDIAN_TOP_OPENER
+{
+    OUT ULONG ProcessId;
+
+    OUT ULONG Reserved;
+
+    //
+    // Upper bound of the opens by this process
+    // 
+    OUT ULONG64 Count;
+
+    //
+    // Maximum overestimation, Count - Error is a lower bound
+    // 
+    OUT ULONG64 Error;
+
+} HIDGUARDIAN_TOP_OPENER, *PHIDGUARDIAN_TOP_OPENER;
+
+typedef struct _HIDGUARDIAN_TOP_OPENERS
+{
+    //
+    // Size of header and entries returned
+    // 
+    OUT ULONG Size;
+
+    //
+    // HIDGUARDIAN_TOP_OPENERS_*
+    // 
+    IN ULONG Flags;
+
+    //
+    // Number of processes tracked, any process with more than
+    // TotalOpens / Capacity opens is guaranteed to be listed
+    // 
+    OUT ULONG Capacity;
+
+    //
+    // Number of HIDGUARDIAN_TOP_OPENER following the header, most
+    // frequent first
+    // 
+    OUT ULONG EntryCount;
+
+    //
+    // Opens counted since the driver loaded or the last reset (opens
+    // settled by the system PID set or the sticky cache excluded)
+    // 
+    OUT ULONG64 TotalOpens;
+
+} HIDGUARDIAN_TOP_OPENERS, *PHIDGUARDIAN_TOP_OPENERS;
+
+typedef struct _HIDGUARDIAN_IDENTITY_POOL_STATS
+{
+    //
+    // Size of packet
+    // 
+    OUT ULONG Size;
+
+    //
+    // Distinct device, instance and hardware ID strings pooled
+    // 
+    OUT ULONG Strings;
+
+    //
+    // References to pooled strings held by filter devices
+    // 
+    OUT ULONG References;
+
+    //
+    // Hash buckets of the pool
+    // 
+    OUT ULONG Buckets;
+
+    //
+    // Bytes allocated for the pool and its strings
+    // 
+    OUT ULONG64 PooledBytes;
+
+    //
+    // Bytes the same strings would take if every device kept its own copy
+    // 
+    OUT ULONG64 UnpooledBytes;
+
+    //
+    // Strings interned since the driver loaded and how many of them were
+    // already pooled
+    // 
+    OUT ULONG64 Interns;
+
+    OUT ULONG64 Hits;
+
+} HIDGUARDIAN_IDENTITY_POOL_STATS, *PHIDGUARDIAN_IDENTITY_POOL_STATS;
+
+typedef struct _HIDGUARDIAN_DEVICE_ADD_STATS
+{
+    //
+    // Size of packet
+    // 
+    OUT ULONG Size;
+
+    OUT ULONG Reserved;
+
+    //
+    // Time the driver spent adding a filter device, from entry to return
+    // of the add callback (100ns units)
+    // 
+    OUT HIDGUARDIAN_LATENCY_HISTOGRAM Add;
+
+    //
+    // Time looking up Device and Instance ID took after the add, one
+    // sample per attempt (100ns units)
+    // 
+    OUT HIDGUARDIAN_LATENCY_HISTOGRAM Identity;
+
+    //
+    // Identities completed by the work item queued at add, by whoever
+    // needed them before it got to run (a create request or a snapshot)
+    // and lookups that failed
+    // 
+    OUT ULONG64 IdentitiesDeferred;
+
+    OUT ULONG64 IdentitiesOnDemand;
+
+    OUT ULONG64 IdentityFailures;
+
+} HIDGUARDIAN_DEVICE_ADD_STATS, *PHIDGUARDIAN_DEVICE_ADD_STATS;
+
+typedef struct _HIDGUARDIAN_DISCONNECT_STATS
+{
+    //
+    // Size of packet
+    // 
+    OUT ULONG Size;
+
+    OUT ULONG Reserved;
+
+    //
+    // Time from Cerberus leaving (or its reconnect grace running out)
+    // until every device resolved its pending requests (100ns units)
+    // 
+    OUT HIDGUARDIAN_LATENCY_HISTOGRAM Duration;
+
+    OUT ULONG64 Disconnects;
+
+    //
+    // Pending requests resolved by cached verdict or default action
+    // 
+    OUT ULONG64 RequestsAllowed;
+
+    OUT ULONG64 RequestsDenied;
+
+    //
+    // Most recent disconnect: duration (100ns units), devices with guard
+    // state gone through and the requests resolved
+    // 
+    OUT ULONG64 LastDuration;
+
+    OUT ULONG LastDevices;
+
+    OUT ULONG LastRequests;
+
+} HIDGUARDIAN_DISCONNECT_STATS, *PHIDGUARDIAN_DISCONNECT_STATS;
+
+//
+// Batch layout (packed, no padding):
+// 
+//   HIDGUARDIAN_DEVICE_CHANGES
+//   HIDGUARDIAN_DEVICE_CHANGE records [RecordCount]
+// 
+typedef struct _HIDGUARDIAN_DEVICE_CHANGES
+{
+    //
+    // Size of header and records returned
+    // 
+    OUT ULONG Size;
+
+    //
+    // HIDGUARDIAN_DEVICE_CHANGES_VERSION
+    // 
+    OUT ULONG Version;
+
+    //
+    // Number of records following the header, oldest first
+    // 
+    OUT ULONG RecordCount;
+
+    //
+    // Changes lost to a full queue since the previous batch; if not 0
+    // the device table of the caller is stale and needs a rescan
+    // 
+    OUT ULONG DroppedCount;
+
+    //
+    // Changes still queued after this batch
+    // 
+    OUT ULONG RemainingCount;
+
+} HIDGUARDIAN_DEVICE_CHANGES, *PHIDGUARDIAN_DEVICE_CHANGES;
+
+//
+// Record layout:
+// 
+//   HIDGUARDIAN_DEVICE_CHANGE
+//   WCHAR DeviceId[DeviceIdLength]
+//   WCHAR InstanceId[InstanceIdLength]
+//   WCHAR ClassName[ClassNameLength]
+//   WCHAR HardwareIds[HardwareIdsLength / sizeof(WCHAR)] (multi-sz)
+// 
+typedef struct _HIDGUARDIAN_DEVICE_CHANGE
+{
+    //
+    // Size of record including strings
+    // 
+    OUT ULONG Size;
+
+    //
+    // HIDGUARDIAN_DEVICE_ARRIVAL or HIDGUARDIAN_DEVICE_REMOVAL
+    // 
+    OUT UCHAR Type;
+
+    OUT UCHAR Reserved;
+
+    //
+    // Length of Device ID in characters, without terminator
+    // 
+    OUT USHORT DeviceIdLength;
+
+    //
+    // Length of Instance ID in characters, without terminator
+    // 
+    OUT USHORT InstanceIdLength;
+
+    //
+    // Length of the device class name in characters, without
+    // terminator (0 if the class couldn't be read)
+    // 
+    OUT USHORT ClassNameLength;
+
+    //
+    // Increments by one per change, gaps match DroppedCount
+    // 
+    OUT ULONG64 Sequence;
+
+    //
+    // Time of the change (interrupt time, 100ns units)
+    // 
+    OUT ULONG64 Timestamp;
+
+    //
+    // Handle of the device, the same FNV-1a hash access records carry
+    // 
+    OUT ULONG DeviceHash;
+
+    //
+    // Bytes the hardware IDs take, terminators included
+    // 
+    OUT ULONG HardwareIdsLength;
+
+} HIDGUARDIAN_DEVICE_CHANGE, *PHIDGUARDIAN_DEVICE_CHANGE;
+
+//
+// List layout (packed, no padding):
+// 
+//   HIDGUARDIAN_DEVICE_LIST
+//   HIDGUARDIAN_DEVICE_INFO records [DeviceCount]
+// 
+typedef struct _HIDGUARDIAN_DEVICE_LIST
+{
+    //
+    // Size of the complete list; if the supplied buffer is too small
+    // only this header is returned and Size holds the size needed
+    // 
+    OUT ULONG Size;
+
+    //
+    // HIDGUARDIAN_DEVICE_LIST_VERSION
+    // 
+    OUT ULONG Version;
+
+    //
+    // Number of device records following the header
+    // 
+    OUT ULONG DeviceCount;
+
+} HIDGUARDIAN_DEVICE_LIST, *PHIDGUARDIAN_DEVICE_LIST;
+
+//
+// Record layout, the strings as in HIDGUARDIAN_DEVICE_CHANGE:
+// 
+//   HIDGUARDIAN_DEVICE_INFO
+//   WCHAR DeviceId[DeviceIdLength]
+//   WCHAR InstanceId[InstanceIdLength]
+//   WCHAR ClassName[ClassNameLength]
+//   WCHAR HardwareIds[HardwareIdsLength / sizeof(WCHAR)] (multi-sz)
+// 
+typedef struct _HIDGUARDIAN_DEVICE_INFO
+{
+    //
+    // Size of record including strings
+    // 
+    OUT ULONG Size;
+
+    //
+    // Same hash as HIDGUARDIAN_ACCESS_RECORD.DeviceHash
+    // 
+    OUT ULONG DeviceHash;
+
+    //
+    // HIDGUARDIAN_DEVICE_* flags
+    // 
+    OUT ULONG Flags;
+
+    OUT USHORT DeviceIdLength;
+
+    OUT USHORT InstanceIdLength;
+
+    OUT USHORT ClassNameLength;
+
+    OUT USHORT Reserved;
+
+    OUT ULONG HardwareIdsLength;
+
+    //
+    // Create requests received and not yet resolved or handed to Cerberus
+    // 
+    OUT ULONG CreateRequests;
+
+    //
+    // Create requests waiting for Cerberus to pick them up (deferred
+    // opens included) / to answer (0 without guard state)
+    // 
+    OUT ULONG PendingCreateRequests;
+
+    OUT ULONG PendingAuthRequests;
+
+    //
+    // Sticky verdicts cached (0 without guard state)
+    // 
+    OUT ULONG CacheOccupancy;
+
+} HIDGUARDIAN_DEVICE_INFO, *PHIDGUARDIAN_DEVICE_INFO;
+
 #include <poppack.h>
@@ -0,0 +1,607 @@
+/*
+* User-mode simulation of the subset of the Windows kernel API used by HidGuardian.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <wctype.h>
+
+#include "SimPrivate.h"
+#include <ntstrsafe.h>
+
+pthread_mutex_t SimEventLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t SimEventSignal = PTHREAD_COND_INITIALIZER;
+
+static __thread ULONG SimCurrentPid = 4;
+
+ULONG SimThreadProcessId(VOID)
+{
+    return SimCurrentPid;
+}
+
+VOID SimSetCurrentProcessId(ULONG ProcessId)
+{
+    SimCurrentPid = ProcessId;
+}
+
+ULONG SimGetCurrentProcessId(VOID)
+{
+    return SimCurrentPid;
+}
+
+ULONGLONG SimNowNs(VOID)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ULONGLONG)ts.tv_sec * 1000000000ULL + (ULONGLONG)ts.tv_nsec;
+}
+
+ULONGLONG SimClockNs(VOID)
+{
+    return SimNowNs();
+}
+
+#pragma region Memory
+
+//
+// Pool blocks carry their tag so mismatched frees are caught
+//
+typedef struct _SIM_POOL_HEADER
+{
+    ULONG   Tag;
+    ULONG   Magic;
+    SIZE_T  Size;
+    UCHAR   Padding[48];
+} SIM_POOL_HEADER;
+
+#define SIM_POOL_MAGIC  0x4C4F4F50
+
+PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag)
+{
+    SIM_POOL_HEADER* header;
+
+    UNREFERENCED_PARAMETER(PoolType);
+
+    if (posix_memalign((void**)&header, 64, sizeof(SIM_POOL_HEADER) + NumberOfBytes) != 0) {
+        return NULL;
+    }
+
+    header->Tag = Tag;
+    header->Magic = SIM_POOL_MAGIC;
+    header->Size = NumberOfBytes;
+
+    return header + 1;
+}
+
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag)
+{
+    SIM_POOL_HEADER* header = ((SIM_POOL_HEADER*)P) - 1;
+
+    if (header->Magic != SIM_POOL_MAGIC || (Tag != 0 && header->Tag != Tag)) {
+        fprintf(stderr, "sim: bad pool free %p (tag 0x%08X, expected 0x%08X)\n", P, Tag, header->Tag);
+        abort();
+    }
+
+    header->Magic = 0;
+    free(header);
+}
+
+VOID ExFreePool(PVOID P)
+{
+    ExFreePoolWithTag(P, 0);
+}
+
+SIZE_T RtlCompareMemory(const VOID* Source1, const VOID* Source2, SIZE_T Length)
+{
+    const UCHAR* a = Source1;
+    const UCHAR* b = Source2;
+    SIZE_T i;
+
+    for (i = 0; i < Length && a[i] == b[i]; i++);
+
+    return i;
+}
+
+#pragma endregion
+
+#pragma region Strings
+
+BOOLEAN RtlEqualUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive)
+{
+    USHORT i;
+
+    if (String1->Length != String2->Length) {
+        return FALSE;
+    }
+
+    for (i = 0; i < String1->Length / sizeof(WCHAR); i++) {
+        WCHAR a = String1->Buffer[i];
+        WCHAR b = String2->Buffer[i];
+
+        if (CaseInSensitive) {
+            a = (WCHAR)towupper(a);
+            b = (WCHAR)towupper(b);
+        }
+
+        if (a != b) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+VOID RtlInitUnicodeString(PUNICODE_STRING DestinationString, PCWSTR SourceString)
+{
+    size_t length = SourceString ? wcslen(SourceString) * sizeof(WCHAR) : 0;
+
+    DestinationString->Buffer = (PWCH)SourceString;
+    DestinationString->Length = (USHORT)length;
+    DestinationString->MaximumLength = SourceString ? (USHORT)(length + sizeof(WCHAR)) : 0;
+}
+
+NTSTATUS RtlUnicodeStringInit(PUNICODE_STRING DestinationString, PCWSTR pszSrc)
+{
+    size_t length = wcslen(pszSrc) * sizeof(WCHAR);
+
+    if (length > MAXUSHORT - sizeof(WCHAR)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RtlInitUnicodeString(DestinationString, pszSrc);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS RtlStringCchLengthW(PCWSTR psz, size_t cchMax, size_t* pcchLength)
+{
+    size_t length = wcsnlen(psz, cchMax);
+
+    if (length == cchMax) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (pcchLength) {
+        *pcchLength = length;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS RtlStringCchCopyW(PWSTR pszDest, size_t cchDest, PCWSTR pszSrc)
+{
+    return wcscpy_s(pszDest, cchDest, pszSrc) == 0 ? STATUS_SUCCESS : STATUS_BUFFER_OVERFLOW;
+}
+
+int wcscpy_s(WCHAR* Destination, SIZE_T Size, const WCHAR* Source)
+{
+    size_t length = wcslen(Source);
+
+    if (Size == 0) {
+        return 22;
+    }
+
+    if (length >= Size) {
+        Destination[0] = L'\0';
+        return 34;
+    }
+
+    wmemcpy(Destination, Source, length + 1);
+
+    return 0;
+}
+
+int wcsncpy_s(WCHAR* Destination, SIZE_T Size, const WCHAR* Source, SIZE_T Count)
+{
+    size_t length = wcsnlen(Source, Count);
+
+    if (Size == 0 || length >= Size) {
+        return 34;
+    }
+
+    wmemcpy(Destination, Source, length);
+    Destination[length] = L'\0';
+
+    return 0;
+}
+
+#pragma endregion
+
+#pragma region Processes, processors and time
+
+HANDLE PsGetCurrentProcessId(VOID)
+{
+    return (HANDLE)(ULONG_PTR)SimCurrentPid;
+}
+
+KIRQL KeGetCurrentIrql(VOID)
+{
+    return PASSIVE_LEVEL;
+}
+
+ULONG KeQueryMaximumProcessorCountEx(USHORT GroupNumber)
+{
+    long count = sysconf(_SC_NPROCESSORS_CONF);
+
+    UNREFERENCED_PARAMETER(GroupNumber);
+
+    return (count > 0) ? (ULONG)count : 1;
+}
+
+ULONG KeGetCurrentProcessorNumberEx(PVOID ProcNumber)
+{
+    int cpu = sched_getcpu();
+
+    UNREFERENCED_PARAMETER(ProcNumber);
+
+    return (cpu >= 0) ? ((ULONG)cpu % KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS)) : 0;
+}
+
+ULONGLONG KeQueryInterruptTime(VOID)
+{
+    return SimNowNs() / 100;
+}
+
+VOID KeQuerySystemTime(PLARGE_INTEGER CurrentTime)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    //
+    // 100ns units since 1601
+    // 
+    CurrentTime->QuadPart = ((LONGLONG)ts.tv_sec + 11644473600LL) * 10000000LL + ts.tv_nsec / 100;
+}
+
+NTSTATUS KeDelayExecutionThread(KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Interval)
+{
+    LONGLONG ticks = Interval->QuadPart;
+    struct timespec ts;
+
+    UNREFERENCED_PARAMETER(WaitMode);
+    UNREFERENCED_PARAMETER(Alertable);
+
+    //
+    // Only relative intervals (negative, 100ns units) are used
+    //
+    if (ticks < 0) {
+        ticks = -ticks;
+    }
+
+    ts.tv_sec = ticks / 10000000;
+    ts.tv_nsec = (ticks % 10000000) * 100;
+    nanosleep(&ts, NULL);
+
+    return STATUS_SUCCESS;
+}
+
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequency)
+{
+    LARGE_INTEGER counter;
+
+    if (PerformanceFrequency) {
+        PerformanceFrequency->QuadPart = 1000000000LL;
+    }
+
+    counter.QuadPart = (LONGLONG)SimNowNs();
+
+    return counter;
+}
+
+#pragma endregion
+
+#pragma region Events
+
+VOID KeInitializeEvent(PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State)
+{
+    Event->Type = Type;
+    __atomic_store_n(&Event->State, State ? 1 : 0, __ATOMIC_SEQ_CST);
+}
+
+LONG KeSetEvent(PRKEVENT Event, LONG Increment, BOOLEAN Wait)
+{
+    LONG previous;
+
+    UNREFERENCED_PARAMETER(Increment);
+    UNREFERENCED_PARAMETER(Wait);
+
+    pthread_mutex_lock(&SimEventLock);
+    previous = Event->State;
+    Event->State = 1;
+    pthread_cond_broadcast(&SimEventSignal);
+    pthread_mutex_unlock(&SimEventLock);
+
+    return previous;
+}
+
+VOID KeClearEvent(PRKEVENT Event)
+{
+    __atomic_store_n(&Event->State, 0, __ATOMIC_SEQ_CST);
+}
+
+LONG KeReadStateEvent(PRKEVENT Event)
+{
+    return __atomic_load_n(&Event->State, __ATOMIC_SEQ_CST);
+}
+
+NTSTATUS KeWaitForSingleObject(PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable, PLARGE_INTEGER Timeout)
+{
+    PRKEVENT event = Object;
+    NTSTATUS status = STATUS_SUCCESS;
+    struct timespec deadline;
+
+    UNREFERENCED_PARAMETER(WaitReason);
+    UNREFERENCED_PARAMETER(WaitMode);
+    UNREFERENCED_PARAMETER(Alertable);
+
+    if (Timeout) {
+        ULONGLONG ns = (ULONGLONG)(Timeout->QuadPart < 0 ? -Timeout->QuadPart : Timeout->QuadPart) * 100;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (time_t)(ns / 1000000000ULL);
+        deadline.tv_nsec += (long)(ns % 1000000000ULL);
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&SimEventLock);
+
+    while (event->State == 0) {
+        if (Timeout) {
+            if (pthread_cond_timedwait(&SimEventSignal, &SimEventLock, &deadline) != 0 && event->State == 0) {
+                status = STATUS_TIMEOUT;
+                break;
+            }
+        }
+        else {
+            pthread_cond_wait(&SimEventSignal, &SimEventLock);
+        }
+    }
+
+    if (status == STATUS_SUCCESS && event->Type == SynchronizationEvent) {
+        event->State = 0;
+    }
+
+    pthread_mutex_unlock(&SimEventLock);
+
+    return status;
+}
+
+#pragma endregion
+
+#pragma region Spin locks and rundown protection
+
+VOID KeInitializeSpinLock(PKSPIN_LOCK SpinLock)
+{
+    *SpinLock = 0;
+}
+
+VOID KeAcquireSpinLock(PKSPIN_LOCK SpinLock, PKIRQL OldIrql)
+{
+    while (__atomic_exchange_n(SpinLock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(SpinLock, __ATOMIC_RELAXED)) {
+            sched_yield();
+        }
+    }
+
+    *OldIrql = PASSIVE_LEVEL;
+}
+
+VOID KeReleaseSpinLock(PKSPIN_LOCK SpinLock, KIRQL NewIrql)
+{
+    UNREFERENCED_PARAMETER(NewIrql);
+
+    __atomic_store_n(SpinLock, 0, __ATOMIC_RELEASE);
+}
+
+#define SIM_EX_SPIN_EXCLUSIVE   ((LONG)0x80000000)
+
+KIRQL ExAcquireSpinLockShared(PEX_SPIN_LOCK SpinLock)
+{
+    for (;;) {
+        LONG value = __atomic_load_n(SpinLock, __ATOMIC_RELAXED);
+
+        if ((value & SIM_EX_SPIN_EXCLUSIVE) == 0
+            && __atomic_compare_exchange_n(SpinLock, &value, value + 1, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return PASSIVE_LEVEL;
+        }
+
+        sched_yield();
+    }
+}
+
+VOID ExReleaseSpinLockShared(PEX_SPIN_LOCK SpinLock, KIRQL OldIrql)
+{
+    UNREFERENCED_PARAMETER(OldIrql);
+
+    __atomic_sub_fetch(SpinLock, 1, __ATOMIC_RELEASE);
+}
+
+KIRQL ExAcquireSpinLockExclusive(PEX_SPIN_LOCK SpinLock)
+{
+    for (;;) {
+        LONG expected = 0;
+
+        if (__atomic_compare_exchange_n(SpinLock, &expected, SIM_EX_SPIN_EXCLUSIVE, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return PASSIVE_LEVEL;
+        }
+
+        sched_yield();
+    }
+}
+
+VOID ExReleaseSpinLockExclusive(PEX_SPIN_LOCK SpinLock, KIRQL OldIrql)
+{
+    UNREFERENCED_PARAMETER(OldIrql);
+
+    __atomic_store_n(SpinLock, 0, __ATOMIC_RELEASE);
+}
+
+//
+// Bit 0 flags an active rundown, references count in steps of two
+//
+VOID ExInitializeRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    __atomic_store_n(&RunRef->Count, 0, __ATOMIC_SEQ_CST);
+}
+
+VOID ExReInitializeRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    __atomic_store_n(&RunRef->Count, 0, __ATOMIC_SEQ_CST);
+}
+
+BOOLEAN ExAcquireRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    for (;;) {
+        LONG_PTR value = __atomic_load_n(&RunRef->Count, __ATOMIC_RELAXED);
+
+        if (value & 1) {
+            return FALSE;
+        }
+
+        if (__atomic_compare_exchange_n(&RunRef->Count, &value, value + 2, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return TRUE;
+        }
+    }
+}
+
+VOID ExReleaseRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    __atomic_sub_fetch(&RunRef->Count, 2, __ATOMIC_RELEASE);
+}
+
+VOID ExWaitForRundownProtectionRelease(PEX_RUNDOWN_REF RunRef)
+{
+    __atomic_or_fetch(&RunRef->Count, 1, __ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(&RunRef->Count, __ATOMIC_ACQUIRE) != 1) {
+        sched_yield();
+    }
+}
+
+#pragma endregion
+
+#pragma region IRP_MN_QUERY_ID
+
+static ULONG SimQueryIdDelayUs = 0;
+
+VOID SimSetQueryIdDelay(ULONG Microseconds)
+{
+    SimQueryIdDelayUs = Microseconds;
+}
+
+PIRP IoBuildSynchronousFsdRequest(ULONG MajorFunction, PDEVICE_OBJECT DeviceObject, PVOID Buffer,
+    ULONG Length, PLARGE_INTEGER StartingOffset, PKEVENT Event, PIO_STATUS_BLOCK IoStatusBlock)
+{
+    PIRP irp;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+    UNREFERENCED_PARAMETER(Buffer);
+    UNREFERENCED_PARAMETER(Length);
+    UNREFERENCED_PARAMETER(StartingOffset);
+
+    irp = calloc(1, sizeof(IRP));
+    if (irp == NULL) {
+        return NULL;
+    }
+
+    irp->Stack.MajorFunction = (UCHAR)MajorFunction;
+    irp->UserEvent = Event;
+    irp->UserIosb = IoStatusBlock;
+
+    return irp;
+}
+
+PIO_STACK_LOCATION IoGetNextIrpStackLocation(PIRP Irp)
+{
+    return &Irp->Stack;
+}
+
+NTSTATUS IoCallDriver(PDEVICE_OBJECT DeviceObject, PIRP Irp)
+{
+    struct _SIM_PDO* pdo = DeviceObject->SimPdo;
+    PCWSTR source = NULL;
+    PWCHAR copy;
+    NTSTATUS status = STATUS_NOT_SUPPORTED;
+    size_t length;
+
+    if (Irp->Stack.MajorFunction == IRP_MJ_PNP && Irp->Stack.MinorFunction == IRP_MN_QUERY_ID) {
+        switch (Irp->Stack.Parameters.QueryId.IdType) {
+        case BusQueryDeviceID:
+            source = pdo->DeviceId;
+            break;
+        case BusQueryInstanceID:
+            source = pdo->InstanceId;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (source != NULL && SimQueryIdDelayUs != 0) {
+        struct timespec ts = { SimQueryIdDelayUs / 1000000, (SimQueryIdDelayUs % 1000000) * 1000L };
+
+        nanosleep(&ts, NULL);
+    }
+
+    if (source != NULL) {
+        length = (wcslen(source) + 1) * sizeof(WCHAR);
+        copy = ExAllocatePoolWithTag(PagedPool, length, 0);
+
+        if (copy != NULL) {
+            memcpy(copy, source, length);
+            Irp->IoStatus.Information = (ULONG_PTR)copy;
+            status = STATUS_SUCCESS;
+        }
+        else {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    Irp->IoStatus.Status = status;
+
+    if (Irp->UserIosb) {
+        *Irp->UserIosb = Irp->IoStatus;
+    }
+
+    if (Irp->UserEvent) {
+        KeSetEvent(Irp->UserEvent, IO_NO_INCREMENT, FALSE);
+    }
+
+    free(Irp);
+
+    return status;
+}
+
+#pragma endregion
@@ -0,0 +1,116 @@
+/*
+* User-mode simulation harness for the HidGuardian filter driver.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <ntddk.h>
+
+EXTERN_C_START
+
+//
+// Simulated physical device object (one per HID collection)
+//
+typedef struct _SIM_PDO *PSIM_PDO;
+
+//
+// Simulated user-mode handle to a filter or control device
+//
+typedef struct _SIM_FILE *PSIM_HANDLE;
+
+//
+// Outstanding asynchronous I/O (an "overlapped" DeviceIoControl)
+//
+typedef struct _SIM_REQUEST *PSIM_IRP;
+
+//
+// Handler emulating the function driver below the filter
+//
+typedef NTSTATUS (*PFN_SIM_LOWER_DRIVER)(PSIM_PDO Pdo, ULONG ProcessId);
+
+//
+// Loads the driver (calls DriverEntry).
+//
+NTSTATUS SimDriverLoad(VOID);
+
+//
+// Removes all remaining devices and unloads the driver.
+//
+VOID SimDriverUnload(VOID);
+
+//
+// Values visible under the driver's Parameters registry key.
+//
+VOID SimRegistrySetULong(PCWSTR Name, ULONG Value);
+VOID SimRegistrySetMultiString(PCWSTR Name, PCWSTR MultiSz, size_t Length);
+
+//
+// Hot-plugs a device; HardwareIds is a double-NUL-terminated multi-sz.
+//
+NTSTATUS SimDeviceArrival(PCWSTR DeviceId, PCWSTR InstanceId, PCWSTR HardwareIds, PCWSTR ClassName, PSIM_PDO* Pdo);
+VOID SimDeviceRemoval(PSIM_PDO Pdo);
+
+VOID SimSetLowerDriver(PFN_SIM_LOWER_DRIVER Handler);
+
+//
+// Time the bus driver takes to answer IRP_MN_QUERY_ID (default 0).
+//
+VOID SimSetQueryIdDelay(ULONG Microseconds);
+
+//
+// Simulated process context of the calling thread (default is the SYSTEM PID 4).
+//
+VOID SimSetCurrentProcessId(ULONG ProcessId);
+ULONG SimGetCurrentProcessId(VOID);
+
+//
+// CreateFile/CloseHandle/DeviceIoControl equivalents.
+//
+NTSTATUS SimOpenDevice(PSIM_PDO Pdo, PSIM_HANDLE* Handle);
+NTSTATUS SimOpenControlDevice(PSIM_HANDLE* Handle);
+VOID SimCloseHandle(PSIM_HANDLE Handle);
+
+NTSTATUS SimDeviceIoControl(PSIM_HANDLE Handle, ULONG IoControlCode,
+    PVOID InBuffer, ULONG InBufferSize, PVOID OutBuffer, ULONG OutBufferSize, PULONG BytesReturned);
+
+PSIM_IRP SimDeviceIoControlAsync(PSIM_HANDLE Handle, ULONG IoControlCode,
+    PVOID InBuffer, ULONG InBufferSize, PVOID OutBuffer, ULONG OutBufferSize);
+
+//
+// Waits up to TimeoutMs (MAXULONG = forever) and returns STATUS_TIMEOUT if
+// the request is still pending. Completed requests must be released
+// with SimFreeIrp; pending ones get cancelled by closing their handle.
+//
+NTSTATUS SimWaitIrp(PSIM_IRP Irp, ULONG TimeoutMs, PULONG BytesReturned);
+BOOLEAN SimIsIrpComplete(PSIM_IRP Irp);
+VOID SimFreeIrp(PSIM_IRP Irp);
+
+//
+// Monotonic nanosecond clock used by the simulation
+//
+ULONGLONG SimClockNs(VOID);
+
+EXTERN_C_END
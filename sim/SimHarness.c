@@ -0,0 +1,509 @@
+/*
+* User-mode simulation harness for the HidGuardian filter driver.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "SimPrivate.h"
+
+DRIVER_INITIALIZE DriverEntry;
+
+extern WDF_DRIVER_CONFIG SimDriverConfig;
+extern DRIVER_OBJECT SimDriverObject;
+
+#pragma region Registry
+
+typedef struct _SIM_REGISTRY_VALUE
+{
+    WCHAR   Name[128];
+
+    BOOLEAN IsMultiString;
+
+    ULONG   ULongValue;
+
+    PWCHAR  MultiString;
+
+} SIM_REGISTRY_VALUE;
+
+static SIM_REGISTRY_VALUE SimRegistry[64];
+static ULONG SimRegistryCount = 0;
+static pthread_mutex_t SimRegistryLock = PTHREAD_MUTEX_INITIALIZER;
+
+static SIM_REGISTRY_VALUE* SimRegistryFind(PCWSTR Name, BOOLEAN Create)
+{
+    ULONG i;
+
+    for (i = 0; i < SimRegistryCount; i++) {
+        if (wcscmp(SimRegistry[i].Name, Name) == 0) {
+            return &SimRegistry[i];
+        }
+    }
+
+    if (!Create || SimRegistryCount == ARRAYSIZE(SimRegistry)) {
+        return NULL;
+    }
+
+    wcsncpy(SimRegistry[SimRegistryCount].Name, Name, ARRAYSIZE(SimRegistry[0].Name) - 1);
+
+    return &SimRegistry[SimRegistryCount++];
+}
+
+VOID SimRegistrySetULong(PCWSTR Name, ULONG Value)
+{
+    SIM_REGISTRY_VALUE* value;
+
+    pthread_mutex_lock(&SimRegistryLock);
+
+    value = SimRegistryFind(Name, TRUE);
+    if (value != NULL) {
+        value->IsMultiString = FALSE;
+        value->ULongValue = Value;
+    }
+
+    pthread_mutex_unlock(&SimRegistryLock);
+}
+
+VOID SimRegistrySetMultiString(PCWSTR Name, PCWSTR MultiSz, size_t Length)
+{
+    SIM_REGISTRY_VALUE* value;
+
+    pthread_mutex_lock(&SimRegistryLock);
+
+    value = SimRegistryFind(Name, TRUE);
+    if (value != NULL) {
+        free(value->MultiString);
+        value->IsMultiString = TRUE;
+        value->MultiString = calloc(1, Length + 2 * sizeof(WCHAR));
+        memcpy(value->MultiString, MultiSz, Length);
+    }
+
+    pthread_mutex_unlock(&SimRegistryLock);
+}
+
+BOOLEAN SimRegistryQueryULong(PCWSTR Name, PULONG Value)
+{
+    SIM_REGISTRY_VALUE* value;
+    BOOLEAN found = FALSE;
+
+    pthread_mutex_lock(&SimRegistryLock);
+
+    value = SimRegistryFind(Name, FALSE);
+    if (value != NULL && !value->IsMultiString) {
+        *Value = value->ULongValue;
+        found = TRUE;
+    }
+
+    pthread_mutex_unlock(&SimRegistryLock);
+
+    return found;
+}
+
+PCWSTR SimRegistryQueryMultiString(PCWSTR Name)
+{
+    SIM_REGISTRY_VALUE* value;
+    PCWSTR result = NULL;
+
+    pthread_mutex_lock(&SimRegistryLock);
+
+    value = SimRegistryFind(Name, FALSE);
+    if (value != NULL && value->IsMultiString) {
+        result = value->MultiString;
+    }
+
+    pthread_mutex_unlock(&SimRegistryLock);
+
+    return result;
+}
+
+#pragma endregion
+
+#pragma region Driver and device lifetime
+
+static PSIM_PDO SimPdos[256];
+static ULONG SimPdoCount = 0;
+
+NTSTATUS SimDriverLoad(VOID)
+{
+    UNICODE_STRING registryPath;
+
+    RtlInitUnicodeString(&registryPath, L"\\Registry\\Machine\\System\\CurrentControlSet\\Services\\HidGuardian");
+
+    return DriverEntry(&SimDriverObject, &registryPath);
+}
+
+VOID SimDriverUnload(VOID)
+{
+    while (SimPdoCount > 0) {
+        SimDeviceRemoval(SimPdos[SimPdoCount - 1]);
+    }
+
+    if (SimDriverConfig.EvtDriverUnload) {
+        SimDriverConfig.EvtDriverUnload(SimDriver);
+    }
+
+    if (SimDriver != NULL) {
+        WdfObjectDelete(SimDriver);
+    }
+}
+
+NTSTATUS SimDeviceArrival(PCWSTR DeviceId, PCWSTR InstanceId, PCWSTR HardwareIds, PCWSTR ClassName, PSIM_PDO* Pdo)
+{
+    PSIM_PDO pdo;
+    PWDFDEVICE_INIT init;
+    PCWSTR iter;
+    ULONG previousPid;
+    NTSTATUS status;
+
+    *Pdo = NULL;
+
+    if (SimPdoCount == ARRAYSIZE(SimPdos)) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    pdo = calloc(1, sizeof(SIM_PDO));
+    init = calloc(1, sizeof(WDFDEVICE_INIT));
+
+    wcsncpy(pdo->DeviceId, DeviceId, ARRAYSIZE(pdo->DeviceId) - 1);
+    wcsncpy(pdo->InstanceId, InstanceId, ARRAYSIZE(pdo->InstanceId) - 1);
+    wcsncpy(pdo->ClassName, ClassName ? ClassName : L"HIDClass", ARRAYSIZE(pdo->ClassName) - 1);
+
+    for (iter = HardwareIds; *iter; iter += wcslen(iter) + 1) {
+        ;
+    }
+    pdo->HardwareIdsLength = (size_t)(iter - HardwareIds + 1) * sizeof(WCHAR);
+    memcpy(pdo->HardwareIds, HardwareIds, pdo->HardwareIdsLength);
+
+    init->Pdo = pdo;
+    init->Driver = SimDriver;
+
+    //
+    // AddDevice runs in the context of the PnP manager
+    //
+    previousPid = SimThreadProcessId();
+    SimSetCurrentProcessId(SYSTEM_PROCESS_ID);
+
+    status = SimDriverConfig.EvtDriverDeviceAdd(SimDriver, init);
+
+    if (NT_SUCCESS(status) && pdo->Device != NULL && pdo->Device->Init.PnpPower.EvtDevicePrepareHardware) {
+        status = pdo->Device->Init.PnpPower.EvtDevicePrepareHardware(&pdo->Device->Header, NULL, NULL);
+    }
+
+    if (!NT_SUCCESS(status) && pdo->Device != NULL) {
+        //
+        // The framework deletes the device if AddDevice fails
+        //
+        WdfObjectDelete(&pdo->Device->Header);
+    }
+
+    SimSetCurrentProcessId(previousPid);
+
+    free(init);
+
+    if (!NT_SUCCESS(status) || pdo->Device == NULL) {
+        free(pdo);
+        return NT_SUCCESS(status) ? STATUS_UNSUCCESSFUL : status;
+    }
+
+    SimPdos[SimPdoCount++] = pdo;
+    *Pdo = pdo;
+
+    return STATUS_SUCCESS;
+}
+
+static VOID SimDeviceDelete(PSIM_DEVICE Device)
+{
+    ULONG previousPid = SimThreadProcessId();
+
+    SimSetCurrentProcessId(SYSTEM_PROCESS_ID);
+    WdfObjectDelete(&Device->Header);
+    SimSetCurrentProcessId(previousPid);
+}
+
+//
+// Surprise removal; the device object goes away once every handle is closed
+//
+VOID SimDeviceRemoval(PSIM_PDO Pdo)
+{
+    PSIM_DEVICE device = Pdo->Device;
+    ULONG previousPid;
+    ULONG i;
+
+    for (i = 0; i < SimPdoCount; i++) {
+        if (SimPdos[i] == Pdo) {
+            SimPdos[i] = SimPdos[--SimPdoCount];
+            break;
+        }
+    }
+
+    if (device == NULL) {
+        free(Pdo);
+        return;
+    }
+
+    previousPid = SimThreadProcessId();
+    SimSetCurrentProcessId(SYSTEM_PROCESS_ID);
+
+    device->RemovalPending = TRUE;
+
+    if (device->Init.PnpPower.EvtDeviceReleaseHardware) {
+        device->Init.PnpPower.EvtDeviceReleaseHardware(&device->Header, NULL);
+    }
+
+    SimSetCurrentProcessId(previousPid);
+
+    WdfObjectReference(&device->Header);
+
+    if (__atomic_load_n(&device->OpenHandles, __ATOMIC_ACQUIRE) == 0) {
+        SimDeviceDelete(device);
+    }
+
+    device->Init.Pdo = NULL;
+    device->PhysicalDevice.SimPdo = NULL;
+    SimObjectRelease(&device->Header);
+
+    free(Pdo);
+}
+
+#pragma endregion
+
+#pragma region Handles and I/O
+
+static NTSTATUS SimOpen(PSIM_DEVICE Device, PSIM_HANDLE* Handle)
+{
+    PSIM_FILE file;
+    PSIM_REQUEST request;
+    NTSTATUS status;
+
+    *Handle = NULL;
+
+    if (Device->Init.IsExclusive && __atomic_load_n(&Device->OpenHandles, __ATOMIC_ACQUIRE) > 0) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    file = SimObjectCreate(SimObjectFile, sizeof(SIM_FILE),
+        Device->Init.HasFileAttributes ? &Device->Init.FileAttributes : NULL, NULL);
+    if (file == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    //
+    // Parent linkage would delete the file with its device
+    //
+    if (file->Header.Parent != NULL) {
+        file->Header.Parent = NULL;
+    }
+
+    file->Device = Device;
+    file->ProcessId = SimThreadProcessId();
+    WdfObjectReference(&Device->Header);
+
+    request = SimRequestCreate(Device, file, WdfRequestTypeCreate);
+    if (request == NULL) {
+        SimObjectRelease(&Device->Header);
+        SimObjectRelease(&file->Header);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    WdfObjectReference(&request->Header);
+
+    SimRequestDispatch(request);
+
+    KeWaitForSingleObject(&request->CompletionEvent, Executive, KernelMode, FALSE, NULL);
+
+    status = request->Status;
+    SimObjectRelease(&request->Header);
+
+    if (!NT_SUCCESS(status)) {
+        SimObjectRelease(&Device->Header);
+        SimObjectRelease(&file->Header);
+        return status;
+    }
+
+    *Handle = file;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS SimOpenDevice(PSIM_PDO Pdo, PSIM_HANDLE* Handle)
+{
+    if (Pdo == NULL || Pdo->Device == NULL) {
+        *Handle = NULL;
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+    }
+
+    return SimOpen(Pdo->Device, Handle);
+}
+
+NTSTATUS SimOpenControlDevice(PSIM_HANDLE* Handle)
+{
+    PSIM_DEVICE device;
+
+    pthread_mutex_lock(&SimGlobalLock);
+    device = SimNamedDevices;
+    if (device != NULL) {
+        WdfObjectReference(&device->Header);
+    }
+    pthread_mutex_unlock(&SimGlobalLock);
+
+    if (device == NULL) {
+        *Handle = NULL;
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    {
+        NTSTATUS status = SimOpen(device, Handle);
+        SimObjectRelease(&device->Header);
+        return status;
+    }
+}
+
+VOID SimCloseHandle(PSIM_HANDLE Handle)
+{
+    PSIM_DEVICE device = Handle->Device;
+    ULONG previousPid = SimThreadProcessId();
+
+    //
+    // IRP_MJ_CLEANUP: cancel the handle's queued I/O, then notify the driver
+    //
+    SimQueueCancelFileRequests(device, Handle);
+
+    SimSetCurrentProcessId(Handle->ProcessId);
+
+    if (!device->Header.Deleted && device->Init.FileConfig.EvtFileCleanup) {
+        device->Init.FileConfig.EvtFileCleanup(&Handle->Header);
+    }
+
+    if (!device->Header.Deleted && device->Init.FileConfig.EvtFileClose) {
+        device->Init.FileConfig.EvtFileClose(&Handle->Header);
+    }
+
+    SimSetCurrentProcessId(previousPid);
+
+    if (__atomic_sub_fetch(&device->OpenHandles, 1, __ATOMIC_ACQ_REL) == 0 && device->RemovalPending) {
+        SimDeviceDelete(device);
+    }
+
+    SimObjectRelease(&Handle->Header);
+    SimObjectRelease(&device->Header);
+}
+
+PSIM_IRP SimDeviceIoControlAsync(PSIM_HANDLE Handle, ULONG IoControlCode,
+    PVOID InBuffer, ULONG InBufferSize, PVOID OutBuffer, ULONG OutBufferSize)
+{
+    PSIM_REQUEST request;
+    ULONG method = IoControlCode & 3;
+    size_t systemLength = (InBufferSize > OutBufferSize) ? InBufferSize : OutBufferSize;
+
+    request = SimRequestCreate(Handle->Device, Handle, WdfRequestTypeDeviceControl);
+    if (request == NULL) {
+        return NULL;
+    }
+
+    request->IoControlCode = IoControlCode;
+    request->InputLength = InBufferSize;
+    request->OutputLength = OutBufferSize;
+
+    if (method == METHOD_BUFFERED) {
+        //
+        // Input and output share a single system buffer
+        //
+        if (systemLength > 0) {
+            request->SystemBuffer = calloc(1, systemLength);
+            if (InBufferSize) {
+                memcpy(request->SystemBuffer, InBuffer, InBufferSize);
+            }
+        }
+        request->InputBuffer = InBufferSize ? request->SystemBuffer : NULL;
+        request->OutputBuffer = OutBufferSize ? request->SystemBuffer : NULL;
+        request->UserOutputBuffer = OutBuffer;
+        request->CopyOutOnCompletion = TRUE;
+    }
+    else {
+        if (InBufferSize) {
+            request->SystemBuffer = calloc(1, InBufferSize);
+            memcpy(request->SystemBuffer, InBuffer, InBufferSize);
+            request->InputBuffer = request->SystemBuffer;
+        }
+        request->OutputBuffer = OutBufferSize ? OutBuffer : NULL;
+    }
+
+    //
+    // One reference for the caller, released by SimFreeIrp
+    //
+    WdfObjectReference(&request->Header);
+
+    SimRequestDispatch(request);
+
+    return request;
+}
+
+NTSTATUS SimWaitIrp(PSIM_IRP Irp, ULONG TimeoutMs, PULONG BytesReturned)
+{
+    LARGE_INTEGER timeout;
+    NTSTATUS status;
+
+    timeout.QuadPart = WDF_REL_TIMEOUT_IN_MS(TimeoutMs);
+
+    status = KeWaitForSingleObject(&Irp->CompletionEvent, Executive, KernelMode, FALSE,
+        (TimeoutMs == MAXULONG) ? NULL : &timeout);
+
+    if (status == STATUS_TIMEOUT) {
+        return STATUS_TIMEOUT;
+    }
+
+    if (BytesReturned) {
+        *BytesReturned = (ULONG)Irp->Information;
+    }
+
+    return Irp->Status;
+}
+
+BOOLEAN SimIsIrpComplete(PSIM_IRP Irp)
+{
+    return KeReadStateEvent(&Irp->CompletionEvent) != 0;
+}
+
+VOID SimFreeIrp(PSIM_IRP Irp)
+{
+    SimObjectRelease(&Irp->Header);
+}
+
+NTSTATUS SimDeviceIoControl(PSIM_HANDLE Handle, ULONG IoControlCode,
+    PVOID InBuffer, ULONG InBufferSize, PVOID OutBuffer, ULONG OutBufferSize, PULONG BytesReturned)
+{
+    PSIM_IRP irp;
+    NTSTATUS status;
+
+    irp = SimDeviceIoControlAsync(Handle, IoControlCode, InBuffer, InBufferSize, OutBuffer, OutBufferSize);
+    if (irp == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    status = SimWaitIrp(irp, MAXULONG, BytesReturned);
+    SimFreeIrp(irp);
+
+    return status;
+}
+
+#pragma endregion
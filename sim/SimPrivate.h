@@ -0,0 +1,358 @@
+/*
+* User-mode simulation of the subset of the Kernel-Mode Driver Framework used by HidGuardian.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <pthread.h>
+
+#include <ntddk.h>
+#include <wdf.h>
+
+#include "Sim.h"
+
+#define SYSTEM_PROCESS_ID   4
+
+typedef enum _SIM_OBJECT_TYPE
+{
+    SimObjectDriver,
+    SimObjectDevice,
+    SimObjectQueue,
+    SimObjectRequest,
+    SimObjectFile,
+    SimObjectMemory,
+    SimObjectCollection,
+    SimObjectWaitLock,
+    SimObjectSpinLock,
+    SimObjectIoTarget,
+    SimObjectKey,
+    SimObjectString,
+    SimObjectTimer,
+    SimObjectWorkItem
+
+} SIM_OBJECT_TYPE;
+
+typedef struct _SIM_CONTEXT
+{
+    struct _SIM_CONTEXT*            Next;
+
+    PCWDF_OBJECT_CONTEXT_TYPE_INFO  TypeInfo;
+
+    //
+    // Context memory follows, cache-line aligned
+    //
+    DECLSPEC_CACHEALIGN UCHAR       Data[];
+
+} SIM_CONTEXT, *PSIM_CONTEXT;
+
+typedef struct _SIM_OBJECT
+{
+    SIM_OBJECT_TYPE                 Type;
+
+    volatile LONG                   RefCount;
+
+    volatile LONG                   Deleted;
+
+    struct _SIM_OBJECT*             Parent;
+
+    struct _SIM_OBJECT*             FirstChild;
+
+    struct _SIM_OBJECT*             NextSibling;
+
+    PSIM_CONTEXT                    Contexts;
+
+    PFN_WDF_OBJECT_CONTEXT_CLEANUP  EvtCleanup;
+
+    PFN_WDF_OBJECT_CONTEXT_DESTROY  EvtDestroy;
+
+} SIM_OBJECT, *PSIM_OBJECT;
+
+typedef struct _SIM_DEVICE      SIM_DEVICE, *PSIM_DEVICE;
+typedef struct _SIM_QUEUE       SIM_QUEUE, *PSIM_QUEUE;
+typedef struct _SIM_REQUEST     SIM_REQUEST, *PSIM_REQUEST;
+typedef struct _SIM_FILE        SIM_FILE, *PSIM_FILE;
+
+struct _WDFDEVICE_INIT
+{
+    BOOLEAN                         IsFilter;
+
+    BOOLEAN                         IsControl;
+
+    BOOLEAN                         IsExclusive;
+
+    WDF_FILEOBJECT_CONFIG           FileConfig;
+
+    WDF_OBJECT_ATTRIBUTES           FileAttributes;
+
+    BOOLEAN                         HasFileAttributes;
+
+    WDF_PNPPOWER_EVENT_CALLBACKS    PnpPower;
+
+    WCHAR                           Name[128];
+
+    struct _SIM_PDO*                Pdo;
+
+    WDFDRIVER                       Driver;
+};
+
+struct _SIM_DEVICE
+{
+    SIM_OBJECT                      Header;
+
+    WDFDEVICE_INIT                  Init;
+
+    BOOLEAN                         Initialized;
+
+    PSIM_QUEUE                      DefaultQueue;
+
+    PSIM_QUEUE                      CreateQueue;
+
+    PSIM_OBJECT                     IoTarget;
+
+    DEVICE_OBJECT                   PhysicalDevice;
+
+    pthread_mutex_t                 QueuesLock;
+
+    PSIM_QUEUE                      Queues[32];
+
+    ULONG                           QueueCount;
+
+    volatile LONG                   OpenHandles;
+
+    BOOLEAN                         RemovalPending;
+
+    struct _SIM_DEVICE*             NextNamed;
+};
+
+struct _SIM_QUEUE
+{
+    SIM_OBJECT                      Header;
+
+    PSIM_DEVICE                     Device;
+
+    WDF_IO_QUEUE_CONFIG             Config;
+
+    pthread_mutex_t                 Lock;
+
+    pthread_cond_t                  Idle;
+
+    PSIM_REQUEST                    Head;
+
+    PSIM_REQUEST                    Tail;
+
+    ULONG                           Queued;
+
+    ULONG                           DriverOwned;
+
+    BOOLEAN                         Accepting;
+
+    BOOLEAN                         Stopped;
+
+    BOOLEAN                         Dispatching;
+
+    BOOLEAN                         Busy;
+};
+
+struct _SIM_REQUEST
+{
+    SIM_OBJECT                      Header;
+
+    WDF_REQUEST_TYPE                Type;
+
+    ULONG                           IoControlCode;
+
+    PSIM_FILE                       File;
+
+    PSIM_DEVICE                     Device;
+
+    PVOID                           SystemBuffer;
+
+    PVOID                           InputBuffer;
+
+    size_t                          InputLength;
+
+    PVOID                           OutputBuffer;
+
+    size_t                          OutputLength;
+
+    PVOID                           UserOutputBuffer;
+
+    BOOLEAN                         CopyOutOnCompletion;
+
+    //
+    // Queue currently holding the request (linked) or the queue
+    // that presented it to the driver (driver-owned)
+    //
+    PSIM_QUEUE                      Queue;
+
+    BOOLEAN                         Linked;
+
+    PSIM_REQUEST                    Next;
+
+    PSIM_REQUEST                    Prev;
+
+    NTSTATUS                        Status;
+
+    ULONG_PTR                       Information;
+
+    volatile LONG                   Completed;
+
+    KEVENT                          CompletionEvent;
+
+    ULONG                           ProcessId;
+};
+
+struct _SIM_FILE
+{
+    SIM_OBJECT                      Header;
+
+    PSIM_DEVICE                     Device;
+
+    ULONG                           ProcessId;
+};
+
+typedef struct _SIM_MEMORY
+{
+    SIM_OBJECT                      Header;
+
+    PVOID                           Buffer;
+
+    size_t                          Size;
+
+} SIM_MEMORY, *PSIM_MEMORY;
+
+typedef struct _SIM_COLLECTION
+{
+    SIM_OBJECT                      Header;
+
+    WDFOBJECT*                      Items;
+
+    ULONG                           Count;
+
+    ULONG                           Capacity;
+
+} SIM_COLLECTION, *PSIM_COLLECTION;
+
+typedef struct _SIM_LOCK
+{
+    SIM_OBJECT                      Header;
+
+    pthread_mutex_t                 Mutex;
+
+} SIM_LOCK, *PSIM_LOCK;
+
+typedef struct _SIM_STRING
+{
+    SIM_OBJECT                      Header;
+
+    UNICODE_STRING                  String;
+
+} SIM_STRING, *PSIM_STRING;
+
+typedef struct _SIM_TIMER
+{
+    SIM_OBJECT                      Header;
+
+    WDF_TIMER_CONFIG                Config;
+
+    pthread_t                       Thread;
+
+    pthread_mutex_t                 Lock;
+
+    pthread_cond_t                  Changed;
+
+    BOOLEAN                         Armed;
+
+    BOOLEAN                         Running;
+
+    BOOLEAN                         Exit;
+
+    ULONGLONG                       DueNs;
+
+} SIM_TIMER, *PSIM_TIMER;
+
+typedef struct _SIM_WORKITEM
+{
+    SIM_OBJECT                      Header;
+
+    WDF_WORKITEM_CONFIG             Config;
+
+    pthread_mutex_t                 Lock;
+
+    pthread_cond_t                  Done;
+
+    BOOLEAN                         Queued;
+
+    BOOLEAN                         Running;
+
+} SIM_WORKITEM, *PSIM_WORKITEM;
+
+typedef struct _SIM_PDO
+{
+    WCHAR                           DeviceId[MAX_DEVICE_ID_LEN * 4];
+
+    WCHAR                           InstanceId[MAX_DEVICE_ID_LEN];
+
+    WCHAR                           HardwareIds[MAX_DEVICE_ID_LEN * 4];
+
+    size_t                          HardwareIdsLength;
+
+    WCHAR                           ClassName[64];
+
+    PSIM_DEVICE                     Device;
+
+} SIM_PDO;
+
+//
+// Object helpers
+//
+
+PVOID SimObjectCreate(SIM_OBJECT_TYPE Type, size_t Size, PWDF_OBJECT_ATTRIBUTES Attributes, PSIM_OBJECT DefaultParent);
+VOID SimObjectRelease(PSIM_OBJECT Object);
+
+//
+// Simulated process context of the calling thread
+//
+ULONG SimThreadProcessId(VOID);
+
+ULONGLONG SimNowNs(VOID);
+
+//
+// Serializes KEVENT waits
+//
+extern pthread_mutex_t SimEventLock;
+extern pthread_cond_t SimEventSignal;
+
+extern PSIM_OBJECT SimDriver;
+extern PSIM_DEVICE SimNamedDevices;
+extern pthread_mutex_t SimGlobalLock;
+
+PSIM_REQUEST SimRequestCreate(PSIM_DEVICE Device, PSIM_FILE File, WDF_REQUEST_TYPE Type);
+VOID SimRequestDispatch(PSIM_REQUEST Request);
+VOID SimQueueCancelFileRequests(PSIM_DEVICE Device, PSIM_FILE File);
+
+BOOLEAN SimRegistryQueryULong(PCWSTR Name, PULONG Value);
+PCWSTR SimRegistryQueryMultiString(PCWSTR Name);
@@ -0,0 +1,1851 @@
+/*
+* User-mode simulation of the subset of the Kernel-Mode Driver Framework used by HidGuardian.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#define _GNU_SOURCE
+#include <time.h>
+
+#include "SimPrivate.h"
+
+PSIM_OBJECT SimDriver = NULL;
+PSIM_DEVICE SimNamedDevices = NULL;
+pthread_mutex_t SimGlobalLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+WDF_DRIVER_CONFIG SimDriverConfig;
+DRIVER_OBJECT SimDriverObject;
+
+const UNICODE_STRING SDDL_DEVOBJ_SYS_ALL_ADM_RWX_WORLD_RWX_RES_RWX = { 0 };
+
+static VOID SimQueueDispatch(PSIM_QUEUE Queue);
+static VOID SimQueuePurge(PSIM_QUEUE Queue, BOOLEAN Wait);
+
+#pragma region Objects
+
+PVOID SimObjectCreate(SIM_OBJECT_TYPE Type, size_t Size, PWDF_OBJECT_ATTRIBUTES Attributes, PSIM_OBJECT DefaultParent)
+{
+    PSIM_OBJECT object;
+    PSIM_OBJECT parent = DefaultParent;
+    PVOID context;
+
+    object = calloc(1, Size);
+    if (object == NULL) {
+        return NULL;
+    }
+
+    object->Type = Type;
+    object->RefCount = 1;
+
+    if (Attributes != NULL) {
+        object->EvtCleanup = Attributes->EvtCleanupCallback;
+        object->EvtDestroy = Attributes->EvtDestroyCallback;
+
+        if (Attributes->ParentObject != NULL) {
+            parent = Attributes->ParentObject;
+        }
+
+        if (Attributes->ContextTypeInfo != NULL) {
+            WdfObjectAllocateContext(object, Attributes, &context);
+        }
+    }
+
+    if (parent != NULL) {
+        pthread_mutex_lock(&SimGlobalLock);
+        object->Parent = parent;
+        object->NextSibling = parent->FirstChild;
+        parent->FirstChild = object;
+        pthread_mutex_unlock(&SimGlobalLock);
+    }
+
+    return object;
+}
+
+static VOID SimObjectFree(PSIM_OBJECT Object)
+{
+    PSIM_CONTEXT context;
+    PSIM_CONTEXT next;
+
+    if (Object->EvtDestroy) {
+        Object->EvtDestroy(Object);
+    }
+
+    switch (Object->Type) {
+    case SimObjectMemory:
+        free(((PSIM_MEMORY)Object)->Buffer);
+        break;
+    case SimObjectString:
+        free(((PSIM_STRING)Object)->String.Buffer);
+        break;
+    case SimObjectRequest:
+        free(((PSIM_REQUEST)Object)->SystemBuffer);
+        break;
+    default:
+        break;
+    }
+
+    for (context = Object->Contexts; context != NULL; context = next) {
+        next = context->Next;
+        free(context);
+    }
+
+    free(Object);
+}
+
+VOID SimObjectRelease(PSIM_OBJECT Object)
+{
+    if (__atomic_sub_fetch(&Object->RefCount, 1, __ATOMIC_ACQ_REL) == 0) {
+        SimObjectFree(Object);
+    }
+}
+
+VOID WdfObjectReference(WDFOBJECT Handle)
+{
+    __atomic_add_fetch(&((PSIM_OBJECT)Handle)->RefCount, 1, __ATOMIC_ACQ_REL);
+}
+
+VOID WdfObjectDereference(WDFOBJECT Handle)
+{
+    SimObjectRelease(Handle);
+}
+
+static VOID SimObjectUnlink(PSIM_OBJECT Object)
+{
+    PSIM_OBJECT* link;
+
+    pthread_mutex_lock(&SimGlobalLock);
+
+    if (Object->Parent != NULL) {
+        for (link = &Object->Parent->FirstChild; *link != NULL; link = &(*link)->NextSibling) {
+            if (*link == Object) {
+                *link = Object->NextSibling;
+                break;
+            }
+        }
+        Object->Parent = NULL;
+    }
+
+    pthread_mutex_unlock(&SimGlobalLock);
+}
+
+static VOID SimQueueDetach(PSIM_QUEUE Queue);
+static VOID SimTimerShutdown(PSIM_TIMER Timer);
+static VOID SimWorkItemShutdown(PSIM_WORKITEM WorkItem);
+
+VOID WdfObjectDelete(WDFOBJECT Object)
+{
+    PSIM_OBJECT object = Object;
+    PSIM_OBJECT child;
+    PSIM_DEVICE device;
+    PSIM_DEVICE* link;
+    PSIM_COLLECTION collection;
+    PSIM_OBJECT* children = NULL;
+    ULONG childCount = 0;
+    ULONG i;
+
+    if (__atomic_exchange_n(&object->Deleted, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    //
+    // Type-specific run-down before the children go away
+    //
+    switch (object->Type) {
+    case SimObjectQueue:
+        SimQueuePurge((PSIM_QUEUE)object, TRUE);
+        SimQueueDetach((PSIM_QUEUE)object);
+        break;
+    case SimObjectTimer:
+        SimTimerShutdown((PSIM_TIMER)object);
+        break;
+    case SimObjectWorkItem:
+        SimWorkItemShutdown((PSIM_WORKITEM)object);
+        break;
+    default:
+        break;
+    }
+
+    //
+    // Children are cleaned up before their parent but their memory
+    // stays valid until the parent is done with its own cleanup
+    //
+    for (;;) {
+        pthread_mutex_lock(&SimGlobalLock);
+        child = object->FirstChild;
+        if (child != NULL) {
+            WdfObjectReference(child);
+        }
+        pthread_mutex_unlock(&SimGlobalLock);
+
+        if (child == NULL) {
+            break;
+        }
+
+        children = realloc(children, sizeof(PSIM_OBJECT) * (childCount + 1));
+        children[childCount++] = child;
+
+        if (child->Deleted) {
+            SimObjectUnlink(child);
+            continue;
+        }
+
+        WdfObjectDelete(child);
+    }
+
+    if (object->EvtCleanup) {
+        object->EvtCleanup(object);
+    }
+
+    switch (object->Type) {
+    case SimObjectCollection:
+        collection = (PSIM_COLLECTION)object;
+        for (i = 0; i < collection->Count; i++) {
+            SimObjectRelease(collection->Items[i]);
+        }
+        free(collection->Items);
+        collection->Items = NULL;
+        collection->Count = 0;
+        break;
+    case SimObjectDevice:
+        device = (PSIM_DEVICE)object;
+        pthread_mutex_lock(&SimGlobalLock);
+        for (link = &SimNamedDevices; *link != NULL; link = &(*link)->NextNamed) {
+            if (*link == device) {
+                *link = device->NextNamed;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&SimGlobalLock);
+        if (device->Init.Pdo != NULL && device->Init.Pdo->Device == device) {
+            device->Init.Pdo->Device = NULL;
+        }
+        break;
+    case SimObjectDriver:
+        SimDriver = NULL;
+        break;
+    default:
+        break;
+    }
+
+    for (i = 0; i < childCount; i++) {
+        SimObjectRelease(children[i]);
+    }
+    free(children);
+
+    SimObjectUnlink(object);
+    SimObjectRelease(object);
+}
+
+static BOOLEAN SimContextMatches(PSIM_CONTEXT Context, PCWDF_OBJECT_CONTEXT_TYPE_INFO TypeInfo)
+{
+    return Context->TypeInfo == TypeInfo
+        || strcmp(Context->TypeInfo->ContextName, TypeInfo->ContextName) == 0;
+}
+
+PVOID WdfObjectGetTypedContextWorker(WDFOBJECT Handle, PCWDF_OBJECT_CONTEXT_TYPE_INFO TypeInfo)
+{
+    PSIM_CONTEXT context;
+
+    if (Handle == NULL) {
+        return NULL;
+    }
+
+    for (context = ((PSIM_OBJECT)Handle)->Contexts; context != NULL; context = context->Next) {
+        if (SimContextMatches(context, TypeInfo)) {
+            return context->Data;
+        }
+    }
+
+    return NULL;
+}
+
+NTSTATUS WdfObjectAllocateContext(WDFOBJECT Handle, PWDF_OBJECT_ATTRIBUTES ContextAttributes, PVOID* Context)
+{
+    PSIM_OBJECT object = Handle;
+    PSIM_CONTEXT context;
+    size_t size;
+
+    pthread_mutex_lock(&SimGlobalLock);
+
+    for (context = object->Contexts; context != NULL; context = context->Next) {
+        if (SimContextMatches(context, ContextAttributes->ContextTypeInfo)) {
+            *Context = context->Data;
+            pthread_mutex_unlock(&SimGlobalLock);
+            return STATUS_OBJECT_NAME_EXISTS;
+        }
+    }
+
+    size = ContextAttributes->ContextTypeInfo->ContextSize;
+    if (ContextAttributes->ContextSizeOverride > size) {
+        size = ContextAttributes->ContextSizeOverride;
+    }
+
+    if (posix_memalign((void**)&context, SYSTEM_CACHE_ALIGNMENT_SIZE, sizeof(SIM_CONTEXT) + size) != 0) {
+        pthread_mutex_unlock(&SimGlobalLock);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    memset(context, 0, sizeof(SIM_CONTEXT) + size);
+    context->TypeInfo = ContextAttributes->ContextTypeInfo;
+    context->Next = object->Contexts;
+    object->Contexts = context;
+
+    //
+    // Cleanup callbacks passed with a context apply to the object
+    //
+    if (object->EvtCleanup == NULL) {
+        object->EvtCleanup = ContextAttributes->EvtCleanupCallback;
+    }
+    if (object->EvtDestroy == NULL) {
+        object->EvtDestroy = ContextAttributes->EvtDestroyCallback;
+    }
+
+    pthread_mutex_unlock(&SimGlobalLock);
+
+    *Context = context->Data;
+
+    return STATUS_SUCCESS;
+}
+
+#pragma endregion
+
+#pragma region Driver and registry
+
+NTSTATUS WdfDriverCreate(PDRIVER_OBJECT DriverObject, PCUNICODE_STRING RegistryPath,
+    PWDF_OBJECT_ATTRIBUTES DriverAttributes, PWDF_DRIVER_CONFIG DriverConfig, WDFDRIVER* Driver)
+{
+    UNREFERENCED_PARAMETER(DriverObject);
+    UNREFERENCED_PARAMETER(RegistryPath);
+
+    SimDriverConfig = *DriverConfig;
+    SimDriver = SimObjectCreate(SimObjectDriver, sizeof(SIM_OBJECT), DriverAttributes, NULL);
+
+    if (SimDriver == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (Driver != NULL) {
+        *Driver = SimDriver;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+WDFDRIVER WdfGetDriver(VOID)
+{
+    return SimDriver;
+}
+
+PDRIVER_OBJECT WdfDriverWdmGetDriverObject(WDFDRIVER Driver)
+{
+    UNREFERENCED_PARAMETER(Driver);
+
+    return &SimDriverObject;
+}
+
+NTSTATUS WdfDriverOpenParametersRegistryKey(WDFDRIVER Driver, ULONG DesiredAccess,
+    PWDF_OBJECT_ATTRIBUTES KeyAttributes, WDFKEY* Key)
+{
+    UNREFERENCED_PARAMETER(DesiredAccess);
+
+    *Key = SimObjectCreate(SimObjectKey, sizeof(SIM_OBJECT), KeyAttributes, Driver);
+
+    return (*Key != NULL) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+static VOID SimUnicodeToWide(PCUNICODE_STRING Source, PWCHAR Destination, size_t Count)
+{
+    size_t length = Source->Length / sizeof(WCHAR);
+
+    if (length >= Count) {
+        length = Count - 1;
+    }
+
+    memcpy(Destination, Source->Buffer, length * sizeof(WCHAR));
+    Destination[length] = L'\0';
+}
+
+NTSTATUS WdfRegistryQueryMultiString(WDFKEY Key, PCUNICODE_STRING ValueName,
+    PWDF_OBJECT_ATTRIBUTES StringsAttributes, WDFCOLLECTION Collection)
+{
+    WCHAR name[128];
+    PCWSTR value;
+    UNICODE_STRING item;
+    WDFSTRING string;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER(Key);
+
+    SimUnicodeToWide(ValueName, name, ARRAYSIZE(name));
+
+    value = SimRegistryQueryMultiString(name);
+    if (value == NULL) {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    for (; *value; value += wcslen(value) + 1) {
+        RtlInitUnicodeString(&item, value);
+
+        status = WdfStringCreate(&item, StringsAttributes, &string);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+
+        status = WdfCollectionAdd(Collection, string);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRegistryQueryULong(WDFKEY Key, PCUNICODE_STRING ValueName, PULONG Value)
+{
+    WCHAR name[128];
+
+    UNREFERENCED_PARAMETER(Key);
+
+    SimUnicodeToWide(ValueName, name, ARRAYSIZE(name));
+
+    return SimRegistryQueryULong(name, Value) ? STATUS_SUCCESS : STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+VOID WdfRegistryClose(WDFKEY Key)
+{
+    WdfObjectDelete(Key);
+}
+
+#pragma endregion
+
+#pragma region Strings, collections, locks and memory
+
+NTSTATUS WdfStringCreate(PCUNICODE_STRING UnicodeString, PWDF_OBJECT_ATTRIBUTES StringAttributes, WDFSTRING* String)
+{
+    PSIM_STRING string;
+
+    string = SimObjectCreate(SimObjectString, sizeof(SIM_STRING), StringAttributes, SimDriver);
+    if (string == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (UnicodeString != NULL && UnicodeString->Length > 0) {
+        string->String.Buffer = malloc(UnicodeString->Length + sizeof(WCHAR));
+        memcpy(string->String.Buffer, UnicodeString->Buffer, UnicodeString->Length);
+        string->String.Buffer[UnicodeString->Length / sizeof(WCHAR)] = L'\0';
+        string->String.Length = UnicodeString->Length;
+        string->String.MaximumLength = UnicodeString->Length + sizeof(WCHAR);
+    }
+
+    *String = &string->Header;
+
+    return STATUS_SUCCESS;
+}
+
+VOID WdfStringGetUnicodeString(WDFSTRING String, PUNICODE_STRING UnicodeString)
+{
+    *UnicodeString = ((PSIM_STRING)String)->String;
+}
+
+NTSTATUS WdfCollectionCreate(PWDF_OBJECT_ATTRIBUTES CollectionAttributes, WDFCOLLECTION* Collection)
+{
+    *Collection = SimObjectCreate(SimObjectCollection, sizeof(SIM_COLLECTION), CollectionAttributes, SimDriver);
+
+    return (*Collection != NULL) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+ULONG WdfCollectionGetCount(WDFCOLLECTION Collection)
+{
+    return ((PSIM_COLLECTION)Collection)->Count;
+}
+
+NTSTATUS WdfCollectionAdd(WDFCOLLECTION Collection, WDFOBJECT Object)
+{
+    PSIM_COLLECTION collection = (PSIM_COLLECTION)Collection;
+    WDFOBJECT* items;
+
+    if (collection->Count == collection->Capacity) {
+        items = realloc(collection->Items, sizeof(WDFOBJECT) * (collection->Capacity ? collection->Capacity * 2 : 8));
+        if (items == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        collection->Items = items;
+        collection->Capacity = collection->Capacity ? collection->Capacity * 2 : 8;
+    }
+
+    WdfObjectReference(Object);
+    collection->Items[collection->Count++] = Object;
+
+    return STATUS_SUCCESS;
+}
+
+VOID WdfCollectionRemoveItem(WDFCOLLECTION Collection, ULONG Index)
+{
+    PSIM_COLLECTION collection = (PSIM_COLLECTION)Collection;
+    WDFOBJECT item;
+
+    if (Index >= collection->Count) {
+        return;
+    }
+
+    item = collection->Items[Index];
+    memmove(&collection->Items[Index], &collection->Items[Index + 1],
+        sizeof(WDFOBJECT) * (collection->Count - Index - 1));
+    collection->Count--;
+
+    SimObjectRelease(item);
+}
+
+VOID WdfCollectionRemove(WDFCOLLECTION Collection, WDFOBJECT Item)
+{
+    PSIM_COLLECTION collection = (PSIM_COLLECTION)Collection;
+    ULONG i;
+
+    for (i = 0; i < collection->Count; i++) {
+        if (collection->Items[i] == Item) {
+            WdfCollectionRemoveItem(Collection, i);
+            return;
+        }
+    }
+}
+
+WDFOBJECT WdfCollectionGetItem(WDFCOLLECTION Collection, ULONG Index)
+{
+    PSIM_COLLECTION collection = (PSIM_COLLECTION)Collection;
+
+    return (Index < collection->Count) ? collection->Items[Index] : NULL;
+}
+
+NTSTATUS WdfWaitLockCreate(PWDF_OBJECT_ATTRIBUTES LockAttributes, WDFWAITLOCK* Lock)
+{
+    PSIM_LOCK lock = SimObjectCreate(SimObjectWaitLock, sizeof(SIM_LOCK), LockAttributes, SimDriver);
+
+    if (lock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    pthread_mutex_init(&lock->Mutex, NULL);
+    *Lock = &lock->Header;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfWaitLockAcquire(WDFWAITLOCK Lock, PLONGLONG Timeout)
+{
+    PSIM_LOCK lock = (PSIM_LOCK)Lock;
+
+    if (Timeout != NULL && *Timeout == 0) {
+        return (pthread_mutex_trylock(&lock->Mutex) == 0) ? STATUS_SUCCESS : STATUS_TIMEOUT;
+    }
+
+    pthread_mutex_lock(&lock->Mutex);
+
+    return STATUS_SUCCESS;
+}
+
+VOID WdfWaitLockRelease(WDFWAITLOCK Lock)
+{
+    pthread_mutex_unlock(&((PSIM_LOCK)Lock)->Mutex);
+}
+
+NTSTATUS WdfSpinLockCreate(PWDF_OBJECT_ATTRIBUTES SpinLockAttributes, WDFSPINLOCK* SpinLock)
+{
+    PSIM_LOCK lock = SimObjectCreate(SimObjectSpinLock, sizeof(SIM_LOCK), SpinLockAttributes, SimDriver);
+
+    if (lock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    pthread_mutex_init(&lock->Mutex, NULL);
+    *SpinLock = &lock->Header;
+
+    return STATUS_SUCCESS;
+}
+
+VOID WdfSpinLockAcquire(WDFSPINLOCK SpinLock)
+{
+    pthread_mutex_lock(&((PSIM_LOCK)SpinLock)->Mutex);
+}
+
+VOID WdfSpinLockRelease(WDFSPINLOCK SpinLock)
+{
+    pthread_mutex_unlock(&((PSIM_LOCK)SpinLock)->Mutex);
+}
+
+NTSTATUS WdfMemoryCreate(PWDF_OBJECT_ATTRIBUTES Attributes, POOL_TYPE PoolType, ULONG PoolTag,
+    size_t BufferSize, WDFMEMORY* Memory, PVOID* Buffer)
+{
+    PSIM_MEMORY memory;
+
+    UNREFERENCED_PARAMETER(PoolType);
+    UNREFERENCED_PARAMETER(PoolTag);
+
+    if (BufferSize == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    memory = SimObjectCreate(SimObjectMemory, sizeof(SIM_MEMORY), Attributes, SimDriver);
+    if (memory == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    memory->Buffer = calloc(1, BufferSize);
+    memory->Size = BufferSize;
+
+    *Memory = &memory->Header;
+    if (Buffer != NULL) {
+        *Buffer = memory->Buffer;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+PVOID WdfMemoryGetBuffer(WDFMEMORY Memory, size_t* BufferSize)
+{
+    PSIM_MEMORY memory = (PSIM_MEMORY)Memory;
+
+    if (BufferSize != NULL) {
+        *BufferSize = memory->Size;
+    }
+
+    return memory->Buffer;
+}
+
+#pragma endregion
+
+#pragma region Devices
+
+VOID WdfFdoInitSetFilter(PWDFDEVICE_INIT DeviceInit)
+{
+    DeviceInit->IsFilter = TRUE;
+}
+
+VOID WdfDeviceInitSetFileObjectConfig(PWDFDEVICE_INIT DeviceInit, PWDF_FILEOBJECT_CONFIG FileObjectConfig,
+    PWDF_OBJECT_ATTRIBUTES FileObjectAttributes)
+{
+    DeviceInit->FileConfig = *FileObjectConfig;
+
+    if (FileObjectAttributes != NULL) {
+        DeviceInit->FileAttributes = *FileObjectAttributes;
+        DeviceInit->HasFileAttributes = TRUE;
+    }
+}
+
+VOID WdfDeviceInitSetPnpPowerEventCallbacks(PWDFDEVICE_INIT DeviceInit, PWDF_PNPPOWER_EVENT_CALLBACKS PnpPowerEventCallbacks)
+{
+    DeviceInit->PnpPower = *PnpPowerEventCallbacks;
+}
+
+VOID WdfDeviceInitSetExclusive(PWDFDEVICE_INIT DeviceInit, BOOLEAN IsExclusive)
+{
+    DeviceInit->IsExclusive = IsExclusive;
+}
+
+NTSTATUS WdfDeviceInitAssignName(PWDFDEVICE_INIT DeviceInit, PCUNICODE_STRING DeviceName)
+{
+    SimUnicodeToWide(DeviceName, DeviceInit->Name, ARRAYSIZE(DeviceInit->Name));
+
+    return STATUS_SUCCESS;
+}
+
+PWDFDEVICE_INIT WdfControlDeviceInitAllocate(WDFDRIVER Driver, PCUNICODE_STRING SDDLString)
+{
+    PWDFDEVICE_INIT init;
+
+    UNREFERENCED_PARAMETER(SDDLString);
+
+    init = calloc(1, sizeof(WDFDEVICE_INIT));
+    if (init != NULL) {
+        init->IsControl = TRUE;
+        init->Driver = Driver;
+    }
+
+    return init;
+}
+
+VOID WdfDeviceInitFree(PWDFDEVICE_INIT DeviceInit)
+{
+    free(DeviceInit);
+}
+
+NTSTATUS WdfDeviceCreate(PWDFDEVICE_INIT* DeviceInit, PWDF_OBJECT_ATTRIBUTES DeviceAttributes, WDFDEVICE* Device)
+{
+    PWDFDEVICE_INIT init = *DeviceInit;
+    PSIM_DEVICE device;
+
+    device = SimObjectCreate(SimObjectDevice, sizeof(SIM_DEVICE), DeviceAttributes, SimDriver);
+    if (device == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    device->Init = *init;
+    pthread_mutex_init(&device->QueuesLock, NULL);
+
+    if (init->IsControl) {
+        pthread_mutex_lock(&SimGlobalLock);
+        device->NextNamed = SimNamedDevices;
+        SimNamedDevices = device;
+        pthread_mutex_unlock(&SimGlobalLock);
+
+        //
+        // The framework owns the init structure from here on
+        //
+        free(init);
+        *DeviceInit = NULL;
+    }
+    else {
+        device->Initialized = TRUE;
+        device->PhysicalDevice.SimPdo = init->Pdo;
+        init->Pdo->Device = device;
+        device->IoTarget = SimObjectCreate(SimObjectIoTarget, sizeof(SIM_OBJECT), NULL, &device->Header);
+    }
+
+    *Device = &device->Header;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfDeviceCreateSymbolicLink(WDFDEVICE Device, PCUNICODE_STRING SymbolicLinkName)
+{
+    UNREFERENCED_PARAMETER(Device);
+    UNREFERENCED_PARAMETER(SymbolicLinkName);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfDeviceCreateDeviceInterface(WDFDEVICE Device, const GUID* InterfaceClassGUID, PCUNICODE_STRING ReferenceString)
+{
+    UNREFERENCED_PARAMETER(Device);
+    UNREFERENCED_PARAMETER(InterfaceClassGUID);
+    UNREFERENCED_PARAMETER(ReferenceString);
+
+    return STATUS_SUCCESS;
+}
+
+VOID WdfDeviceSetDeviceInterfaceState(WDFDEVICE Device, const GUID* InterfaceClassGUID, PCUNICODE_STRING ReferenceString, BOOLEAN IsInterfaceEnabled)
+{
+    UNREFERENCED_PARAMETER(Device);
+    UNREFERENCED_PARAMETER(InterfaceClassGUID);
+    UNREFERENCED_PARAMETER(ReferenceString);
+    UNREFERENCED_PARAMETER(IsInterfaceEnabled);
+}
+
+VOID WdfControlFinishInitializing(WDFDEVICE Device)
+{
+    ((PSIM_DEVICE)Device)->Initialized = TRUE;
+}
+
+WDFDRIVER WdfDeviceGetDriver(WDFDEVICE Device)
+{
+    UNREFERENCED_PARAMETER(Device);
+
+    return SimDriver;
+}
+
+WDFIOTARGET WdfDeviceGetIoTarget(WDFDEVICE Device)
+{
+    return ((PSIM_DEVICE)Device)->IoTarget;
+}
+
+PDEVICE_OBJECT WdfDeviceWdmGetPhysicalDevice(WDFDEVICE Device)
+{
+    return &((PSIM_DEVICE)Device)->PhysicalDevice;
+}
+
+NTSTATUS WdfDeviceAllocAndQueryProperty(WDFDEVICE Device, DEVICE_REGISTRY_PROPERTY DeviceProperty,
+    POOL_TYPE PoolType, PWDF_OBJECT_ATTRIBUTES PropertyMemoryAttributes, WDFMEMORY* PropertyMemory)
+{
+    struct _SIM_PDO* pdo = ((PSIM_DEVICE)Device)->Init.Pdo;
+    PVOID buffer;
+    PCVOID source;
+    size_t length;
+    NTSTATUS status;
+
+    if (pdo == NULL) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    switch (DeviceProperty) {
+    case DevicePropertyHardwareID:
+        source = pdo->HardwareIds;
+        length = pdo->HardwareIdsLength;
+        break;
+    case DevicePropertyClassName:
+        source = pdo->ClassName;
+        length = (wcslen(pdo->ClassName) + 1) * sizeof(WCHAR);
+        break;
+    default:
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    status = WdfMemoryCreate(PropertyMemoryAttributes, PoolType, 0, length, PropertyMemory, &buffer);
+    if (NT_SUCCESS(status)) {
+        memcpy(buffer, source, length);
+    }
+
+    return status;
+}
+
+WDFDEVICE WdfFileObjectGetDevice(WDFFILEOBJECT FileObject)
+{
+    return &((PSIM_FILE)FileObject)->Device->Header;
+}
+
+#pragma endregion
+
+#pragma region Queues
+
+NTSTATUS WdfIoQueueCreate(WDFDEVICE Device, PWDF_IO_QUEUE_CONFIG Config,
+    PWDF_OBJECT_ATTRIBUTES QueueAttributes, WDFQUEUE* Queue)
+{
+    PSIM_DEVICE device = (PSIM_DEVICE)Device;
+    PSIM_QUEUE queue;
+
+    if (Config->DispatchType != WdfIoQueueDispatchManual
+        && Config->EvtIoDefault == NULL && Config->EvtIoDeviceControl == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    pthread_mutex_lock(&device->QueuesLock);
+    if (device->QueueCount == ARRAYSIZE(device->Queues)
+        || (Config->DefaultQueue && device->DefaultQueue != NULL)) {
+        pthread_mutex_unlock(&device->QueuesLock);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+    pthread_mutex_unlock(&device->QueuesLock);
+
+    queue = SimObjectCreate(SimObjectQueue, sizeof(SIM_QUEUE), QueueAttributes, &device->Header);
+    if (queue == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    queue->Device = device;
+    queue->Config = *Config;
+    queue->Accepting = TRUE;
+    pthread_mutex_init(&queue->Lock, NULL);
+    pthread_cond_init(&queue->Idle, NULL);
+
+    pthread_mutex_lock(&device->QueuesLock);
+    device->Queues[device->QueueCount++] = queue;
+    if (Config->DefaultQueue) {
+        device->DefaultQueue = queue;
+    }
+    pthread_mutex_unlock(&device->QueuesLock);
+
+    if (Queue != NULL) {
+        *Queue = &queue->Header;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfDeviceConfigureRequestDispatching(WDFDEVICE Device, WDFQUEUE Queue, WDF_REQUEST_TYPE RequestType)
+{
+    if (RequestType != WdfRequestTypeCreate) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    ((PSIM_DEVICE)Device)->CreateQueue = (PSIM_QUEUE)Queue;
+
+    return STATUS_SUCCESS;
+}
+
+WDFDEVICE WdfIoQueueGetDevice(WDFQUEUE Queue)
+{
+    return &((PSIM_QUEUE)Queue)->Device->Header;
+}
+
+//
+// Caller holds the queue lock
+//
+static VOID SimQueueLink(PSIM_QUEUE Queue, PSIM_REQUEST Request, BOOLEAN AtHead)
+{
+    Request->Queue = Queue;
+    Request->Linked = TRUE;
+
+    if (AtHead) {
+        Request->Prev = NULL;
+        Request->Next = Queue->Head;
+        if (Queue->Head) {
+            Queue->Head->Prev = Request;
+        }
+        else {
+            Queue->Tail = Request;
+        }
+        Queue->Head = Request;
+    }
+    else {
+        Request->Next = NULL;
+        Request->Prev = Queue->Tail;
+        if (Queue->Tail) {
+            Queue->Tail->Next = Request;
+        }
+        else {
+            Queue->Head = Request;
+        }
+        Queue->Tail = Request;
+    }
+
+    Queue->Queued++;
+}
+
+//
+// Caller holds the queue lock
+//
+static VOID SimQueueUnlink(PSIM_QUEUE Queue, PSIM_REQUEST Request)
+{
+    if (Request->Prev) {
+        Request->Prev->Next = Request->Next;
+    }
+    else {
+        Queue->Head = Request->Next;
+    }
+
+    if (Request->Next) {
+        Request->Next->Prev = Request->Prev;
+    }
+    else {
+        Queue->Tail = Request->Prev;
+    }
+
+    Request->Next = Request->Prev = NULL;
+    Request->Linked = FALSE;
+    Queue->Queued--;
+
+    if (Queue->Queued == 0 && Queue->DriverOwned == 0) {
+        pthread_cond_broadcast(&Queue->Idle);
+    }
+}
+
+//
+// Caller holds the queue lock; the request becomes driver-owned
+//
+static VOID SimQueuePresent(PSIM_QUEUE Queue, PSIM_REQUEST Request)
+{
+    SimQueueUnlink(Queue, Request);
+    Request->Queue = Queue;
+    Queue->DriverOwned++;
+
+    if (Queue->Config.DispatchType == WdfIoQueueDispatchSequential) {
+        Queue->Busy = TRUE;
+    }
+}
+
+//
+// A driver-owned request left the driver (completed, forwarded or sent)
+//
+static VOID SimQueueReleaseRequest(PSIM_QUEUE Queue)
+{
+    pthread_mutex_lock(&Queue->Lock);
+
+    Queue->DriverOwned--;
+    Queue->Busy = FALSE;
+
+    if (Queue->Queued == 0 && Queue->DriverOwned == 0) {
+        pthread_cond_broadcast(&Queue->Idle);
+    }
+
+    pthread_mutex_unlock(&Queue->Lock);
+
+    SimQueueDispatch(Queue);
+}
+
+static VOID SimQueueInvoke(PSIM_QUEUE Queue, PSIM_REQUEST Request)
+{
+    if (Request->Type == WdfRequestTypeDeviceControl && Queue->Config.EvtIoDeviceControl) {
+        Queue->Config.EvtIoDeviceControl(&Queue->Header, &Request->Header,
+            Request->OutputLength, Request->InputLength, Request->IoControlCode);
+    }
+    else if (Queue->Config.EvtIoDefault) {
+        Queue->Config.EvtIoDefault(&Queue->Header, &Request->Header);
+    }
+    else {
+        WdfRequestComplete(&Request->Header, STATUS_INVALID_DEVICE_REQUEST);
+    }
+}
+
+//
+// Presents queued requests to the driver; sequential queues only
+// ever have one request in flight and are drained by one thread
+//
+static VOID SimQueueDispatch(PSIM_QUEUE Queue)
+{
+    BOOLEAN sequential = Queue->Config.DispatchType == WdfIoQueueDispatchSequential;
+    PSIM_REQUEST request;
+
+    if (Queue->Config.DispatchType == WdfIoQueueDispatchManual) {
+        return;
+    }
+
+    pthread_mutex_lock(&Queue->Lock);
+
+    if (sequential) {
+        if (Queue->Dispatching) {
+            pthread_mutex_unlock(&Queue->Lock);
+            return;
+        }
+        Queue->Dispatching = TRUE;
+    }
+
+    while (Queue->Head != NULL && !Queue->Stopped && !(sequential && Queue->Busy)) {
+        request = Queue->Head;
+        SimQueuePresent(Queue, request);
+
+        pthread_mutex_unlock(&Queue->Lock);
+        SimQueueInvoke(Queue, request);
+        pthread_mutex_lock(&Queue->Lock);
+    }
+
+    if (sequential) {
+        Queue->Dispatching = FALSE;
+    }
+
+    pthread_mutex_unlock(&Queue->Lock);
+}
+
+static NTSTATUS SimQueueInsert(PSIM_QUEUE Queue, PSIM_REQUEST Request, BOOLEAN AtHead)
+{
+    pthread_mutex_lock(&Queue->Lock);
+
+    if (!Queue->Accepting || Queue->Header.Deleted) {
+        pthread_mutex_unlock(&Queue->Lock);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    SimQueueLink(Queue, Request, AtHead);
+
+    pthread_mutex_unlock(&Queue->Lock);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfIoQueueRetrieveNextRequest(WDFQUEUE Queue, WDFREQUEST* OutRequest)
+{
+    PSIM_QUEUE queue = (PSIM_QUEUE)Queue;
+    NTSTATUS status = STATUS_NO_MORE_ENTRIES;
+
+    *OutRequest = NULL;
+
+    pthread_mutex_lock(&queue->Lock);
+
+    if (queue->Stopped) {
+        status = STATUS_WDF_PAUSED;
+    }
+    else if (queue->Head != NULL) {
+        *OutRequest = &queue->Head->Header;
+        SimQueuePresent(queue, queue->Head);
+        status = STATUS_SUCCESS;
+    }
+
+    pthread_mutex_unlock(&queue->Lock);
+
+    return status;
+}
+
+NTSTATUS WdfIoQueueRetrieveRequestByFileObject(WDFQUEUE Queue, WDFFILEOBJECT FileObject, WDFREQUEST* OutRequest)
+{
+    PSIM_QUEUE queue = (PSIM_QUEUE)Queue;
+    PSIM_REQUEST request;
+    NTSTATUS status = STATUS_NO_MORE_ENTRIES;
+
+    *OutRequest = NULL;
+
+    pthread_mutex_lock(&queue->Lock);
+
+    for (request = queue->Head; request != NULL; request = request->Next) {
+        if (&request->File->Header == FileObject) {
+            SimQueuePresent(queue, request);
+            *OutRequest = &request->Header;
+            status = STATUS_SUCCESS;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&queue->Lock);
+
+    return status;
+}
+
+NTSTATUS WdfIoQueueFindRequest(WDFQUEUE Queue, WDFREQUEST FoundRequest, WDFFILEOBJECT FileObject,
+    PVOID Parameters, WDFREQUEST* OutRequest)
+{
+    PSIM_QUEUE queue = (PSIM_QUEUE)Queue;
+    PSIM_REQUEST request;
+    PSIM_REQUEST previous = (PSIM_REQUEST)FoundRequest;
+
+    UNREFERENCED_PARAMETER(Parameters);
+
+    *OutRequest = NULL;
+
+    pthread_mutex_lock(&queue->Lock);
+
+    if (previous != NULL) {
+        if (!previous->Linked || previous->Queue != queue) {
+            pthread_mutex_unlock(&queue->Lock);
+            return STATUS_NOT_FOUND;
+        }
+        request = previous->Next;
+    }
+    else {
+        request = queue->Head;
+    }
+
+    for (; request != NULL; request = request->Next) {
+        if (FileObject == NULL || &request->File->Header == FileObject) {
+            WdfObjectReference(request);
+            *OutRequest = &request->Header;
+            pthread_mutex_unlock(&queue->Lock);
+            return STATUS_SUCCESS;
+        }
+    }
+
+    pthread_mutex_unlock(&queue->Lock);
+
+    return STATUS_NO_MORE_ENTRIES;
+}
+
+NTSTATUS WdfIoQueueRetrieveFoundRequest(WDFQUEUE Queue, WDFREQUEST FoundRequest, WDFREQUEST* OutRequest)
+{
+    PSIM_QUEUE queue = (PSIM_QUEUE)Queue;
+    PSIM_REQUEST request = (PSIM_REQUEST)FoundRequest;
+    NTSTATUS status = STATUS_NOT_FOUND;
+
+    *OutRequest = NULL;
+
+    pthread_mutex_lock(&queue->Lock);
+
+    if (request->Linked && request->Queue == queue) {
+        SimQueuePresent(queue, request);
+        *OutRequest = FoundRequest;
+        status = STATUS_SUCCESS;
+    }
+
+    pthread_mutex_unlock(&queue->Lock);
+
+    return status;
+}
+
+VOID WdfIoQueueStart(WDFQUEUE Queue)
+{
+    PSIM_QUEUE queue = (PSIM_QUEUE)Queue;
+
+    pthread_mutex_lock(&queue->Lock);
+    queue->Accepting = TRUE;
+    queue->Stopped = FALSE;
+    pthread_mutex_unlock(&queue->Lock);
+
+    SimQueueDispatch(queue);
+}
+
+static VOID SimQueueWaitIdle(PSIM_QUEUE Queue, BOOLEAN DriverOwnedOnly)
+{
+    pthread_mutex_lock(&Queue->Lock);
+
+    while (Queue->DriverOwned != 0 || (!DriverOwnedOnly && Queue->Queued != 0)) {
+        pthread_cond_wait(&Queue->Idle, &Queue->Lock);
+    }
+
+    pthread_mutex_unlock(&Queue->Lock);
+}
+
+VOID WdfIoQueueStop(WDFQUEUE Queue, PFN_WDF_IO_QUEUE_STATE StopComplete, WDFCONTEXT Context)
+{
+    PSIM_QUEUE queue = (PSIM_QUEUE)Queue;
+
+    pthread_mutex_lock(&queue->Lock);
+    queue->Stopped = TRUE;
+    pthread_mutex_unlock(&queue->Lock);
+
+    if (StopComplete) {
+        SimQueueWaitIdle(queue, TRUE);
+        StopComplete(Queue, Context);
+    }
+}
+
+VOID WdfIoQueueStopSynchronously(WDFQUEUE Queue)
+{
+    WdfIoQueueStop(Queue, NULL, NULL);
+    SimQueueWaitIdle((PSIM_QUEUE)Queue, TRUE);
+}
+
+static VOID SimQueuePurge(PSIM_QUEUE Queue, BOOLEAN Wait)
+{
+    PSIM_REQUEST request;
+
+    pthread_mutex_lock(&Queue->Lock);
+    Queue->Accepting = FALSE;
+
+    while ((request = Queue->Head) != NULL) {
+        SimQueueUnlink(Queue, request);
+        request->Queue = NULL;
+
+        pthread_mutex_unlock(&Queue->Lock);
+        WdfRequestComplete(&request->Header, STATUS_CANCELLED);
+        pthread_mutex_lock(&Queue->Lock);
+    }
+
+    pthread_mutex_unlock(&Queue->Lock);
+
+    if (Wait) {
+        SimQueueWaitIdle(Queue, TRUE);
+    }
+}
+
+VOID WdfIoQueuePurge(WDFQUEUE Queue, PFN_WDF_IO_QUEUE_STATE PurgeComplete, WDFCONTEXT Context)
+{
+    SimQueuePurge((PSIM_QUEUE)Queue, PurgeComplete != NULL);
+
+    if (PurgeComplete) {
+        PurgeComplete(Queue, Context);
+    }
+}
+
+VOID WdfIoQueuePurgeSynchronously(WDFQUEUE Queue)
+{
+    SimQueuePurge((PSIM_QUEUE)Queue, TRUE);
+}
+
+WDF_IO_QUEUE_STATE WdfIoQueueGetState(WDFQUEUE Queue, PULONG QueueRequests, PULONG DriverRequests)
+{
+    PSIM_QUEUE queue = (PSIM_QUEUE)Queue;
+    WDF_IO_QUEUE_STATE state = 0;
+
+    pthread_mutex_lock(&queue->Lock);
+
+    if (queue->Accepting) {
+        state |= WdfIoQueueAcceptRequests;
+    }
+    if (!queue->Stopped) {
+        state |= WdfIoQueueDispatchRequests;
+    }
+    if (queue->Queued == 0) {
+        state |= WdfIoQueueNoRequests;
+    }
+    if (queue->DriverOwned == 0) {
+        state |= WdfIoQueueDriverNoRequests;
+    }
+    if (QueueRequests) {
+        *QueueRequests = queue->Queued;
+    }
+    if (DriverRequests) {
+        *DriverRequests = queue->DriverOwned;
+    }
+
+    pthread_mutex_unlock(&queue->Lock);
+
+    return state;
+}
+
+VOID SimQueueCancelFileRequests(PSIM_DEVICE Device, PSIM_FILE File)
+{
+    PSIM_QUEUE queues[ARRAYSIZE(Device->Queues)];
+    PSIM_REQUEST request;
+    PSIM_REQUEST next;
+    ULONG count;
+    ULONG i;
+
+    //
+    // Queues may get deleted meanwhile, hold on to them
+    //
+    pthread_mutex_lock(&Device->QueuesLock);
+    count = Device->QueueCount;
+    memcpy(queues, Device->Queues, sizeof(PSIM_QUEUE) * count);
+    for (i = 0; i < count; i++) {
+        WdfObjectReference(&queues[i]->Header);
+    }
+    pthread_mutex_unlock(&Device->QueuesLock);
+
+    for (i = 0; i < count; i++) {
+        pthread_mutex_lock(&queues[i]->Lock);
+
+        for (request = queues[i]->Head; request != NULL; request = next) {
+            next = request->Next;
+
+            if (request->File != File) {
+                continue;
+            }
+
+            SimQueueUnlink(queues[i], request);
+            request->Queue = NULL;
+
+            pthread_mutex_unlock(&queues[i]->Lock);
+            WdfRequestComplete(&request->Header, STATUS_CANCELLED);
+            pthread_mutex_lock(&queues[i]->Lock);
+
+            next = queues[i]->Head;
+        }
+
+        pthread_mutex_unlock(&queues[i]->Lock);
+        SimObjectRelease(&queues[i]->Header);
+    }
+}
+
+//
+// Takes a deleted queue off its device so no more requests get routed
+// to it and the slot can be reused
+//
+static VOID SimQueueDetach(PSIM_QUEUE Queue)
+{
+    PSIM_DEVICE device = Queue->Device;
+    ULONG i;
+
+    pthread_mutex_lock(&device->QueuesLock);
+
+    for (i = 0; i < device->QueueCount; i++) {
+        if (device->Queues[i] == Queue) {
+            device->Queues[i] = device->Queues[--device->QueueCount];
+            break;
+        }
+    }
+
+    if (device->DefaultQueue == Queue) {
+        device->DefaultQueue = NULL;
+    }
+
+    if (device->CreateQueue == Queue) {
+        device->CreateQueue = NULL;
+    }
+
+    pthread_mutex_unlock(&device->QueuesLock);
+}
+
+#pragma endregion
+
+#pragma region Requests
+
+static PFN_SIM_LOWER_DRIVER SimLowerDriver = NULL;
+
+VOID SimSetLowerDriver(PFN_SIM_LOWER_DRIVER Handler)
+{
+    SimLowerDriver = Handler;
+}
+
+PSIM_REQUEST SimRequestCreate(PSIM_DEVICE Device, PSIM_FILE File, WDF_REQUEST_TYPE Type)
+{
+    PSIM_REQUEST request;
+
+    request = SimObjectCreate(SimObjectRequest, sizeof(SIM_REQUEST), NULL, NULL);
+    if (request == NULL) {
+        return NULL;
+    }
+
+    request->Type = Type;
+    request->Device = Device;
+    request->File = File;
+    request->ProcessId = SimThreadProcessId();
+    request->Status = STATUS_PENDING;
+
+    KeInitializeEvent(&request->CompletionEvent, NotificationEvent, FALSE);
+
+    return request;
+}
+
+//
+// Entry point of the simulated I/O manager
+//
+VOID SimRequestDispatch(PSIM_REQUEST Request)
+{
+    PSIM_DEVICE device = Request->Device;
+    PSIM_QUEUE target = NULL;
+    NTSTATUS status;
+
+    if (!device->Initialized || device->Header.Deleted || device->RemovalPending) {
+        WdfRequestComplete(&Request->Header, STATUS_INVALID_DEVICE_STATE);
+        return;
+    }
+
+    if (Request->Type == WdfRequestTypeCreate) {
+        if (device->CreateQueue != NULL) {
+            target = device->CreateQueue;
+        }
+        else if (device->Init.FileConfig.EvtDeviceFileCreate != NULL) {
+            device->Init.FileConfig.EvtDeviceFileCreate(&device->Header, &Request->Header, &Request->File->Header);
+            return;
+        }
+        else if (device->Init.IsFilter) {
+            WdfRequestSend(&Request->Header, device->IoTarget, NULL);
+            return;
+        }
+        else {
+            WdfRequestComplete(&Request->Header, STATUS_SUCCESS);
+            return;
+        }
+    }
+    else {
+        target = device->DefaultQueue;
+    }
+
+    if (target == NULL) {
+        WdfRequestComplete(&Request->Header, STATUS_INVALID_DEVICE_REQUEST);
+        return;
+    }
+
+    status = SimQueueInsert(target, Request, FALSE);
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(&Request->Header, status);
+        return;
+    }
+
+    SimQueueDispatch(target);
+}
+
+VOID WdfRequestCompleteWithInformation(WDFREQUEST Request, NTSTATUS Status, ULONG_PTR Information)
+{
+    PSIM_REQUEST request = (PSIM_REQUEST)Request;
+    PSIM_QUEUE owner = request->Linked ? NULL : request->Queue;
+    size_t copy;
+
+    if (__atomic_exchange_n(&request->Completed, 1, __ATOMIC_ACQ_REL)) {
+        fprintf(stderr, "sim: request %p completed twice\n", (void*)request);
+        abort();
+    }
+
+    if (request->Linked) {
+        fprintf(stderr, "sim: completing request %p still owned by a queue\n", (void*)request);
+        abort();
+    }
+
+    request->Status = Status;
+    request->Information = Information;
+    request->Queue = NULL;
+
+    if (request->CopyOutOnCompletion && request->UserOutputBuffer != NULL && NT_SUCCESS(Status)) {
+        copy = (Information < request->OutputLength) ? Information : request->OutputLength;
+        memcpy(request->UserOutputBuffer, request->SystemBuffer, copy);
+    }
+    else if (request->CopyOutOnCompletion && request->UserOutputBuffer != NULL && Status == STATUS_BUFFER_OVERFLOW) {
+        copy = (Information < request->OutputLength) ? Information : request->OutputLength;
+        memcpy(request->UserOutputBuffer, request->SystemBuffer, copy);
+    }
+
+    if (request->Type == WdfRequestTypeCreate && request->File != NULL && NT_SUCCESS(Status)) {
+        __atomic_add_fetch(&request->Device->OpenHandles, 1, __ATOMIC_ACQ_REL);
+    }
+
+    KeSetEvent(&request->CompletionEvent, IO_NO_INCREMENT, FALSE);
+
+    if (owner != NULL) {
+        SimQueueReleaseRequest(owner);
+    }
+
+    SimObjectRelease(&request->Header);
+}
+
+VOID WdfRequestComplete(WDFREQUEST Request, NTSTATUS Status)
+{
+    WdfRequestCompleteWithInformation(Request, Status, ((PSIM_REQUEST)Request)->Information);
+}
+
+VOID WdfRequestSetInformation(WDFREQUEST Request, ULONG_PTR Information)
+{
+    ((PSIM_REQUEST)Request)->Information = Information;
+}
+
+NTSTATUS WdfRequestGetStatus(WDFREQUEST Request)
+{
+    return ((PSIM_REQUEST)Request)->Status;
+}
+
+VOID WdfRequestFormatRequestUsingCurrentType(WDFREQUEST Request)
+{
+    UNREFERENCED_PARAMETER(Request);
+}
+
+//
+// The lower driver completes everything synchronously
+//
+BOOLEAN WdfRequestSend(WDFREQUEST Request, WDFIOTARGET Target, PWDF_REQUEST_SEND_OPTIONS Options)
+{
+    PSIM_REQUEST request = (PSIM_REQUEST)Request;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    UNREFERENCED_PARAMETER(Target);
+    UNREFERENCED_PARAMETER(Options);
+
+    if (request->Type == WdfRequestTypeCreate && SimLowerDriver != NULL) {
+        status = SimLowerDriver(request->Device->Init.Pdo, request->ProcessId);
+    }
+
+    WdfRequestCompleteWithInformation(Request, status, 0);
+
+    return TRUE;
+}
+
+NTSTATUS WdfRequestForwardToIoQueue(WDFREQUEST Request, WDFQUEUE DestinationQueue)
+{
+    PSIM_REQUEST request = (PSIM_REQUEST)Request;
+    PSIM_QUEUE destination = (PSIM_QUEUE)DestinationQueue;
+    PSIM_QUEUE owner = request->Queue;
+    NTSTATUS status;
+
+    if (owner == destination) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    status = SimQueueInsert(destination, request, FALSE);
+    if (!NT_SUCCESS(status)) {
+        request->Queue = owner;
+        return status;
+    }
+
+    if (owner != NULL) {
+        SimQueueReleaseRequest(owner);
+    }
+
+    SimQueueDispatch(destination);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestRequeue(WDFREQUEST Request)
+{
+    PSIM_REQUEST request = (PSIM_REQUEST)Request;
+    PSIM_QUEUE owner = request->Queue;
+    NTSTATUS status;
+
+    if (owner == NULL || owner->Config.DispatchType != WdfIoQueueDispatchManual) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    pthread_mutex_lock(&owner->Lock);
+    owner->DriverOwned--;
+    pthread_mutex_unlock(&owner->Lock);
+
+    status = SimQueueInsert(owner, request, TRUE);
+    if (!NT_SUCCESS(status)) {
+        pthread_mutex_lock(&owner->Lock);
+        owner->DriverOwned++;
+        pthread_mutex_unlock(&owner->Lock);
+    }
+
+    return status;
+}
+
+NTSTATUS WdfRequestRetrieveInputBuffer(WDFREQUEST Request, size_t MinimumRequiredLength, PVOID* Buffer, size_t* Length)
+{
+    PSIM_REQUEST request = (PSIM_REQUEST)Request;
+
+    *Buffer = NULL;
+
+    if (request->InputBuffer == NULL || request->InputLength == 0) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    if (request->InputLength < MinimumRequiredLength) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    *Buffer = request->InputBuffer;
+    if (Length) {
+        *Length = request->InputLength;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestRetrieveOutputBuffer(WDFREQUEST Request, size_t MinimumRequiredSize, PVOID* Buffer, size_t* Length)
+{
+    PSIM_REQUEST request = (PSIM_REQUEST)Request;
+
+    *Buffer = NULL;
+
+    if (request->OutputBuffer == NULL || request->OutputLength == 0) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    if (request->OutputLength < MinimumRequiredSize) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    *Buffer = request->OutputBuffer;
+    if (Length) {
+        *Length = request->OutputLength;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+WDFFILEOBJECT WdfRequestGetFileObject(WDFREQUEST Request)
+{
+    PSIM_REQUEST request = (PSIM_REQUEST)Request;
+
+    return request->File ? &request->File->Header : NULL;
+}
+
+WDFQUEUE WdfRequestGetIoQueue(WDFREQUEST Request)
+{
+    PSIM_REQUEST request = (PSIM_REQUEST)Request;
+
+    return request->Queue ? &request->Queue->Header : NULL;
+}
+
+NTSTATUS WdfRequestMarkCancelableEx(WDFREQUEST Request, PFN_WDF_REQUEST_CANCEL EvtRequestCancel)
+{
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(EvtRequestCancel);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestUnmarkCancelable(WDFREQUEST Request)
+{
+    UNREFERENCED_PARAMETER(Request);
+
+    return STATUS_SUCCESS;
+}
+
+#pragma endregion
+
+#pragma region Timers
+
+static void* SimTimerThread(void* Parameter)
+{
+    PSIM_TIMER timer = Parameter;
+    struct timespec deadline;
+    ULONGLONG now;
+
+    SimSetCurrentProcessId(SYSTEM_PROCESS_ID);
+
+    pthread_mutex_lock(&timer->Lock);
+
+    while (!timer->Exit) {
+        if (!timer->Armed) {
+            pthread_cond_wait(&timer->Changed, &timer->Lock);
+            continue;
+        }
+
+        now = SimNowNs();
+        if (now < timer->DueNs) {
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += (time_t)((timer->DueNs - now) / 1000000000ULL);
+            deadline.tv_nsec += (long)((timer->DueNs - now) % 1000000000ULL);
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&timer->Changed, &timer->Lock, &deadline);
+            continue;
+        }
+
+        if (timer->Config.Period) {
+            timer->DueNs = now + (ULONGLONG)timer->Config.Period * 1000000ULL;
+        }
+        else {
+            timer->Armed = FALSE;
+        }
+
+        timer->Running = TRUE;
+        pthread_mutex_unlock(&timer->Lock);
+
+        timer->Config.EvtTimerFunc(&timer->Header);
+
+        pthread_mutex_lock(&timer->Lock);
+        timer->Running = FALSE;
+        pthread_cond_broadcast(&timer->Changed);
+    }
+
+    pthread_mutex_unlock(&timer->Lock);
+
+    return NULL;
+}
+
+NTSTATUS WdfTimerCreate(PWDF_TIMER_CONFIG Config, PWDF_OBJECT_ATTRIBUTES Attributes, WDFTIMER* Timer)
+{
+    PSIM_TIMER timer;
+    pthread_condattr_t attr;
+
+    if (Attributes == NULL || Attributes->ParentObject == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    timer = SimObjectCreate(SimObjectTimer, sizeof(SIM_TIMER), Attributes, NULL);
+    if (timer == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    timer->Config = *Config;
+    pthread_mutex_init(&timer->Lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer->Changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_create(&timer->Thread, NULL, SimTimerThread, timer);
+
+    *Timer = &timer->Header;
+
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN WdfTimerStart(WDFTIMER Timer, LONGLONG DueTime)
+{
+    PSIM_TIMER timer = (PSIM_TIMER)Timer;
+    BOOLEAN wasArmed;
+    ULONGLONG delay = (ULONGLONG)(DueTime < 0 ? -DueTime : DueTime) * 100ULL;
+
+    pthread_mutex_lock(&timer->Lock);
+    wasArmed = timer->Armed;
+    timer->Armed = TRUE;
+    timer->DueNs = SimNowNs() + delay;
+    pthread_cond_broadcast(&timer->Changed);
+    pthread_mutex_unlock(&timer->Lock);
+
+    return wasArmed;
+}
+
+BOOLEAN WdfTimerStop(WDFTIMER Timer, BOOLEAN Wait)
+{
+    PSIM_TIMER timer = (PSIM_TIMER)Timer;
+    BOOLEAN wasArmed;
+
+    pthread_mutex_lock(&timer->Lock);
+
+    wasArmed = timer->Armed;
+    timer->Armed = FALSE;
+    pthread_cond_broadcast(&timer->Changed);
+
+    if (Wait && !pthread_equal(pthread_self(), timer->Thread)) {
+        while (timer->Running) {
+            pthread_cond_wait(&timer->Changed, &timer->Lock);
+        }
+    }
+
+    pthread_mutex_unlock(&timer->Lock);
+
+    return wasArmed;
+}
+
+WDFOBJECT WdfTimerGetParentObject(WDFTIMER Timer)
+{
+    return Timer->Parent;
+}
+
+static VOID SimTimerShutdown(PSIM_TIMER Timer)
+{
+    pthread_mutex_lock(&Timer->Lock);
+    Timer->Exit = TRUE;
+    Timer->Armed = FALSE;
+    pthread_cond_broadcast(&Timer->Changed);
+    pthread_mutex_unlock(&Timer->Lock);
+
+    if (pthread_equal(pthread_self(), Timer->Thread)) {
+        pthread_detach(Timer->Thread);
+    }
+    else {
+        pthread_join(Timer->Thread, NULL);
+    }
+}
+
+#pragma endregion
+
+#pragma region Work items
+
+static void* SimWorkItemThread(void* Parameter)
+{
+    PSIM_WORKITEM workItem = Parameter;
+
+    SimSetCurrentProcessId(SYSTEM_PROCESS_ID);
+
+    pthread_mutex_lock(&workItem->Lock);
+    workItem->Queued = FALSE;
+    workItem->Running = TRUE;
+    pthread_mutex_unlock(&workItem->Lock);
+
+    workItem->Config.EvtWorkItemFunc(&workItem->Header);
+
+    pthread_mutex_lock(&workItem->Lock);
+    workItem->Running = FALSE;
+    pthread_cond_broadcast(&workItem->Done);
+    pthread_mutex_unlock(&workItem->Lock);
+
+    SimObjectRelease(&workItem->Header);
+
+    return NULL;
+}
+
+NTSTATUS WdfWorkItemCreate(PWDF_WORKITEM_CONFIG Config, PWDF_OBJECT_ATTRIBUTES Attributes, WDFWORKITEM* WorkItem)
+{
+    PSIM_WORKITEM workItem;
+
+    if (Attributes == NULL || Attributes->ParentObject == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    workItem = SimObjectCreate(SimObjectWorkItem, sizeof(SIM_WORKITEM), Attributes, NULL);
+    if (workItem == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    workItem->Config = *Config;
+    pthread_mutex_init(&workItem->Lock, NULL);
+    pthread_cond_init(&workItem->Done, NULL);
+
+    *WorkItem = &workItem->Header;
+
+    return STATUS_SUCCESS;
+}
+
+VOID WdfWorkItemEnqueue(WDFWORKITEM WorkItem)
+{
+    PSIM_WORKITEM workItem = (PSIM_WORKITEM)WorkItem;
+    pthread_t thread;
+
+    pthread_mutex_lock(&workItem->Lock);
+
+    if (workItem->Queued) {
+        pthread_mutex_unlock(&workItem->Lock);
+        return;
+    }
+
+    workItem->Queued = TRUE;
+    pthread_mutex_unlock(&workItem->Lock);
+
+    WdfObjectReference(WorkItem);
+
+    pthread_create(&thread, NULL, SimWorkItemThread, workItem);
+    pthread_detach(thread);
+}
+
+WDFOBJECT WdfWorkItemGetParentObject(WDFWORKITEM WorkItem)
+{
+    return WorkItem->Parent;
+}
+
+VOID WdfWorkItemFlush(WDFWORKITEM WorkItem)
+{
+    PSIM_WORKITEM workItem = (PSIM_WORKITEM)WorkItem;
+
+    pthread_mutex_lock(&workItem->Lock);
+
+    while (workItem->Queued || workItem->Running) {
+        pthread_cond_wait(&workItem->Done, &workItem->Lock);
+    }
+
+    pthread_mutex_unlock(&workItem->Lock);
+}
+
+static VOID SimWorkItemShutdown(PSIM_WORKITEM WorkItem)
+{
+    WdfWorkItemFlush(&WorkItem->Header);
+}
+
+#pragma endregion
@@ -0,0 +1,321 @@
+/*
+* Decodes the binary event log of the HidGuardian driver.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+//
+// Turns drains of IOCTL_HIDGUARDIAN_GET_EVENTS back into text. Input files
+// hold one or more drains back to back, exactly as the IOCTL returned them
+// (loadgen --events-out writes such a file, a collector on a real system
+// only has to append every output buffer). Events of all processors are
+// merged by timestamp and printed one per line with their typed payload;
+// lost events show up as gaps in the per-processor sequence numbers.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <ntddk.h>
+#endif
+
+#include "HidGuardian.h"
+
+//
+// How to print one event argument
+//
+typedef enum _DECODE_ARG
+{
+    DecodeArgNone,
+    DecodeArgDecimal,
+    DecodeArgHex,
+    DecodeArgBoolean,
+    DecodeArgPath,
+    DecodeArgVerdict
+
+} DECODE_ARG;
+
+typedef struct _DECODE_EVENT
+{
+    const char* Name;
+
+    const char* ArgNames[3];
+
+    DECODE_ARG ArgTypes[3];
+
+} DECODE_EVENT;
+
+//
+// Indexed by HIDGUARDIAN_EVENT_*, keep in sync with HidGuardian.h
+//
+static const DECODE_EVENT DecodeEvents[HIDGUARDIAN_EVENT_COUNT] =
+{
+    { "none",               { NULL },                           { DecodeArgNone } },
+    { "create_arrival",     { "pid" },                          { DecodeArgDecimal } },
+    { "create_resolved",    { "pid", "path", "allowed" },       { DecodeArgDecimal, DecodeArgPath, DecodeArgBoolean } },
+    { "create_held",        { "pid", "pending" },               { DecodeArgDecimal, DecodeArgDecimal } },
+    { "create_pending",     { "pid", "pending" },               { DecodeArgDecimal, DecodeArgDecimal } },
+    { "notify_missed",      { "pid", "status" },                { DecodeArgDecimal, DecodeArgHex } },
+    { "device_control",     { "code", "in", "out" },            { DecodeArgHex, DecodeArgDecimal, DecodeArgDecimal } },
+    { "pickup",             { "request", "pid", "hwid_len" },   { DecodeArgDecimal, DecodeArgDecimal, DecodeArgDecimal } },
+    { "verdict_scan",       { "wanted", "found" },              { DecodeArgDecimal, DecodeArgDecimal } },
+    { "verdict",            { "request", "pid", "verdict" },    { DecodeArgDecimal, DecodeArgDecimal, DecodeArgVerdict } },
+    { "notification",       { "held_left", "parked" },          { DecodeArgDecimal, DecodeArgBoolean } },
+};
+
+static const char* DecodePathNames[HIDGUARDIAN_ACCESS_PATH_COUNT] =
+{
+    "system", "system_pid", "cerberus", "sticky", "verdict", "default", "timeout", "limited"
+};
+
+static PHIDGUARDIAN_EVENT_RECORD DecodeRecords;
+static ULONG DecodeCount;
+static ULONG64 DecodeFrequency;
+static ULONG64 DecodeDropped;
+
+static int DecodeCompare(const void* A, const void* B)
+{
+    const HIDGUARDIAN_EVENT_RECORD* a = A;
+    const HIDGUARDIAN_EVENT_RECORD* b = B;
+
+    if (a->Timestamp != b->Timestamp)
+        return (a->Timestamp > b->Timestamp) - (a->Timestamp < b->Timestamp);
+
+    if (a->Processor != b->Processor)
+        return (a->Processor > b->Processor) - (a->Processor < b->Processor);
+
+    return (a->Sequence > b->Sequence) - (a->Sequence < b->Sequence);
+}
+
+//
+// Appends all drains in the file, records of newer versions are cut down
+// to the fields this decoder knows
+//
+static BOOLEAN DecodeLoad(const char* Path)
+{
+    HIDGUARDIAN_EVENT_TRACE header;
+    PHIDGUARDIAN_EVENT_RECORD grown;
+    PUCHAR record = NULL;
+    FILE* file = fopen(Path, "rb");
+    ULONG i;
+
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s\n", Path);
+        return FALSE;
+    }
+
+    while (fread(&header, sizeof(header), 1, file) == 1)
+    {
+        if (header.Version < HIDGUARDIAN_EVENT_TRACE_VERSION
+            || header.RecordSize < sizeof(HIDGUARDIAN_EVENT_RECORD)
+            || header.Size != sizeof(header) + (ULONG64)header.RecordSize * header.RecordCount) {
+            fprintf(stderr, "%s: not an event log\n", Path);
+            break;
+        }
+
+        grown = realloc(DecodeRecords, sizeof(HIDGUARDIAN_EVENT_RECORD) * ((size_t)DecodeCount + header.RecordCount));
+        record = realloc(record, header.RecordSize);
+
+        if (grown == NULL || record == NULL) {
+            fprintf(stderr, "out of memory\n");
+            break;
+        }
+
+        DecodeRecords = grown;
+
+        for (i = 0; i < header.RecordCount; i++) {
+            if (fread(record, header.RecordSize, 1, file) != 1)
+                break;
+
+            memcpy(&DecodeRecords[DecodeCount++], record, sizeof(HIDGUARDIAN_EVENT_RECORD));
+        }
+
+        DecodeFrequency = header.Frequency;
+        DecodeDropped += header.DroppedCount;
+
+        if (i < header.RecordCount) {
+            fprintf(stderr, "%s: truncated\n", Path);
+            break;
+        }
+    }
+
+    free(record);
+
+    return (BOOLEAN)(fclose(file) == 0);
+}
+
+static VOID DecodePrintArg(DECODE_ARG Type, const char* Name, ULONG Value)
+{
+    switch (Type)
+    {
+    case DecodeArgDecimal:
+        printf(" %s=%u", Name, Value);
+        break;
+    case DecodeArgHex:
+        printf(" %s=0x%08X", Name, Value);
+        break;
+    case DecodeArgBoolean:
+        printf(" %s=%s", Name, Value ? "yes" : "no");
+        break;
+    case DecodeArgPath:
+        if (Value < HIDGUARDIAN_ACCESS_PATH_COUNT)
+            printf(" %s=%s", Name, DecodePathNames[Value]);
+        else
+            printf(" %s=%u", Name, Value);
+        break;
+    case DecodeArgVerdict:
+        printf(" %s=%s%s", Name,
+            (Value & HIDGUARDIAN_EVENT_VERDICT_ALLOWED) ? "allow" : "deny",
+            (Value & HIDGUARDIAN_EVENT_VERDICT_STICKY) ? ",sticky" : "");
+        break;
+    default:
+        break;
+    }
+}
+
+//
+// Reports holes in the per-processor sequence numbers, the input is
+// still in drain order so each processor's events are ascending
+//
+static VOID DecodeReportGaps(VOID)
+{
+    static ULONG last[0x10000];
+    static BOOLEAN seen[0x10000];
+    PHIDGUARDIAN_EVENT_RECORD record;
+    ULONG i;
+
+    for (i = 0; i < DecodeCount; i++)
+    {
+        record = &DecodeRecords[i];
+
+        if (seen[record->Processor] && record->Sequence != last[record->Processor] + 1) {
+            printf("# cpu %u: %u events lost before sequence %u\n",
+                record->Processor, record->Sequence - last[record->Processor] - 1, record->Sequence);
+        }
+
+        seen[record->Processor] = TRUE;
+        last[record->Processor] = record->Sequence;
+    }
+}
+
+static VOID DecodePrint(VOID)
+{
+    PHIDGUARDIAN_EVENT_RECORD record;
+    const DECODE_EVENT* event;
+    ULONG i, k;
+
+    for (i = 0; i < DecodeCount; i++)
+    {
+        record = &DecodeRecords[i];
+
+        printf("%14.3f us  cpu %-3u %08X  ",
+            (double)(record->Timestamp - DecodeRecords[0].Timestamp) * 1e6 / DecodeFrequency,
+            record->Processor, record->DeviceHash);
+
+        if (record->EventId >= HIDGUARDIAN_EVENT_COUNT) {
+            printf("event_%u args=%u,%u,%u\n",
+                record->EventId, record->Args[0], record->Args[1], record->Args[2]);
+            continue;
+        }
+
+        event = &DecodeEvents[record->EventId];
+
+        printf("%-16s", event->Name);
+
+        for (k = 0; k < ARRAYSIZE(event->ArgTypes); k++) {
+            DecodePrintArg(event->ArgTypes[k], event->ArgNames[k], record->Args[k]);
+        }
+
+        printf("\n");
+    }
+}
+
+static VOID DecodeSummary(VOID)
+{
+    ULONG counts[HIDGUARDIAN_EVENT_COUNT + 1];
+    double span = 0;
+    ULONG i;
+
+    memset(counts, 0, sizeof(counts));
+
+    for (i = 0; i < DecodeCount; i++)
+        counts[min(DecodeRecords[i].EventId, HIDGUARDIAN_EVENT_COUNT)]++;
+
+    if (DecodeCount > 0)
+        span = (double)(DecodeRecords[DecodeCount - 1].Timestamp - DecodeRecords[0].Timestamp) / DecodeFrequency;
+
+    printf("events:  %u over %.3f ms (%llu dropped by the driver)\n",
+        DecodeCount, span * 1e3, (unsigned long long)DecodeDropped);
+
+    for (i = 0; i < HIDGUARDIAN_EVENT_COUNT; i++) {
+        if (counts[i] > 0)
+            printf("  %-16s %u\n", DecodeEvents[i].Name, counts[i]);
+    }
+
+    if (counts[HIDGUARDIAN_EVENT_COUNT] > 0)
+        printf("  %-16s %u\n", "unknown", counts[HIDGUARDIAN_EVENT_COUNT]);
+}
+
+int main(int argc, char* argv[])
+{
+    BOOLEAN summary = FALSE;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--summary") == 0) {
+            summary = TRUE;
+            continue;
+        }
+
+        if (argv[i][0] == '-' || !DecodeLoad(argv[i])) {
+            fprintf(stderr, "usage: %s [--summary] FILE...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (DecodeFrequency == 0) {
+        fprintf(stderr, "usage: %s [--summary] FILE...\n", argv[0]);
+        return 1;
+    }
+
+    if (summary) {
+        qsort(DecodeRecords, DecodeCount, sizeof(HIDGUARDIAN_EVENT_RECORD), DecodeCompare);
+        DecodeSummary();
+    }
+    else {
+        DecodeReportGaps();
+        qsort(DecodeRecords, DecodeCount, sizeof(HIDGUARDIAN_EVENT_RECORD), DecodeCompare);
+        DecodePrint();
+    }
+
+    free(DecodeRecords);
+
+    return 0;
+}
@@ -0,0 +1,499 @@
+/*
+* Create storm against the simulated HidGuardian driver with a Cerberus stand-in.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "Sim.h"
+#include "HidGuardian.h"
+
+#define DEMO_CERBERUS_PID   50
+#define DEMO_FIRST_PID      1000
+#define DEMO_CHANGES_SIZE   0x4000
+
+typedef struct _DEMO_CONFIG
+{
+    ULONG Devices;
+
+    ULONG Openers;
+
+    ULONG OpensPerOpener;
+
+    ULONG Processes;
+
+    BOOLEAN WithCerberus;
+
+} DEMO_CONFIG;
+
+typedef struct _DEMO_CERBERUS_WORKER
+{
+    PSIM_PDO Pdo;
+
+    PSIM_HANDLE Handle;
+
+    pthread_t Thread;
+
+    ULONG Answered;
+
+} DEMO_CERBERUS_WORKER;
+
+typedef struct _DEMO_OPENER
+{
+    ULONG Index;
+
+    pthread_t Thread;
+
+    ULONG Allowed;
+
+    ULONG Denied;
+
+} DEMO_OPENER;
+
+static DEMO_CONFIG DemoConfig = { 8, 16, 200, 64, TRUE };
+static PSIM_PDO* DemoPads;
+static volatile LONG DemoStop = 0;
+static volatile LONG DemoStalledDone = 0;
+
+typedef struct _DEMO_CHANGES
+{
+    ULONG Arrivals;
+
+    ULONG Removals;
+
+    ULONG Dropped;
+
+    ULONG Batches;
+
+    WCHAR Last[MAX_DEVICE_ID_SIZE];
+
+} DEMO_CHANGES;
+
+//
+// Stand-in for one HidCerberus device worker: waits for a notification,
+// fetches the pending request and answers it. Every third process gets
+// denied, verdicts for even PIDs are made sticky.
+//
+static void* DemoCerberusThread(void* Context)
+{
+    DEMO_CERBERUS_WORKER* worker = Context;
+    ULONG size = sizeof(HIDGUARDIAN_GET_CREATE_REQUEST) + 1024;
+    PHIDGUARDIAN_GET_CREATE_REQUEST get = calloc(1, size);
+    HIDGUARDIAN_SET_CREATE_REQUEST set;
+    PSIM_IRP notify;
+    NTSTATUS status;
+    ULONG requestId = 0;
+
+    SimSetCurrentProcessId(DEMO_CERBERUS_PID);
+
+    while (!DemoStop)
+    {
+        notify = SimDeviceIoControlAsync(worker->Handle,
+            IOCTL_HIDGUARDIAN_SUBMIT_NOTIFICATION, NULL, 0, NULL, 0);
+
+        while ((status = SimWaitIrp(notify, 50, NULL)) == STATUS_TIMEOUT && !DemoStop);
+
+        SimFreeIrp(notify);
+
+        if (status != STATUS_SUCCESS) {
+            break;
+        }
+
+        get->Size = size;
+        get->RequestId = ++requestId;
+
+        status = SimDeviceIoControl(worker->Handle, IOCTL_HIDGUARDIAN_GET_CREATE_REQUEST,
+            get, size, get, size, NULL);
+
+        if (!NT_SUCCESS(status)) {
+            continue;
+        }
+
+        set.RequestId = requestId;
+        set.IsAllowed = ((get->ProcessId / 4) % 3) != 0;
+        set.IsSticky = ((get->ProcessId / 4) % 2) == 0;
+
+        if (NT_SUCCESS(SimDeviceIoControl(worker->Handle, IOCTL_HIDGUARDIAN_SET_CREATE_REQUEST,
+            &set, sizeof(set), NULL, 0, NULL))) {
+            worker->Answered++;
+        }
+    }
+
+    free(get);
+
+    return NULL;
+}
+
+//
+// Waits for one batch of device changes, as HidCerberus would to keep
+// its device table current, and tallies the records
+//
+static NTSTATUS DemoReadChanges(PSIM_HANDLE Control, PVOID Buffer, DEMO_CHANGES* Changes)
+{
+    PHIDGUARDIAN_DEVICE_CHANGES batch = Buffer;
+    PHIDGUARDIAN_DEVICE_CHANGE record;
+    PSIM_IRP irp;
+    NTSTATUS status;
+    ULONG i;
+
+    irp = SimDeviceIoControlAsync(Control, IOCTL_HIDGUARDIAN_ARRIVAL_NOTIFICATION,
+        NULL, 0, Buffer, DEMO_CHANGES_SIZE);
+
+    status = SimWaitIrp(irp, 1000, NULL);
+    SimFreeIrp(irp);
+
+    if (status != STATUS_SUCCESS) {
+        return status;
+    }
+
+    Changes->Batches++;
+    Changes->Dropped += batch->DroppedCount;
+
+    for (i = 0, record = (PHIDGUARDIAN_DEVICE_CHANGE)(batch + 1); i < batch->RecordCount; i++)
+    {
+        if (record->Type == HIDGUARDIAN_DEVICE_ARRIVAL) Changes->Arrivals++;
+        if (record->Type == HIDGUARDIAN_DEVICE_REMOVAL) Changes->Removals++;
+
+        //
+        // Device ID, instance ID and class name follow the record
+        //
+        swprintf(Changes->Last, ARRAYSIZE(Changes->Last), L"%ls 0x%08X %.*ls\\%.*ls (%.*ls)",
+            (record->Type == HIDGUARDIAN_DEVICE_ARRIVAL) ? L"arrival" : L"removal", record->DeviceHash,
+            record->DeviceIdLength, (PWCHAR)(record + 1),
+            record->InstanceIdLength, (PWCHAR)(record + 1) + record->DeviceIdLength,
+            record->ClassNameLength, (PWCHAR)(record + 1) + record->DeviceIdLength + record->InstanceIdLength);
+
+        record = (PHIDGUARDIAN_DEVICE_CHANGE)((PUCHAR)record + record->Size);
+    }
+
+    return (batch->RemainingCount > 0) ? STATUS_MORE_ENTRIES : STATUS_SUCCESS;
+}
+
+//
+// Reads the device list the way HidCerberus builds its device table on
+// startup: ask for the size, then fetch all records in one call
+//
+static VOID DemoListDevices(PSIM_HANDLE Control, ULONG* Listed, ULONG* Guarded, ULONG* Active, ULONG* Size)
+{
+    HIDGUARDIAN_DEVICE_LIST header;
+    PHIDGUARDIAN_DEVICE_LIST list;
+    PHIDGUARDIAN_DEVICE_INFO record;
+    ULONG i;
+
+    *Listed = *Guarded = *Active = *Size = 0;
+
+    if (SimDeviceIoControl(Control, IOCTL_HIDGUARDIAN_GET_DEVICES,
+        NULL, 0, &header, sizeof(header), NULL) != STATUS_BUFFER_OVERFLOW) {
+        return;
+    }
+
+    list = malloc(header.Size);
+
+    if (NT_SUCCESS(SimDeviceIoControl(Control, IOCTL_HIDGUARDIAN_GET_DEVICES,
+        NULL, 0, list, header.Size, NULL)))
+    {
+        *Listed = list->DeviceCount;
+        *Size = list->Size;
+
+        for (i = 0, record = (PHIDGUARDIAN_DEVICE_INFO)(list + 1); i < list->DeviceCount; i++)
+        {
+            if (record->Flags & HIDGUARDIAN_DEVICE_GUARDED) (*Guarded)++;
+            if (record->Flags & HIDGUARDIAN_DEVICE_GUARD_ACTIVE) (*Active)++;
+
+            record = (PHIDGUARDIAN_DEVICE_INFO)((PUCHAR)record + record->Size);
+        }
+    }
+
+    free(list);
+}
+
+static void* DemoOpenerThread(void* Context)
+{
+    DEMO_OPENER* opener = Context;
+    ULONG seed = 0x9E3779B9 * (opener->Index + 1);
+    PSIM_HANDLE handle;
+    ULONG i;
+
+    for (i = 0; i < DemoConfig.OpensPerOpener; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+
+        SimSetCurrentProcessId(DEMO_FIRST_PID + 4 * ((seed >> 8) % DemoConfig.Processes));
+
+        if (NT_SUCCESS(SimOpenDevice(DemoPads[(seed >> 20) % DemoConfig.Devices], &handle))) {
+            opener->Allowed++;
+            SimCloseHandle(handle);
+        }
+        else {
+            opener->Denied++;
+        }
+    }
+
+    return NULL;
+}
+
+//
+// Opens one pad from a process Cerberus never decided on; with Cerberus
+// gone before answering, the driver has to resolve it
+//
+static void* DemoStalledOpenThread(void* Context)
+{
+    DEMO_OPENER* opener = Context;
+    PSIM_HANDLE handle;
+
+    SimSetCurrentProcessId(DEMO_FIRST_PID + 4 * (DemoConfig.Processes + opener->Index));
+
+    if (NT_SUCCESS(SimOpenDevice(DemoPads[opener->Index], &handle))) {
+        opener->Allowed++;
+        SimCloseHandle(handle);
+    }
+    else {
+        opener->Denied++;
+    }
+
+    InterlockedIncrement(&DemoStalledDone);
+
+    return NULL;
+}
+
+//
+// Open requests waiting for Cerberus across all pads
+//
+static ULONG DemoCountPending(PSIM_HANDLE Control)
+{
+    PHIDGUARDIAN_DEVICE_LIST list = malloc(DEMO_CHANGES_SIZE * 16);
+    PHIDGUARDIAN_DEVICE_INFO record;
+    ULONG pending = 0;
+    ULONG i;
+
+    if (NT_SUCCESS(SimDeviceIoControl(Control, IOCTL_HIDGUARDIAN_GET_DEVICES,
+        NULL, 0, list, DEMO_CHANGES_SIZE * 16, NULL)))
+    {
+        for (i = 0, record = (PHIDGUARDIAN_DEVICE_INFO)(list + 1); i < list->DeviceCount; i++)
+        {
+            pending += record->PendingCreateRequests + record->PendingAuthRequests;
+
+            record = (PHIDGUARDIAN_DEVICE_INFO)((PUCHAR)record + record->Size);
+        }
+    }
+
+    free(list);
+
+    return pending;
+}
+
+int main(int argc, char* argv[])
+{
+    DEMO_CERBERUS_WORKER* workers;
+    DEMO_OPENER* openers;
+    HIDGUARDIAN_STICKY_CACHE_STATS stats;
+    HIDGUARDIAN_DISCONNECT_STATS disconnect;
+    DEMO_CHANGES changes;
+    PVOID changesBuffer;
+    PSIM_HANDLE control = NULL;
+    PSIM_PDO master, extra;
+    WCHAR instanceId[32];
+    ULONGLONG start, elapsed;
+    ULONG allowed = 0, denied = 0, answered = 0;
+    ULONG listed = 0, guarded = 0, active = 0, listSize = 0;
+    ULONG stalledAllowed = 0;
+    struct timespec tick = { 0, 1000000 };
+    ULONG i, k;
+
+    if (argc > 1) DemoConfig.Devices = (ULONG)strtoul(argv[1], NULL, 0);
+    if (argc > 2) DemoConfig.Openers = (ULONG)strtoul(argv[2], NULL, 0);
+    if (argc > 3) DemoConfig.OpensPerOpener = (ULONG)strtoul(argv[3], NULL, 0);
+    if (argc > 4) DemoConfig.Processes = (ULONG)strtoul(argv[4], NULL, 0);
+    if (argc > 5) DemoConfig.WithCerberus = (BOOLEAN)(strtoul(argv[5], NULL, 0) != 0);
+
+    if (DemoConfig.Devices == 0 || DemoConfig.Processes == 0) {
+        fprintf(stderr, "usage: %s [devices] [openers] [opens-per-opener] [processes] [cerberus 0|1]\n", argv[0]);
+        return 1;
+    }
+
+    DemoPads = calloc(DemoConfig.Devices, sizeof(PSIM_PDO));
+    workers = calloc(DemoConfig.Devices, sizeof(DEMO_CERBERUS_WORKER));
+    openers = calloc(DemoConfig.Openers, sizeof(DEMO_OPENER));
+
+    if (!NT_SUCCESS(SimDriverLoad())) {
+        fprintf(stderr, "DriverEntry failed\n");
+        return 1;
+    }
+
+    //
+    // The virtual master device carries the control device
+    //
+    SimDeviceArrival(L"ROOT\\SYSTEM", L"0000", L"Nefarius\\HidGuardian\\Gen4\0", L"System", &master);
+
+    for (i = 0; i < DemoConfig.Devices; i++)
+    {
+        swprintf(instanceId, ARRAYSIZE(instanceId), L"7&%X&0&0000", i);
+
+        if (!NT_SUCCESS(SimDeviceArrival(L"HID\\VID_054C&PID_05C4", instanceId,
+            L"HID\\VID_054C&PID_05C4\0HID_DEVICE_SYSTEM_GAME\0HID_DEVICE\0", L"HIDClass", &DemoPads[i]))) {
+            fprintf(stderr, "AddDevice failed for pad %u\n", i);
+            return 1;
+        }
+    }
+
+    if (DemoConfig.WithCerberus)
+    {
+        SimSetCurrentProcessId(DEMO_CERBERUS_PID);
+        SimOpenControlDevice(&control);
+
+        for (i = 0; i < DemoConfig.Devices; i++)
+        {
+            workers[i].Pdo = DemoPads[i];
+            SimOpenDevice(DemoPads[i], &workers[i].Handle);
+            pthread_create(&workers[i].Thread, NULL, DemoCerberusThread, &workers[i]);
+        }
+    }
+
+    start = SimClockNs();
+
+    for (i = 0; i < DemoConfig.Openers; i++)
+    {
+        openers[i].Index = i;
+        pthread_create(&openers[i].Thread, NULL, DemoOpenerThread, &openers[i]);
+    }
+
+    for (i = 0; i < DemoConfig.Openers; i++)
+    {
+        pthread_join(openers[i].Thread, NULL);
+        allowed += openers[i].Allowed;
+        denied += openers[i].Denied;
+    }
+
+    elapsed = SimClockNs() - start;
+
+    RtlZeroMemory(&stats, sizeof(stats));
+    RtlZeroMemory(&changes, sizeof(changes));
+    changesBuffer = malloc(DEMO_CHANGES_SIZE);
+
+    if (control != NULL) {
+        SimDeviceIoControl(control, IOCTL_HIDGUARDIAN_GET_STICKY_CACHE_STATS,
+            NULL, 0, &stats, sizeof(stats), NULL);
+
+        DemoListDevices(control, &listed, &guarded, &active, &listSize);
+
+        //
+        // Arrivals queued up since the pads were added, then one pad
+        // coming and going while a request waits
+        //
+        while (DemoReadChanges(control, changesBuffer, &changes) == STATUS_MORE_ENTRIES);
+
+        SimDeviceArrival(L"HID\\VID_054C&PID_09CC", L"7&EXTRA&0&0000",
+            L"HID\\VID_054C&PID_09CC\0HID_DEVICE_SYSTEM_GAME\0HID_DEVICE\0", L"HIDClass", &extra);
+        DemoReadChanges(control, changesBuffer, &changes);
+
+        SimDeviceRemoval(extra);
+        DemoReadChanges(control, changesBuffer, &changes);
+    }
+
+    //
+    // Closing the handles cancels the outstanding notification requests
+    //
+    DemoStop = 1;
+
+    for (i = 0; DemoConfig.WithCerberus && i < DemoConfig.Devices; i++)
+    {
+        pthread_join(workers[i].Thread, NULL);
+        answered += workers[i].Answered;
+    }
+
+    RtlZeroMemory(&disconnect, sizeof(disconnect));
+
+    if (control != NULL) {
+        //
+        // Every pad gets an open stuck waiting on the notification its
+        // worker left behind, then Cerberus goes away
+        //
+        openers = realloc(openers, sizeof(DEMO_OPENER) * DemoConfig.Devices);
+
+        for (i = 0; i < DemoConfig.Devices; i++)
+        {
+            RtlZeroMemory(&openers[i], sizeof(DEMO_OPENER));
+            openers[i].Index = i;
+            pthread_create(&openers[i].Thread, NULL, DemoStalledOpenThread, &openers[i]);
+        }
+
+        for (k = 0; k < 1000 && DemoCountPending(control) + DemoStalledDone < DemoConfig.Devices; k++) {
+            nanosleep(&tick, NULL);
+        }
+    }
+
+    for (i = 0; DemoConfig.WithCerberus && i < DemoConfig.Devices; i++)
+    {
+        SimCloseHandle(workers[i].Handle);
+    }
+
+    if (control != NULL) {
+        SimCloseHandle(control);
+
+        for (i = 0; i < DemoConfig.Devices; i++)
+        {
+            pthread_join(openers[i].Thread, NULL);
+            stalledAllowed += openers[i].Allowed;
+        }
+
+        //
+        // Whoever opens the control device next reads how that went
+        //
+        SimOpenControlDevice(&control);
+
+        for (k = 0; k < 1000 && disconnect.Disconnects == 0; k++) {
+            SimDeviceIoControl(control, IOCTL_HIDGUARDIAN_GET_DISCONNECT_STATS,
+                NULL, 0, &disconnect, sizeof(disconnect), NULL);
+            nanosleep(&tick, NULL);
+        }
+
+        SimCloseHandle(control);
+    }
+
+    printf("opens:      %u (%u allowed, %u denied)\n", allowed + denied, allowed, denied);
+    printf("duration:   %.1f ms (%.0f opens/s)\n", elapsed / 1e6, (allowed + denied) / (elapsed / 1e9));
+    printf("cerberus:   %u answered\n", answered);
+    printf("sticky:     %llu hits, %llu misses, %u cached\n",
+        (unsigned long long)stats.Hits, (unsigned long long)stats.Misses, stats.Occupancy);
+    printf("devices:    %u listed (%u guarded, %u with guard state) in %u bytes\n",
+        listed, guarded, active, listSize);
+    printf("changes:    %u arrivals, %u removals, %u dropped in %u batches\n",
+        changes.Arrivals, changes.Removals, changes.Dropped, changes.Batches);
+    printf("last:       %ls\n", changes.Last);
+    printf("disconnect: %u pending opens resolved (%u allowed) on %u devices in %.2f ms\n",
+        disconnect.LastRequests, stalledAllowed, disconnect.LastDevices, disconnect.LastDuration / 1e4);
+
+    SimDriverUnload();
+
+    free(changesBuffer);
+    free(openers);
+    free(workers);
+    free(DemoPads);
+
+    return 0;
+}
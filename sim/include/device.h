@@ -0,0 +1,4 @@
+//
+// Case-insensitive include shim for ../../sys/Device.h
+//
+#include "../../sys/Device.h"
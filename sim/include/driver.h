@@ -0,0 +1,4 @@
+//
+// Case-insensitive include shim for ../../sys/Driver.h
+//
+#include "../../sys/Driver.h"
@@ -0,0 +1,552 @@
+/*
+* User-mode simulation of the subset of the Windows kernel API used by HidGuardian.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <stdio.h>
+
+#ifndef _KERNEL_MODE
+#define _KERNEL_MODE 1
+#endif
+
+//
+// Calling conventions, linkage and SAL annotations
+//
+
+#ifdef __cplusplus
+#define EXTERN_C            extern "C"
+#define EXTERN_C_START      extern "C" {
+#define EXTERN_C_END        }
+#else
+#define EXTERN_C            extern
+#define EXTERN_C_START
+#define EXTERN_C_END
+#endif
+
+#define FORCEINLINE         static inline __attribute__((always_inline))
+#define DECLSPEC_CACHEALIGN __attribute__((aligned(64)))
+#define SYSTEM_CACHE_ALIGNMENT_SIZE 64
+#define UNREFERENCED_PARAMETER(P)   ((void)(P))
+#define PAGED_CODE()        ((void)0)
+#define NTAPI
+#define IN
+#define OUT
+#define OPTIONAL
+#define CONST               const
+#define VOID                void
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _In_reads_(x)
+#define _In_reads_bytes_(x)
+#define _Out_writes_(x)
+#define _Out_writes_bytes_(x)
+#define _Out_writes_bytes_to_(x, y)
+#define _Out_writes_bytes_opt_(x)
+#define _Out_writes_opt_(x)
+#define _In_reads_opt_(x)
+#define _Use_decl_annotations_
+#define _Must_inspect_result_
+#define _Success_(x)
+#define _IRQL_requires_max_(x)
+#define _IRQL_requires_(x)
+#define _IRQL_raises_(x)
+#define _IRQL_saves_
+#define _IRQL_restores_
+#define _When_(a, b)
+#define _Requires_lock_held_(x)
+#define _Requires_lock_not_held_(x)
+#define _Acquires_lock_(x)
+#define _Releases_lock_(x)
+#define _Function_class_(x)
+#define _Field_size_(x)
+#define _Field_size_bytes_(x)
+#define _Ret_maybenull_
+#define _Post_writable_byte_size_(x)
+#define __drv_aliasesMem
+#define __drv_allocatesMem(x)
+#define __drv_freesMem(x)
+
+//
+// Base types
+//
+
+typedef void*               PVOID;
+typedef const void*         PCVOID;
+typedef void*               HANDLE;
+typedef HANDLE*             PHANDLE;
+typedef char                CHAR;
+typedef unsigned char       UCHAR;
+typedef UCHAR*              PUCHAR;
+typedef CHAR*               PCHAR;
+typedef const CHAR*         PCSTR;
+typedef short               SHORT;
+typedef unsigned short      USHORT;
+typedef USHORT*             PUSHORT;
+typedef int32_t             LONG;
+typedef LONG*               PLONG;
+typedef uint32_t            ULONG;
+typedef ULONG*              PULONG;
+typedef int64_t             LONG64;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONG64;
+typedef uint64_t            ULONGLONG;
+typedef ULONG64*            PULONG64;
+typedef LONG64*             PLONG64;
+typedef ULONGLONG*          PULONGLONG;
+typedef LONGLONG*           PLONGLONG;
+typedef intptr_t            LONG_PTR;
+typedef uintptr_t           ULONG_PTR;
+typedef uintptr_t           DWORD_PTR;
+typedef uintptr_t           SIZE_T;
+typedef SIZE_T*             PSIZE_T;
+typedef uint32_t            DWORD;
+typedef DWORD*              PDWORD;
+typedef uint16_t            WORD;
+typedef uint8_t             BYTE;
+typedef BYTE*               PBYTE;
+typedef int                 BOOL;
+typedef UCHAR               BOOLEAN;
+typedef BOOLEAN*            PBOOLEAN;
+typedef LONG                NTSTATUS;
+typedef NTSTATUS*           PNTSTATUS;
+typedef wchar_t             WCHAR;
+typedef WCHAR*              PWCHAR;
+typedef WCHAR*              PWCH;
+typedef WCHAR*              PWSTR;
+typedef const WCHAR*        PCWSTR;
+typedef CHAR                CCHAR;
+typedef UCHAR               KIRQL;
+typedef KIRQL*              PKIRQL;
+typedef ULONG               LOGICAL;
+
+typedef union _LARGE_INTEGER
+{
+    struct
+    {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _GUID
+{
+    ULONG   Data1;
+    USHORT  Data2;
+    USHORT  Data3;
+    UCHAR   Data4[8];
+} GUID, *PGUID;
+
+typedef const GUID* LPCGUID;
+
+#define TRUE                1
+#define FALSE               0
+
+#ifndef MAXULONG
+#define MAXULONG            0xFFFFFFFFUL
+#endif
+#define MAXUSHORT           0xFFFF
+#define MAXLONG             0x7FFFFFFFL
+#define MAXULONG64          0xFFFFFFFFFFFFFFFFULL
+#define MAXLONGLONG         0x7FFFFFFFFFFFFFFFLL
+
+#define ARRAYSIZE(A)        (sizeof(A) / sizeof((A)[0]))
+#define RTL_NUMBER_OF(A)    ARRAYSIZE(A)
+#define FIELD_OFFSET(type, field)   ((LONG)offsetof(type, field))
+#define CONTAINING_RECORD(address, type, field) \
+    ((type *)((PCHAR)(address) - offsetof(type, field)))
+#define C_ASSERT(e)         _Static_assert(e, #e)
+#define ALIGN_UP_BY(length, alignment) \
+    (((ULONG_PTR)(length) + (alignment) - 1) & ~((ULONG_PTR)(alignment) - 1))
+#define min(a, b)           (((a) < (b)) ? (a) : (b))
+#define max(a, b)           (((a) > (b)) ? (a) : (b))
+
+#ifdef INITGUID
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    __attribute__((weak)) const GUID name = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+#else
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    extern const GUID name
+#endif
+
+//
+// Status values
+//
+
+#define NT_SUCCESS(Status)                  (((NTSTATUS)(Status)) >= 0)
+
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                      ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING                      ((NTSTATUS)0x00000103L)
+#define STATUS_OBJECT_NAME_EXISTS           ((NTSTATUS)0x40000000L)
+#define STATUS_MORE_ENTRIES                 ((NTSTATUS)0x00000105L)
+#define STATUS_BUFFER_OVERFLOW              ((NTSTATUS)0x80000005L)
+#define STATUS_NO_MORE_ENTRIES              ((NTSTATUS)0x8000001AL)
+#define STATUS_UNSUCCESSFUL                 ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED              ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000DL)
+#define STATUS_INVALID_DEVICE_REQUEST       ((NTSTATUS)0xC0000010L)
+#define STATUS_ACCESS_DENIED                ((NTSTATUS)0xC0000022L)
+#define STATUS_BUFFER_TOO_SMALL             ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_NAME_NOT_FOUND        ((NTSTATUS)0xC0000034L)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009AL)
+#define STATUS_NOT_SUPPORTED                ((NTSTATUS)0xC00000BBL)
+#define STATUS_INTERNAL_ERROR               ((NTSTATUS)0xC00000E5L)
+#define STATUS_CANCELLED                    ((NTSTATUS)0xC0000120L)
+#define STATUS_NOT_FOUND                    ((NTSTATUS)0xC0000225L)
+#define STATUS_DEVICE_BUSY                  ((NTSTATUS)0x80000011L)
+#define STATUS_INVALID_DEVICE_STATE         ((NTSTATUS)0xC0000184L)
+#define STATUS_DEVICE_DOES_NOT_EXIST        ((NTSTATUS)0xC00000C0L)
+#define STATUS_DEVICE_NOT_READY             ((NTSTATUS)0xC00000A3L)
+#define STATUS_DEVICE_FEATURE_NOT_SUPPORTED ((NTSTATUS)0xC0000463L)
+#define STATUS_INVALID_BUFFER_SIZE          ((NTSTATUS)0xC0000206L)
+#define STATUS_QUOTA_EXCEEDED               ((NTSTATUS)0xC0000044L)
+#define STATUS_INTEGER_OVERFLOW             ((NTSTATUS)0xC0000095L)
+#define STATUS_REVISION_MISMATCH            ((NTSTATUS)0xC0000059L)
+#define STATUS_DATA_ERROR                   ((NTSTATUS)0xC000003EL)
+#define STATUS_WDF_BUSY                     ((NTSTATUS)0xC0200203L)
+#define STATUS_WDF_PAUSED                   ((NTSTATUS)0xC0200204L)
+
+//
+// IRQL
+//
+
+#define PASSIVE_LEVEL       0
+#define APC_LEVEL           1
+#define DISPATCH_LEVEL      2
+
+KIRQL KeGetCurrentIrql(VOID);
+
+//
+// I/O control codes
+//
+
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+#define METHOD_FROM_CTL_CODE(ctrlCode)  ((ULONG)((ctrlCode) & 3))
+
+#define METHOD_BUFFERED     0
+#define METHOD_IN_DIRECT    1
+#define METHOD_OUT_DIRECT   2
+#define METHOD_NEITHER      3
+
+#define FILE_ANY_ACCESS     0
+#define FILE_READ_ACCESS    0x0001
+#define FILE_WRITE_ACCESS   0x0002
+
+//
+// Debug output
+//
+
+#define KdPrint(_x_)        ((void)0)
+#define DbgPrint            printf
+#define NT_ASSERT(e)        ((void)0)
+#define ASSERT(e)           ((void)0)
+
+//
+// Memory
+//
+
+typedef enum _POOL_TYPE
+{
+    NonPagedPool,
+    PagedPool,
+    NonPagedPoolNx = 512
+} POOL_TYPE;
+
+PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag);
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag);
+VOID ExFreePool(PVOID P);
+
+#define RtlZeroMemory(Destination, Length)          memset((Destination), 0, (Length))
+#define RtlFillMemory(Destination, Length, Fill)    memset((Destination), (Fill), (Length))
+#define RtlCopyMemory(Destination, Source, Length)  memcpy((Destination), (Source), (Length))
+#define RtlMoveMemory(Destination, Source, Length)  memmove((Destination), (Source), (Length))
+#define RtlEqualMemory(Destination, Source, Length) (!memcmp((Destination), (Source), (Length)))
+
+SIZE_T RtlCompareMemory(const VOID* Source1, const VOID* Source2, SIZE_T Length);
+
+//
+// Strings
+//
+
+typedef struct _UNICODE_STRING
+{
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCH Buffer;
+} UNICODE_STRING;
+
+typedef UNICODE_STRING* PUNICODE_STRING;
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+#define DECLARE_CONST_UNICODE_STRING(_var, _string)             \
+    const WCHAR _var ## _buffer[] = _string;                    \
+    const UNICODE_STRING _var = {                               \
+        sizeof(_string) - sizeof(WCHAR),                        \
+        sizeof(_string),                                        \
+        (PWCH)_var ## _buffer }
+
+#define DECLARE_UNICODE_STRING_SIZE(_var, _size)                \
+    WCHAR _var ## _buffer[_size];                               \
+    UNICODE_STRING _var = { 0, (_size) * sizeof(WCHAR), _var ## _buffer }
+
+BOOLEAN RtlEqualUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive);
+VOID RtlInitUnicodeString(PUNICODE_STRING DestinationString, PCWSTR SourceString);
+int wcscpy_s(WCHAR* Destination, SIZE_T Size, const WCHAR* Source);
+int wcsncpy_s(WCHAR* Destination, SIZE_T Size, const WCHAR* Source, SIZE_T Count);
+
+//
+// Interlocked operations
+//
+
+#define InterlockedIncrement(p)             __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p)             __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64(p)           __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement64(p)           __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedAdd(p, v)                __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedAdd64(p, v)              __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(p, v)        __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd64(p, v)      __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v)           __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(p, v)         __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedOr(p, v)                 __atomic_fetch_or((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedAnd(p, v)                __atomic_fetch_and((p), (v), __ATOMIC_SEQ_CST)
+
+FORCEINLINE LONG InterlockedCompareExchange(volatile LONG* Destination, LONG Exchange, LONG Comperand)
+{
+    __atomic_compare_exchange_n(Destination, &Comperand, Exchange, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comperand;
+}
+
+FORCEINLINE LONG64 InterlockedCompareExchange64(volatile LONG64* Destination, LONG64 Exchange, LONG64 Comperand)
+{
+    __atomic_compare_exchange_n(Destination, &Comperand, Exchange, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comperand;
+}
+
+FORCEINLINE PVOID InterlockedCompareExchangePointer(PVOID volatile* Destination, PVOID Exchange, PVOID Comperand)
+{
+    __atomic_compare_exchange_n(Destination, &Comperand, Exchange, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comperand;
+}
+
+FORCEINLINE PVOID InterlockedExchangePointer(PVOID volatile* Target, PVOID Value)
+{
+    return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE BOOLEAN _BitScanReverse(PULONG Index, ULONG Mask)
+{
+    if (Mask == 0) {
+        return FALSE;
+    }
+
+    *Index = 31 - (ULONG)__builtin_clz(Mask);
+    return TRUE;
+}
+
+#define ReadAcquire(p)                      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ReadNoFence(p)                      __atomic_load_n((p), __ATOMIC_RELAXED)
+#define ReadNoFence64(p)                    __atomic_load_n((p), __ATOMIC_RELAXED)
+#define WriteRelease(p, v)                  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define WriteNoFence(p, v)                  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define KeMemoryBarrier()                   __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define YieldProcessor()                    __builtin_ia32_pause()
+
+//
+// Processes, processors and time
+//
+
+HANDLE PsGetCurrentProcessId(VOID);
+ULONG KeGetCurrentProcessorNumberEx(PVOID ProcNumber);
+ULONG KeQueryMaximumProcessorCountEx(USHORT GroupNumber);
+ULONGLONG KeQueryInterruptTime(VOID);
+VOID KeQuerySystemTime(PLARGE_INTEGER CurrentTime);
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequency);
+
+#define ALL_PROCESSOR_GROUPS    0xFFFF
+
+//
+// Synchronization
+//
+
+typedef enum _EVENT_TYPE
+{
+    NotificationEvent,
+    SynchronizationEvent
+} EVENT_TYPE;
+
+typedef enum _KWAIT_REASON
+{
+    Executive
+} KWAIT_REASON;
+
+typedef enum _MODE
+{
+    KernelMode,
+    UserMode
+} KPROCESSOR_MODE, MODE;
+
+typedef struct _KEVENT
+{
+    volatile LONG   State;
+    EVENT_TYPE      Type;
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+VOID KeInitializeEvent(PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State);
+LONG KeSetEvent(PRKEVENT Event, LONG Increment, BOOLEAN Wait);
+VOID KeClearEvent(PRKEVENT Event);
+LONG KeReadStateEvent(PRKEVENT Event);
+NTSTATUS KeWaitForSingleObject(PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout);
+NTSTATUS KeDelayExecutionThread(KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Interval);
+
+#define IO_NO_INCREMENT     0
+
+typedef volatile LONG       KSPIN_LOCK;
+typedef KSPIN_LOCK*         PKSPIN_LOCK;
+
+VOID KeInitializeSpinLock(PKSPIN_LOCK SpinLock);
+VOID KeAcquireSpinLock(PKSPIN_LOCK SpinLock, PKIRQL OldIrql);
+VOID KeReleaseSpinLock(PKSPIN_LOCK SpinLock, KIRQL NewIrql);
+
+typedef volatile LONG       EX_SPIN_LOCK;
+typedef EX_SPIN_LOCK*       PEX_SPIN_LOCK;
+
+KIRQL ExAcquireSpinLockShared(PEX_SPIN_LOCK SpinLock);
+VOID ExReleaseSpinLockShared(PEX_SPIN_LOCK SpinLock, KIRQL OldIrql);
+KIRQL ExAcquireSpinLockExclusive(PEX_SPIN_LOCK SpinLock);
+VOID ExReleaseSpinLockExclusive(PEX_SPIN_LOCK SpinLock, KIRQL OldIrql);
+
+typedef struct _EX_RUNDOWN_REF
+{
+    volatile LONG_PTR Count;
+} EX_RUNDOWN_REF, *PEX_RUNDOWN_REF;
+
+VOID ExInitializeRundownProtection(PEX_RUNDOWN_REF RunRef);
+VOID ExReInitializeRundownProtection(PEX_RUNDOWN_REF RunRef);
+BOOLEAN ExAcquireRundownProtection(PEX_RUNDOWN_REF RunRef);
+VOID ExReleaseRundownProtection(PEX_RUNDOWN_REF RunRef);
+VOID ExWaitForRundownProtectionRelease(PEX_RUNDOWN_REF RunRef);
+
+//
+// Device objects and IRPs (just enough for IRP_MN_QUERY_ID)
+//
+
+#define MAX_DEVICE_ID_LEN   200
+
+typedef enum
+{
+    BusQueryDeviceID = 0,
+    BusQueryHardwareIDs = 1,
+    BusQueryCompatibleIDs = 2,
+    BusQueryInstanceID = 3,
+    BusQueryDeviceSerialNumber = 4,
+    BusQueryContainerID = 5
+} BUS_QUERY_ID_TYPE, *PBUS_QUERY_ID_TYPE;
+
+typedef enum _DEVICE_REGISTRY_PROPERTY
+{
+    DevicePropertyDeviceDescription = 0,
+    DevicePropertyHardwareID = 1,
+    DevicePropertyCompatibleIDs = 2,
+    DevicePropertyClassName = 4,
+    DevicePropertyClassGuid = 5
+} DEVICE_REGISTRY_PROPERTY;
+
+typedef struct _DEVICE_OBJECT
+{
+    PVOID   SimPdo;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+typedef struct _DRIVER_OBJECT
+{
+    PVOID   SimDriver;
+} DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+typedef struct _IO_STATUS_BLOCK
+{
+    NTSTATUS    Status;
+    ULONG_PTR   Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+#define IRP_MJ_PNP          0x1b
+#define IRP_MN_QUERY_ID     0x13
+
+typedef struct _IO_STACK_LOCATION
+{
+    UCHAR MajorFunction;
+    UCHAR MinorFunction;
+    union
+    {
+        struct
+        {
+            BUS_QUERY_ID_TYPE IdType;
+        } QueryId;
+    } Parameters;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+typedef struct _IRP
+{
+    IO_STATUS_BLOCK     IoStatus;
+    IO_STACK_LOCATION   Stack;
+    PIO_STATUS_BLOCK    UserIosb;
+    PKEVENT             UserEvent;
+} IRP, *PIRP;
+
+PIRP IoBuildSynchronousFsdRequest(ULONG MajorFunction, PDEVICE_OBJECT DeviceObject, PVOID Buffer,
+    ULONG Length, PLARGE_INTEGER StartingOffset, PKEVENT Event, PIO_STATUS_BLOCK IoStatusBlock);
+NTSTATUS IoCallDriver(PDEVICE_OBJECT DeviceObject, PIRP Irp);
+PIO_STACK_LOCATION IoGetNextIrpStackLocation(PIRP Irp);
+
+typedef NTSTATUS DRIVER_INITIALIZE(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+
+//
+// WPP stand-ins; tracing is compiled out in the simulation
+//
+
+#define WPP_INIT_TRACING(DriverObject, RegistryPath)    ((void)0)
+#define WPP_CLEANUP(DriverObject)                       ((void)0)
+
+#define TRACE_LEVEL_NONE        0
+#define TRACE_LEVEL_CRITICAL    1
+#define TRACE_LEVEL_FATAL       1
+#define TRACE_LEVEL_ERROR       2
+#define TRACE_LEVEL_WARNING     3
+#define TRACE_LEVEL_INFORMATION 4
+#define TRACE_LEVEL_VERBOSE     5
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ntddk.h"
+
+FORCEINLINE NTSTATUS RtlULongAdd(ULONG Augend, ULONG Addend, PULONG Result)
+{
+    if (__builtin_add_overflow(Augend, Addend, Result)) {
+        *Result = MAXULONG;
+        return STATUS_INTEGER_OVERFLOW;
+    }
+    return STATUS_SUCCESS;
+}
+
+FORCEINLINE NTSTATUS RtlULongMult(ULONG Multiplicand, ULONG Multiplier, PULONG Result)
+{
+    if (__builtin_mul_overflow(Multiplicand, Multiplier, Result)) {
+        *Result = MAXULONG;
+        return STATUS_INTEGER_OVERFLOW;
+    }
+    return STATUS_SUCCESS;
+}
+
+FORCEINLINE NTSTATUS RtlSizeTAdd(size_t Augend, size_t Addend, size_t* Result)
+{
+    if (__builtin_add_overflow(Augend, Addend, Result)) {
+        *Result = (size_t)-1;
+        return STATUS_INTEGER_OVERFLOW;
+    }
+    return STATUS_SUCCESS;
+}
+
+FORCEINLINE NTSTATUS RtlSizeTMult(size_t Multiplicand, size_t Multiplier, size_t* Result)
+{
+    if (__builtin_mul_overflow(Multiplicand, Multiplier, Result)) {
+        *Result = (size_t)-1;
+        return STATUS_INTEGER_OVERFLOW;
+    }
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,4 @@
+//
+// Case-insensitive include shim for ../../sys/Queue.h
+//
+#include "../../sys/Queue.h"
@@ -0,0 +1,8 @@
+//
+// WPP is not available in user mode, tracing compiles to nothing.
+//
+
+#pragma once
+
+#define TraceEvents(...)    ((void)0)
+#define Trace(...)          ((void)0)
@@ -0,0 +1,1182 @@
+/*
+* Synthetic open/close load against the simulated HidGuardian driver.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+//
+// Models many processes (a Zipf-distributed population, so a few of them
+// - the game, Steam, an anti-cheat scanner - do most of the opening)
+// hammering a set of guarded pads while a Cerberus stand-in answers each
+// create request after a configurable think time. Open latency is
+// measured from the caller's side and reported together with the
+// throughput and sticky cache counters as a single JSON object on stdout.
+//
+// With --trace-out the driver's access trace is drained while the load
+// runs and written to a file that sim/replay can play back. With --stages
+// the driver's stage trace is drained as well and the time spent between
+// consecutive lifecycle stages is reported next to the path latencies.
+// --events-out saves the driver's event log for sim/decode.
+//
+// The Cerberus stand-in feeds the OpenMetrics exporter of HidCerberus
+// (cerberus/) with its callback latency and queue depth; --metrics-port
+// serves scrapes while the load runs, --metrics-out writes one at the end.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "Sim.h"
+#include "HidGuardian.h"
+#include "LatencyHistogram.h"
+#include "HidCerberusMetrics.h"
+
+#define LOADGEN_CERBERUS_PID    50
+#define LOADGEN_FIRST_PID       1000
+
+typedef enum _LOADGEN_THINK_DIST
+{
+    LoadGenThinkFixed,
+    LoadGenThinkUniform,
+    LoadGenThinkExponential
+
+} LOADGEN_THINK_DIST;
+
+typedef struct _LOADGEN_CONFIG
+{
+    ULONG Devices;
+
+    //
+    // Guarded pads that arrive but never get opened
+    //
+    ULONG IdleDevices;
+
+    ULONG Processes;
+
+    double ZipfExponent;
+
+    ULONG Openers;
+
+    ULONG OpsPerOpener;
+
+    //
+    // Probability of an operation being an open (the rest close a held handle)
+    //
+    double OpenRatio;
+
+    ULONG MaxHeldHandles;
+
+    LOADGEN_THINK_DIST ThinkDist;
+
+    ULONG ThinkMeanUs;
+
+    //
+    // Share of processes Cerberus marks sticky / denies
+    //
+    double StickyRatio;
+
+    double DenyRatio;
+
+    ULONG CacheCapacity;
+
+    ULONG CacheTtlSeconds;
+
+    ULONG GuardIdleSeconds;
+
+    //
+    // Driver admission control, see OpenRateLimit and friends
+    //
+    ULONG OpenRateLimit;
+
+    ULONG OpenRateBurst;
+
+    ULONG OpenExcessAction;
+
+    ULONG PendingQueueLimit;
+
+    //
+    // Time the bus driver takes per IRP_MN_QUERY_ID
+    //
+    ULONG QueryIdUs;
+
+    ULONG Seed;
+
+    const char* TraceOut;
+
+    BOOLEAN Stages;
+
+    const char* EventsOut;
+
+    const char* MetricsOut;
+
+    USHORT MetricsPort;
+
+} LOADGEN_CONFIG;
+
+typedef struct _LOADGEN_CERBERUS
+{
+    PSIM_HANDLE Handle;
+
+    pthread_t Thread;
+
+    ULONG Seed;
+
+    ULONG Answered;
+
+} LOADGEN_CERBERUS;
+
+typedef struct _LOADGEN_OPENER
+{
+    pthread_t Thread;
+
+    ULONG Seed;
+
+    PSIM_HANDLE* Held;
+
+    ULONG HeldCount;
+
+    ULONGLONG* Latencies;
+
+    ULONG Opens;
+
+    ULONG Allowed;
+
+    ULONG Closes;
+
+} LOADGEN_OPENER;
+
+static LOADGEN_CONFIG LoadGenConfig =
+{
+    30,                     // Devices
+    0,                      // IdleDevices
+    200,                    // Processes
+    1.1,                    // ZipfExponent
+    16,                     // Openers
+    2000,                   // OpsPerOpener
+    0.6,                    // OpenRatio
+    4,                      // MaxHeldHandles
+    LoadGenThinkExponential,
+    50,                     // ThinkMeanUs
+    0.5,                    // StickyRatio
+    0.1,                    // DenyRatio
+    256,                    // CacheCapacity
+    0,                      // CacheTtlSeconds
+    30,                     // GuardIdleSeconds
+    0,                      // OpenRateLimit
+    16,                     // OpenRateBurst
+    0,                      // OpenExcessAction
+    256,                    // PendingQueueLimit
+    0,                      // QueryIdUs
+    0x48474C47,             // Seed
+    NULL,                   // TraceOut
+    FALSE,                  // Stages
+    NULL,                   // EventsOut
+    NULL,                   // MetricsOut
+    0                       // MetricsPort
+};
+
+static PSIM_PDO* LoadGenPads;
+static double* LoadGenZipfCdf;
+
+//
+// Opens issued per process, to check the driver's top openers against
+//
+static volatile LONG* LoadGenPidOpens;
+static volatile LONG LoadGenStop = 0;
+static volatile LONG LoadGenTracing = 0;
+
+#define LOADGEN_TRACE_CAPACITY  0x10000
+
+//
+// Top openers reported
+//
+#define LOADGEN_TOP_OPENERS     10
+
+//
+// Access records collected from the driver
+//
+static PHIDGUARDIAN_ACCESS_RECORD LoadGenTrace;
+static ULONG LoadGenTraceCount;
+static ULONG LoadGenTraceDropped;
+
+//
+// Time from the previous reached stage to each stage, 100ns ticks
+//
+static HIDGUARDIAN_LATENCY_HISTOGRAM LoadGenStageGaps[HIDGUARDIAN_STAGE_COUNT];
+static ULONG LoadGenStageCount;
+static ULONG LoadGenStageDropped;
+
+//
+// Event log drains are appended to this file as returned by the driver
+//
+static FILE* LoadGenEvents;
+static ULONG LoadGenEventCount;
+static ULONG LoadGenEventDropped;
+
+//
+// Service metrics as HidCerberus would collect them
+//
+static PHC_METRICS LoadGenMetrics;
+
+static const char* LoadGenThinkNames[] = { "fixed", "uniform", "exp" };
+
+//
+// Indexed by the driver's OPEN_EXCESS_* values
+//
+static const char* LoadGenExcessNames[] = { "fail", "default", "defer" };
+
+//
+// xorshift32, one state per thread so runs are reproducible
+//
+static ULONG LoadGenRandom(ULONG* State)
+{
+    ULONG x = *State;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *State = x;
+}
+
+static double LoadGenUniform(ULONG* State)
+{
+    return (LoadGenRandom(State) >> 8) / (double)(1 << 24);
+}
+
+//
+// Stable per-process property so a PID always gets the same verdict
+//
+static BOOLEAN LoadGenPidHas(ULONG Pid, ULONG Salt, double Ratio)
+{
+    ULONG h = (Pid ^ Salt) * 0x9E3779B1;
+
+    h ^= h >> 15;
+
+    return (h % 10000) < (ULONG)(Ratio * 10000);
+}
+
+static BOOLEAN LoadGenBuildZipf(VOID)
+{
+    double sum = 0;
+    ULONG i;
+
+    LoadGenZipfCdf = malloc(sizeof(double) * LoadGenConfig.Processes);
+
+    if (LoadGenZipfCdf == NULL) {
+        return FALSE;
+    }
+
+    for (i = 0; i < LoadGenConfig.Processes; i++) {
+        sum += 1.0 / pow(i + 1, LoadGenConfig.ZipfExponent);
+        LoadGenZipfCdf[i] = sum;
+    }
+
+    for (i = 0; i < LoadGenConfig.Processes; i++) {
+        LoadGenZipfCdf[i] /= sum;
+    }
+
+    return TRUE;
+}
+
+static ULONG LoadGenZipfPid(ULONG* State)
+{
+    double u = LoadGenUniform(State);
+    ULONG low = 0;
+    ULONG high = LoadGenConfig.Processes - 1;
+    ULONG mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+
+        if (LoadGenZipfCdf[mid] < u)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return LOADGEN_FIRST_PID + 4 * low;
+}
+
+static VOID LoadGenThink(ULONG* State)
+{
+    double us = LoadGenConfig.ThinkMeanUs;
+    struct timespec ts;
+
+    switch (LoadGenConfig.ThinkDist)
+    {
+    case LoadGenThinkUniform:
+        us = 2 * us * LoadGenUniform(State);
+        break;
+    case LoadGenThinkExponential:
+        us = -us * log(1.0 - LoadGenUniform(State));
+        break;
+    default:
+        break;
+    }
+
+    if (us < 1) {
+        return;
+    }
+
+    ts.tv_sec = (time_t)(us / 1e6);
+    ts.tv_nsec = (long)(fmod(us, 1e6) * 1000);
+
+    nanosleep(&ts, NULL);
+}
+
+//
+// One Cerberus worker per device, same loop as HidCerberus: park a
+// notification, fetch the pending request, think, answer
+//
+static void* LoadGenCerberusThread(void* Context)
+{
+    LOADGEN_CERBERUS* worker = Context;
+    ULONG size = sizeof(HIDGUARDIAN_GET_CREATE_REQUEST) + 1024;
+    PHIDGUARDIAN_GET_CREATE_REQUEST get = calloc(1, size);
+    HIDGUARDIAN_SET_CREATE_REQUEST set;
+    PSIM_IRP notify;
+    NTSTATUS status;
+    ULONG requestId = 0;
+    ULONGLONG start;
+
+    SimSetCurrentProcessId(LOADGEN_CERBERUS_PID);
+
+    while (!LoadGenStop && get != NULL)
+    {
+        notify = SimDeviceIoControlAsync(worker->Handle,
+            IOCTL_HIDGUARDIAN_SUBMIT_NOTIFICATION, NULL, 0, NULL, 0);
+
+        while ((status = SimWaitIrp(notify, 50, NULL)) == STATUS_TIMEOUT && !LoadGenStop);
+
+        SimFreeIrp(notify);
+
+        if (status != STATUS_SUCCESS) {
+            break;
+        }
+
+        get->Size = size;
+        get->RequestId = ++requestId;
+
+        if (!NT_SUCCESS(SimDeviceIoControl(worker->Handle, IOCTL_HIDGUARDIAN_GET_CREATE_REQUEST,
+            get, size, get, size, NULL))) {
+            continue;
+        }
+
+        hc_metrics_queue_enter(LoadGenMetrics);
+        start = SimClockNs();
+
+        LoadGenThink(&worker->Seed);
+
+        set.RequestId = requestId;
+        set.IsAllowed = !LoadGenPidHas(get->ProcessId, 0xD3A1, LoadGenConfig.DenyRatio);
+        set.IsSticky = LoadGenPidHas(get->ProcessId, 0x571C, LoadGenConfig.StickyRatio);
+
+        hc_metrics_record_callback(LoadGenMetrics, (SimClockNs() - start) / 100);
+
+        if (NT_SUCCESS(SimDeviceIoControl(worker->Handle, IOCTL_HIDGUARDIAN_SET_CREATE_REQUEST,
+            &set, sizeof(set), NULL, 0, NULL))) {
+            worker->Answered++;
+        }
+
+        hc_metrics_queue_leave(LoadGenMetrics);
+    }
+
+    free(get);
+
+    return NULL;
+}
+
+static VOID LoadGenDrainTrace(PSIM_HANDLE Control)
+{
+    ULONG size = sizeof(HIDGUARDIAN_ACCESS_TRACE) + sizeof(HIDGUARDIAN_ACCESS_RECORD) * 4096;
+    PHIDGUARDIAN_ACCESS_TRACE trace = malloc(size);
+    PHIDGUARDIAN_ACCESS_RECORD grown;
+
+    if (trace == NULL) {
+        return;
+    }
+
+    do {
+        if (!NT_SUCCESS(SimDeviceIoControl(Control, IOCTL_HIDGUARDIAN_GET_ACCESS_TRACE,
+            NULL, 0, trace, size, NULL))) {
+            break;
+        }
+
+        grown = realloc(LoadGenTrace, sizeof(HIDGUARDIAN_ACCESS_RECORD) * (LoadGenTraceCount + trace->RecordCount));
+
+        if (grown == NULL) {
+            break;
+        }
+
+        LoadGenTrace = grown;
+        memcpy(&LoadGenTrace[LoadGenTraceCount], trace + 1, sizeof(HIDGUARDIAN_ACCESS_RECORD) * trace->RecordCount);
+        LoadGenTraceCount += trace->RecordCount;
+        LoadGenTraceDropped += trace->DroppedCount;
+
+    } while (trace->RemainingCount > 0);
+
+    free(trace);
+}
+
+static VOID LoadGenDrainEvents(PSIM_HANDLE Control)
+{
+    ULONG size = sizeof(HIDGUARDIAN_EVENT_TRACE) + sizeof(HIDGUARDIAN_EVENT_RECORD) * 4096;
+    PHIDGUARDIAN_EVENT_TRACE trace = malloc(size);
+
+    if (trace == NULL) {
+        return;
+    }
+
+    do {
+        if (!NT_SUCCESS(SimDeviceIoControl(Control, IOCTL_HIDGUARDIAN_GET_EVENTS,
+            NULL, 0, trace, size, NULL))) {
+            break;
+        }
+
+        if (fwrite(trace, trace->Size, 1, LoadGenEvents) != 1) {
+            break;
+        }
+
+        LoadGenEventCount += trace->RecordCount;
+        LoadGenEventDropped += trace->DroppedCount;
+
+    } while (trace->RemainingCount > 0 && trace->RecordCount > 0);
+
+    free(trace);
+}
+
+static void* LoadGenDrainThread(void* Context)
+{
+    struct timespec ts = { 0, 20 * 1000 * 1000 };
+
+    while (LoadGenTracing) {
+        if (LoadGenConfig.TraceOut != NULL) {
+            LoadGenDrainTrace(Context);
+        }
+
+        if (LoadGenEvents != NULL) {
+            LoadGenDrainEvents(Context);
+        }
+
+        nanosleep(&ts, NULL);
+    }
+
+    return NULL;
+}
+
+static BOOLEAN LoadGenMetricsQuery(PVOID Context, ULONG IoControlCode, PVOID Buffer, ULONG BufferLength)
+{
+    return NT_SUCCESS(SimDeviceIoControl(Context, IoControlCode, NULL, 0, Buffer, BufferLength, NULL));
+}
+
+static void* LoadGenMetricsThread(void* Context)
+{
+    if (!hc_metrics_serve(LoadGenMetrics, LoadGenConfig.MetricsPort)) {
+        fprintf(stderr, "Failed to serve metrics on port %u\n", LoadGenConfig.MetricsPort);
+    }
+
+    return NULL;
+}
+
+//
+// Same layout the IOCTL returns: one header followed by all records
+//
+static BOOLEAN LoadGenWriteTrace(const char* Path)
+{
+    HIDGUARDIAN_ACCESS_TRACE header;
+    FILE* file = fopen(Path, "wb");
+    BOOLEAN ok;
+
+    if (file == NULL) {
+        return FALSE;
+    }
+
+    header.Size = sizeof(header) + sizeof(HIDGUARDIAN_ACCESS_RECORD) * LoadGenTraceCount;
+    header.Version = HIDGUARDIAN_ACCESS_TRACE_VERSION;
+    header.RecordSize = sizeof(HIDGUARDIAN_ACCESS_RECORD);
+    header.RecordCount = LoadGenTraceCount;
+    header.DroppedCount = LoadGenTraceDropped;
+    header.RemainingCount = 0;
+
+    ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(LoadGenTrace, sizeof(HIDGUARDIAN_ACCESS_RECORD), LoadGenTraceCount, file) == LoadGenTraceCount;
+
+    return (BOOLEAN)(fclose(file) == 0 && ok);
+}
+
+static VOID LoadGenDrainStages(PSIM_HANDLE Control)
+{
+    ULONG size = sizeof(HIDGUARDIAN_STAGE_TRACE) + sizeof(HIDGUARDIAN_STAGE_RECORD) * 4096;
+    PHIDGUARDIAN_STAGE_TRACE trace = malloc(size);
+    PHIDGUARDIAN_STAGE_RECORD record;
+    ULONG i, stage, previous;
+
+    if (trace == NULL) {
+        return;
+    }
+
+    do {
+        if (!NT_SUCCESS(SimDeviceIoControl(Control, IOCTL_HIDGUARDIAN_GET_STAGE_TRACE,
+            NULL, 0, trace, size, NULL))) {
+            break;
+        }
+
+        record = (PHIDGUARDIAN_STAGE_RECORD)(trace + 1);
+
+        for (i = 0; i < trace->RecordCount; i++, record++)
+        {
+            previous = HIDGUARDIAN_STAGE_ARRIVAL;
+
+            for (stage = HIDGUARDIAN_STAGE_ARRIVAL + 1; stage < HIDGUARDIAN_STAGE_COUNT; stage++)
+            {
+                if (!(record->StageMask & (1 << stage))) {
+                    continue;
+                }
+
+                LATENCY_HISTOGRAM_RECORD(&LoadGenStageGaps[stage],
+                    record->StageOffsets[stage] - min(record->StageOffsets[previous], record->StageOffsets[stage]));
+                previous = stage;
+            }
+        }
+
+        LoadGenStageCount += trace->RecordCount;
+        LoadGenStageDropped += trace->DroppedCount;
+
+    } while (trace->RemainingCount > 0);
+
+    free(trace);
+}
+
+static VOID LoadGenClose(LOADGEN_OPENER* Opener)
+{
+    ULONG index = LoadGenRandom(&Opener->Seed) % Opener->HeldCount;
+
+    SimCloseHandle(Opener->Held[index]);
+    Opener->Held[index] = Opener->Held[--Opener->HeldCount];
+    Opener->Closes++;
+}
+
+static void* LoadGenOpenerThread(void* Context)
+{
+    LOADGEN_OPENER* opener = Context;
+    PSIM_HANDLE handle;
+    ULONGLONG start;
+    NTSTATUS status;
+    ULONG pid;
+    ULONG i;
+
+    for (i = 0; i < LoadGenConfig.OpsPerOpener; i++)
+    {
+        if (opener->HeldCount > 0
+            && (LoadGenUniform(&opener->Seed) >= LoadGenConfig.OpenRatio
+                || opener->HeldCount >= LoadGenConfig.MaxHeldHandles)) {
+            LoadGenClose(opener);
+            continue;
+        }
+
+        pid = LoadGenZipfPid(&opener->Seed);
+        InterlockedIncrement(&LoadGenPidOpens[(pid - LOADGEN_FIRST_PID) / 4]);
+
+        SimSetCurrentProcessId(pid);
+
+        start = SimClockNs();
+        status = SimOpenDevice(LoadGenPads[LoadGenRandom(&opener->Seed) % LoadGenConfig.Devices], &handle);
+        opener->Latencies[opener->Opens++] = SimClockNs() - start;
+
+        if (NT_SUCCESS(status)) {
+            opener->Allowed++;
+
+            if (LoadGenConfig.MaxHeldHandles > 0) {
+                opener->Held[opener->HeldCount++] = handle;
+            }
+            else {
+                SimCloseHandle(handle);
+                opener->Closes++;
+            }
+        }
+    }
+
+    while (opener->HeldCount > 0) {
+        LoadGenClose(opener);
+    }
+
+    return NULL;
+}
+
+static int LoadGenCompare(const void* A, const void* B)
+{
+    ULONGLONG a = *(const ULONGLONG*)A;
+    ULONGLONG b = *(const ULONGLONG*)B;
+
+    return (a > b) - (a < b);
+}
+
+//
+// Lower bound of the bucket holding the percentile, 100ns ticks to us
+//
+static double LoadGenHistogramPercentileUs(const HIDGUARDIAN_LATENCY_HISTOGRAM* Histogram, double Percentile)
+{
+    ULONG64 rank = (ULONG64)ceil(Percentile / 100.0 * Histogram->Count);
+    ULONG64 seen = 0;
+    ULONG i;
+
+    for (i = 0; i < HIDGUARDIAN_LATENCY_BUCKETS; i++) {
+        seen += Histogram->Buckets[i];
+
+        if (seen >= rank && seen > 0) {
+            return LATENCY_HISTOGRAM_LOWER_BOUND(i) / 10.0;
+        }
+    }
+
+    return 0;
+}
+
+static double LoadGenPercentileUs(const ULONGLONG* Sorted, ULONG Count, double Percentile)
+{
+    ULONG index;
+
+    if (Count == 0) {
+        return 0;
+    }
+
+    index = (ULONG)ceil(Percentile / 100.0 * Count);
+
+    return Sorted[index ? index - 1 : 0] / 1000.0;
+}
+
+static VOID LoadGenUsage(const char* Name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --devices N          guarded pads (%u)\n"
+        "  --idle-devices N     guarded pads that are never opened (%u)\n"
+        "  --processes N        size of the PID population (%u)\n"
+        "  --zipf S             Zipf exponent of the PID distribution (%.2f)\n"
+        "  --openers N          concurrent opener threads (%u)\n"
+        "  --ops N              operations per opener (%u)\n"
+        "  --open-ratio R       share of operations that open, the rest close (%.2f)\n"
+        "  --max-held N         handles an opener keeps before closing (%u)\n"
+        "  --think-dist D       Cerberus think time: fixed, uniform or exp (%s)\n"
+        "  --think-us N         mean Cerberus think time in microseconds (%u)\n"
+        "  --sticky-ratio R     share of processes given sticky verdicts (%.2f)\n"
+        "  --deny-ratio R       share of processes denied (%.2f)\n"
+        "  --cache-capacity N   StickyCacheCapacity (%u)\n"
+        "  --cache-ttl N        StickyCacheTtlSeconds (%u)\n"
+        "  --guard-idle N       GuardIdleSeconds (%u)\n"
+        "  --open-rate N        OpenRateLimit, opens per second and process (%u)\n"
+        "  --open-burst N       OpenRateBurst (%u)\n"
+        "  --excess-action A    OpenExcessAction: fail, default or defer (%s)\n"
+        "  --pending-limit N    PendingQueueLimit (%u)\n"
+        "  --query-id-us N      bus driver time per device/instance ID query (%u)\n"
+        "  --seed N             random seed (0x%X)\n"
+        "  --trace-out FILE     record the access trace for sim/replay\n"
+        "  --stages             report time spent between request lifecycle stages\n"
+        "  --events-out FILE    save the driver's event log for sim/decode\n"
+        "  --metrics-out FILE   write an OpenMetrics scrape at the end of the run\n"
+        "  --metrics-port N     serve OpenMetrics on 127.0.0.1:N while the load runs\n",
+        Name,
+        LoadGenConfig.Devices, LoadGenConfig.IdleDevices, LoadGenConfig.Processes, LoadGenConfig.ZipfExponent,
+        LoadGenConfig.Openers, LoadGenConfig.OpsPerOpener, LoadGenConfig.OpenRatio,
+        LoadGenConfig.MaxHeldHandles, LoadGenThinkNames[LoadGenConfig.ThinkDist],
+        LoadGenConfig.ThinkMeanUs, LoadGenConfig.StickyRatio, LoadGenConfig.DenyRatio,
+        LoadGenConfig.CacheCapacity, LoadGenConfig.CacheTtlSeconds, LoadGenConfig.GuardIdleSeconds,
+        LoadGenConfig.OpenRateLimit, LoadGenConfig.OpenRateBurst,
+        LoadGenExcessNames[LoadGenConfig.OpenExcessAction], LoadGenConfig.PendingQueueLimit,
+        LoadGenConfig.QueryIdUs, LoadGenConfig.Seed);
+}
+
+static BOOLEAN LoadGenParse(int argc, char* argv[])
+{
+    static const struct option options[] =
+    {
+        { "devices",        required_argument, NULL, 'd' },
+        { "idle-devices",   required_argument, NULL, 'i' },
+        { "processes",      required_argument, NULL, 'p' },
+        { "zipf",           required_argument, NULL, 'z' },
+        { "openers",        required_argument, NULL, 'o' },
+        { "ops",            required_argument, NULL, 'n' },
+        { "open-ratio",     required_argument, NULL, 'r' },
+        { "max-held",       required_argument, NULL, 'm' },
+        { "think-dist",     required_argument, NULL, 'D' },
+        { "think-us",       required_argument, NULL, 't' },
+        { "sticky-ratio",   required_argument, NULL, 's' },
+        { "deny-ratio",     required_argument, NULL, 'x' },
+        { "cache-capacity", required_argument, NULL, 'c' },
+        { "cache-ttl",      required_argument, NULL, 'T' },
+        { "guard-idle",     required_argument, NULL, 'g' },
+        { "open-rate",      required_argument, NULL, 'R' },
+        { "open-burst",     required_argument, NULL, 'B' },
+        { "excess-action",  required_argument, NULL, 'A' },
+        { "pending-limit",  required_argument, NULL, 'l' },
+        { "query-id-us",    required_argument, NULL, 'q' },
+        { "seed",           required_argument, NULL, 'S' },
+        { "trace-out",      required_argument, NULL, 'O' },
+        { "stages",         no_argument,       NULL, 'L' },
+        { "events-out",     required_argument, NULL, 'E' },
+        { "metrics-out",    required_argument, NULL, 'M' },
+        { "metrics-port",   required_argument, NULL, 'P' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    ULONG i;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'd': LoadGenConfig.Devices = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'i': LoadGenConfig.IdleDevices = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'p': LoadGenConfig.Processes = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'z': LoadGenConfig.ZipfExponent = strtod(optarg, NULL); break;
+        case 'o': LoadGenConfig.Openers = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'n': LoadGenConfig.OpsPerOpener = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'r': LoadGenConfig.OpenRatio = strtod(optarg, NULL); break;
+        case 'm': LoadGenConfig.MaxHeldHandles = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 't': LoadGenConfig.ThinkMeanUs = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 's': LoadGenConfig.StickyRatio = strtod(optarg, NULL); break;
+        case 'x': LoadGenConfig.DenyRatio = strtod(optarg, NULL); break;
+        case 'c': LoadGenConfig.CacheCapacity = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'T': LoadGenConfig.CacheTtlSeconds = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'g': LoadGenConfig.GuardIdleSeconds = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'R': LoadGenConfig.OpenRateLimit = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'B': LoadGenConfig.OpenRateBurst = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'l': LoadGenConfig.PendingQueueLimit = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'q': LoadGenConfig.QueryIdUs = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'S': LoadGenConfig.Seed = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'O': LoadGenConfig.TraceOut = optarg; break;
+        case 'L': LoadGenConfig.Stages = TRUE; break;
+        case 'E': LoadGenConfig.EventsOut = optarg; break;
+        case 'M': LoadGenConfig.MetricsOut = optarg; break;
+        case 'P': LoadGenConfig.MetricsPort = (USHORT)strtoul(optarg, NULL, 0); break;
+        case 'D':
+            for (i = 0; i < ARRAYSIZE(LoadGenThinkNames); i++) {
+                if (strcmp(optarg, LoadGenThinkNames[i]) == 0)
+                    break;
+            }
+            if (i == ARRAYSIZE(LoadGenThinkNames))
+                return FALSE;
+            LoadGenConfig.ThinkDist = (LOADGEN_THINK_DIST)i;
+            break;
+        case 'A':
+            for (i = 0; i < ARRAYSIZE(LoadGenExcessNames); i++) {
+                if (strcmp(optarg, LoadGenExcessNames[i]) == 0)
+                    break;
+            }
+            if (i == ARRAYSIZE(LoadGenExcessNames))
+                return FALSE;
+            LoadGenConfig.OpenExcessAction = i;
+            break;
+        default:
+            return FALSE;
+        }
+    }
+
+    return optind == argc
+        && LoadGenConfig.Devices > 0
+        && LoadGenConfig.Processes > 0
+        && LoadGenConfig.Openers > 0
+        && LoadGenConfig.OpenRatio > 0
+        && LoadGenConfig.Seed != 0;
+}
+
+int main(int argc, char* argv[])
+{
+    LOADGEN_CERBERUS* workers;
+    LOADGEN_OPENER* openers;
+    HIDGUARDIAN_STICKY_CACHE_STATS stats;
+    HIDGUARDIAN_PERF_COUNTERS counters;
+    HIDGUARDIAN_IDENTITY_POOL_STATS pool;
+    HIDGUARDIAN_DEVICE_ADD_STATS adds;
+    HIDGUARDIAN_LATENCY_HISTOGRAMS histograms;
+    struct
+    {
+        HIDGUARDIAN_TOP_OPENERS Header;
+        HIDGUARDIAN_TOP_OPENER Entries[LOADGEN_TOP_OPENERS];
+    } top;
+    static const char* pathNames[HIDGUARDIAN_ACCESS_PATH_COUNT] =
+    {
+        "system", "system_pid", "cerberus", "sticky", "verdict", "default", "timeout", "limited"
+    };
+    static const char* stageNames[HIDGUARDIAN_STAGE_COUNT] =
+    {
+        "arrival", "pending", "notified", "pickup", "auth_queued", "verdict", "completed"
+    };
+    PSIM_HANDLE control = NULL;
+    pthread_t drain;
+    pthread_t metrics;
+    PSIM_PDO master;
+    PSIM_PDO idle;
+    WCHAR instanceId[32];
+    ULONGLONG* latencies;
+    ULONGLONG start, elapsed, arrivals, total = 0;
+    ULONG opens = 0, allowed = 0, closes = 0, answered = 0;
+    ULONG i;
+
+    if (!LoadGenParse(argc, argv)) {
+        LoadGenUsage(argv[0]);
+        return 1;
+    }
+
+    LoadGenPads = calloc(LoadGenConfig.Devices, sizeof(PSIM_PDO));
+    LoadGenPidOpens = calloc(LoadGenConfig.Processes, sizeof(LONG));
+    workers = calloc(LoadGenConfig.Devices, sizeof(LOADGEN_CERBERUS));
+    openers = calloc(LoadGenConfig.Openers, sizeof(LOADGEN_OPENER));
+    latencies = malloc(sizeof(ULONGLONG) * LoadGenConfig.Openers * (LoadGenConfig.OpsPerOpener + 1));
+
+    if (LoadGenPads == NULL || LoadGenPidOpens == NULL || workers == NULL || openers == NULL || latencies == NULL
+        || !LoadGenBuildZipf()) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    SimRegistrySetULong(L"StickyCacheCapacity", LoadGenConfig.CacheCapacity);
+    SimRegistrySetULong(L"StickyCacheTtlSeconds", LoadGenConfig.CacheTtlSeconds);
+    SimRegistrySetULong(L"GuardIdleSeconds", LoadGenConfig.GuardIdleSeconds);
+    SimRegistrySetULong(L"OpenRateLimit", LoadGenConfig.OpenRateLimit);
+    SimRegistrySetULong(L"OpenRateBurst", LoadGenConfig.OpenRateBurst);
+    SimRegistrySetULong(L"OpenExcessAction", LoadGenConfig.OpenExcessAction);
+    SimRegistrySetULong(L"PendingQueueLimit", LoadGenConfig.PendingQueueLimit);
+
+    if (LoadGenConfig.TraceOut != NULL) {
+        SimRegistrySetULong(L"AccessTraceCapacity", LOADGEN_TRACE_CAPACITY);
+    }
+
+    if (LoadGenConfig.Stages) {
+        SimRegistrySetULong(L"StageTraceCapacity", LOADGEN_TRACE_CAPACITY);
+    }
+
+    if (LoadGenConfig.EventsOut != NULL) {
+        SimRegistrySetULong(L"EventLogCapacity", LOADGEN_TRACE_CAPACITY);
+    }
+
+    if (LoadGenConfig.EventsOut != NULL) {
+        LoadGenEvents = fopen(LoadGenConfig.EventsOut, "wb");
+
+        if (LoadGenEvents == NULL) {
+            fprintf(stderr, "Failed to open %s\n", LoadGenConfig.EventsOut);
+            return 1;
+        }
+    }
+
+    if (!NT_SUCCESS(SimDriverLoad())) {
+        fprintf(stderr, "DriverEntry failed\n");
+        return 1;
+    }
+
+    SimSetQueryIdDelay(LoadGenConfig.QueryIdUs);
+
+    arrivals = SimClockNs();
+
+    SimDeviceArrival(L"ROOT\\SYSTEM", L"0000", L"Nefarius\\HidGuardian\\Gen4\0", L"System", &master);
+
+    for (i = 0; i < LoadGenConfig.Devices; i++)
+    {
+        swprintf(instanceId, ARRAYSIZE(instanceId), L"7&%X&0&0000", i);
+
+        if (!NT_SUCCESS(SimDeviceArrival(L"HID\\VID_054C&PID_05C4", instanceId,
+            L"HID\\VID_054C&PID_05C4\0HID_DEVICE_SYSTEM_GAME\0HID_DEVICE\0", L"HIDClass", &LoadGenPads[i]))) {
+            fprintf(stderr, "AddDevice failed for pad %u\n", i);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < LoadGenConfig.IdleDevices; i++)
+    {
+        swprintf(instanceId, ARRAYSIZE(instanceId), L"7&%X&1&0000", i);
+
+        if (!NT_SUCCESS(SimDeviceArrival(L"HID\\VID_054C&PID_09CC", instanceId,
+            L"HID\\VID_054C&PID_09CC\0HID_DEVICE_SYSTEM_GAME\0HID_DEVICE\0", L"HIDClass", &idle))) {
+            fprintf(stderr, "AddDevice failed for idle pad %u\n", i);
+            return 1;
+        }
+    }
+
+    arrivals = SimClockNs() - arrivals;
+
+    SimSetCurrentProcessId(LOADGEN_CERBERUS_PID);
+    SimOpenControlDevice(&control);
+
+    LoadGenMetrics = hc_metrics_create(LoadGenConfig.Devices + LoadGenConfig.IdleDevices + 1,
+        LoadGenMetricsQuery, control);
+
+    if (LoadGenMetrics == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    if (LoadGenConfig.MetricsPort != 0) {
+        pthread_create(&metrics, NULL, LoadGenMetricsThread, NULL);
+    }
+
+    for (i = 0; i < LoadGenConfig.Devices; i++)
+    {
+        workers[i].Seed = LoadGenConfig.Seed ^ (0x85EBCA6B * (i + 1));
+        SimOpenDevice(LoadGenPads[i], &workers[i].Handle);
+        pthread_create(&workers[i].Thread, NULL, LoadGenCerberusThread, &workers[i]);
+    }
+
+    if (LoadGenConfig.TraceOut != NULL || LoadGenEvents != NULL) {
+        LoadGenTracing = 1;
+        pthread_create(&drain, NULL, LoadGenDrainThread, control);
+    }
+
+    start = SimClockNs();
+
+    for (i = 0; i < LoadGenConfig.Openers; i++)
+    {
+        openers[i].Seed = LoadGenConfig.Seed ^ (0xC2B2AE35 * (i + 1));
+        openers[i].Latencies = &latencies[i * (LoadGenConfig.OpsPerOpener + 1)];
+        openers[i].Held = calloc(LoadGenConfig.MaxHeldHandles + 1, sizeof(PSIM_HANDLE));
+        pthread_create(&openers[i].Thread, NULL, LoadGenOpenerThread, &openers[i]);
+    }
+
+    for (i = 0; i < LoadGenConfig.Openers; i++)
+    {
+        pthread_join(openers[i].Thread, NULL);
+        free(openers[i].Held);
+
+        //
+        // Compact the per-opener samples into one run
+        //
+        memmove(&latencies[opens], openers[i].Latencies, sizeof(ULONGLONG) * openers[i].Opens);
+
+        opens += openers[i].Opens;
+        allowed += openers[i].Allowed;
+        closes += openers[i].Closes;
+    }
+
+    elapsed = SimClockNs() - start;
+
+    RtlZeroMemory(&stats, sizeof(stats));
+    SimDeviceIoControl(control, IOCTL_HIDGUARDIAN_GET_STICKY_CACHE_STATS,
+        NULL, 0, &stats, sizeof(stats), NULL);
+
+    RtlZeroMemory(&counters, sizeof(counters));
+    SimDeviceIoControl(control, IOCTL_HIDGUARDIAN_GET_PERF_COUNTERS,
+        NULL, 0, &counters, sizeof(counters), NULL);
+
+    RtlZeroMemory(&histograms, sizeof(histograms));
+    SimDeviceIoControl(control, IOCTL_HIDGUARDIAN_GET_LATENCY_HISTOGRAMS,
+        NULL, 0, &histograms, sizeof(histograms), NULL);
+
+    RtlZeroMemory(&top, sizeof(top));
+    SimDeviceIoControl(control, IOCTL_HIDGUARDIAN_GET_TOP_OPENERS,
+        &top, sizeof(top), &top, sizeof(top), NULL);
+
+    RtlZeroMemory(&pool, sizeof(pool));
+    SimDeviceIoControl(control, IOCTL_HIDGUARDIAN_GET_IDENTITY_POOL_STATS,
+        NULL, 0, &pool, sizeof(pool), NULL);
+
+    RtlZeroMemory(&adds, sizeof(adds));
+    SimDeviceIoControl(control, IOCTL_HIDGUARDIAN_GET_DEVICE_ADD_STATS,
+        NULL, 0, &adds, sizeof(adds), NULL);
+
+    LoadGenStop = 1;
+
+    for (i = 0; i < LoadGenConfig.Devices; i++)
+    {
+        pthread_join(workers[i].Thread, NULL);
+        SimCloseHandle(workers[i].Handle);
+        answered += workers[i].Answered;
+    }
+
+    if (LoadGenTracing) {
+        LoadGenTracing = 0;
+        pthread_join(drain, NULL);
+    }
+
+    if (LoadGenConfig.TraceOut != NULL) {
+        LoadGenDrainTrace(control);
+
+        if (!LoadGenWriteTrace(LoadGenConfig.TraceOut)) {
+            fprintf(stderr, "Failed to write %s\n", LoadGenConfig.TraceOut);
+        }
+    }
+
+    if (LoadGenEvents != NULL) {
+        LoadGenDrainEvents(control);
+
+        if (fclose(LoadGenEvents) != 0) {
+            fprintf(stderr, "Failed to write %s\n", LoadGenConfig.EventsOut);
+        }
+    }
+
+    if (LoadGenConfig.Stages) {
+        LoadGenDrainStages(control);
+    }
+
+    if (LoadGenConfig.MetricsPort != 0) {
+        hc_metrics_stop(LoadGenMetrics);
+        pthread_join(metrics, NULL);
+    }
+
+    if (LoadGenConfig.MetricsOut != NULL && !hc_metrics_write_file(LoadGenMetrics, LoadGenConfig.MetricsOut)) {
+        fprintf(stderr, "Failed to write %s\n", LoadGenConfig.MetricsOut);
+    }
+
+    hc_metrics_destroy(LoadGenMetrics);
+    SimCloseHandle(control);
+
+    qsort(latencies, opens, sizeof(ULONGLONG), LoadGenCompare);
+
+    for (i = 0; i < opens; i++) {
+        total += latencies[i];
+    }
+
+    printf("{\n");
+    printf("  \"config\": {\"devices\": %u, \"idle_devices\": %u, \"processes\": %u, \"zipf\": %.3f, \"openers\": %u, "
+        "\"ops_per_opener\": %u, \"open_ratio\": %.3f, \"max_held\": %u, \"think_dist\": \"%s\", "
+        "\"think_mean_us\": %u, \"sticky_ratio\": %.3f, \"deny_ratio\": %.3f, "
+        "\"cache_capacity\": %u, \"cache_ttl_s\": %u, \"guard_idle_s\": %u, \"open_rate\": %u, \"open_burst\": %u, "
+        "\"excess_action\": \"%s\", \"pending_limit\": %u, \"query_id_us\": %u, \"seed\": %u},\n",
+        LoadGenConfig.Devices, LoadGenConfig.IdleDevices, LoadGenConfig.Processes, LoadGenConfig.ZipfExponent,
+        LoadGenConfig.Openers, LoadGenConfig.OpsPerOpener, LoadGenConfig.OpenRatio,
+        LoadGenConfig.MaxHeldHandles, LoadGenThinkNames[LoadGenConfig.ThinkDist],
+        LoadGenConfig.ThinkMeanUs, LoadGenConfig.StickyRatio, LoadGenConfig.DenyRatio,
+        LoadGenConfig.CacheCapacity, LoadGenConfig.CacheTtlSeconds, LoadGenConfig.GuardIdleSeconds,
+        LoadGenConfig.OpenRateLimit, LoadGenConfig.OpenRateBurst,
+        LoadGenExcessNames[LoadGenConfig.OpenExcessAction], LoadGenConfig.PendingQueueLimit,
+        LoadGenConfig.QueryIdUs, LoadGenConfig.Seed);
+    printf("  \"duration_ms\": %.3f,\n", elapsed / 1e6);
+    printf("  \"opens\": %u,\n  \"allowed\": %u,\n  \"denied\": %u,\n  \"closes\": %u,\n",
+        opens, allowed, opens - allowed, closes);
+    printf("  \"throughput_opens_per_s\": %.1f,\n", opens / (elapsed / 1e9));
+    printf("  \"open_latency_us\": {\"mean\": %.2f, \"p50\": %.2f, \"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f},\n",
+        opens ? total / 1000.0 / opens : 0,
+        LoadGenPercentileUs(latencies, opens, 50),
+        LoadGenPercentileUs(latencies, opens, 99),
+        LoadGenPercentileUs(latencies, opens, 99.9),
+        LoadGenPercentileUs(latencies, opens, 100));
+    printf("  \"cerberus_answered\": %u,\n", answered);
+
+    if (LoadGenConfig.TraceOut != NULL) {
+        printf("  \"trace\": {\"records\": %u, \"dropped\": %u},\n", LoadGenTraceCount, LoadGenTraceDropped);
+    }
+
+    if (LoadGenConfig.EventsOut != NULL) {
+        printf("  \"events\": {\"records\": %u, \"dropped\": %u},\n", LoadGenEventCount, LoadGenEventDropped);
+    }
+
+    printf("  \"sticky_cache\": {\"hits\": %llu, \"misses\": %llu, \"insertions\": %llu, "
+        "\"evictions\": %llu, \"expirations\": %llu, \"occupancy\": %u},\n",
+        (unsigned long long)stats.Hits, (unsigned long long)stats.Misses,
+        (unsigned long long)stats.Insertions, (unsigned long long)stats.Evictions,
+        (unsigned long long)stats.Expirations, stats.Occupancy);
+    printf("  \"driver_counters\": {\"opens\": %llu, \"system_pid_hits\": %llu, \"sticky_hits\": %llu, "
+        "\"sticky_misses\": %llu, \"default_allowed\": %llu, \"default_denied\": %llu, "
+        "\"notifications_missed\": %llu, \"verdicts_received\": %llu, \"timeouts\": %llu, "
+        "\"pending_high_water\": %llu, \"auth_high_water\": %llu, \"rate_limited\": %llu, "
+        "\"queue_full\": %llu, \"excess_failed\": %llu, \"excess_defaulted\": %llu, "
+        "\"excess_deferred\": %llu, \"not_ready\": %llu, \"memory_usage\": %u},\n",
+        (unsigned long long)counters.Totals.Opens, (unsigned long long)counters.Totals.SystemPidHits,
+        (unsigned long long)counters.Totals.StickyHits, (unsigned long long)counters.Totals.StickyMisses,
+        (unsigned long long)counters.Totals.DefaultAllowed, (unsigned long long)counters.Totals.DefaultDenied,
+        (unsigned long long)counters.Totals.NotificationsMissed, (unsigned long long)counters.Totals.VerdictsReceived,
+        (unsigned long long)counters.Totals.Timeouts, (unsigned long long)counters.Totals.PendingHighWater,
+        (unsigned long long)counters.Totals.AuthHighWater, (unsigned long long)counters.Totals.RateLimited,
+        (unsigned long long)counters.Totals.QueueFull, (unsigned long long)counters.Totals.ExcessFailed,
+        (unsigned long long)counters.Totals.ExcessDefaulted, (unsigned long long)counters.Totals.ExcessDeferred,
+        (unsigned long long)counters.Totals.NotReady, counters.MemoryUsage);
+    printf("  \"identity_pool\": {\"strings\": %u, \"references\": %u, \"buckets\": %u, "
+        "\"pooled_bytes\": %llu, \"unpooled_bytes\": %llu, \"interns\": %llu, \"hits\": %llu},\n",
+        pool.Strings, pool.References, pool.Buckets,
+        (unsigned long long)pool.PooledBytes, (unsigned long long)pool.UnpooledBytes,
+        (unsigned long long)pool.Interns, (unsigned long long)pool.Hits);
+    printf("  \"device_add\": {\"arrivals_ms\": %.3f, "
+        "\"add_us\": {\"count\": %llu, \"mean\": %.2f, \"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f}, "
+        "\"identity_us\": {\"count\": %llu, \"mean\": %.2f, \"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f}, "
+        "\"identities_deferred\": %llu, \"identities_on_demand\": %llu, \"identity_failures\": %llu},\n",
+        arrivals / 1e6,
+        (unsigned long long)adds.Add.Count, adds.Add.Count ? adds.Add.Sum / 10.0 / adds.Add.Count : 0,
+        LoadGenHistogramPercentileUs(&adds.Add, 50), LoadGenHistogramPercentileUs(&adds.Add, 99),
+        adds.Add.Max / 10.0,
+        (unsigned long long)adds.Identity.Count, adds.Identity.Count ? adds.Identity.Sum / 10.0 / adds.Identity.Count : 0,
+        LoadGenHistogramPercentileUs(&adds.Identity, 50), LoadGenHistogramPercentileUs(&adds.Identity, 99),
+        adds.Identity.Max / 10.0,
+        (unsigned long long)adds.IdentitiesDeferred, (unsigned long long)adds.IdentitiesOnDemand,
+        (unsigned long long)adds.IdentityFailures);
+    printf("  \"top_openers\": {\"total\": %llu, \"capacity\": %u, \"top\": [",
+        (unsigned long long)top.Header.TotalOpens, top.Header.Capacity);
+
+    for (i = 0; i < top.Header.EntryCount; i++) {
+        ULONG index = (top.Entries[i].ProcessId - LOADGEN_FIRST_PID) / 4;
+
+        printf("%s\n    {\"pid\": %u, \"count\": %llu, \"error\": %llu, \"actual\": %d}",
+            i ? "," : "", top.Entries[i].ProcessId,
+            (unsigned long long)top.Entries[i].Count, (unsigned long long)top.Entries[i].Error,
+            (top.Entries[i].ProcessId >= LOADGEN_FIRST_PID && index < LoadGenConfig.Processes)
+                ? LoadGenPidOpens[index] : -1);
+    }
+
+    printf("\n  ]},\n");
+    printf("  \"driver_latency_us\": {");
+
+    for (i = 0; i < HIDGUARDIAN_ACCESS_PATH_COUNT; i++) {
+        printf("%s\n    \"%s\": {\"count\": %llu, \"mean\": %.2f, \"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f}",
+            i ? "," : "", pathNames[i], (unsigned long long)histograms.Global[i].Count,
+            histograms.Global[i].Count ? histograms.Global[i].Sum / 10.0 / histograms.Global[i].Count : 0,
+            LoadGenHistogramPercentileUs(&histograms.Global[i], 50),
+            LoadGenHistogramPercentileUs(&histograms.Global[i], 99),
+            histograms.Global[i].Max / 10.0);
+    }
+
+    printf("\n  }");
+
+    if (LoadGenConfig.Stages) {
+        printf(",\n  \"driver_stages_us\": {\"records\": %u, \"dropped\": %u", LoadGenStageCount, LoadGenStageDropped);
+
+        for (i = HIDGUARDIAN_STAGE_ARRIVAL + 1; i < HIDGUARDIAN_STAGE_COUNT; i++) {
+            printf(",\n    \"%s\": {\"count\": %llu, \"mean\": %.2f, \"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f}",
+                stageNames[i], (unsigned long long)LoadGenStageGaps[i].Count,
+                LoadGenStageGaps[i].Count ? LoadGenStageGaps[i].Sum / 10.0 / LoadGenStageGaps[i].Count : 0,
+                LoadGenHistogramPercentileUs(&LoadGenStageGaps[i], 50),
+                LoadGenHistogramPercentileUs(&LoadGenStageGaps[i], 99),
+                LoadGenStageGaps[i].Max / 10.0);
+        }
+
+        printf("\n  }");
+    }
+
+    printf("\n");
+    printf("}\n");
+
+    SimDriverUnload();
+
+    free(LoadGenZipfCdf);
+    free((PVOID)LoadGenPidOpens);
+    free(LoadGenTrace);
+    free(latencies);
+    free(openers);
+    free(workers);
+    free(LoadGenPads);
+
+    return 0;
+}
@@ -0,0 +1,755 @@
+/*
+* Replays a recorded access trace against the simulated HidGuardian driver.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+//
+// Plays back a file written by loadgen --trace-out (or any drain of
+// IOCTL_HIDGUARDIAN_GET_ACCESS_TRACE saved as one header followed by the
+// records). Every recorded open is re-issued by the same PID against the
+// same device at its recorded offset (scaled by --speed), and a Cerberus
+// stand-in answers with the recorded verdict after the recorded
+// authorization time. The result compares verdicts and resolution paths
+// of both runs so a change to the request path can be measured on the
+// exact same sequence of requests.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "Sim.h"
+#include "HidGuardian.h"
+
+#define REPLAY_DEFAULT_CERBERUS_PID 50
+#define REPLAY_PATH_COUNT           HIDGUARDIAN_ACCESS_PATH_COUNT
+
+typedef struct _REPLAY_CONFIG
+{
+    const char* TraceIn;
+
+    //
+    // Playback rate relative to the recording, 0 issues as fast as possible
+    //
+    double Speed;
+
+    ULONG Workers;
+
+    ULONG CacheCapacity;
+
+    ULONG CacheTtlSeconds;
+
+} REPLAY_CONFIG;
+
+//
+// One open to re-issue
+//
+typedef struct _REPLAY_OPEN
+{
+    ULONGLONG Offset;
+
+    ULONG Device;
+
+    ULONG ProcessId;
+
+    BOOLEAN WasAllowed;
+
+    BOOLEAN IsAllowed;
+
+    UCHAR Path;
+
+    ULONGLONG Latency;
+
+    ULONGLONG Lateness;
+
+} REPLAY_OPEN;
+
+//
+// Recorded Cerberus answer, consumed in order per (device, PID)
+//
+typedef struct _REPLAY_VERDICT
+{
+    ULONG ProcessId;
+
+    BOOLEAN IsAllowed;
+
+    BOOLEAN IsSticky;
+
+    BOOLEAN IsUsed;
+
+    ULONG AuthTime;
+
+} REPLAY_VERDICT;
+
+typedef struct _REPLAY_DEVICE
+{
+    ULONG Hash;
+
+    PSIM_PDO Pdo;
+
+    PSIM_HANDLE Handle;
+
+    pthread_t Thread;
+
+    REPLAY_VERDICT* Verdicts;
+
+    ULONG VerdictCount;
+
+    ULONG Answered;
+
+    ULONG Unmatched;
+
+} REPLAY_DEVICE;
+
+typedef struct _REPLAY_WORKER
+{
+    pthread_t Thread;
+
+    PSIM_HANDLE* Held;
+
+    ULONG HeldCount;
+
+} REPLAY_WORKER;
+
+static REPLAY_CONFIG ReplayConfig =
+{
+    NULL,                   // TraceIn
+    1.0,                    // Speed
+    16,                     // Workers
+    256,                    // CacheCapacity
+    0                       // CacheTtlSeconds
+};
+
+static const char* ReplayPathNames[REPLAY_PATH_COUNT] =
+{
+    "system", "system_pid", "cerberus", "sticky", "verdict", "default", "timeout", "limited"
+};
+
+static REPLAY_DEVICE* ReplayDevices;
+static ULONG ReplayDeviceCount;
+static REPLAY_OPEN* ReplayOpens;
+static ULONG ReplayOpenCount;
+static volatile LONG ReplayNext = 0;
+static volatile LONG ReplayStop = 0;
+static ULONGLONG ReplayStart;
+static pthread_mutex_t ReplayVerdictLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int ReplayCompareRecords(const void* A, const void* B)
+{
+    ULONG64 a = ((const HIDGUARDIAN_ACCESS_RECORD*)A)->Timestamp;
+    ULONG64 b = ((const HIDGUARDIAN_ACCESS_RECORD*)B)->Timestamp;
+
+    return (a > b) - (a < b);
+}
+
+static int ReplayCompare(const void* A, const void* B)
+{
+    ULONGLONG a = *(const ULONGLONG*)A;
+    ULONGLONG b = *(const ULONGLONG*)B;
+
+    return (a > b) - (a < b);
+}
+
+static double ReplayPercentileUs(const ULONGLONG* Sorted, ULONG Count, double Percentile)
+{
+    ULONG index;
+
+    if (Count == 0) {
+        return 0;
+    }
+
+    index = (ULONG)ceil(Percentile / 100.0 * Count);
+
+    return Sorted[index ? index - 1 : 0] / 1000.0;
+}
+
+static VOID ReplaySleepNs(ULONGLONG Ns)
+{
+    struct timespec ts;
+
+    if (Ns < 1000) {
+        return;
+    }
+
+    ts.tv_sec = (time_t)(Ns / 1000000000ULL);
+    ts.tv_nsec = (long)(Ns % 1000000000ULL);
+
+    nanosleep(&ts, NULL);
+}
+
+static PHIDGUARDIAN_ACCESS_RECORD ReplayLoad(const char* Path, PHIDGUARDIAN_ACCESS_TRACE Header)
+{
+    PHIDGUARDIAN_ACCESS_RECORD records = NULL;
+    FILE* file = fopen(Path, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Can't open %s\n", Path);
+        return NULL;
+    }
+
+    if (fread(Header, sizeof(*Header), 1, file) != 1
+        || Header->Version != HIDGUARDIAN_ACCESS_TRACE_VERSION
+        || Header->RecordSize != sizeof(HIDGUARDIAN_ACCESS_RECORD)) {
+        fprintf(stderr, "%s is not a version %u access trace\n", Path, HIDGUARDIAN_ACCESS_TRACE_VERSION);
+        fclose(file);
+        return NULL;
+    }
+
+    records = malloc(sizeof(HIDGUARDIAN_ACCESS_RECORD) * (Header->RecordCount + 1));
+
+    if (records == NULL
+        || fread(records, sizeof(HIDGUARDIAN_ACCESS_RECORD), Header->RecordCount, file) != Header->RecordCount) {
+        fprintf(stderr, "%s is truncated\n", Path);
+        free(records);
+        records = NULL;
+    }
+
+    fclose(file);
+
+    return records;
+}
+
+static ULONG ReplayDeviceIndex(ULONG Hash)
+{
+    ULONG i;
+
+    for (i = 0; i < ReplayDeviceCount; i++) {
+        if (ReplayDevices[i].Hash == Hash) {
+            return i;
+        }
+    }
+
+    ReplayDevices[ReplayDeviceCount].Hash = Hash;
+
+    return ReplayDeviceCount++;
+}
+
+//
+// Splits the recording into opens to re-issue and per-device answers
+//
+static BOOLEAN ReplayPrepare(PHIDGUARDIAN_ACCESS_RECORD Records, ULONG Count, ULONG* CerberusPid)
+{
+    PHIDGUARDIAN_ACCESS_RECORD record;
+    REPLAY_DEVICE* device;
+    ULONG i;
+
+    ReplayDevices = calloc(Count + 1, sizeof(REPLAY_DEVICE));
+    ReplayOpens = calloc(Count + 1, sizeof(REPLAY_OPEN));
+
+    if (ReplayDevices == NULL || ReplayOpens == NULL) {
+        return FALSE;
+    }
+
+    qsort(Records, Count, sizeof(HIDGUARDIAN_ACCESS_RECORD), ReplayCompareRecords);
+
+    for (i = 0; i < Count; i++)
+    {
+        record = &Records[i];
+
+        //
+        // Cerberus' own opens are made by the stand-in
+        //
+        if (record->Path == HIDGUARDIAN_ACCESS_PATH_CERBERUS) {
+            *CerberusPid = record->ProcessId;
+            continue;
+        }
+
+        device = &ReplayDevices[ReplayDeviceIndex(record->DeviceHash)];
+
+        if (record->Path == HIDGUARDIAN_ACCESS_PATH_VERDICT) {
+            if (device->Verdicts == NULL) {
+                device->Verdicts = calloc(Count, sizeof(REPLAY_VERDICT));
+
+                if (device->Verdicts == NULL) {
+                    return FALSE;
+                }
+            }
+
+            device->Verdicts[device->VerdictCount].ProcessId = record->ProcessId;
+            device->Verdicts[device->VerdictCount].IsAllowed = record->IsAllowed;
+            device->Verdicts[device->VerdictCount].IsSticky = record->IsSticky;
+            device->Verdicts[device->VerdictCount].AuthTime = record->AuthTime;
+            device->VerdictCount++;
+        }
+
+        ReplayOpens[ReplayOpenCount].Offset = (record->Timestamp - Records[0].Timestamp) * 100;
+        ReplayOpens[ReplayOpenCount].Device = (ULONG)(device - ReplayDevices);
+        ReplayOpens[ReplayOpenCount].ProcessId = record->ProcessId;
+        ReplayOpens[ReplayOpenCount].WasAllowed = record->IsAllowed;
+        ReplayOpens[ReplayOpenCount].Path = record->Path;
+        ReplayOpenCount++;
+    }
+
+    return TRUE;
+}
+
+//
+// Every PID the recording resolved via the system PID list gets whitelisted again
+//
+static VOID ReplaySubmitSystemPids(PSIM_HANDLE Control)
+{
+    PHIDGUARDIAN_SUBMIT_SYSTEM_PIDS pids;
+    ULONG i, k, count = 0;
+
+    pids = calloc(1, sizeof(HIDGUARDIAN_SUBMIT_SYSTEM_PIDS) + sizeof(ULONG) * (ReplayOpenCount + 1));
+
+    if (pids == NULL) {
+        return;
+    }
+
+    for (i = 0; i < ReplayOpenCount; i++)
+    {
+        if (ReplayOpens[i].Path != HIDGUARDIAN_ACCESS_PATH_SYSTEM_PID) {
+            continue;
+        }
+
+        for (k = 0; k < count && pids->ProcessIds[k] != ReplayOpens[i].ProcessId; k++);
+
+        if (k == count) {
+            pids->ProcessIds[count++] = ReplayOpens[i].ProcessId;
+        }
+    }
+
+    if (count > 0) {
+        pids->Size = sizeof(HIDGUARDIAN_SUBMIT_SYSTEM_PIDS) + sizeof(ULONG) * count;
+        pids->Flags = HIDGUARDIAN_SYSTEM_PIDS_REPLACE;
+        pids->Count = count;
+
+        SimDeviceIoControl(Control, IOCTL_HIDGUARDIAN_SUBMIT_SYSTEM_PIDS,
+            pids, pids->Size, NULL, 0, NULL);
+    }
+
+    free(pids);
+}
+
+static REPLAY_VERDICT* ReplayTakeVerdict(REPLAY_DEVICE* Device, ULONG ProcessId)
+{
+    REPLAY_VERDICT* verdict = NULL;
+    ULONG i;
+
+    pthread_mutex_lock(&ReplayVerdictLock);
+
+    for (i = 0; i < Device->VerdictCount; i++) {
+        if (!Device->Verdicts[i].IsUsed && Device->Verdicts[i].ProcessId == ProcessId) {
+            verdict = &Device->Verdicts[i];
+            verdict->IsUsed = TRUE;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&ReplayVerdictLock);
+
+    return verdict;
+}
+
+//
+// Cerberus stand-in: answers with the recorded verdict for that PID and
+// device, or allows (non-sticky) requests the recording never saw
+//
+static void* ReplayCerberusThread(void* Context)
+{
+    REPLAY_DEVICE* device = Context;
+    ULONG size = sizeof(HIDGUARDIAN_GET_CREATE_REQUEST) + 1024;
+    PHIDGUARDIAN_GET_CREATE_REQUEST get = calloc(1, size);
+    HIDGUARDIAN_SET_CREATE_REQUEST set;
+    REPLAY_VERDICT* verdict;
+    PSIM_IRP notify;
+    NTSTATUS status;
+    ULONG requestId = 0;
+
+    while (!ReplayStop && get != NULL)
+    {
+        notify = SimDeviceIoControlAsync(device->Handle,
+            IOCTL_HIDGUARDIAN_SUBMIT_NOTIFICATION, NULL, 0, NULL, 0);
+
+        while ((status = SimWaitIrp(notify, 50, NULL)) == STATUS_TIMEOUT && !ReplayStop);
+
+        SimFreeIrp(notify);
+
+        if (status != STATUS_SUCCESS) {
+            break;
+        }
+
+        get->Size = size;
+        get->RequestId = ++requestId;
+
+        if (!NT_SUCCESS(SimDeviceIoControl(device->Handle, IOCTL_HIDGUARDIAN_GET_CREATE_REQUEST,
+            get, size, get, size, NULL))) {
+            continue;
+        }
+
+        verdict = ReplayTakeVerdict(device, get->ProcessId);
+
+        set.RequestId = requestId;
+
+        if (verdict != NULL) {
+            if (ReplayConfig.Speed > 0) {
+                ReplaySleepNs((ULONGLONG)(verdict->AuthTime * 100.0 / ReplayConfig.Speed));
+            }
+
+            set.IsAllowed = verdict->IsAllowed;
+            set.IsSticky = verdict->IsSticky;
+        }
+        else {
+            set.IsAllowed = TRUE;
+            set.IsSticky = FALSE;
+            device->Unmatched++;
+        }
+
+        if (NT_SUCCESS(SimDeviceIoControl(device->Handle, IOCTL_HIDGUARDIAN_SET_CREATE_REQUEST,
+            &set, sizeof(set), NULL, 0, NULL))) {
+            device->Answered++;
+        }
+    }
+
+    free(get);
+
+    return NULL;
+}
+
+//
+// Handles stay open until the end: closing one drops the PID's sticky
+// verdict and the recording carries no close events to place it
+//
+static void* ReplayWorkerThread(void* Context)
+{
+    REPLAY_WORKER* worker = Context;
+    REPLAY_OPEN* open;
+    PSIM_HANDLE handle;
+    ULONGLONG due, now, start;
+    LONG index;
+
+    while ((index = InterlockedIncrement(&ReplayNext) - 1) < (LONG)ReplayOpenCount)
+    {
+        open = &ReplayOpens[index];
+
+        if (ReplayConfig.Speed > 0) {
+            due = ReplayStart + (ULONGLONG)(open->Offset / ReplayConfig.Speed);
+            now = SimClockNs();
+
+            if (now < due) {
+                ReplaySleepNs(due - now);
+            }
+        }
+        else {
+            due = SimClockNs();
+        }
+
+        SimSetCurrentProcessId(open->ProcessId);
+
+        start = SimClockNs();
+        open->IsAllowed = NT_SUCCESS(SimOpenDevice(ReplayDevices[open->Device].Pdo, &handle));
+        open->Latency = SimClockNs() - start;
+        open->Lateness = start > due ? start - due : 0;
+
+        if (open->IsAllowed) {
+            worker->Held[worker->HeldCount++] = handle;
+        }
+    }
+
+    return NULL;
+}
+
+static ULONG ReplayDrainPaths(PSIM_HANDLE Control, ULONG* Paths)
+{
+    ULONG size = sizeof(HIDGUARDIAN_ACCESS_TRACE) + sizeof(HIDGUARDIAN_ACCESS_RECORD) * 4096;
+    PHIDGUARDIAN_ACCESS_TRACE trace = malloc(size);
+    PHIDGUARDIAN_ACCESS_RECORD records;
+    ULONG dropped = 0;
+    ULONG i;
+
+    if (trace == NULL) {
+        return 0;
+    }
+
+    do {
+        if (!NT_SUCCESS(SimDeviceIoControl(Control, IOCTL_HIDGUARDIAN_GET_ACCESS_TRACE,
+            NULL, 0, trace, size, NULL))) {
+            break;
+        }
+
+        records = (PHIDGUARDIAN_ACCESS_RECORD)(trace + 1);
+
+        for (i = 0; i < trace->RecordCount; i++) {
+            if (records[i].Path < REPLAY_PATH_COUNT) {
+                Paths[records[i].Path]++;
+            }
+        }
+
+        dropped += trace->DroppedCount;
+
+    } while (trace->RemainingCount > 0);
+
+    free(trace);
+
+    return dropped;
+}
+
+static VOID ReplayPrintPaths(const char* Name, const ULONG* Paths, BOOLEAN Last)
+{
+    ULONG i;
+
+    printf("    \"%s\": {", Name);
+
+    for (i = 0; i < REPLAY_PATH_COUNT; i++) {
+        printf("%s\"%s\": %u", i ? ", " : "", ReplayPathNames[i], Paths[i]);
+    }
+
+    printf("}%s\n", Last ? "" : ",");
+}
+
+static VOID ReplayUsage(const char* Name)
+{
+    fprintf(stderr,
+        "Usage: %s --trace-in FILE [options]\n"
+        "  --speed X            playback rate, 0 = as fast as possible (%.1f)\n"
+        "  --workers N          concurrent openers (%u)\n"
+        "  --cache-capacity N   sticky cache entries per device (%u)\n"
+        "  --cache-ttl S        sticky cache TTL in seconds, 0 = none (%u)\n",
+        Name, ReplayConfig.Speed, ReplayConfig.Workers,
+        ReplayConfig.CacheCapacity, ReplayConfig.CacheTtlSeconds);
+}
+
+static BOOLEAN ReplayParse(int argc, char* argv[])
+{
+    static const struct option options[] =
+    {
+        { "trace-in",       required_argument, NULL, 'i' },
+        { "speed",          required_argument, NULL, 's' },
+        { "workers",        required_argument, NULL, 'w' },
+        { "cache-capacity", required_argument, NULL, 'c' },
+        { "cache-ttl",      required_argument, NULL, 'T' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'i': ReplayConfig.TraceIn = optarg; break;
+        case 's': ReplayConfig.Speed = atof(optarg); break;
+        case 'w': ReplayConfig.Workers = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'c': ReplayConfig.CacheCapacity = (ULONG)strtoul(optarg, NULL, 0); break;
+        case 'T': ReplayConfig.CacheTtlSeconds = (ULONG)strtoul(optarg, NULL, 0); break;
+        default:
+            ReplayUsage(argv[0]);
+            return FALSE;
+        }
+    }
+
+    if (ReplayConfig.TraceIn == NULL || ReplayConfig.Workers == 0 || ReplayConfig.Speed < 0) {
+        ReplayUsage(argv[0]);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+int main(int argc, char* argv[])
+{
+    HIDGUARDIAN_ACCESS_TRACE header;
+    PHIDGUARDIAN_ACCESS_RECORD records;
+    REPLAY_WORKER* workers;
+    PSIM_HANDLE control = NULL;
+    PSIM_PDO master;
+    WCHAR instanceId[32];
+    ULONGLONG* latencies;
+    ULONGLONG* lateness;
+    ULONGLONG elapsed, total = 0;
+    ULONG recorded[REPLAY_PATH_COUNT] = { 0 };
+    ULONG replayed[REPLAY_PATH_COUNT] = { 0 };
+    ULONG cerberusPid = REPLAY_DEFAULT_CERBERUS_PID;
+    ULONG agreed = 0, allowed = 0, answered = 0, unmatched = 0, dropped;
+    ULONG i, k;
+
+    if (!ReplayParse(argc, argv)) {
+        return 1;
+    }
+
+    records = ReplayLoad(ReplayConfig.TraceIn, &header);
+
+    if (records == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < header.RecordCount; i++) {
+        if (records[i].Path < REPLAY_PATH_COUNT) {
+            recorded[records[i].Path]++;
+        }
+    }
+
+    if (!ReplayPrepare(records, header.RecordCount, &cerberusPid)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    workers = calloc(ReplayConfig.Workers, sizeof(REPLAY_WORKER));
+    latencies = malloc(sizeof(ULONGLONG) * (ReplayOpenCount + 1));
+    lateness = malloc(sizeof(ULONGLONG) * (ReplayOpenCount + 1));
+
+    if (workers == NULL || latencies == NULL || lateness == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    SimRegistrySetULong(L"StickyCacheCapacity", ReplayConfig.CacheCapacity);
+    SimRegistrySetULong(L"StickyCacheTtlSeconds", ReplayConfig.CacheTtlSeconds);
+    SimRegistrySetULong(L"AccessTraceCapacity", header.RecordCount + 1);
+
+    if (!NT_SUCCESS(SimDriverLoad())) {
+        fprintf(stderr, "DriverEntry failed\n");
+        return 1;
+    }
+
+    SimDeviceArrival(L"ROOT\\SYSTEM", L"0000", L"Nefarius\\HidGuardian\\Gen4\0", L"System", &master);
+
+    for (i = 0; i < ReplayDeviceCount; i++)
+    {
+        swprintf(instanceId, ARRAYSIZE(instanceId), L"7&%X&0&0000", ReplayDevices[i].Hash);
+
+        if (!NT_SUCCESS(SimDeviceArrival(L"HID\\VID_054C&PID_05C4", instanceId,
+            L"HID\\VID_054C&PID_05C4\0HID_DEVICE_SYSTEM_GAME\0HID_DEVICE\0", L"HIDClass", &ReplayDevices[i].Pdo))) {
+            fprintf(stderr, "AddDevice failed for pad %u\n", i);
+            return 1;
+        }
+    }
+
+    SimSetCurrentProcessId(cerberusPid);
+    SimOpenControlDevice(&control);
+    ReplaySubmitSystemPids(control);
+
+    for (i = 0; i < ReplayDeviceCount; i++)
+    {
+        SimOpenDevice(ReplayDevices[i].Pdo, &ReplayDevices[i].Handle);
+        pthread_create(&ReplayDevices[i].Thread, NULL, ReplayCerberusThread, &ReplayDevices[i]);
+    }
+
+    //
+    // The stand-in's own opens are not part of the replay
+    //
+    ReplayDrainPaths(control, replayed);
+    RtlZeroMemory(replayed, sizeof(replayed));
+
+    ReplayStart = SimClockNs();
+
+    for (i = 0; i < ReplayConfig.Workers; i++)
+    {
+        workers[i].Held = calloc(ReplayOpenCount + 1, sizeof(PSIM_HANDLE));
+        pthread_create(&workers[i].Thread, NULL, ReplayWorkerThread, &workers[i]);
+    }
+
+    for (i = 0; i < ReplayConfig.Workers; i++) {
+        pthread_join(workers[i].Thread, NULL);
+    }
+
+    elapsed = SimClockNs() - ReplayStart;
+
+    dropped = ReplayDrainPaths(control, replayed);
+
+    for (i = 0; i < ReplayConfig.Workers; i++)
+    {
+        for (k = 0; k < workers[i].HeldCount; k++) {
+            SimCloseHandle(workers[i].Held[k]);
+        }
+
+        free(workers[i].Held);
+    }
+
+    ReplayStop = 1;
+
+    for (i = 0; i < ReplayDeviceCount; i++)
+    {
+        pthread_join(ReplayDevices[i].Thread, NULL);
+        SimCloseHandle(ReplayDevices[i].Handle);
+        answered += ReplayDevices[i].Answered;
+        unmatched += ReplayDevices[i].Unmatched;
+    }
+
+    SimCloseHandle(control);
+
+    for (i = 0; i < ReplayOpenCount; i++)
+    {
+        latencies[i] = ReplayOpens[i].Latency;
+        lateness[i] = ReplayOpens[i].Lateness;
+        total += ReplayOpens[i].Latency;
+        allowed += ReplayOpens[i].IsAllowed;
+        agreed += ReplayOpens[i].IsAllowed == ReplayOpens[i].WasAllowed;
+    }
+
+    qsort(latencies, ReplayOpenCount, sizeof(ULONGLONG), ReplayCompare);
+    qsort(lateness, ReplayOpenCount, sizeof(ULONGLONG), ReplayCompare);
+
+    printf("{\n");
+    printf("  \"config\": {\"trace\": \"%s\", \"speed\": %.3f, \"workers\": %u, "
+        "\"cache_capacity\": %u, \"cache_ttl_s\": %u},\n",
+        ReplayConfig.TraceIn, ReplayConfig.Speed, ReplayConfig.Workers,
+        ReplayConfig.CacheCapacity, ReplayConfig.CacheTtlSeconds);
+    printf("  \"recording\": {\"records\": %u, \"dropped\": %u, \"devices\": %u, \"cerberus_pid\": %u, "
+        "\"span_ms\": %.3f},\n",
+        header.RecordCount, header.DroppedCount, ReplayDeviceCount, cerberusPid,
+        ReplayOpenCount ? ReplayOpens[ReplayOpenCount - 1].Offset / 1e6 : 0);
+    printf("  \"duration_ms\": %.3f,\n", elapsed / 1e6);
+    printf("  \"opens\": %u,\n  \"allowed\": %u,\n  \"denied\": %u,\n",
+        ReplayOpenCount, allowed, ReplayOpenCount - allowed);
+    printf("  \"verdict_agreement\": %.4f,\n", ReplayOpenCount ? (double)agreed / ReplayOpenCount : 1.0);
+    printf("  \"cerberus_answered\": %u,\n  \"cerberus_unmatched\": %u,\n", answered, unmatched);
+    printf("  \"paths\": {\n");
+    ReplayPrintPaths("recorded", recorded, FALSE);
+    ReplayPrintPaths("replayed", replayed, TRUE);
+    printf("  },\n");
+    printf("  \"replay_trace_dropped\": %u,\n", dropped);
+    printf("  \"open_latency_us\": {\"mean\": %.2f, \"p50\": %.2f, \"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f},\n",
+        ReplayOpenCount ? total / 1000.0 / ReplayOpenCount : 0,
+        ReplayPercentileUs(latencies, ReplayOpenCount, 50),
+        ReplayPercentileUs(latencies, ReplayOpenCount, 99),
+        ReplayPercentileUs(latencies, ReplayOpenCount, 99.9),
+        ReplayPercentileUs(latencies, ReplayOpenCount, 100));
+    printf("  \"schedule_lateness_us\": {\"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f}\n",
+        ReplayPercentileUs(lateness, ReplayOpenCount, 50),
+        ReplayPercentileUs(lateness, ReplayOpenCount, 99),
+        ReplayPercentileUs(lateness, ReplayOpenCount, 100));
+    printf("}\n");
+
+    SimDriverUnload();
+
+    for (i = 0; i < ReplayDeviceCount; i++) {
+        free(ReplayDevices[i].Verdicts);
+    }
+
+    free(ReplayDevices);
+    free(ReplayOpens);
+    free(records);
+    free(workers);
+    free(latencies);
+    free(lateness);
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Driver.h"
+#include "AccessTrace.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, AccessTraceInitialize)
+#pragma alloc_text (PAGE, AccessTraceUninitialize)
+#endif
+
+//
+// Recorded access requests, NULL if recording is off
+// 
+static PRECORD_RING AccessTraceRing = NULL;
+
+//
+// Serializes access to AccessTraceRing
+// 
+static WDFSPINLOCK AccessTraceLock = NULL;
+
+//
+// Allocates the record buffer if enabled in the configuration.
+// 
+_Use_decl_annotations_
+NTSTATUS
+AccessTraceInitialize(
+    WDFDRIVER Driver
+)
+{
+    NTSTATUS                status;
+    WDF_OBJECT_ATTRIBUTES   attribs;
+
+    PAGED_CODE();
+
+    if (GuardianConfig.AccessTraceCapacity == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = Driver;
+
+    status = WdfSpinLockCreate(&attribs, &AccessTraceLock);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "WdfSpinLockCreate failed with status %!STATUS!", status);
+        return status;
+    }
+
+    AccessTraceRing = RECORD_RING_CREATE(
+        GuardianConfig.AccessTraceCapacity,
+        sizeof(HIDGUARDIAN_ACCESS_RECORD)
+    );
+    if (AccessTraceRing == NULL) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "RECORD_RING_CREATE failed");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DRIVER,
+        "Recording up to %d access requests", AccessTraceRing->Capacity);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Frees the record buffer on driver unload.
+// 
+_Use_decl_annotations_
+VOID
+AccessTraceUninitialize(
+    VOID
+)
+{
+    PAGED_CODE();
+
+    //
+    // No devices left at this point, so nobody records anymore
+    // 
+    RECORD_RING_DESTROY(&AccessTraceRing);
+}
+
+//
+// Stable identity of a device across reboots and trace files.
+// 
+ULONG
+AccessTraceDeviceHash(
+    PCWSTR DeviceId,
+    PCWSTR InstanceId
+)
+{
+    ULONG hash = 2166136261;
+
+    for (; *DeviceId != L'\0'; DeviceId++) {
+        hash = (hash ^ *DeviceId) * 16777619;
+    }
+
+    hash = (hash ^ L'\\') * 16777619;
+
+    for (; *InstanceId != L'\0'; InstanceId++) {
+        hash = (hash ^ *InstanceId) * 16777619;
+    }
+
+    return hash;
+}
+
+//
+// Appends a resolved access request to the trace.
+// 
+_Use_decl_annotations_
+VOID
+AccessTraceRecord(
+    PDEVICE_CONTEXT DeviceContext,
+    ULONG ProcessId,
+    UCHAR Path,
+    BOOLEAN IsAllowed,
+    BOOLEAN IsSticky,
+    ULONGLONG ArrivalTime,
+    ULONGLONG PickupTime
+)
+{
+    PHIDGUARDIAN_ACCESS_RECORD  pRecord;
+    ULONGLONG                   now;
+
+    if (AccessTraceRing == NULL) {
+        return;
+    }
+
+    now = KeQueryInterruptTime();
+
+    WdfSpinLockAcquire(AccessTraceLock);
+
+    pRecord = RECORD_RING_PUSH(AccessTraceRing);
+
+    pRecord->Timestamp = ArrivalTime;
+    pRecord->DeviceHash = DeviceContext->DeviceHash;
+    pRecord->ProcessId = ProcessId;
+    pRecord->Path = Path;
+    pRecord->IsAllowed = IsAllowed;
+    pRecord->IsSticky = IsSticky;
+    pRecord->Reserved = 0;
+
+    //
+    // Requests resolved on arrival were never queued
+    // 
+    if (PickupTime != 0) {
+        pRecord->PendingTime = (ULONG)min(PickupTime - ArrivalTime, MAXULONG);
+        pRecord->AuthTime = (ULONG)min(now - PickupTime, MAXULONG);
+    }
+    else {
+        pRecord->PendingTime = (ULONG)min(now - ArrivalTime, MAXULONG);
+        pRecord->AuthTime = 0;
+    }
+
+    WdfSpinLockRelease(AccessTraceLock);
+}
+
+//
+// Moves as many records as fit into the supplied buffer, oldest first.
+// 
+_Use_decl_annotations_
+NTSTATUS
+AccessTraceDrain(
+    PHIDGUARDIAN_ACCESS_TRACE Trace,
+    ULONG BufferLength
+)
+{
+    ULONG count;
+
+    if (AccessTraceRing == NULL) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if (BufferLength < sizeof(HIDGUARDIAN_ACCESS_TRACE)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    count = (BufferLength - sizeof(HIDGUARDIAN_ACCESS_TRACE)) / sizeof(HIDGUARDIAN_ACCESS_RECORD);
+
+    WdfSpinLockAcquire(AccessTraceLock);
+
+    count = RECORD_RING_POP(AccessTraceRing, Trace + 1, count);
+
+    Trace->DroppedCount = (ULONG)min(AccessTraceRing->Dropped, MAXULONG);
+    Trace->RemainingCount = RECORD_RING_COUNT(AccessTraceRing);
+    AccessTraceRing->Dropped = 0;
+
+    WdfSpinLockRelease(AccessTraceLock);
+
+    Trace->Size = sizeof(HIDGUARDIAN_ACCESS_TRACE) + count * sizeof(HIDGUARDIAN_ACCESS_RECORD);
+    Trace->Version = HIDGUARDIAN_ACCESS_TRACE_VERSION;
+    Trace->RecordSize = sizeof(HIDGUARDIAN_ACCESS_RECORD);
+    Trace->RecordCount = count;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE,
+        TRACE_DRIVER,
+        "Drained %d access records (%d dropped, %d remaining)",
+        count, Trace->DroppedCount, Trace->RemainingCount);
+
+    return STATUS_SUCCESS;
+}
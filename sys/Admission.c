@@ -0,0 +1,134 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+
+#include "Driver.h"
+#include "Admission.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, AdmissionInitialize)
+#pragma alloc_text (PAGE, AdmissionUninitialize)
+#endif
+
+//
+// Open rate allowance of every process, NULL if rate limiting is off
+// 
+static PTOKEN_BUCKETS AdmissionBuckets = NULL;
+
+//
+// Serializes access to AdmissionBuckets
+// 
+static WDFSPINLOCK AdmissionLock = NULL;
+
+//
+// Allocates the per-process buckets unless disabled in the configuration.
+// 
+_Use_decl_annotations_
+NTSTATUS
+AdmissionInitialize(
+    WDFDRIVER Driver
+)
+{
+    NTSTATUS                status;
+    WDF_OBJECT_ATTRIBUTES   attribs;
+
+    PAGED_CODE();
+
+    if (GuardianConfig.OpenRateLimit == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = Driver;
+
+    status = WdfSpinLockCreate(&attribs, &AdmissionLock);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "WdfSpinLockCreate failed with status %!STATUS!", status);
+        return status;
+    }
+
+    AdmissionBuckets = TOKEN_BUCKETS_CREATE(
+        TOKEN_BUCKETS_DEFAULT_CAPACITY,
+        GuardianConfig.OpenRateLimit,
+        GuardianConfig.OpenRateBurst);
+    if (AdmissionBuckets == NULL) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "TOKEN_BUCKETS_CREATE failed");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DRIVER,
+        "Limiting %d processes to %d opens per second, bursts of %d",
+        AdmissionBuckets->Capacity,
+        GuardianConfig.OpenRateLimit,
+        GuardianConfig.OpenRateBurst);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Frees the buckets on driver unload.
+// 
+_Use_decl_annotations_
+VOID
+AdmissionUninitialize(
+    VOID
+)
+{
+    PAGED_CODE();
+
+    TOKEN_BUCKETS_DESTROY(&AdmissionBuckets);
+}
+
+//
+// Charges an open of a guarded device to the given process, returns FALSE
+// if the process exceeds its open rate.
+// 
+_Use_decl_annotations_
+BOOLEAN
+AdmissionTake(
+    ULONG ProcessId
+)
+{
+    BOOLEAN admitted;
+
+    if (AdmissionBuckets == NULL) {
+        return TRUE;
+    }
+
+    WdfSpinLockAcquire(AdmissionLock);
+
+    admitted = TOKEN_BUCKETS_TAKE(AdmissionBuckets, ProcessId, KeQueryInterruptTime());
+
+    WdfSpinLockRelease(AdmissionLock);
+
+    return admitted;
+}
@@ -28,11 +28,64 @@
 #include "driver.h"
 #include "device.tmh"
 
+static NTSTATUS
+DeviceIdentityCreate(
+    _In_ WDFDEVICE Device,
+    _Out_ PDEVICE_IDENTITY* Identity
+);
+
+static VOID
+DeviceIdentityDestroy(
+    _Inout_ PDEVICE_IDENTITY* Identity
+);
+
+static NTSTATUS
+DeviceIdentityResolve(
+    _In_ WDFDEVICE Device,
+    _In_ BOOLEAN Deferred
+);
+
+EVT_WDF_WORKITEM DeviceIdentityPrefetch;
+
+static NTSTATUS
+DeviceGuardCreateState(
+    _In_ WDFDEVICE Device
+);
+
+static BOOLEAN
+DeviceGuardTryReference(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
+EVT_WDF_TIMER DeviceGuardIdleExpired;
+
+EVT_WDF_TIMER DeviceDeferExpired;
+
+EVT_WDF_WORKITEM DevicePendingResolve;
+
+static VOID
+DevicePendingDrop(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _In_ WDFQUEUE Queue
+);
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (PAGE, HidGuardianCreateDevice)
+#pragma alloc_text (PAGE, DeviceIdentityCreate)
+#pragma alloc_text (PAGE, DeviceIdentityDestroy)
+#pragma alloc_text (PAGE, DeviceIdentityRelease)
+#pragma alloc_text (PAGE, DeviceIdentityResolve)
+#pragma alloc_text (PAGE, DeviceIdentityEnsure)
+#pragma alloc_text (PAGE, DeviceIdentityEnsureAll)
+#pragma alloc_text (PAGE, DeviceIdentityPrefetch)
 #pragma alloc_text (PAGE, BusQueryId)
 #pragma alloc_text (PAGE, HidGuardianEvtDeviceContextCleanup)
 #pragma alloc_text (PAGE, EvtFileCleanup)
+#pragma alloc_text (PAGE, DeviceGuardAcquire)
+#pragma alloc_text (PAGE, DeviceGuardCreateState)
+#pragma alloc_text (PAGE, DeviceGuardIdleExpired)
+#pragma alloc_text (PAGE, DeviceDeferExpired)
+#pragma alloc_text (PAGE, DevicePendingResolve)
 #endif
 
 
@@ -46,16 +99,18 @@ HidGuardianCreateDevice(
     WDFDEVICE                       device;
     NTSTATUS                        status;
     WDF_FILEOBJECT_CONFIG           deviceConfig;
-    WDFMEMORY                       memory;
-    WDFMEMORY                       classNameMemory;
-    PCWSTR                          className;
     WDF_PNPPOWER_EVENT_CALLBACKS    pnpPowerCallbacks;
+    WDF_WORKITEM_CONFIG             workItemConfig;
+    WDFWORKITEM                     workItem;
     PCONTROL_DEVICE_CONTEXT         pControlCtx;
     WDFREQUEST                      notifyReq;
+    ULONGLONG                       start;
 
 
     PAGED_CODE();
 
+    start = LatencyTimestamp();
+
     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Entry");
 
     //
@@ -124,139 +179,128 @@ HidGuardianCreateDevice(
         //
         pDeviceCtx = DeviceGetContext(device);
 
-        //
-        // Query Device ID
-        // 
-        status = BusQueryId(device,
-            BusQueryDeviceID,
-            pDeviceCtx->DeviceID,
-            MAX_DEVICE_ID_SIZE
-        );
-        if (!NT_SUCCESS(status))
-        {
+        pDeviceCtx->RegistryIndex = DEVICE_REGISTRY_INVALID_INDEX;
+
+        ExInitializeRundownProtection(&pDeviceCtx->IdentityRundown);
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+        attribs.ParentObject = device;
+
+        status = WdfWaitLockCreate(&attribs, &pDeviceCtx->IdentityLock);
+        if (!NT_SUCCESS(status)) {
             TraceEvents(TRACE_LEVEL_ERROR,
                 TRACE_DEVICE,
-                "BusQueryDeviceID failed with status %!STATUS!", status);
+                "WdfWaitLockCreate failed with status %!STATUS!", status);
             return status;
         }
 
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_DEVICE,
-            "BusQueryDeviceID = %ws\n", pDeviceCtx->DeviceID);
-
         //
-        // Query Instance ID
+        // Query Hardware IDs; Device and Instance ID cost two synchronous
+        // IRPs to the bus driver and nobody needs them before the first
+        // open, so they're looked up after the add
         // 
-        BusQueryId(device,
-            BusQueryInstanceID,
-            pDeviceCtx->InstanceID,
-            MAX_INSTANCE_ID_SIZE
-        );
+        status = DeviceIdentityCreate(device, &pDeviceCtx->Identity);
         if (!NT_SUCCESS(status))
         {
             TraceEvents(TRACE_LEVEL_ERROR,
                 TRACE_DEVICE,
-                "BusQueryInstanceID failed with status %!STATUS!", status);
+                "DeviceIdentityCreate failed with status %!STATUS!", status);
             return status;
         }
 
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_DEVICE,
-            "BusQueryInstanceID = %ws\n", pDeviceCtx->InstanceID);
-
         //
-        // Linked list for sticky PIDs
-        // 
-        pDeviceCtx->StickyPidList = PID_LIST_CREATE();
-        if (pDeviceCtx->StickyPidList == NULL) {
+        // Initialize the I/O Package and any Queues
+        //
+        status = HidGuardianQueueInitialize(device);
+        if (!NT_SUCCESS(status)) {
             TraceEvents(TRACE_LEVEL_ERROR,
                 TRACE_DEVICE,
-                "PID_LIST_CREATE failed");
-            return STATUS_INSUFFICIENT_RESOURCES;
+                "HidGuardianQueueInitialize failed with status %!STATUS!", status);
+            return status;
         }
 
         //
-        // Always allow SYSTEM PID 4
-        // 
-        PID_LIST_PUSH(&pDeviceCtx->StickyPidList, SYSTEM_PID, TRUE);
-
-        WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
-        attribs.ParentObject = device;
-
+        // Add this device to the device registry; nothing would resolve
+        // the pending opens of a device missing from it when Cerberus
+        // leaves, so it's better not filtered at all
         //
-        // Query for current device's Hardware ID
-        // 
-        status = WdfDeviceAllocAndQueryProperty(device,
-            DevicePropertyHardwareID,
-            NonPagedPool,
-            &attribs,
-            &memory
-        );
+        WdfWaitLockAcquire(DeviceRegistryLock, NULL);
+        status = DeviceRegistryAdd(device, &pDeviceCtx->RegistryIndex);
+        WdfWaitLockRelease(DeviceRegistryLock);
 
         if (!NT_SUCCESS(status)) {
             TraceEvents(TRACE_LEVEL_ERROR,
                 TRACE_DEVICE,
-                "WdfDeviceAllocAndQueryProperty failed with status %!STATUS!", status);
+                "DeviceRegistryAdd failed with status %!STATUS!", status);
             return status;
         }
 
         //
-        // Get Hardware ID string
-        // 
-        pDeviceCtx->HardwareIDsMemory = memory;
-        pDeviceCtx->HardwareIDs = WdfMemoryGetBuffer(memory, &pDeviceCtx->HardwareIDsLength);
-
-        WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
-        attribs.ParentObject = device;
-
+        // Create a control device
         //
-        // Query for current device's ClassName
-        // 
-        status = WdfDeviceAllocAndQueryProperty(device,
-            DevicePropertyClassName,
-            NonPagedPool,
-            &attribs,
-            &classNameMemory
-        );
+        status = HidGuardianCreateControlDevice(device);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_DEVICE,
+                "HidGuardianCreateControlDevice failed with status %!STATUS!", status);
 
-        if (NT_SUCCESS(status)) {
-            className = WdfMemoryGetBuffer(classNameMemory, NULL);
+            return status;
+        }
 
+        if (AmIMaster(pDeviceCtx))
+        {
             TraceEvents(TRACE_LEVEL_INFORMATION,
                 TRACE_DEVICE,
-                "Current device class: %ls", className);
+                "I am the master, skipping further initialization");
+
+            pDeviceCtx->AllowByDefault = FALSE;
+
+            //
+            // Opens still get decided, but only ever by default action
+            // 
+            status = CreateRequestsQueueInitialize(device);
+            if (!NT_SUCCESS(status)) {
+                TraceEvents(TRACE_LEVEL_ERROR,
+                    TRACE_DEVICE,
+                    "CreateRequestsQueueInitialize failed with %!STATUS!", status);
+            }
+
+            goto creationDone;
         }
 
         //
-        // Initialize the I/O Package and any Queues
-        //
-        status = HidGuardianQueueInitialize(device);
-        if (!NT_SUCCESS(status)) {
+        // Check if this device should get intercepted
+        // 
+        status = AmIAffected(pDeviceCtx);
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_DEVICE,
+            "AmIAffected status %!STATUS!", status);
+
+        pDeviceCtx->Counters = PER_CPU_COUNTERS_CREATE(DEVICE_COUNTER_COUNT);
+        if (pDeviceCtx->Counters == NULL) {
             TraceEvents(TRACE_LEVEL_ERROR,
                 TRACE_DEVICE,
-                "HidGuardianQueueInitialize failed with status %!STATUS!", status);
-            return status;
+                "PER_CPU_COUNTERS_CREATE failed");
+            return STATUS_INSUFFICIENT_RESOURCES;
         }
 
-        //
-        // Create PendingAuthQueue I/O Queue
-        // 
-        status = PendingAuthQueueInitialize(device);
+        status = LatencyCreateHistograms(pDeviceCtx);
         if (!NT_SUCCESS(status)) {
             TraceEvents(TRACE_LEVEL_ERROR,
                 TRACE_DEVICE,
-                "PendingAuthQueueInitialize failed with %!STATUS!", status);
+                "LatencyCreateHistograms failed with status %!STATUS!", status);
             return status;
         }
 
-        //
-        // Create PendingAuthQueue I/O Queue
-        //  
-        status = PendingCreateRequestsQueueInitialize(device);
+        WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+        attribs.ParentObject = device;
+
+        status = WdfWaitLockCreate(&attribs, &pDeviceCtx->GuardLock);
         if (!NT_SUCCESS(status)) {
             TraceEvents(TRACE_LEVEL_ERROR,
                 TRACE_DEVICE,
-                "PendingCreateRequestsQueueInitialize failed with %!STATUS!", status);
+                "WdfWaitLockCreate failed with status %!STATUS!", status);
             return status;
         }
 
@@ -272,7 +316,8 @@ HidGuardianCreateDevice(
         }
 
         //
-        // Create NotificationsQueue I/O Queue
+        // Create NotificationsQueue I/O Queue; Cerberus parks a request on
+        // every guarded device, so this one can't wait for the first open
         // 
         status = NotificationsQueueInitialize(device);
         if (!NT_SUCCESS(status)) {
@@ -283,44 +328,10 @@ HidGuardianCreateDevice(
         }
 
         //
-        // Add this device to the FilterDevice collection.
-        //
-        WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
-        //
-        // WdfCollectionAdd takes a reference on the item object and removes
-        // it when you call WdfCollectionRemove.
-        //
-        status = WdfCollectionAdd(FilterDeviceCollection, device);
-        if (!NT_SUCCESS(status)) {
-            TraceEvents(TRACE_LEVEL_ERROR,
-                TRACE_DEVICE,
-                "WdfCollectionAdd failed with status %!STATUS!", status);
-        }
-        WdfWaitLockRelease(FilterDeviceCollectionLock);
-
-        //
-        // Create a control device
-        //
-        status = HidGuardianCreateControlDevice(device);
-        if (!NT_SUCCESS(status)) {
-            TraceEvents(TRACE_LEVEL_ERROR,
-                TRACE_DEVICE,
-                "HidGuardianCreateControlDevice failed with status %!STATUS!", status);
-
-            return status;
-        }
-
-        if (AmIMaster(pDeviceCtx))
-        {
-            TraceEvents(TRACE_LEVEL_INFORMATION,
-                TRACE_DEVICE,
-                "I am the master, skipping further initialization");
-
-            status = STATUS_SUCCESS;
-            pDeviceCtx->AllowByDefault = FALSE;
-
-            goto creationDone;
-        }
+        // Sticky cache and pending queues follow with the first open
+        // Cerberus has to decide on
+        // 
+        pDeviceCtx->IsGuarded = TRUE;
 
         //
         // Expose FDO interface GUID
@@ -339,15 +350,6 @@ HidGuardianCreateDevice(
         // 
         pDeviceCtx->AllowByDefault = TRUE;
 
-        //
-        // Check if this device should get intercepted
-        // 
-        status = AmIAffected(pDeviceCtx);
-
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_DEVICE,
-            "AmIAffected status %!STATUS!", status);
-
         //
         // Try to notify Cerberus that a new device is available
         //
@@ -368,6 +370,24 @@ HidGuardianCreateDevice(
 
 creationDone:
 
+    if (NT_SUCCESS(status)) {
+        //
+        // Have the rest of the identity ready by the time somebody needs
+        // it; if this fails, the first one to need it looks it up
+        // 
+        WDF_WORKITEM_CONFIG_INIT(&workItemConfig, DeviceIdentityPrefetch);
+        workItemConfig.AutomaticSerialization = FALSE;
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+        attribs.ParentObject = device;
+
+        if (NT_SUCCESS(WdfWorkItemCreate(&workItemConfig, &attribs, &workItem))) {
+            WdfWorkItemEnqueue(workItem);
+        }
+
+        LatencyRecordDeviceAdd(start);
+    }
+
     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Exit");
 
     return status;
@@ -417,7 +437,7 @@ NTSTATUS BusQueryId(
     {
         WCHAR *retval = (WCHAR*)iosb.Information;
 
-        if (wcslen(retval) > BufferLength)
+        if (wcslen(retval) >= BufferLength)
         {
             ExFreePool(retval); // IRP_MN_QUERY_ID requires this
             return STATUS_BUFFER_TOO_SMALL;
@@ -431,136 +451,1765 @@ NTSTATUS BusQueryId(
 }
 
 //
-// Gets called when the device gets removed.
-// 
-// Happens once in the devices lifetime.
+// Looks up the hardware IDs of the device and interns them in the
+// identity pool. Device and instance ID are left to
+// DeviceIdentityResolve.
 // 
-#pragma warning(push)
-#pragma warning(disable:28118) // this callback will run at IRQL=PASSIVE_LEVEL
-_Use_decl_annotations_
-VOID
-HidGuardianEvtDeviceContextCleanup(
-    WDFOBJECT Device
+static NTSTATUS
+DeviceIdentityCreate(
+    WDFDEVICE Device,
+    PDEVICE_IDENTITY* Identity
 )
 {
+    NTSTATUS            status;
+    WDF_OBJECT_ATTRIBUTES attribs;
+    WDFMEMORY           memory;
+    PCWSTR              hardwareIds;
+    PCWSTR              szIter;
+    size_t              hardwareIdsLength;
+    PDEVICE_IDENTITY    identity;
     ULONG               count;
-    PDEVICE_CONTEXT     pDeviceCtx;
+    ULONG               size;
+    ULONG               i;
 
     PAGED_CODE();
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Entry (PID: %d)", CURRENT_PROCESS_ID());
+    *Identity = NULL;
 
-    pDeviceCtx = DeviceGetContext(Device);
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = Device;
 
-    PID_LIST_DESTROY(&pDeviceCtx->StickyPidList);
+    //
+    // Query for current device's Hardware ID
+    // 
+    status = WdfDeviceAllocAndQueryProperty(Device,
+        DevicePropertyHardwareID,
+        PagedPool,
+        &attribs,
+        &memory
+    );
 
-    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DEVICE,
+            "WdfDeviceAllocAndQueryProperty failed with status %!STATUS!", status);
+        return status;
+    }
 
-    count = WdfCollectionGetCount(FilterDeviceCollection);
+    hardwareIds = WdfMemoryGetBuffer(memory, &hardwareIdsLength);
 
-    if (count == 1)
-    {
-        //
-        // We are the last instance. So let us delete the control-device
-        // so that driver can unload when the FilterDevice is deleted.
-        // We absolutely have to do the deletion of control device with
-        // the collection lock acquired because we implicitly use this
-        // lock to protect ControlDevice global variable. We need to make
-        // sure another thread doesn't attempt to create while we are
-        // deleting the device.
-        //
-        HidGuardianDeleteControlDevice((WDFDEVICE)Device);
+    for (count = 0, szIter = hardwareIds; *szIter; szIter += wcslen(szIter) + 1) {
+        count++;
     }
 
-    WdfCollectionRemove(FilterDeviceCollection, Device);
+    size = (ULONG)(FIELD_OFFSET(DEVICE_IDENTITY, HardwareIDs) + max(count, 1) * sizeof(PCWSTR));
 
-    WdfWaitLockRelease(FilterDeviceCollectionLock);
+    identity = ExAllocatePoolWithTag(NonPagedPool, size, DEVICE_IDENTITY_TAG);
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Exit");
+    if (identity != NULL)
+    {
+        RtlZeroMemory(identity, size);
+
+        identity->Size = size;
+        identity->References = 1;
+        identity->HardwareIDCount = count;
+        identity->HardwareIDsLength = (size_t)((szIter + 1) - hardwareIds) * sizeof(WCHAR);
+
+        for (i = 0, szIter = hardwareIds; i < count; i++, szIter += wcslen(szIter) + 1) {
+            identity->HardwareIDs[i] = IdentityPoolIntern(szIter);
+
+            if (identity->HardwareIDs[i] == NULL) {
+                break;
+            }
+        }
+
+        if (i == count) {
+            *Identity = identity;
+        }
+        else {
+            DeviceIdentityDestroy(&identity);
+            status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+    else {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    WdfObjectDelete(memory);
+
+    return status;
 }
-#pragma warning(pop) // enable 28118 again
 
 //
-// Gets called when a device handle gets closed.
-// 
-// May happen multiple times in the devices lifetime.
+// Returns the strings to the identity pool and frees the identity.
 // 
-_Use_decl_annotations_
-VOID
-EvtFileCleanup(
-    WDFFILEOBJECT  FileObject
+static VOID
+DeviceIdentityDestroy(
+    PDEVICE_IDENTITY* Identity
 )
 {
-    WDFDEVICE                   device;
-    PDEVICE_CONTEXT             pDeviceCtx;
-    PCONTROL_DEVICE_CONTEXT     pControlCtx;
-    ULONG                       pid;
-
+    ULONG i;
 
     PAGED_CODE();
 
-    device = WdfFileObjectGetDevice(FileObject);
-    pDeviceCtx = DeviceGetContext(device);
-    pControlCtx = ControlDeviceGetContext(ControlDevice);
-    pid = CURRENT_PROCESS_ID();
+    if (*Identity == NULL) {
+        return;
+    }
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Entry (PID: %d)", pid);
+    IdentityPoolRelease((*Identity)->DeviceID);
+    IdentityPoolRelease((*Identity)->InstanceID);
+    IdentityPoolRelease((*Identity)->ClassName);
 
-    //
-    // Remove PID from sticky list - if it is found
-    // 
-    if (PID_LIST_REMOVE_BY_PID(&pDeviceCtx->StickyPidList, pid))
-    {
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_DEVICE,
-            "PID %d was sticky, removed from cache",
-            pid);
+    for (i = 0; i < (*Identity)->HardwareIDCount; i++) {
+        IdentityPoolRelease((*Identity)->HardwareIDs[i]);
     }
 
-    //
-    // Cerberus handle got closed, perform clean-up
-    // 
-    if (pControlCtx->CerberusPid == pid) {
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_DEVICE,
-            "Cerberus has left the realm, performing clean-up");
+    ExFreePoolWithTag(*Identity, DEVICE_IDENTITY_TAG);
+
+    *Identity = NULL;
+}
 
-        WdfIoQueuePurgeSynchronously(pDeviceCtx->PendingCreateRequestsQueue);
-        WdfIoQueueStart(pDeviceCtx->PendingCreateRequestsQueue);
+//
+// Takes another reference on the identity.
+// 
+_Use_decl_annotations_
+VOID
+DeviceIdentityReference(
+    PDEVICE_IDENTITY Identity
+)
+{
+    InterlockedIncrement(&Identity->References);
+}
+
+//
+// Drops a reference on the identity, freeing it with the last one.
+// 
+_Use_decl_annotations_
+VOID
+DeviceIdentityRelease(
+    PDEVICE_IDENTITY* Identity
+)
+{
+    PAGED_CODE();
 
-        WdfIoQueuePurgeSynchronously(pDeviceCtx->PendingAuthQueue);
-        WdfIoQueueStart(pDeviceCtx->PendingAuthQueue);
+    if (*Identity == NULL) {
+        return;
     }
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Exit");
+    if (InterlockedDecrement(&(*Identity)->References) == 0) {
+        DeviceIdentityDestroy(Identity);
+    }
+
+    *Identity = NULL;
 }
 
 //
-// Gets called when the device gets powered down.
+// Queries Device and Instance ID from the bus driver and completes the
+// identity with them and the class name. Deferred tells the work item
+// queued at add apart from callers that had to wait for the lookup.
 // 
-_Use_decl_annotations_
-NTSTATUS
-EvtWdfDeviceReleaseHardware(
-    WDFDEVICE  Device,
-    WDFCMRESLIST  ResourcesTranslated
+// Guarded devices are announced to Cerberus once their identity is
+// complete.
+// 
+static NTSTATUS
+DeviceIdentityResolve(
+    WDFDEVICE Device,
+    BOOLEAN Deferred
 )
 {
+    NTSTATUS            status;
     PDEVICE_CONTEXT     pDeviceCtx;
+    PDEVICE_IDENTITY    identity;
+    WDF_OBJECT_ATTRIBUTES attribs;
+    WDFMEMORY           classNameMemory;
+    PWCHAR              scratch;
+    PWCHAR              pInstanceId;
+    ULONGLONG           start;
 
-    UNREFERENCED_PARAMETER(ResourcesTranslated);
-
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Entry");
+    PAGED_CODE();
 
     pDeviceCtx = DeviceGetContext(Device);
+    identity = pDeviceCtx->Identity;
 
-    pDeviceCtx->IsShuttingDown = TRUE;
+    WdfWaitLockAcquire(pDeviceCtx->IdentityLock, NULL);
 
-    WdfIoQueuePurge(pDeviceCtx->CreateRequestsQueue, NULL, NULL);
-    WdfIoQueuePurge(pDeviceCtx->PendingCreateRequestsQueue, NULL, NULL);
-    WdfIoQueuePurge(pDeviceCtx->PendingAuthQueue, NULL, NULL);
-    WdfIoQueuePurge(pDeviceCtx->NotificationsQueue, NULL, NULL);
+    //
+    // Somebody else got here first
+    // 
+    if (ReadAcquire(&pDeviceCtx->IdentityReady)) {
+        WdfWaitLockRelease(pDeviceCtx->IdentityLock);
+        return STATUS_SUCCESS;
+    }
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Exit");
+    //
+    // Failed not long ago, the bus driver won't know any better yet
+    // 
+    if (!NT_SUCCESS(pDeviceCtx->IdentityStatus) && KeQueryInterruptTime() < pDeviceCtx->IdentityRetryTime) {
+        status = pDeviceCtx->IdentityStatus;
+        WdfWaitLockRelease(pDeviceCtx->IdentityLock);
+        return status;
+    }
 
-    return STATUS_SUCCESS;
+    start = LatencyTimestamp();
+
+    scratch = ExAllocatePoolWithTag(PagedPool,
+        (MAX_DEVICE_ID_SIZE + MAX_INSTANCE_ID_SIZE) * sizeof(WCHAR), DEVICE_IDENTITY_TAG);
+    if (scratch == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto resolveDone;
+    }
+
+    pInstanceId = scratch + MAX_DEVICE_ID_SIZE;
+
+    //
+    // Query Device ID
+    // 
+    status = BusQueryId(Device,
+        BusQueryDeviceID,
+        scratch,
+        MAX_DEVICE_ID_SIZE
+    );
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DEVICE,
+            "BusQueryDeviceID failed with status %!STATUS!", status);
+        goto resolveDone;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DEVICE,
+        "BusQueryDeviceID = %ws\n", scratch);
+
+    //
+    // Query Instance ID
+    // 
+    status = BusQueryId(Device,
+        BusQueryInstanceID,
+        pInstanceId,
+        MAX_INSTANCE_ID_SIZE
+    );
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DEVICE,
+            "BusQueryInstanceID failed with status %!STATUS!", status);
+        goto resolveDone;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DEVICE,
+        "BusQueryInstanceID = %ws\n", pInstanceId);
+
+    identity->DeviceID = IdentityPoolIntern(scratch);
+    identity->InstanceID = IdentityPoolIntern(pInstanceId);
+
+    if (identity->DeviceID == NULL || identity->InstanceID == NULL) {
+        IdentityPoolRelease(identity->DeviceID);
+        IdentityPoolRelease(identity->InstanceID);
+        identity->DeviceID = NULL;
+        identity->InstanceID = NULL;
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto resolveDone;
+    }
+
+    pDeviceCtx->DeviceHash = AccessTraceDeviceHash(identity->DeviceID, identity->InstanceID);
+
+    //
+    // Query for current device's ClassName, not every device has one
+    // 
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = Device;
+
+    if (NT_SUCCESS(WdfDeviceAllocAndQueryProperty(Device,
+        DevicePropertyClassName,
+        PagedPool,
+        &attribs,
+        &classNameMemory)))
+    {
+        identity->ClassName = IdentityPoolIntern((PCWSTR)WdfMemoryGetBuffer(classNameMemory, NULL));
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_DEVICE,
+            "Current device class: %ls", (PCWSTR)WdfMemoryGetBuffer(classNameMemory, NULL));
+
+        WdfObjectDelete(classNameMemory);
+    }
+
+    WriteRelease(&pDeviceCtx->IdentityReady, TRUE);
+
+resolveDone:
+
+    LatencyRecordIdentity(start, Deferred, status);
+
+    if (!NT_SUCCESS(status)) {
+        pDeviceCtx->IdentityRetryDelay = (pDeviceCtx->IdentityRetryDelay == 0)
+            ? DEVICE_IDENTITY_RETRY_MIN
+            : min(pDeviceCtx->IdentityRetryDelay * 2, DEVICE_IDENTITY_RETRY_MAX);
+        pDeviceCtx->IdentityRetryTime = KeQueryInterruptTime() + pDeviceCtx->IdentityRetryDelay;
+    }
+
+    pDeviceCtx->IdentityStatus = status;
+
+    WdfWaitLockRelease(pDeviceCtx->IdentityLock);
+
+    if (scratch != NULL) {
+        ExFreePoolWithTag(scratch, DEVICE_IDENTITY_TAG);
+    }
+
+    if (NT_SUCCESS(status) && pDeviceCtx->IsGuarded) {
+        DeviceChangesPost(pDeviceCtx, HIDGUARDIAN_DEVICE_ARRIVAL);
+    }
+
+    return status;
+}
+
+//
+// Makes sure Device and Instance ID of the device are known. Costs a
+// single load once they are; the first caller after the add may have
+// to wait for the lookup (or the work item doing it) instead.
+// 
+_Use_decl_annotations_
+NTSTATUS
+DeviceIdentityEnsure(
+    WDFDEVICE Device
+)
+{
+    PAGED_CODE();
+
+    if (ReadAcquire(&DeviceGetContext(Device)->IdentityReady)) {
+        return STATUS_SUCCESS;
+    }
+
+    return DeviceIdentityResolve(Device, FALSE);
+}
+
+//
+// Makes sure Device and Instance ID of all registered devices are known,
+// as far as they can be looked up. Registry walks call this up front and
+// then skip devices without them, so no slot is held while the bus driver
+// answers and removals don't wait for it under DeviceRegistryLock.
+// 
+_Use_decl_annotations_
+VOID
+DeviceIdentityEnsureAll(
+    VOID
+)
+{
+    WDFDEVICE       device;
+    PDEVICE_CONTEXT pDeviceCtx;
+    BOOLEAN         held;
+    ULONG           i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < DeviceRegistryBound(); i++)
+    {
+        device = DeviceRegistryAcquire(i);
+        if (device == NULL) {
+            continue;
+        }
+
+        pDeviceCtx = DeviceGetContext(device);
+
+        if (ReadAcquire(&pDeviceCtx->IdentityReady)) {
+            DeviceRegistryRelease(i);
+            continue;
+        }
+
+        held = ExAcquireRundownProtection(&pDeviceCtx->IdentityRundown);
+
+        DeviceRegistryRelease(i);
+
+        //
+        // On its way out
+        // 
+        if (!held) {
+            continue;
+        }
+
+        (VOID)DeviceIdentityEnsure(device);
+
+        ExReleaseRundownProtection(&pDeviceCtx->IdentityRundown);
+    }
+}
+
+//
+// Looks up the rest of the identity right after the add, off the path
+// of the PnP manager.
+// 
+_Use_decl_annotations_
+VOID
+DeviceIdentityPrefetch(
+    WDFWORKITEM WorkItem
+)
+{
+    PAGED_CODE();
+
+    (VOID)DeviceIdentityResolve((WDFDEVICE)WdfWorkItemGetParentObject(WorkItem), TRUE);
+}
+
+//
+// Writes the hardware IDs as the multi-sz the device reported them as.
+// 
+_Use_decl_annotations_
+VOID
+DeviceIdentityWriteHardwareIDs(
+    PDEVICE_IDENTITY Identity,
+    PWCHAR Buffer
+)
+{
+    size_t length;
+    ULONG i;
+
+    for (i = 0; i < Identity->HardwareIDCount; i++) {
+        length = wcslen(Identity->HardwareIDs[i]) + 1;
+        RtlCopyMemory(Buffer, Identity->HardwareIDs[i], length * sizeof(WCHAR));
+        Buffer += length;
+    }
+
+    *Buffer = L'\0';
+}
+
+//
+// Bytes the strings of a complete identity take in device change and
+// device list records; returns the string lengths in characters too.
+// 
+_Use_decl_annotations_
+ULONG
+DeviceIdentityMeasureStrings(
+    PDEVICE_IDENTITY Identity,
+    PUSHORT DeviceIdLength,
+    PUSHORT InstanceIdLength,
+    PUSHORT ClassNameLength
+)
+{
+    *DeviceIdLength = (USHORT)wcslen(Identity->DeviceID);
+    *InstanceIdLength = (USHORT)wcslen(Identity->InstanceID);
+    *ClassNameLength = (Identity->ClassName != NULL) ? (USHORT)wcslen(Identity->ClassName) : 0;
+
+    return (ULONG)((*DeviceIdLength + *InstanceIdLength + *ClassNameLength) * sizeof(WCHAR)
+        + Identity->HardwareIDsLength);
+}
+
+//
+// Writes device ID, instance ID and class name without terminators,
+// followed by the hardware IDs.
+// 
+_Use_decl_annotations_
+VOID
+DeviceIdentityWriteStrings(
+    PDEVICE_IDENTITY Identity,
+    PWCHAR Buffer
+)
+{
+    size_t length;
+
+    length = wcslen(Identity->DeviceID);
+    RtlCopyMemory(Buffer, Identity->DeviceID, length * sizeof(WCHAR));
+    Buffer += length;
+
+    length = wcslen(Identity->InstanceID);
+    RtlCopyMemory(Buffer, Identity->InstanceID, length * sizeof(WCHAR));
+    Buffer += length;
+
+    if (Identity->ClassName != NULL) {
+        length = wcslen(Identity->ClassName);
+        RtlCopyMemory(Buffer, Identity->ClassName, length * sizeof(WCHAR));
+        Buffer += length;
+    }
+
+    DeviceIdentityWriteHardwareIDs(Identity, Buffer);
+}
+
+//
+// Gets called when the device gets removed.
+// 
+// Happens once in the devices lifetime.
+// 
+#pragma warning(push)
+#pragma warning(disable:28118) // this callback will run at IRQL=PASSIVE_LEVEL
+_Use_decl_annotations_
+VOID
+HidGuardianEvtDeviceContextCleanup(
+    WDFOBJECT Device
+)
+{
+    PDEVICE_CONTEXT     pDeviceCtx;
+
+    PAGED_CODE();
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Entry (PID: %d)", CURRENT_PROCESS_ID());
+
+    pDeviceCtx = DeviceGetContext(Device);
+
+    //
+    // Cerberus only heard of devices with complete identity
+    // 
+    if (pDeviceCtx->IsGuarded && ReadAcquire(&pDeviceCtx->IdentityReady)) {
+        DeviceChangesPost(pDeviceCtx, HIDGUARDIAN_DEVICE_REMOVAL);
+    }
+
+    //
+    // Identity lookups of registry walks don't hold the slot, wait for
+    // them before taking the lock adds and removals need
+    // 
+    ExWaitForRundownProtectionRelease(&pDeviceCtx->IdentityRundown);
+
+    WdfWaitLockAcquire(DeviceRegistryLock, NULL);
+
+    //
+    // Waits for readers still walking over this device
+    // 
+    DeviceRegistryRemove(pDeviceCtx->RegistryIndex);
+
+    LatencyRetireHistograms(pDeviceCtx);
+
+    DeviceRegistryRemoveDone();
+
+    if (DeviceRegistryCount() == 0)
+    {
+        //
+        // We were the last instance. So let us delete the control-device
+        // so that driver can unload when the FilterDevice is deleted.
+        // We absolutely have to do the deletion of control device with
+        // the registry lock acquired because we implicitly use this
+        // lock to protect ControlDevice global variable. We need to make
+        // sure another thread doesn't attempt to create while we are
+        // deleting the device.
+        //
+        HidGuardianDeleteControlDevice((WDFDEVICE)Device);
+    }
+
+    WdfWaitLockRelease(DeviceRegistryLock);
+
+    //
+    // No longer reachable through the registry, safe to free
+    // 
+    VERDICT_CACHE_DESTROY(&pDeviceCtx->StickyCache);
+    PER_CPU_COUNTERS_DESTROY(&pDeviceCtx->Counters);
+    LatencyDestroyHistograms(pDeviceCtx);
+
+    DeviceIdentityRelease(&pDeviceCtx->Identity);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Exit");
+}
+#pragma warning(pop) // enable 28118 again
+
+//
+// Gets called when a device handle gets closed.
+// 
+// May happen multiple times in the devices lifetime.
+// 
+_Use_decl_annotations_
+VOID
+EvtFileCleanup(
+    WDFFILEOBJECT  FileObject
+)
+{
+    WDFDEVICE                   device;
+    PDEVICE_CONTEXT             pDeviceCtx;
+    ULONG                       pid;
+
+
+    PAGED_CODE();
+
+    device = WdfFileObjectGetDevice(FileObject);
+    pDeviceCtx = DeviceGetContext(device);
+    pid = CURRENT_PROCESS_ID();
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Entry (PID: %d)", pid);
+
+    //
+    // Remove PID from sticky list - if it is found
+    // 
+    if (DeviceGuardReference(pDeviceCtx))
+    {
+        if (StickyCacheRemove(pDeviceCtx, pid))
+        {
+            TraceEvents(TRACE_LEVEL_INFORMATION,
+                TRACE_DEVICE,
+                "PID %d was sticky, removed from cache",
+                pid);
+        }
+
+        DeviceGuardRelease(pDeviceCtx);
+    }
+
+    //
+    // Pending requests of Cerberus leaving are taken care of for all
+    // devices at once by HidGuardianSidebandFileCleanup
+    // 
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Exit");
+}
+
+//
+// Gets called when the device gets powered down.
+// 
+_Use_decl_annotations_
+NTSTATUS
+EvtWdfDeviceReleaseHardware(
+    WDFDEVICE  Device,
+    WDFCMRESLIST  ResourcesTranslated
+)
+{
+    PDEVICE_CONTEXT     pDeviceCtx;
+
+    UNREFERENCED_PARAMETER(ResourcesTranslated);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Entry");
+
+    pDeviceCtx = DeviceGetContext(Device);
+
+    pDeviceCtx->IsShuttingDown = TRUE;
+
+    if (pDeviceCtx->CreateRequestsQueue != NULL) {
+        WdfIoQueuePurge(pDeviceCtx->CreateRequestsQueue, NULL, NULL);
+    }
+
+    if (pDeviceCtx->NotificationsQueue != NULL) {
+        WdfIoQueuePurge(pDeviceCtx->NotificationsQueue, NULL, NULL);
+    }
+
+    if (DeviceGuardReference(pDeviceCtx)) {
+        DevicePendingDrop(pDeviceCtx, pDeviceCtx->PendingCreateRequestsQueue);
+        DevicePendingDrop(pDeviceCtx, pDeviceCtx->PendingAuthQueue);
+
+        if (pDeviceCtx->DeferredRequestsQueue != NULL) {
+            DevicePendingDrop(pDeviceCtx, pDeviceCtx->DeferredRequestsQueue);
+        }
+
+        InterlockedExchange(&pDeviceCtx->UnnotifiedCreateRequests, 0);
+
+        DeviceGuardRelease(pDeviceCtx);
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DEVICE, "%!FUNC! Exit");
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Fails the requests on a pending queue of a device going away; they
+// never got a decision, so each one is accounted as a timeout. The
+// queue is purged afterwards to turn away anything arriving later.
+// 
+static VOID
+DevicePendingDrop(
+    PDEVICE_CONTEXT DeviceContext,
+    WDFQUEUE Queue
+)
+{
+    PCREATE_REQUEST_CONTEXT pRequestCtx;
+    WDFREQUEST              request;
+
+    while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(Queue, &request)))
+    {
+        pRequestCtx = CreateRequestGetContext(request);
+
+        CREATE_REQUEST_STAMP(pRequestCtx, HIDGUARDIAN_STAGE_COMPLETED);
+
+        DEVICE_COUNTER_INCREMENT(DeviceContext, Timeouts);
+        LatencyRecord(DeviceContext, HIDGUARDIAN_ACCESS_PATH_TIMEOUT,
+            pRequestCtx->StageTimes[HIDGUARDIAN_STAGE_ARRIVAL]);
+        AccessTraceRecord(DeviceContext, pRequestCtx->ProcessId, HIDGUARDIAN_ACCESS_PATH_TIMEOUT,
+            FALSE, FALSE, pRequestCtx->ArrivalTime, pRequestCtx->PickupTime);
+        StageTraceRecord(DeviceContext, pRequestCtx, HIDGUARDIAN_ACCESS_PATH_TIMEOUT, FALSE);
+
+        WdfRequestComplete(request, STATUS_CANCELLED);
+    }
+
+    WdfIoQueuePurge(Queue, NULL, NULL);
+}
+
+//
+// Looks up a cached verdict for the given PID. Lookups of concurrent
+// create requests don't exclude each other.
+// 
+BOOLEAN StickyCacheLookup(
+    PDEVICE_CONTEXT DeviceContext,
+    ULONG Pid,
+    PBOOLEAN Allowed
+)
+{
+    BOOLEAN found;
+    ULONGLONG now = KeQueryInterruptTime();
+    KIRQL oldIrql;
+
+    oldIrql = ExAcquireSpinLockShared(&DeviceContext->StickyCacheLock);
+    found = VERDICT_CACHE_PEEK(DeviceContext->StickyCache, Pid, now, Allowed);
+    ExReleaseSpinLockShared(&DeviceContext->StickyCacheLock, oldIrql);
+
+    return found;
+}
+
+//
+// Caches (or refreshes) a verdict for the given PID.
+// 
+VOID StickyCacheInsert(
+    PDEVICE_CONTEXT DeviceContext,
+    ULONG Pid,
+    BOOLEAN Allowed
+)
+{
+    ULONGLONG now = KeQueryInterruptTime();
+    KIRQL oldIrql;
+
+    oldIrql = ExAcquireSpinLockExclusive(&DeviceContext->StickyCacheLock);
+    if (DeviceContext->StickyCache != NULL) {
+        VERDICT_CACHE_INSERT(DeviceContext->StickyCache, Pid, Allowed, now);
+    }
+    ExReleaseSpinLockExclusive(&DeviceContext->StickyCacheLock, oldIrql);
+}
+
+//
+// Drops a cached verdict, returns TRUE if one was present.
+// 
+BOOLEAN StickyCacheRemove(
+    PDEVICE_CONTEXT DeviceContext,
+    ULONG Pid
+)
+{
+    BOOLEAN removed;
+    KIRQL oldIrql;
+
+    oldIrql = ExAcquireSpinLockExclusive(&DeviceContext->StickyCacheLock);
+    removed = VERDICT_CACHE_REMOVE(DeviceContext->StickyCache, Pid);
+    ExReleaseSpinLockExclusive(&DeviceContext->StickyCacheLock, oldIrql);
+
+    return removed;
+}
+
+//
+// Installs a new sticky cache (or none) and returns the previous one.
+// Kept out of the pageable guard state paths, the lock raises to
+// DISPATCH_LEVEL.
+// 
+PVERDICT_CACHE StickyCacheSwap(
+    PDEVICE_CONTEXT DeviceContext,
+    PVERDICT_CACHE Cache
+)
+{
+    PVERDICT_CACHE previous;
+    KIRQL oldIrql;
+
+    oldIrql = ExAcquireSpinLockExclusive(&DeviceContext->StickyCacheLock);
+    previous = DeviceContext->StickyCache;
+    DeviceContext->StickyCache = Cache;
+    ExReleaseSpinLockExclusive(&DeviceContext->StickyCacheLock, oldIrql);
+
+    return previous;
+}
+
+//
+// Counts the cached verdicts that haven't expired yet.
+// 
+ULONG StickyCacheLive(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    ULONG live;
+    KIRQL oldIrql;
+
+    oldIrql = ExAcquireSpinLockShared(&DeviceContext->StickyCacheLock);
+    live = VERDICT_CACHE_LIVE(DeviceContext->StickyCache, KeQueryInterruptTime());
+    ExReleaseSpinLockShared(&DeviceContext->StickyCacheLock, oldIrql);
+
+    return live;
+}
+
+//
+// Combines the per-processor request path counters of this device.
+// 
+VOID DeviceCountersRead(
+    PDEVICE_CONTEXT DeviceContext,
+    PHIDGUARDIAN_DEVICE_COUNTERS Counters
+)
+{
+    PULONG64    values = (PULONG64)Counters;
+    ULONG       i;
+
+    for (i = 0; i < DEVICE_COUNTER_COUNT; i++) {
+        values[i] = PER_CPU_COUNTERS_SUM(DeviceContext->Counters, i);
+    }
+
+    Counters->PendingHighWater = PER_CPU_COUNTERS_HIGHEST(DeviceContext->Counters,
+        DEVICE_COUNTER_INDEX(PendingHighWater));
+    Counters->AuthHighWater = PER_CPU_COUNTERS_HIGHEST(DeviceContext->Counters,
+        DEVICE_COUNTER_INDEX(AuthHighWater));
+}
+
+//
+// Bytes of pool the driver holds for this device (framework objects such
+// as the queues not included).
+// 
+ULONG DeviceMemoryUsage(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    size_t size = sizeof(DEVICE_CONTEXT);
+    KIRQL oldIrql;
+
+    if (DeviceContext->Identity != NULL) {
+        size += DeviceContext->Identity->Size;
+    }
+
+    if (DeviceContext->LatencyHistograms != NULL) {
+        size += sizeof(HIDGUARDIAN_LATENCY_HISTOGRAM) * HIDGUARDIAN_ACCESS_PATH_COUNT;
+    }
+
+    oldIrql = ExAcquireSpinLockShared(&DeviceContext->StickyCacheLock);
+    size += VERDICT_CACHE_FOOTPRINT(DeviceContext->StickyCache);
+    ExReleaseSpinLockShared(&DeviceContext->StickyCacheLock, oldIrql);
+
+    size += PER_CPU_COUNTERS_FOOTPRINT(DeviceContext->Counters);
+
+    return (ULONG)size;
+}
+
+//
+// Adds this devices cache counters to the supplied totals.
+// 
+VOID StickyCacheAccumulateStats(
+    PDEVICE_CONTEXT DeviceContext,
+    PHIDGUARDIAN_STICKY_CACHE_STATS Stats
+)
+{
+    PVERDICT_CACHE cache;
+    KIRQL oldIrql;
+
+    //
+    // Hits and misses outlive the cache, the rest is about the one
+    // the device has right now (if any)
+    // 
+    Stats->Hits += PER_CPU_COUNTERS_SUM(DeviceContext->Counters,
+        DEVICE_COUNTER_INDEX(StickyHits));
+    Stats->Misses += PER_CPU_COUNTERS_SUM(DeviceContext->Counters,
+        DEVICE_COUNTER_INDEX(StickyMisses));
+
+    oldIrql = ExAcquireSpinLockShared(&DeviceContext->StickyCacheLock);
+
+    cache = DeviceContext->StickyCache;
+
+    if (cache != NULL) {
+        Stats->DeviceCount++;
+        Stats->Occupancy += cache->Occupancy;
+        Stats->Insertions += cache->Insertions;
+        Stats->Evictions += cache->Evictions;
+        Stats->Expirations += cache->Expirations;
+    }
+
+    ExReleaseSpinLockShared(&DeviceContext->StickyCacheLock, oldIrql);
+}
+
+//
+// Serializes this devices cache as a snapshot record into the supplied
+// buffer. Returns the size of the record; nothing gets written if the
+// buffer is too small for it. The caller made sure the identity is
+// complete (DeviceIdentityEnsure).
+// 
+ULONG StickyCacheExport(
+    PDEVICE_CONTEXT DeviceContext,
+    PUCHAR Buffer,
+    ULONG BufferLength
+)
+{
+    PHIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE    pRecord;
+    PHIDGUARDIAN_VERDICT_SNAPSHOT_ENTRY     pEntry;
+    PVERDICT_CACHE_ENTRY                    entry;
+    USHORT                                  deviceIdLength;
+    USHORT                                  instanceIdLength;
+    ULONG                                   size;
+    ULONGLONG                               now = KeQueryInterruptTime();
+    PVERDICT_CACHE                          cache;
+    KIRQL                                   oldIrql;
+
+    deviceIdLength = (USHORT)wcslen(DeviceContext->Identity->DeviceID);
+    instanceIdLength = (USHORT)wcslen(DeviceContext->Identity->InstanceID);
+
+    //
+    // Lookups don't touch the lists, so walking them shared is fine
+    // 
+    oldIrql = ExAcquireSpinLockShared(&DeviceContext->StickyCacheLock);
+
+    cache = DeviceContext->StickyCache;
+
+    size = sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE)
+        + (deviceIdLength + instanceIdLength) * sizeof(WCHAR);
+
+    //
+    // Expired verdicts are left behind
+    // 
+    if (cache != NULL) {
+        size += VERDICT_CACHE_LIVE(cache, now) * sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT_ENTRY);
+    }
+
+    if (Buffer != NULL && size <= BufferLength)
+    {
+        pRecord = (PHIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE)Buffer;
+        pRecord->Size = size;
+        pRecord->DeviceIdLength = deviceIdLength;
+        pRecord->InstanceIdLength = instanceIdLength;
+        pRecord->EntryCount = 0;
+
+        Buffer += sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE);
+        RtlCopyMemory(Buffer, DeviceContext->Identity->DeviceID, deviceIdLength * sizeof(WCHAR));
+        Buffer += deviceIdLength * sizeof(WCHAR);
+        RtlCopyMemory(Buffer, DeviceContext->Identity->InstanceID, instanceIdLength * sizeof(WCHAR));
+        Buffer += instanceIdLength * sizeof(WCHAR);
+
+        pEntry = (PHIDGUARDIAN_VERDICT_SNAPSHOT_ENTRY)Buffer;
+
+        //
+        // Oldest first, so restoring in order rebuilds the same LRU order
+        // 
+        if (cache != NULL) {
+            for (entry = cache->LruTail; entry != NULL; entry = entry->LruPrev)
+            {
+                if (cache->Ttl != 0 && now - entry->InsertTime >= cache->Ttl) {
+                    continue;
+                }
+
+                pEntry->ProcessId = entry->Pid;
+                pEntry->IsAllowed = entry->IsAllowed;
+                pEntry->Age = now - entry->InsertTime;
+                pEntry++;
+                pRecord->EntryCount++;
+            }
+        }
+    }
+
+    ExReleaseSpinLockShared(&DeviceContext->StickyCacheLock, oldIrql);
+
+    return size;
+}
+
+//
+// Describes this device as a device list record in the supplied buffer.
+// Returns the size of the record; nothing gets written if the buffer is
+// too small for it. The caller made sure the identity is complete
+// (DeviceIdentityEnsure).
+// 
+ULONG DeviceInfoExport(
+    PDEVICE_CONTEXT DeviceContext,
+    PUCHAR Buffer,
+    ULONG BufferLength
+)
+{
+    PHIDGUARDIAN_DEVICE_INFO    pRecord;
+    USHORT                      deviceIdLength;
+    USHORT                      instanceIdLength;
+    USHORT                      classNameLength;
+    ULONG                       queued = 0;
+    ULONG                       owned = 0;
+    ULONG                       size;
+    KIRQL                       oldIrql;
+
+    size = sizeof(HIDGUARDIAN_DEVICE_INFO) + DeviceIdentityMeasureStrings(
+        DeviceContext->Identity, &deviceIdLength, &instanceIdLength, &classNameLength);
+
+    if (Buffer == NULL || size > BufferLength) {
+        return size;
+    }
+
+    pRecord = (PHIDGUARDIAN_DEVICE_INFO)Buffer;
+
+    RtlZeroMemory(pRecord, sizeof(HIDGUARDIAN_DEVICE_INFO));
+
+    pRecord->Size = size;
+    pRecord->DeviceHash = DeviceContext->DeviceHash;
+    pRecord->DeviceIdLength = deviceIdLength;
+    pRecord->InstanceIdLength = instanceIdLength;
+    pRecord->ClassNameLength = classNameLength;
+    pRecord->HardwareIdsLength = (ULONG)DeviceContext->Identity->HardwareIDsLength;
+
+    if (DeviceContext->IsGuarded) {
+        pRecord->Flags |= HIDGUARDIAN_DEVICE_GUARDED;
+    }
+
+    if (DeviceContext->AllowByDefault) {
+        pRecord->Flags |= HIDGUARDIAN_DEVICE_ALLOW_BY_DEFAULT;
+    }
+
+    if (DeviceContext->IsShuttingDown) {
+        pRecord->Flags |= HIDGUARDIAN_DEVICE_SHUTTING_DOWN;
+    }
+
+    //
+    // Not there while the add is still under way
+    // 
+    if (DeviceContext->CreateRequestsQueue != NULL) {
+        WdfIoQueueGetState(DeviceContext->CreateRequestsQueue, &queued, &owned);
+        pRecord->CreateRequests = queued + owned;
+    }
+
+    //
+    // Don't bring the guard state back just to report on it
+    // 
+    if (DeviceGuardReference(DeviceContext))
+    {
+        pRecord->Flags |= HIDGUARDIAN_DEVICE_GUARD_ACTIVE;
+
+        WdfIoQueueGetState(DeviceContext->PendingCreateRequestsQueue, &pRecord->PendingCreateRequests, NULL);
+        WdfIoQueueGetState(DeviceContext->PendingAuthQueue, &pRecord->PendingAuthRequests, NULL);
+
+        if (DeviceContext->DeferredRequestsQueue != NULL) {
+            WdfIoQueueGetState(DeviceContext->DeferredRequestsQueue, &queued, NULL);
+            pRecord->PendingCreateRequests += queued;
+        }
+
+        oldIrql = ExAcquireSpinLockShared(&DeviceContext->StickyCacheLock);
+        pRecord->CacheOccupancy = DeviceContext->StickyCache->Occupancy;
+        ExReleaseSpinLockShared(&DeviceContext->StickyCacheLock, oldIrql);
+
+        DeviceGuardRelease(DeviceContext);
+    }
+
+    DeviceIdentityWriteStrings(DeviceContext->Identity, (PWCHAR)(pRecord + 1));
+
+    return size;
+}
+
+//
+// Seeds this devices cache with verdicts from a snapshot record taken
+// Elapsed (100ns units) ago.
+// 
+VOID StickyCacheImport(
+    PDEVICE_CONTEXT DeviceContext,
+    PHIDGUARDIAN_VERDICT_SNAPSHOT_ENTRY Entries,
+    ULONG Count,
+    ULONG64 Elapsed
+)
+{
+    ULONGLONG   now = KeQueryInterruptTime();
+    ULONGLONG   age;
+    ULONG       i;
+    KIRQL       oldIrql;
+
+    oldIrql = ExAcquireSpinLockExclusive(&DeviceContext->StickyCacheLock);
+
+    for (i = 0; i < Count && DeviceContext->StickyCache != NULL; i++)
+    {
+        //
+        // Backdated by its age, so it expires when it would have without
+        // the snapshot (interrupt time arithmetic wraps consistently, even
+        // if the age exceeds the time since boot); verdicts expired under
+        // this TTL don't get to evict live ones
+        // 
+        age = (Entries[i].Age > MAXULONG64 - Elapsed) ? MAXULONG64 : Entries[i].Age + Elapsed;
+
+        if (DeviceContext->StickyCache->Ttl != 0 && age >= DeviceContext->StickyCache->Ttl) {
+            continue;
+        }
+
+        if (Entries[i].ProcessId != 0) {
+            VERDICT_CACHE_INSERT(DeviceContext->StickyCache, Entries[i].ProcessId, Entries[i].IsAllowed,
+                now - age);
+        }
+    }
+
+    ExReleaseSpinLockExclusive(&DeviceContext->StickyCacheLock, oldIrql);
+}
+
+//
+// Creates the sticky cache and the pending queues of a guarded device.
+// 
+// Caller must hold GuardLock.
+// 
+static NTSTATUS
+DeviceGuardCreateState(
+    WDFDEVICE Device
+)
+{
+    NTSTATUS                status;
+    PDEVICE_CONTEXT         pDeviceCtx;
+    PVERDICT_CACHE          cache;
+    WDF_TIMER_CONFIG        timerConfig;
+    WDF_OBJECT_ATTRIBUTES   timerAttributes;
+    WDF_WORKITEM_CONFIG     workItemConfig;
+    WDF_OBJECT_ATTRIBUTES   workItemAttributes;
+
+
+    PAGED_CODE();
+
+    pDeviceCtx = DeviceGetContext(Device);
+
+    cache = VERDICT_CACHE_CREATE(
+        GuardianConfig.StickyCacheCapacity,
+        GuardianConfig.StickyCacheTtlSeconds * VERDICT_CACHE_TICKS_PER_SECOND
+    );
+    if (cache == NULL) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DEVICE,
+            "VERDICT_CACHE_CREATE failed");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    status = PendingAuthQueueInitialize(Device);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DEVICE,
+            "PendingAuthQueueInitialize failed with %!STATUS!", status);
+        goto Error;
+    }
+
+    status = PendingCreateRequestsQueueInitialize(Device);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DEVICE,
+            "PendingCreateRequestsQueueInitialize failed with %!STATUS!", status);
+        goto Error;
+    }
+
+    if (GuardianConfig.OpenExcessAction == OPEN_EXCESS_DEFER)
+    {
+        status = DeferredRequestsQueueInitialize(Device);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_DEVICE,
+                "DeferredRequestsQueueInitialize failed with %!STATUS!", status);
+            goto Error;
+        }
+    }
+
+    //
+    // One-shot timer, restarted whenever the last reference goes away
+    // 
+    if (pDeviceCtx->GuardIdleTimer == NULL && GuardianConfig.GuardIdleSeconds > 0)
+    {
+        WDF_TIMER_CONFIG_INIT(&timerConfig, DeviceGuardIdleExpired);
+        timerConfig.AutomaticSerialization = FALSE;
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+        timerAttributes.ParentObject = Device;
+        timerAttributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+        status = WdfTimerCreate(&timerConfig, &timerAttributes, &pDeviceCtx->GuardIdleTimer);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_DEVICE,
+                "WdfTimerCreate failed with %!STATUS!", status);
+            goto Error;
+        }
+    }
+
+    //
+    // One-shot as well, started when an open gets deferred
+    // 
+    if (pDeviceCtx->DeferTimer == NULL && GuardianConfig.OpenExcessAction == OPEN_EXCESS_DEFER)
+    {
+        WDF_TIMER_CONFIG_INIT(&timerConfig, DeviceDeferExpired);
+        timerConfig.AutomaticSerialization = FALSE;
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+        timerAttributes.ParentObject = Device;
+        timerAttributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+        status = WdfTimerCreate(&timerConfig, &timerAttributes, &pDeviceCtx->DeferTimer);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_DEVICE,
+                "WdfTimerCreate failed with %!STATUS!", status);
+            goto Error;
+        }
+    }
+
+    //
+    // Kept until the device goes away, queued whenever Cerberus does
+    // 
+    if (pDeviceCtx->ResolveWorkItem == NULL)
+    {
+        WDF_WORKITEM_CONFIG_INIT(&workItemConfig, DevicePendingResolve);
+        workItemConfig.AutomaticSerialization = FALSE;
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&workItemAttributes);
+        workItemAttributes.ParentObject = Device;
+
+        status = WdfWorkItemCreate(&workItemConfig, &workItemAttributes, &pDeviceCtx->ResolveWorkItem);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_DEVICE,
+                "WdfWorkItemCreate failed with %!STATUS!", status);
+            goto Error;
+        }
+    }
+
+    StickyCacheSwap(pDeviceCtx, cache);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DEVICE,
+        "Guard state created (device %08X)", pDeviceCtx->DeviceHash);
+
+    return STATUS_SUCCESS;
+
+Error:
+
+    if (pDeviceCtx->PendingCreateRequestsQueue != NULL) {
+        WdfObjectDelete(pDeviceCtx->PendingCreateRequestsQueue);
+        pDeviceCtx->PendingCreateRequestsQueue = NULL;
+    }
+
+    if (pDeviceCtx->PendingAuthQueue != NULL) {
+        WdfObjectDelete(pDeviceCtx->PendingAuthQueue);
+        pDeviceCtx->PendingAuthQueue = NULL;
+    }
+
+    if (pDeviceCtx->DeferredRequestsQueue != NULL) {
+        WdfObjectDelete(pDeviceCtx->DeferredRequestsQueue);
+        pDeviceCtx->DeferredRequestsQueue = NULL;
+    }
+
+    VERDICT_CACHE_DESTROY(&cache);
+
+    return status;
+}
+
+//
+// Takes a reference on the guard state if it exists.
+// 
+static BOOLEAN
+DeviceGuardTryReference(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    LONG state;
+
+    for (state = DeviceContext->GuardState; state & DEVICE_GUARD_ACTIVE; state = DeviceContext->GuardState)
+    {
+        if (InterlockedCompareExchange(&DeviceContext->GuardState, state + 1, state) == state) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//
+// Takes a reference on the guard state, creating it first if the device
+// has none right now. Used by create requests that need Cerberus.
+// 
+NTSTATUS DeviceGuardAcquire(
+    WDFDEVICE Device
+)
+{
+    NTSTATUS        status;
+    PDEVICE_CONTEXT pDeviceCtx;
+
+
+    PAGED_CODE();
+
+    pDeviceCtx = DeviceGetContext(Device);
+
+    if (!pDeviceCtx->IsGuarded) {
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    if (DeviceGuardTryReference(pDeviceCtx)) {
+        return STATUS_SUCCESS;
+    }
+
+    WdfWaitLockAcquire(pDeviceCtx->GuardLock, NULL);
+
+    if (DeviceGuardTryReference(pDeviceCtx)) {
+        status = STATUS_SUCCESS;
+    }
+    else if (pDeviceCtx->IsShuttingDown) {
+        status = STATUS_DEVICE_DOES_NOT_EXIST;
+    }
+    else {
+        status = DeviceGuardCreateState(Device);
+
+        if (NT_SUCCESS(status)) {
+            InterlockedExchange(&pDeviceCtx->GuardState, DEVICE_GUARD_ACTIVE + 1);
+        }
+    }
+
+    WdfWaitLockRelease(pDeviceCtx->GuardLock);
+
+    return status;
+}
+
+//
+// Takes a reference on the guard state if the device has one; everything
+// that only deals with requests already pending uses this.
+// 
+// Must be called at PASSIVE_LEVEL.
+// 
+BOOLEAN DeviceGuardReference(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    BOOLEAN referenced;
+
+    if (!DeviceContext->IsGuarded) {
+        return FALSE;
+    }
+
+    if (DeviceGuardTryReference(DeviceContext)) {
+        return TRUE;
+    }
+
+    //
+    // Might just be checked for idleness, which holds the lock until the
+    // state is either back or gone
+    // 
+    WdfWaitLockAcquire(DeviceContext->GuardLock, NULL);
+    referenced = DeviceGuardTryReference(DeviceContext);
+    WdfWaitLockRelease(DeviceContext->GuardLock);
+
+    return referenced;
+}
+
+//
+// Drops a reference on the guard state; the last one starts the idle timer.
+// 
+VOID DeviceGuardRelease(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    if (InterlockedDecrement(&DeviceContext->GuardState) == DEVICE_GUARD_ACTIVE
+        && DeviceContext->GuardIdleTimer != NULL)
+    {
+        WdfTimerStart(DeviceContext->GuardIdleTimer,
+            WDF_REL_TIMEOUT_IN_SEC(GuardianConfig.GuardIdleSeconds));
+    }
+}
+
+//
+// Frees the guard state of a device nobody has used for GuardIdleSeconds,
+// unless requests are still pending or verdicts still cached.
+// 
+_Use_decl_annotations_
+VOID
+DeviceGuardIdleExpired(
+    WDFTIMER Timer
+)
+{
+    PDEVICE_CONTEXT pDeviceCtx;
+    PVERDICT_CACHE  cache;
+    ULONG           queued[3] = { 0 };
+    ULONG           owned[3] = { 0 };
+    ULONG           live;
+
+
+    PAGED_CODE();
+
+    pDeviceCtx = DeviceGetContext(WdfTimerGetParentObject(Timer));
+
+    WdfWaitLockAcquire(pDeviceCtx->GuardLock, NULL);
+
+    //
+    // Claim it before looking, references taken meanwhile wait on the lock
+    // 
+    if (InterlockedCompareExchange(&pDeviceCtx->GuardState, 0, DEVICE_GUARD_ACTIVE) != DEVICE_GUARD_ACTIVE) {
+        WdfWaitLockRelease(pDeviceCtx->GuardLock);
+        return;
+    }
+
+    WdfIoQueueGetState(pDeviceCtx->PendingCreateRequestsQueue, &queued[0], &owned[0]);
+    WdfIoQueueGetState(pDeviceCtx->PendingAuthQueue, &queued[1], &owned[1]);
+
+    if (pDeviceCtx->DeferredRequestsQueue != NULL) {
+        WdfIoQueueGetState(pDeviceCtx->DeferredRequestsQueue, &queued[2], &owned[2]);
+    }
+
+    live = StickyCacheLive(pDeviceCtx);
+
+    if (queued[0] + queued[1] + queued[2] + owned[0] + owned[1] + owned[2] + live > 0
+        || pDeviceCtx->UnnotifiedCreateRequests > 0)
+    {
+        //
+        // Still in use; look again later, verdicts expire and requests
+        // sent down complete without anybody taking a reference
+        // 
+        InterlockedExchange(&pDeviceCtx->GuardState, DEVICE_GUARD_ACTIVE);
+
+        WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_SEC(GuardianConfig.GuardIdleSeconds));
+
+        WdfWaitLockRelease(pDeviceCtx->GuardLock);
+        return;
+    }
+
+    cache = StickyCacheSwap(pDeviceCtx, NULL);
+
+    VERDICT_CACHE_DESTROY(&cache);
+
+    WdfObjectDelete(pDeviceCtx->PendingCreateRequestsQueue);
+    pDeviceCtx->PendingCreateRequestsQueue = NULL;
+
+    WdfObjectDelete(pDeviceCtx->PendingAuthQueue);
+    pDeviceCtx->PendingAuthQueue = NULL;
+
+    if (pDeviceCtx->DeferredRequestsQueue != NULL) {
+        WdfObjectDelete(pDeviceCtx->DeferredRequestsQueue);
+        pDeviceCtx->DeferredRequestsQueue = NULL;
+    }
+
+    WdfWaitLockRelease(pDeviceCtx->GuardLock);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DEVICE,
+        "Guard state released (device %08X)", pDeviceCtx->DeviceHash);
+}
+
+//
+// Queues resolving the requests waiting for a decision by Cerberus, so
+// devices don't wait on each other. FALSE if there's nothing to do or
+// it's queued already.
+// 
+BOOLEAN HidGuardianResolvePendingRequests(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    //
+    // Set once with the first guard state; without it nothing can pend
+    // 
+    if (DeviceContext->ResolveWorkItem == NULL) {
+        return FALSE;
+    }
+
+    if (InterlockedExchange(&DeviceContext->ResolveQueued, TRUE)) {
+        return FALSE;
+    }
+
+    LatencyDisconnectAddDevice();
+
+    WdfWorkItemEnqueue(DeviceContext->ResolveWorkItem);
+
+    return TRUE;
+}
+
+//
+// Completes the requests waiting for a decision by Cerberus the way
+// they would have been without it: by cached verdict, or else by the
+// default action.
+// 
+_Use_decl_annotations_
+VOID
+DevicePendingResolve(
+    WDFWORKITEM WorkItem
+)
+{
+    WDFDEVICE               device = (WDFDEVICE)WdfWorkItemGetParentObject(WorkItem);
+    PDEVICE_CONTEXT         pDeviceCtx = DeviceGetContext(device);
+    PCREATE_REQUEST_CONTEXT pRequestCtx;
+    WDF_REQUEST_SEND_OPTIONS options;
+    WDFREQUEST              request;
+    UCHAR                   path;
+    BOOLEAN                 allowed;
+    BOOLEAN                 sticky;
+    ULONG                   allowedCount = 0;
+    ULONG                   deniedCount = 0;
+
+    PAGED_CODE();
+
+    InterlockedExchange(&pDeviceCtx->ResolveQueued, FALSE);
+
+    //
+    // Cerberus came back before we got to run, let it decide instead
+    // 
+    if (ControlDevice != NULL && ControlDeviceGetContext(ControlDevice)->IsCerberusConnected) {
+        HidGuardianHoldPendingRequests(pDeviceCtx);
+        LatencyDisconnectEnd(0, 0);
+        return;
+    }
+
+    if (!DeviceGuardReference(pDeviceCtx)) {
+        InterlockedExchange(&pDeviceCtx->UnnotifiedCreateRequests, 0);
+        LatencyDisconnectEnd(0, 0);
+        return;
+    }
+
+    while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(pDeviceCtx->PendingCreateRequestsQueue, &request))
+        || NT_SUCCESS(WdfIoQueueRetrieveNextRequest(pDeviceCtx->PendingAuthQueue, &request))
+        || (pDeviceCtx->DeferredRequestsQueue != NULL
+            && NT_SUCCESS(WdfIoQueueRetrieveNextRequest(pDeviceCtx->DeferredRequestsQueue, &request))))
+    {
+        pRequestCtx = CreateRequestGetContext(request);
+
+        sticky = StickyCacheLookup(pDeviceCtx, pRequestCtx->ProcessId, &allowed);
+
+        if (sticky) {
+            path = HIDGUARDIAN_ACCESS_PATH_STICKY;
+        }
+        else {
+            path = HIDGUARDIAN_ACCESS_PATH_DEFAULT;
+            allowed = pDeviceCtx->AllowByDefault;
+
+            if (allowed) {
+                DEVICE_COUNTER_INCREMENT(pDeviceCtx, DefaultAllowed);
+            }
+            else {
+                DEVICE_COUNTER_INCREMENT(pDeviceCtx, DefaultDenied);
+            }
+        }
+
+        CREATE_REQUEST_STAMP(pRequestCtx, HIDGUARDIAN_STAGE_COMPLETED);
+
+        LatencyRecord(pDeviceCtx, path,
+            pRequestCtx->StageTimes[HIDGUARDIAN_STAGE_ARRIVAL]);
+        AccessTraceRecord(pDeviceCtx, pRequestCtx->ProcessId, path,
+            allowed, sticky, pRequestCtx->ArrivalTime, pRequestCtx->PickupTime);
+        StageTraceRecord(pDeviceCtx, pRequestCtx, path, allowed);
+
+        EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_CREATE_RESOLVED, pRequestCtx->ProcessId, path, allowed);
+
+        if (allowed) {
+            allowedCount++;
+
+            WdfRequestFormatRequestUsingCurrentType(request);
+
+            WDF_REQUEST_SEND_OPTIONS_INIT(&options,
+                WDF_REQUEST_SEND_OPTION_SEND_AND_FORGET);
+
+            if (!WdfRequestSend(request, WdfDeviceGetIoTarget(device), &options)) {
+                TraceEvents(TRACE_LEVEL_ERROR,
+                    TRACE_DEVICE,
+                    "WdfRequestSend failed: %!STATUS!", WdfRequestGetStatus(request));
+                WdfRequestComplete(request, WdfRequestGetStatus(request));
+            }
+        }
+        else {
+            deniedCount++;
+
+            WdfRequestComplete(request, STATUS_ACCESS_DENIED);
+        }
+    }
+
+    InterlockedExchange(&pDeviceCtx->UnnotifiedCreateRequests, 0);
+
+    DeviceGuardRelease(pDeviceCtx);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DEVICE,
+        "Resolved %d pending requests (%d allowed, device %08X)",
+        allowedCount + deniedCount, allowedCount, pDeviceCtx->DeviceHash);
+
+    LatencyDisconnectEnd(allowedCount, deniedCount);
+}
+
+//
+// Keeps requests waiting for a decision around for the next Cerberus
+// connection. Requests the previous one already fetched are put back
+// for pickup, and all of them are flagged as not yet notified.
+// 
+VOID HidGuardianHoldPendingRequests(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    NTSTATUS    status;
+    WDFREQUEST  request;
+    ULONG       queued = 0;
+
+    //
+    // Nothing pending without guard state
+    // 
+    if (!DeviceGuardReference(DeviceContext)) {
+        return;
+    }
+
+    while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(DeviceContext->PendingAuthQueue, &request)))
+    {
+        status = WdfRequestForwardToIoQueue(request, DeviceContext->PendingCreateRequestsQueue);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_DEVICE,
+                "WdfRequestForwardToIoQueue failed with status %!STATUS!", status);
+
+            WdfRequestComplete(request, status);
+        }
+    }
+
+    WdfIoQueueGetState(DeviceContext->PendingCreateRequestsQueue, &queued, NULL);
+
+    InterlockedExchange(&DeviceContext->UnnotifiedCreateRequests, (LONG)queued);
+
+    //
+    // Deferred requests stay parked; keep releasing them
+    // 
+    if (DeviceContext->DeferredRequestsQueue != NULL) {
+        HidGuardianNotifyDeferredRequests(DeviceContext);
+    }
+
+    DeviceGuardRelease(DeviceContext);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DEVICE,
+        "Holding %d pending requests for reconnect", queued);
+}
+
+//
+// Starts the defer timer unless it's running already. It ticks about as
+// often as a process earns an open back, releasing deferred requests and
+// telling Cerberus about them even if it submits no further notifications.
+// 
+VOID HidGuardianNotifyDeferredRequests(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    ULONG interval;
+
+    if (DeviceContext->DeferTimer == NULL) {
+        return;
+    }
+
+    if (InterlockedExchange(&DeviceContext->DeferArmed, TRUE)) {
+        return;
+    }
+
+    interval = (GuardianConfig.OpenRateLimit == 0) ? 1000 : 1000 / GuardianConfig.OpenRateLimit;
+
+    WdfTimerStart(DeviceContext->DeferTimer, WDF_REL_TIMEOUT_IN_MS(max(interval, 1)));
+}
+
+//
+// Completes notifications Cerberus keeps parked for requests nobody told
+// it about yet, as long as there are both. Whoever parks one side checks
+// for the other afterwards, so neither gets stranded.
+// 
+VOID HidGuardianNotifyPendingRequests(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    NTSTATUS    status;
+    WDFREQUEST  notifyReq;
+    LONG        unnotified;
+
+    for (;;)
+    {
+        for (unnotified = DeviceContext->UnnotifiedCreateRequests; unnotified > 0; unnotified = DeviceContext->UnnotifiedCreateRequests)
+        {
+            if (InterlockedCompareExchange(&DeviceContext->UnnotifiedCreateRequests, unnotified - 1, unnotified) == unnotified)
+            {
+                break;
+            }
+        }
+
+        if (unnotified <= 0) {
+            break;
+        }
+
+        status = WdfIoQueueRetrieveNextRequest(DeviceContext->NotificationsQueue, &notifyReq);
+        if (!NT_SUCCESS(status)) {
+            InterlockedIncrement(&DeviceContext->UnnotifiedCreateRequests);
+            break;
+        }
+
+        WdfRequestComplete(notifyReq, STATUS_SUCCESS);
+    }
+}
+
+//
+// Moves deferred requests whose process may open again on to Cerberus,
+// charging each open to its process like any other, then completes
+// notifications Cerberus keeps parked for requests nobody told it about
+// yet, as long as there are both.
+// 
+_Use_decl_annotations_
+VOID
+DeviceDeferExpired(
+    WDFTIMER Timer
+)
+{
+    NTSTATUS                status;
+    PDEVICE_CONTEXT         pDeviceCtx;
+    PCONTROL_DEVICE_CONTEXT pControlCtx;
+    WDFREQUEST              kept = NULL;
+    WDFREQUEST              found;
+    WDFREQUEST              request;
+    ULONG                   deferred;
+    ULONG                   depth;
+
+
+    PAGED_CODE();
+
+    pDeviceCtx = DeviceGetContext(WdfTimerGetParentObject(Timer));
+    pControlCtx = (ControlDevice != NULL) ? ControlDeviceGetContext(ControlDevice) : NULL;
+
+    InterlockedExchange(&pDeviceCtx->DeferArmed, FALSE);
+
+    if (!DeviceGuardReference(pDeviceCtx)) {
+        return;
+    }
+
+    //
+    // One pass over what's parked, oldest first; requests of a process
+    // out of opens stay for the next tick. Without Cerberus they're left
+    // to be resolved with the others.
+    // 
+    if (pControlCtx != NULL && (pControlCtx->IsCerberusConnected || pControlCtx->IsInReconnectGrace))
+    {
+        for (;;)
+        {
+            //
+            // Resume after the last request kept back, or start over if
+            // it got cancelled meanwhile
+            // 
+            status = WdfIoQueueFindRequest(pDeviceCtx->DeferredRequestsQueue, kept, NULL, NULL, &found);
+            if (status == STATUS_NOT_FOUND) {
+                WdfObjectDereference(kept);
+                kept = NULL;
+                continue;
+            }
+
+            if (!NT_SUCCESS(status)) {
+                break;
+            }
+
+            if (!AdmissionTake(CreateRequestGetContext(found)->ProcessId)) {
+                if (kept != NULL) {
+                    WdfObjectDereference(kept);
+                }
+
+                kept = found;
+                continue;
+            }
+
+            status = WdfIoQueueRetrieveFoundRequest(pDeviceCtx->DeferredRequestsQueue, found, &request);
+
+            WdfObjectDereference(found);
+
+            if (!NT_SUCCESS(status)) {
+                continue;
+            }
+
+            status = WdfRequestForwardToIoQueue(request, pDeviceCtx->PendingCreateRequestsQueue);
+            if (!NT_SUCCESS(status)) {
+                TraceEvents(TRACE_LEVEL_ERROR,
+                    TRACE_DEVICE,
+                    "WdfRequestForwardToIoQueue failed with status %!STATUS!", status);
+
+                WdfRequestComplete(request, status);
+                continue;
+            }
+
+            InterlockedIncrement(&pDeviceCtx->UnnotifiedCreateRequests);
+        }
+
+        if (kept != NULL) {
+            WdfObjectDereference(kept);
+        }
+
+        WdfIoQueueGetState(pDeviceCtx->PendingCreateRequestsQueue, &depth, NULL);
+        DEVICE_COUNTER_HIGH_WATER(pDeviceCtx, PendingHighWater, depth);
+    }
+
+    HidGuardianNotifyPendingRequests(pDeviceCtx);
+
+    //
+    // Requests still parked, or Cerberus is busy; look again later unless
+    // it's gone for good, then the requests get resolved anyway
+    // 
+    WdfIoQueueGetState(pDeviceCtx->DeferredRequestsQueue, &deferred, NULL);
+
+    if ((deferred > 0 || pDeviceCtx->UnnotifiedCreateRequests > 0)
+        && pControlCtx != NULL
+        && (pControlCtx->IsCerberusConnected || pControlCtx->IsInReconnectGrace))
+    {
+        HidGuardianNotifyDeferredRequests(pDeviceCtx);
+    }
+
+    DeviceGuardRelease(pDeviceCtx);
 }
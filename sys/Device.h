@@ -38,39 +38,123 @@ EXTERN_C_START
 // 
 #define CURRENT_PROCESS_ID() ((DWORD)((DWORD_PTR)PsGetCurrentProcessId() & 0xFFFFFFFF))
 
+#define DEVICE_IDENTITY_TAG         'IDGH'
+
+//
+// A failed device and instance ID lookup isn't repeated for this long,
+// doubled with every further failure (100ns units)
+// 
+#define DEVICE_IDENTITY_RETRY_MIN   (1ULL * 10000000ULL)
+#define DEVICE_IDENTITY_RETRY_MAX   (60ULL * 10000000ULL)
+
+//
+// Identity strings of a device, interned in the driver-wide identity
+// pool so devices with equal IDs share one copy. Only read when Cerberus
+// asks about a request or when matching snapshots, so it stays out of
+// the device context.
+//
+// The add only reads the hardware IDs it needs to classify the device;
+// device, instance ID and class name stay NULL until DeviceIdentityEnsure
+// looked them up.
+//
+// Queued device changes keep the identity of a removed device alive, so
+// it is reference counted; the device holds the first reference.
+//
+typedef struct _DEVICE_IDENTITY
+{
+    //
+    // Bytes allocated for this structure, the pooled strings excluded
+    // 
+    ULONG           Size;
+
+    volatile LONG   References;
+
+    PCWSTR          DeviceID;
+
+    PCWSTR          InstanceID;
+
+    //
+    // Device setup class name, NULL if the device has none
+    // 
+    PCWSTR          ClassName;
+
+    ULONG           HardwareIDCount;
+
+    //
+    // Bytes the hardware IDs take as multi-sz, terminators included
+    // 
+    size_t          HardwareIDsLength;
+
+    PCWSTR          HardwareIDs[1];
+
+} DEVICE_IDENTITY, *PDEVICE_IDENTITY;
+
+//
+// Set in DEVICE_CONTEXT.GuardState while the guard state exists
+//
+#define DEVICE_GUARD_ACTIVE         0x40000000
+
 //
 // The device context performs the same job as
 // a WDM device extension in the driver frameworks
 //
+// Laid out by access pattern: what every create request reads comes
+// first, what concurrent requests write sits on the next cache line so
+// lookups on one processor don't invalidate the read-mostly state on
+// another, and the identity is a pointer away. The framework only aligns
+// contexts to MEMORY_ALLOCATION_ALIGNMENT, so the boundaries are line
+// sized rather than exactly on lines.
+//
+// The guard state (sticky cache and the two pending queues) only exists
+// between the first create request that needs Cerberus and the device
+// going idle again; take a reference with DeviceGuardAcquire or
+// DeviceGuardReference before touching it.
+//
 typedef struct _DEVICE_CONTEXT
 {
-    WDFMEMORY       HardwareIDsMemory;
+    //
+    // Bounded cache of Process IDs and their access state (guard state)
+    // 
+    PVERDICT_CACHE  StickyCache;
 
-    PCWSTR          HardwareIDs;
+    //
+    // Request path statistics (HIDGUARDIAN_DEVICE_COUNTERS layout)
+    // 
+    PPER_CPU_COUNTERS Counters;
+
+    //
+    // Open latency per HIDGUARDIAN_ACCESS_PATH_*
+    // 
+    PHIDGUARDIAN_LATENCY_HISTOGRAM LatencyHistograms;
 
-    size_t          HardwareIDsLength;
-       
     //
     // Queue for incoming create requests
     // 
     WDFQUEUE        CreateRequestsQueue;
 
     //
-    // Queue for pending create requests (for pickup by Cerberus)
+    // Queue for pending create requests (for pickup by Cerberus, guard state)
     // 
     WDFQUEUE        PendingCreateRequestsQueue;
 
     //
-    // Queue for pending create requests (while waiting for answer)
+    // Queue for pending create requests (while waiting for answer, guard state)
     // 
     WDFQUEUE        PendingAuthQueue;
 
+    //
+    // Queue for create requests deferred by admission control, moved on
+    // to PendingCreateRequestsQueue once their process may open again
+    // (guard state, only if opens may be deferred)
+    // 
+    WDFQUEUE        DeferredRequestsQueue;
+
     WDFQUEUE        NotificationsQueue;
 
     //
-    // Linked list containing cached Process IDs and their access state
+    // Identifies this device in access traces (0 until IdentityReady)
     // 
-    PPID_LIST_NODE  StickyPidList;
+    ULONG           DeviceHash;
 
     //
     // Default behavior for requests unguarded by Cerberus
@@ -79,9 +163,108 @@ typedef struct _DEVICE_CONTEXT
 
     BOOLEAN         IsShuttingDown;
 
-    WCHAR           DeviceID[MAX_DEVICE_ID_SIZE];
+    //
+    // Create requests of this device are decided by Cerberus; FALSE for
+    // the master device
+    // 
+    BOOLEAN         IsGuarded;
+
+    //
+    // Guards StickyCache; create requests look up verdicts holding it
+    // shared, everything else takes it exclusive
+    // 
+    DECLSPEC_CACHEALIGN EX_SPIN_LOCK StickyCacheLock;
+
+    //
+    // Requests in PendingCreateRequestsQueue Cerberus hasn't been told
+    // about (held over from a previous connection)
+    // 
+    volatile LONG   UnnotifiedCreateRequests;
+
+    //
+    // Create requests that passed the PendingQueueLimit check and aren't
+    // queued yet; they count towards the limit
+    // 
+    volatile LONG   PendingReservations;
+
+    //
+    // DEVICE_GUARD_ACTIVE while the guard state exists, plus the number
+    // of references held on it
+    // 
+    volatile LONG   GuardState;
+
+    //
+    // Device, instance and hardware IDs
+    // 
+    DECLSPEC_CACHEALIGN PDEVICE_IDENTITY Identity;
+
+    //
+    // TRUE once device and instance ID are in Identity and DeviceHash is
+    // set; never goes back
+    // 
+    volatile LONG   IdentityReady;
+
+    //
+    // Serializes looking up device and instance ID
+    // 
+    WDFWAITLOCK     IdentityLock;
+
+    //
+    // Outcome of the last lookup; a failure is handed out again instead
+    // of asking the bus driver until IdentityRetryTime (interrupt time)
+    // has passed. Guarded by IdentityLock.
+    // 
+    NTSTATUS        IdentityStatus;
+
+    ULONGLONG       IdentityRetryTime;
+
+    ULONGLONG       IdentityRetryDelay;
+
+    //
+    // Held instead of the registry slot while a registry walk has the
+    // bus driver look up device and instance ID; the device waits for it
+    // before leaving the registry
+    // 
+    EX_RUNDOWN_REF  IdentityRundown;
+
+    //
+    // Serializes creating and releasing the guard state
+    // 
+    WDFWAITLOCK     GuardLock;
+
+    //
+    // Releases the guard state once the device went idle
+    // 
+    WDFTIMER        GuardIdleTimer;
+
+    //
+    // Resolves pending requests once Cerberus is gone; created along with
+    // the first guard state, as that's where requests can pend
+    // 
+    WDFWORKITEM     ResolveWorkItem;
+
+    //
+    // TRUE while ResolveWorkItem is queued and hasn't started yet
+    // 
+    volatile LONG   ResolveQueued;
+
+    //
+    // Releases opens deferred by admission control to Cerberus as their
+    // processes earn opens back; created along with the first guard state
+    // if opens may be deferred
+    // 
+    WDFTIMER        DeferTimer;
+
+    //
+    // TRUE while DeferTimer is started and hasn't fired yet
+    // 
+    volatile LONG   DeferArmed;
 
-    WCHAR           InstanceID[MAX_INSTANCE_ID_SIZE];
+    //
+    // Slot in the device registry, DEVICE_REGISTRY_INVALID_INDEX if the
+    // device couldn't be registered
+    // 
+    ULONG           RegistryIndex;
 
 } DEVICE_CONTEXT, *PDEVICE_CONTEXT;
 
@@ -92,16 +275,46 @@ typedef struct _DEVICE_CONTEXT
 //
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_CONTEXT, DeviceGetContext)
 
+//
+// Index of a HIDGUARDIAN_DEVICE_COUNTERS field in DEVICE_CONTEXT.Counters
+//
+#define DEVICE_COUNTER_INDEX(_field_) \
+    ((ULONG)(FIELD_OFFSET(HIDGUARDIAN_DEVICE_COUNTERS, _field_) / sizeof(ULONG64)))
+
+#define DEVICE_COUNTER_COUNT \
+    ((ULONG)(sizeof(HIDGUARDIAN_DEVICE_COUNTERS) / sizeof(ULONG64)))
+
+#define DEVICE_COUNTER_INCREMENT(_ctx_, _field_) \
+    PER_CPU_COUNTERS_ADD((_ctx_)->Counters, DEVICE_COUNTER_INDEX(_field_), 1)
+
+#define DEVICE_COUNTER_HIGH_WATER(_ctx_, _field_, _value_) \
+    PER_CPU_COUNTERS_MAX((_ctx_)->Counters, DEVICE_COUNTER_INDEX(_field_), (_value_))
+
 typedef struct _CREATE_REQUEST_CONTEXT
 {
     ULONG RequestId;
 
     ULONG ProcessId;
 
+    //
+    // Interrupt time of arrival and of pickup by Cerberus (0 = not yet)
+    // 
+    ULONGLONG ArrivalTime;
+
+    ULONGLONG PickupTime;
+
+    //
+    // Performance counter value per HIDGUARDIAN_STAGE_* (0 = not reached)
+    // 
+    ULONGLONG StageTimes[HIDGUARDIAN_STAGE_COUNT];
+
 } CREATE_REQUEST_CONTEXT, *PCREATE_REQUEST_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(CREATE_REQUEST_CONTEXT, CreateRequestGetContext)
 
+#define CREATE_REQUEST_STAMP(_ctx_, _stage_) \
+    ((_ctx_)->StageTimes[(_stage_)] = LatencyTimestamp())
+
 //
 // Function to initialize the device and its callbacks
 //
@@ -114,6 +327,126 @@ EVT_WDF_DEVICE_CONTEXT_CLEANUP HidGuardianEvtDeviceContextCleanup;
 EVT_WDF_FILE_CLEANUP EvtFileCleanup;
 EVT_WDF_DEVICE_RELEASE_HARDWARE EvtWdfDeviceReleaseHardware;
 
+BOOLEAN StickyCacheLookup(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _In_ ULONG Pid,
+    _Out_opt_ PBOOLEAN Allowed
+);
+
+VOID StickyCacheInsert(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _In_ ULONG Pid,
+    _In_ BOOLEAN Allowed
+);
+
+BOOLEAN StickyCacheRemove(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _In_ ULONG Pid
+);
+
+VOID StickyCacheAccumulateStats(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _Inout_ PHIDGUARDIAN_STICKY_CACHE_STATS Stats
+);
+
+PVERDICT_CACHE StickyCacheSwap(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _In_opt_ PVERDICT_CACHE Cache
+);
+
+ULONG StickyCacheLive(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
+VOID DeviceCountersRead(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _Out_ PHIDGUARDIAN_DEVICE_COUNTERS Counters
+);
+
+NTSTATUS DeviceIdentityEnsure(
+    _In_ WDFDEVICE Device
+);
+
+VOID DeviceIdentityEnsureAll(
+    VOID
+);
+
+VOID DeviceIdentityReference(
+    _In_ PDEVICE_IDENTITY Identity
+);
+
+VOID DeviceIdentityRelease(
+    _Inout_ PDEVICE_IDENTITY* Identity
+);
+
+VOID DeviceIdentityWriteHardwareIDs(
+    _In_ PDEVICE_IDENTITY Identity,
+    _Out_writes_bytes_(Identity->HardwareIDsLength) PWCHAR Buffer
+);
+
+ULONG DeviceIdentityMeasureStrings(
+    _In_ PDEVICE_IDENTITY Identity,
+    _Out_ PUSHORT DeviceIdLength,
+    _Out_ PUSHORT InstanceIdLength,
+    _Out_ PUSHORT ClassNameLength
+);
+
+VOID DeviceIdentityWriteStrings(
+    _In_ PDEVICE_IDENTITY Identity,
+    _Out_ PWCHAR Buffer
+);
+
+ULONG DeviceInfoExport(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _Out_writes_bytes_opt_(BufferLength) PUCHAR Buffer,
+    _In_ ULONG BufferLength
+);
+
+ULONG DeviceMemoryUsage(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
+ULONG StickyCacheExport(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _Out_writes_bytes_opt_(BufferLength) PUCHAR Buffer,
+    _In_ ULONG BufferLength
+);
+
+VOID StickyCacheImport(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _In_reads_(Count) PHIDGUARDIAN_VERDICT_SNAPSHOT_ENTRY Entries,
+    _In_ ULONG Count,
+    _In_ ULONG64 Elapsed
+);
+
+NTSTATUS DeviceGuardAcquire(
+    _In_ WDFDEVICE Device
+);
+
+BOOLEAN DeviceGuardReference(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
+VOID DeviceGuardRelease(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
+BOOLEAN HidGuardianResolvePendingRequests(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
+VOID HidGuardianHoldPendingRequests(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
+VOID HidGuardianNotifyDeferredRequests(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
+VOID HidGuardianNotifyPendingRequests(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
 NTSTATUS BusQueryId(
     _In_ WDFDEVICE Device, 
     _In_ BUS_QUERY_ID_TYPE IdType, 
@@ -0,0 +1,375 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Driver.h"
+#include "DeviceChanges.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, DeviceChangesInitialize)
+#pragma alloc_text (PAGE, DeviceChangesUninitialize)
+#pragma alloc_text (PAGE, DeviceChangesPost)
+#pragma alloc_text (PAGE, DeviceChangesSubmit)
+#endif
+
+//
+// Queued arrival or removal; the strings are read from the identity
+// when the change is handed out
+// 
+typedef struct _DEVICE_CHANGE
+{
+    ULONG64             Sequence;
+
+    ULONG64             Timestamp;
+
+    PDEVICE_IDENTITY    Identity;
+
+    ULONG               DeviceHash;
+
+    UCHAR               Type;
+
+} DEVICE_CHANGE, *PDEVICE_CHANGE;
+
+//
+// Changes Cerberus hasn't picked up yet, NULL if queueing is off
+// 
+static PRECORD_RING DeviceChangesRing = NULL;
+
+//
+// Serializes access to DeviceChangesRing and parking requests in
+// DeviceChangesQueue, so no change slips past a waiting request
+// 
+static WDFWAITLOCK DeviceChangesLock = NULL;
+
+//
+// Last sequence number handed out
+// 
+static ULONG64 DeviceChangesSequence = 0;
+
+static NTSTATUS
+DeviceChangesFill(
+    _Out_writes_bytes_(BufferLength) PHIDGUARDIAN_DEVICE_CHANGES Changes,
+    _In_ ULONG BufferLength,
+    _Out_ PULONG BytesWritten
+);
+
+//
+// Allocates the change queue if enabled in the configuration.
+// 
+_Use_decl_annotations_
+NTSTATUS
+DeviceChangesInitialize(
+    WDFDRIVER Driver
+)
+{
+    NTSTATUS                status;
+    WDF_OBJECT_ATTRIBUTES   attribs;
+
+    PAGED_CODE();
+
+    if (GuardianConfig.DeviceChangeCapacity == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = Driver;
+
+    status = WdfWaitLockCreate(&attribs, &DeviceChangesLock);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_SIDEBAND,
+            "WdfWaitLockCreate failed with status %!STATUS!", status);
+        return status;
+    }
+
+    DeviceChangesRing = RECORD_RING_CREATE(
+        GuardianConfig.DeviceChangeCapacity,
+        sizeof(DEVICE_CHANGE)
+    );
+    if (DeviceChangesRing == NULL) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_SIDEBAND,
+            "RECORD_RING_CREATE failed");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_SIDEBAND,
+        "Queueing up to %d device changes", DeviceChangesRing->Capacity);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Drops the identities still queued and frees the queue on driver
+// unload; runs before the identity pool goes away.
+// 
+_Use_decl_annotations_
+VOID
+DeviceChangesUninitialize(
+    VOID
+)
+{
+    DEVICE_CHANGE change;
+
+    PAGED_CODE();
+
+    if (DeviceChangesRing == NULL) {
+        return;
+    }
+
+    while (RECORD_RING_POP(DeviceChangesRing, &change, 1) == 1) {
+        DeviceIdentityRelease(&change.Identity);
+    }
+
+    RECORD_RING_DESTROY(&DeviceChangesRing);
+}
+
+//
+// Queues an arrival or removal of a guarded device with complete
+// identity and hands it to a waiting request, if any. The device has to
+// be in the device registry, which keeps the control device alive.
+// 
+_Use_decl_annotations_
+VOID
+DeviceChangesPost(
+    PDEVICE_CONTEXT DeviceContext,
+    UCHAR Type
+)
+{
+    NTSTATUS        status = STATUS_SUCCESS;
+    PDEVICE_CHANGE  pChange;
+    WDFREQUEST      request = NULL;
+    PVOID           buffer;
+    size_t          length;
+    ULONG           written = 0;
+    ULONGLONG       now;
+
+    PAGED_CODE();
+
+    if (DeviceChangesRing == NULL) {
+        return;
+    }
+
+    now = KeQueryInterruptTime();
+
+    WdfWaitLockAcquire(DeviceChangesLock, NULL);
+
+    //
+    // The oldest change is about to be overwritten (and counted as
+    // dropped), let go of its identity first
+    // 
+    if (RECORD_RING_COUNT(DeviceChangesRing) == DeviceChangesRing->Capacity) {
+        pChange = RECORD_RING_PEEK(DeviceChangesRing);
+        DeviceIdentityRelease(&pChange->Identity);
+    }
+
+    pChange = RECORD_RING_PUSH(DeviceChangesRing);
+
+    DeviceIdentityReference(DeviceContext->Identity);
+
+    pChange->Sequence = ++DeviceChangesSequence;
+    pChange->Timestamp = now;
+    pChange->Identity = DeviceContext->Identity;
+    pChange->DeviceHash = DeviceContext->DeviceHash;
+    pChange->Type = Type;
+
+    if (ControlDevice != NULL && NT_SUCCESS(WdfIoQueueRetrieveNextRequest(
+        ControlDeviceGetContext(ControlDevice)->DeviceChangesQueue,
+        &request)))
+    {
+        //
+        // Checked for the header when it got parked
+        // 
+        status = WdfRequestRetrieveOutputBuffer(request,
+            sizeof(HIDGUARDIAN_DEVICE_CHANGES), &buffer, &length);
+
+        if (NT_SUCCESS(status)) {
+            status = DeviceChangesFill(buffer, (ULONG)min(length, MAXULONG), &written);
+        }
+    }
+
+    WdfWaitLockRelease(DeviceChangesLock);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE,
+        TRACE_SIDEBAND,
+        "Device 0x%08X %s", DeviceContext->DeviceHash,
+        (Type == HIDGUARDIAN_DEVICE_ARRIVAL) ? "arrived" : "removed");
+
+    if (request != NULL) {
+        WdfRequestCompleteWithInformation(request, status, written);
+    }
+}
+
+//
+// Handles IOCTL_HIDGUARDIAN_ARRIVAL_NOTIFICATION. Requests without room
+// for a batch wait for the next arrival as they always did; the others
+// get the queued changes right away or wait for the next one. Returns
+// STATUS_PENDING if the request got parked.
+// 
+_Use_decl_annotations_
+NTSTATUS
+DeviceChangesSubmit(
+    WDFREQUEST Request
+)
+{
+    NTSTATUS                status;
+    PCONTROL_DEVICE_CONTEXT pControlCtx;
+    PVOID                   buffer;
+    size_t                  length;
+    ULONG                   written = 0;
+
+    PAGED_CODE();
+
+    pControlCtx = ControlDeviceGetContext(ControlDevice);
+
+    if (!NT_SUCCESS(WdfRequestRetrieveOutputBuffer(Request,
+        sizeof(HIDGUARDIAN_DEVICE_CHANGES), &buffer, &length)))
+    {
+        status = WdfRequestForwardToIoQueue(Request, pControlCtx->DeviceArrivalNotificationQueue);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestForwardToIoQueue (DeviceArrivalNotificationQueue) failed with status %!STATUS!",
+                status);
+            return status;
+        }
+
+        return STATUS_PENDING;
+    }
+
+    if (DeviceChangesRing == NULL) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    WdfWaitLockAcquire(DeviceChangesLock, NULL);
+
+    if (RECORD_RING_COUNT(DeviceChangesRing) > 0 || DeviceChangesRing->Dropped > 0) {
+        status = DeviceChangesFill(buffer, (ULONG)min(length, MAXULONG), &written);
+    }
+    else {
+        status = WdfRequestForwardToIoQueue(Request, pControlCtx->DeviceChangesQueue);
+        if (NT_SUCCESS(status)) {
+            status = STATUS_PENDING;
+        }
+        else {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestForwardToIoQueue (DeviceChangesQueue) failed with status %!STATUS!",
+                status);
+        }
+    }
+
+    WdfWaitLockRelease(DeviceChangesLock);
+
+    if (status != STATUS_PENDING) {
+        WdfRequestSetInformation(Request, written);
+    }
+
+    return status;
+}
+
+//
+// Moves as many changes as fit into the supplied buffer, oldest first.
+// If not even the oldest one fits, only the header is written with Size
+// holding the buffer size it needs. Caller holds DeviceChangesLock.
+// 
+static NTSTATUS
+DeviceChangesFill(
+    PHIDGUARDIAN_DEVICE_CHANGES Changes,
+    ULONG BufferLength,
+    PULONG BytesWritten
+)
+{
+    PHIDGUARDIAN_DEVICE_CHANGE  pRecord;
+    PDEVICE_CHANGE              pChange;
+    DEVICE_CHANGE               change;
+    ULONG                       offset = sizeof(HIDGUARDIAN_DEVICE_CHANGES);
+    ULONG                       count = 0;
+    ULONG                       size = 0;
+    USHORT                      deviceIdLength;
+    USHORT                      instanceIdLength;
+    USHORT                      classNameLength;
+
+    while ((pChange = RECORD_RING_PEEK(DeviceChangesRing)) != NULL)
+    {
+        //
+        // Only devices with complete identity get queued
+        // 
+        size = sizeof(HIDGUARDIAN_DEVICE_CHANGE) + DeviceIdentityMeasureStrings(
+            pChange->Identity, &deviceIdLength, &instanceIdLength, &classNameLength);
+
+        if (size > BufferLength - offset) {
+            break;
+        }
+
+        pRecord = (PHIDGUARDIAN_DEVICE_CHANGE)((PUCHAR)Changes + offset);
+
+        pRecord->Size = size;
+        pRecord->Type = pChange->Type;
+        pRecord->Reserved = 0;
+        pRecord->DeviceIdLength = deviceIdLength;
+        pRecord->InstanceIdLength = instanceIdLength;
+        pRecord->ClassNameLength = classNameLength;
+        pRecord->Sequence = pChange->Sequence;
+        pRecord->Timestamp = pChange->Timestamp;
+        pRecord->DeviceHash = pChange->DeviceHash;
+        pRecord->HardwareIdsLength = (ULONG)pChange->Identity->HardwareIDsLength;
+
+        DeviceIdentityWriteStrings(pChange->Identity, (PWCHAR)(pRecord + 1));
+
+        RECORD_RING_POP(DeviceChangesRing, &change, 1);
+        DeviceIdentityRelease(&change.Identity);
+
+        offset += size;
+        count++;
+    }
+
+    Changes->Version = HIDGUARDIAN_DEVICE_CHANGES_VERSION;
+    Changes->RecordCount = count;
+    Changes->DroppedCount = (ULONG)min(DeviceChangesRing->Dropped, MAXULONG);
+    Changes->RemainingCount = RECORD_RING_COUNT(DeviceChangesRing);
+
+    *BytesWritten = sizeof(HIDGUARDIAN_DEVICE_CHANGES);
+
+    if (count == 0 && Changes->RemainingCount > 0) {
+        Changes->Size = offset + size;
+
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    DeviceChangesRing->Dropped = 0;
+
+    Changes->Size = offset;
+    *BytesWritten = offset;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE,
+        TRACE_SIDEBAND,
+        "Handed out %d device changes (%d dropped, %d remaining)",
+        count, Changes->DroppedCount, Changes->RemainingCount);
+
+    return STATUS_SUCCESS;
+}
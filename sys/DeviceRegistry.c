@@ -0,0 +1,360 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Driver.h"
+#include "DeviceRegistry.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, DeviceRegistryInitialize)
+#pragma alloc_text (PAGE, DeviceRegistryUninitialize)
+#pragma alloc_text (PAGE, DeviceRegistryAdd)
+#pragma alloc_text (PAGE, DeviceRegistryRemove)
+#pragma alloc_text (PAGE, DeviceRegistryRemoveDone)
+#pragma alloc_text (PAGE, DeviceRegistryReadBegin)
+#endif
+
+#define DEVICE_REGISTRY_TAG         'RDGH'
+
+//
+// Slots are allocated in chunks that stay put until unload, so indices
+// are stable and readers never see an array being replaced
+// 
+#define DEVICE_REGISTRY_CHUNK_SIZE  64
+#define DEVICE_REGISTRY_MAX_CHUNKS  64
+
+typedef struct _DEVICE_REGISTRY_SLOT
+{
+    //
+    // NULL while the slot is free
+    // 
+    WDFDEVICE           Device;
+
+    //
+    // Held by readers while they use Device; removal waits for them
+    // 
+    EX_RUNDOWN_REF      Rundown;
+
+} DEVICE_REGISTRY_SLOT, *PDEVICE_REGISTRY_SLOT;
+
+static PDEVICE_REGISTRY_SLOT DeviceRegistryChunks[DEVICE_REGISTRY_MAX_CHUNKS];
+
+//
+// One past the highest slot ever used; only grows
+// 
+static volatile LONG DeviceRegistrySlots = 0;
+
+//
+// Devices in the registry
+// 
+static volatile LONG DeviceRegistryDevices = 0;
+
+//
+// Odd while a device is being removed, see DeviceRegistryReadBegin
+// 
+static volatile LONG DeviceRegistrySequence = 0;
+
+//
+// Signaled while no device is being removed; readers wait on it
+// 
+static KEVENT DeviceRegistryIdle;
+
+static PDEVICE_REGISTRY_SLOT
+DeviceRegistrySlot(
+    _In_ ULONG Index
+)
+{
+    return &DeviceRegistryChunks[Index / DEVICE_REGISTRY_CHUNK_SIZE][Index % DEVICE_REGISTRY_CHUNK_SIZE];
+}
+
+//
+// Creates the lock serializing adds and removals.
+// 
+_Use_decl_annotations_
+NTSTATUS
+DeviceRegistryInitialize(
+    WDFDRIVER Driver
+)
+{
+    NTSTATUS                status;
+    WDF_OBJECT_ATTRIBUTES   attribs;
+
+    PAGED_CODE();
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = Driver;
+
+    status = WdfWaitLockCreate(&attribs, &DeviceRegistryLock);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "WdfWaitLockCreate failed with status %!STATUS!", status);
+        return status;
+    }
+
+    RtlZeroMemory(DeviceRegistryChunks, sizeof(DeviceRegistryChunks));
+
+    DeviceRegistrySlots = 0;
+    DeviceRegistryDevices = 0;
+    DeviceRegistrySequence = 0;
+
+    KeInitializeEvent(&DeviceRegistryIdle, NotificationEvent, TRUE);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Frees the slots on driver unload, no devices are left.
+// 
+_Use_decl_annotations_
+VOID
+DeviceRegistryUninitialize(
+    VOID
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < DEVICE_REGISTRY_MAX_CHUNKS; i++) {
+        if (DeviceRegistryChunks[i] != NULL) {
+            ExFreePoolWithTag(DeviceRegistryChunks[i], DEVICE_REGISTRY_TAG);
+            DeviceRegistryChunks[i] = NULL;
+        }
+    }
+}
+
+//
+// Puts a device into the first free slot and returns its index. Caller
+// holds DeviceRegistryLock.
+// 
+_Use_decl_annotations_
+NTSTATUS
+DeviceRegistryAdd(
+    WDFDEVICE Device,
+    PULONG Index
+)
+{
+    PDEVICE_REGISTRY_SLOT   chunk;
+    ULONG                   slots = (ULONG)DeviceRegistrySlots;
+    ULONG                   i;
+
+    PAGED_CODE();
+
+    *Index = DEVICE_REGISTRY_INVALID_INDEX;
+
+    for (i = 0; i < slots; i++) {
+        if (DeviceRegistrySlot(i)->Device == NULL) {
+            break;
+        }
+    }
+
+    if (i == DEVICE_REGISTRY_CHUNK_SIZE * DEVICE_REGISTRY_MAX_CHUNKS) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DEVICE,
+            "Device registry is full (%d devices)", i);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (DeviceRegistryChunks[i / DEVICE_REGISTRY_CHUNK_SIZE] == NULL)
+    {
+        chunk = ExAllocatePoolWithTag(NonPagedPool,
+            DEVICE_REGISTRY_CHUNK_SIZE * sizeof(DEVICE_REGISTRY_SLOT), DEVICE_REGISTRY_TAG);
+        if (chunk == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(chunk, DEVICE_REGISTRY_CHUNK_SIZE * sizeof(DEVICE_REGISTRY_SLOT));
+
+        for (slots = 0; slots < DEVICE_REGISTRY_CHUNK_SIZE; slots++) {
+            ExInitializeRundownProtection(&chunk[slots].Rundown);
+        }
+
+        InterlockedExchangePointer((PVOID volatile*)&DeviceRegistryChunks[i / DEVICE_REGISTRY_CHUNK_SIZE], chunk);
+    }
+
+    InterlockedExchangePointer((PVOID volatile*)&DeviceRegistrySlot(i)->Device, Device);
+
+    //
+    // Readers only look at slots below the bound, so the slot is filled
+    // (and its chunk published) before the bound moves past it
+    // 
+    if (i == (ULONG)DeviceRegistrySlots) {
+        InterlockedIncrement(&DeviceRegistrySlots);
+    }
+
+    InterlockedIncrement(&DeviceRegistryDevices);
+
+    *Index = i;
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Takes a device out of its slot once no reader uses it anymore. State
+// of the device that gets folded into driver-wide totals has to move
+// before DeviceRegistryRemoveDone. Index may be invalid for a device
+// that never got registered. Caller holds DeviceRegistryLock.
+// 
+_Use_decl_annotations_
+VOID
+DeviceRegistryRemove(
+    ULONG Index
+)
+{
+    PDEVICE_REGISTRY_SLOT slot;
+
+    PAGED_CODE();
+
+    //
+    // Cleared before the sequence turns odd, so a reader that sees it
+    // odd can't miss the end of the removal
+    // 
+    KeClearEvent(&DeviceRegistryIdle);
+
+    InterlockedIncrement(&DeviceRegistrySequence);
+
+    if (Index == DEVICE_REGISTRY_INVALID_INDEX) {
+        return;
+    }
+
+    slot = DeviceRegistrySlot(Index);
+
+    ExWaitForRundownProtectionRelease(&slot->Rundown);
+
+    InterlockedExchangePointer((PVOID volatile*)&slot->Device, NULL);
+
+    ExReInitializeRundownProtection(&slot->Rundown);
+
+    InterlockedDecrement(&DeviceRegistryDevices);
+}
+
+//
+// Ends the removal started with DeviceRegistryRemove.
+// 
+_Use_decl_annotations_
+VOID
+DeviceRegistryRemoveDone(
+    VOID
+)
+{
+    PAGED_CODE();
+
+    InterlockedIncrement(&DeviceRegistrySequence);
+
+    KeSetEvent(&DeviceRegistryIdle, IO_NO_INCREMENT, FALSE);
+}
+
+ULONG
+DeviceRegistryCount(
+    VOID
+)
+{
+    return (ULONG)ReadAcquire(&DeviceRegistryDevices);
+}
+
+//
+// Upper bound (exclusive) for the indices to walk.
+// 
+ULONG
+DeviceRegistryBound(
+    VOID
+)
+{
+    return (ULONG)ReadAcquire(&DeviceRegistrySlots);
+}
+
+//
+// Returns the device in the slot and keeps it from being removed until
+// DeviceRegistryRelease, NULL if the slot is free or being freed. Removal
+// waits for it holding DeviceRegistryLock, so nothing that may block (like
+// sending IRPs) happens in between.
+// 
+_Use_decl_annotations_
+WDFDEVICE
+DeviceRegistryAcquire(
+    ULONG Index
+)
+{
+    PDEVICE_REGISTRY_SLOT   slot = DeviceRegistrySlot(Index);
+    WDFDEVICE               device;
+
+    if (!ExAcquireRundownProtection(&slot->Rundown)) {
+        return NULL;
+    }
+
+    device = InterlockedCompareExchangePointer((PVOID volatile*)&slot->Device, NULL, NULL);
+
+    if (device == NULL) {
+        ExReleaseRundownProtection(&slot->Rundown);
+    }
+
+    return device;
+}
+
+_Use_decl_annotations_
+VOID
+DeviceRegistryRelease(
+    ULONG Index
+)
+{
+    ExReleaseRundownProtection(&DeviceRegistrySlot(Index)->Rundown);
+}
+
+//
+// For readers combining the devices with what removed devices left
+// behind (LatencyRetireHistograms): returns the sequence to pass to
+// DeviceRegistryReadRetry after the walk, waiting for a removal in
+// progress to finish first.
+// 
+_Use_decl_annotations_
+LONG
+DeviceRegistryReadBegin(
+    VOID
+)
+{
+    LONG sequence;
+
+    PAGED_CODE();
+
+    while ((sequence = ReadAcquire(&DeviceRegistrySequence)) & 1) {
+        KeWaitForSingleObject(&DeviceRegistryIdle, Executive, KernelMode, FALSE, NULL);
+    }
+
+    return sequence;
+}
+
+//
+// TRUE if a device got removed during the walk and it has to be redone.
+// 
+_Use_decl_annotations_
+BOOLEAN
+DeviceRegistryReadRetry(
+    LONG Sequence
+)
+{
+    return InterlockedCompareExchange(&DeviceRegistrySequence, 0, 0) != Sequence;
+}
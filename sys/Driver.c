@@ -102,31 +102,72 @@ Return Value:
     }
 
     //
-    // Since there is only one control-device for all the instances
-    // of the physical device, we need an ability to get to particular instance
-    // of the device in our FilterEvtIoDeviceControlForControl. For that we
-    // will create a collection object and store filter device objects.        
-    // The collection object has the driver object as a default parent.
+    // Fetch tunables once, devices pick them up on creation
     //
+    GuardianLoadConfig(WdfGetDriver());
 
-    status = WdfCollectionCreate(WDF_NO_OBJECT_ATTRIBUTES,
-        &FilterDeviceCollection);
-    if (!NT_SUCCESS(status))
-    {
-        KdPrint(("WdfCollectionCreate failed with status 0x%x\n", status));
+    //
+    // Recording is optional, carry on without it
+    //
+    status = AccessTraceInitialize(WdfGetDriver());
+    if (!NT_SUCCESS(status)) {
+        KdPrint((DRIVERNAME "AccessTraceInitialize failed with status 0x%X", status));
+    }
+
+    LatencyInitialize();
+
+    status = StageTraceInitialize(WdfGetDriver());
+    if (!NT_SUCCESS(status)) {
+        KdPrint((DRIVERNAME "StageTraceInitialize failed with status 0x%X", status));
+    }
+
+    status = EventLogInitialize(WdfGetDriver());
+    if (!NT_SUCCESS(status)) {
+        KdPrint((DRIVERNAME "EventLogInitialize failed with status 0x%X", status));
+    }
+
+    status = TopOpenersInitialize(WdfGetDriver());
+    if (!NT_SUCCESS(status)) {
+        KdPrint((DRIVERNAME "TopOpenersInitialize failed with status 0x%X", status));
+    }
+
+    //
+    // Without the buckets opens go unlimited, as with OpenRateLimit 0
+    //
+    status = AdmissionInitialize(WdfGetDriver());
+    if (!NT_SUCCESS(status)) {
+        KdPrint((DRIVERNAME "AdmissionInitialize failed with status 0x%X", status));
+    }
+
+    //
+    // Without the change queue Cerberus only gets the legacy arrival
+    // notification
+    //
+    status = DeviceChangesInitialize(WdfGetDriver());
+    if (!NT_SUCCESS(status)) {
+        KdPrint((DRIVERNAME "DeviceChangesInitialize failed with status 0x%X", status));
+    }
+
+    //
+    // Devices keep their identity strings in the pool, no way around it
+    //
+    status = IdentityPoolInitialize(WdfGetDriver());
+    if (!NT_SUCCESS(status)) {
+        KdPrint((DRIVERNAME "IdentityPoolInitialize failed with status 0x%X", status));
         WPP_CLEANUP(DriverObject);
         return status;
     }
 
     //
-    // The wait-lock object has the driver object as a default parent.
+    // Since there is only one control-device for all the instances
+    // of the physical device, we need an ability to get to particular instance
+    // of the device in our FilterEvtIoDeviceControlForControl. For that we
+    // keep the filter device objects in the device registry.
     //
-
-    status = WdfWaitLockCreate(WDF_NO_OBJECT_ATTRIBUTES,
-        &FilterDeviceCollectionLock);
+    status = DeviceRegistryInitialize(WdfGetDriver());
     if (!NT_SUCCESS(status))
     {
-        KdPrint(("WdfWaitLockCreate failed with status 0x%x\n", status));
+        KdPrint((DRIVERNAME "DeviceRegistryInitialize failed with status 0x%X", status));
         WPP_CLEANUP(DriverObject);
         return status;
     }
@@ -200,6 +241,15 @@ Return Value:
 
     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "%!FUNC! Entry");
 
+    AccessTraceUninitialize();
+    StageTraceUninitialize();
+    EventLogUninitialize();
+    TopOpenersUninitialize();
+    AdmissionUninitialize();
+    DeviceChangesUninitialize();
+    DeviceRegistryUninitialize();
+    IdentityPoolUninitialize();
+
     //
     // Stop WPP Tracing
     //
@@ -32,16 +32,33 @@
 
 #include "HidGuardian.h"
 #include "PidList.h"
+#include "VerdictCache.h"
+#include "PidSet.h"
+#include "RecordRing.h"
+#include "PerCpuCounters.h"
+#include "LatencyHistogram.h"
+#include "EventRing.h"
+#include "SpaceSaving.h"
+#include "TokenBuckets.h"
+#include "StringPool.h"
 #include "Sideband.h"
 #include "device.h"
 #include "queue.h"
 #include "Guardian.h"
+#include "AccessTrace.h"
+#include "Latency.h"
+#include "StageTrace.h"
+#include "EventLog.h"
+#include "TopOpeners.h"
+#include "IdentityPool.h"
+#include "DeviceChanges.h"
+#include "DeviceRegistry.h"
+#include "Admission.h"
 #include "trace.h"
 
 #define DRIVERNAME "HidGuardian: "
 
-WDFCOLLECTION   FilterDeviceCollection;
-WDFWAITLOCK     FilterDeviceCollectionLock;
+WDFWAITLOCK     DeviceRegistryLock;
 WDFDEVICE       ControlDevice;
 
 EXTERN_C_START
@@ -0,0 +1,156 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+
+#include "Driver.h"
+#include "EventLog.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, EventLogInitialize)
+#pragma alloc_text (PAGE, EventLogUninitialize)
+#endif
+
+PEVENT_RING EventLogRing = NULL;
+
+//
+// Serializes readers of EventLogRing, writers need no lock
+// 
+static WDFSPINLOCK EventLogLock = NULL;
+
+//
+// Allocates the per-processor rings unless disabled in the configuration.
+// 
+_Use_decl_annotations_
+NTSTATUS
+EventLogInitialize(
+    WDFDRIVER Driver
+)
+{
+    NTSTATUS                status;
+    WDF_OBJECT_ATTRIBUTES   attribs;
+
+    PAGED_CODE();
+
+    if (GuardianConfig.EventLogCapacity == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = Driver;
+
+    status = WdfSpinLockCreate(&attribs, &EventLogLock);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "WdfSpinLockCreate failed with status %!STATUS!", status);
+        return status;
+    }
+
+    EventLogRing = EVENT_RING_CREATE(GuardianConfig.EventLogCapacity);
+    if (EventLogRing == NULL) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "EVENT_RING_CREATE failed");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DRIVER,
+        "Logging up to %d events on each of %d processors",
+        EventLogRing->Capacity, EventLogRing->Processors);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Frees the rings on driver unload.
+// 
+_Use_decl_annotations_
+VOID
+EventLogUninitialize(
+    VOID
+)
+{
+    PAGED_CODE();
+
+    EVENT_RING_DESTROY(&EventLogRing);
+}
+
+//
+// Moves as many events as fit into the supplied buffer.
+// 
+_Use_decl_annotations_
+NTSTATUS
+EventLogDrain(
+    PHIDGUARDIAN_EVENT_TRACE Trace,
+    ULONG BufferLength
+)
+{
+    LARGE_INTEGER   frequency;
+    ULONG64         dropped;
+    ULONG64         remaining;
+    ULONG           count;
+
+    if (EventLogRing == NULL) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if (BufferLength < sizeof(HIDGUARDIAN_EVENT_TRACE)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    count = (BufferLength - sizeof(HIDGUARDIAN_EVENT_TRACE)) / sizeof(HIDGUARDIAN_EVENT_RECORD);
+
+    WdfSpinLockAcquire(EventLogLock);
+
+    count = EVENT_RING_DRAIN(
+        EventLogRing,
+        (PHIDGUARDIAN_EVENT_RECORD)(Trace + 1),
+        count,
+        &dropped,
+        &remaining
+    );
+
+    WdfSpinLockRelease(EventLogLock);
+
+    KeQueryPerformanceCounter(&frequency);
+
+    Trace->Size = sizeof(HIDGUARDIAN_EVENT_TRACE) + count * sizeof(HIDGUARDIAN_EVENT_RECORD);
+    Trace->Version = HIDGUARDIAN_EVENT_TRACE_VERSION;
+    Trace->RecordSize = sizeof(HIDGUARDIAN_EVENT_RECORD);
+    Trace->RecordCount = count;
+    Trace->DroppedCount = (ULONG)min(dropped, MAXULONG);
+    Trace->RemainingCount = (ULONG)min(remaining, MAXULONG);
+    Trace->Frequency = (ULONG64)frequency.QuadPart;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE,
+        TRACE_DRIVER,
+        "Drained %d events (%d dropped, %d remaining)",
+        count, Trace->DroppedCount, Trace->RemainingCount);
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,252 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#define EVENT_RING_TAG              'ERGH'
+
+//
+// Records per processor unless configured otherwise, and the upper bound
+//
+#define EVENT_RING_DEFAULT_CAPACITY 0x400
+#define EVENT_RING_MAX_CAPACITY     0x10000
+
+//
+// Processor headers and record arrays start on their own cache line
+//
+#define EVENT_RING_ALIGNMENT        64
+
+#ifndef _KERNEL_MODE
+#include <stdlib.h>
+#endif
+
+//
+// Fixed-size HIDGUARDIAN_EVENT_RECORDs in one power-of-two ring per
+// processor. Writers claim a slot of the processor they run on with a
+// single interlocked increment and fill it in place, so logging an event
+// costs a handful of stores and never takes a lock. When a ring is full
+// the oldest events get overwritten.
+//
+// A slot's Sequence is published last, so a reader only copies slots
+// that are complete. Since the slot is claimed (Head advanced) before it
+// gets overwritten, a reader that finds Head a full lap ahead after the
+// copy discards what it read. Readers must be serialized among themselves.
+//
+typedef struct _EVENT_RING_PROCESSOR
+{
+    //
+    // Events ever written / ever consumed (or overwritten)
+    //
+    volatile LONG64 Head;
+
+    ULONG64 Tail;
+
+    UCHAR Padding[EVENT_RING_ALIGNMENT - 2 * sizeof(ULONG64)];
+
+    HIDGUARDIAN_EVENT_RECORD Records[1];
+
+} EVENT_RING_PROCESSOR, *PEVENT_RING_PROCESSOR;
+
+typedef struct _EVENT_RING
+{
+    ULONG Capacity;
+
+    ULONG Processors;
+
+    //
+    // Bytes between two processors
+    //
+    ULONG Stride;
+
+    PUCHAR Rows;
+
+    UCHAR Buffer[1];
+
+} EVENT_RING, *PEVENT_RING;
+
+PEVENT_RING FORCEINLINE EVENT_RING_CREATE(ULONG capacity)
+{
+    PEVENT_RING ring;
+    ULONG processors = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    ULONG slots = 1;
+    ULONG stride;
+    size_t size;
+
+    if (capacity == 0 || capacity > EVENT_RING_MAX_CAPACITY || processors == 0)
+        return NULL;
+
+    while (slots < capacity)
+        slots <<= 1;
+
+    stride = (FIELD_OFFSET(EVENT_RING_PROCESSOR, Records) + slots * sizeof(HIDGUARDIAN_EVENT_RECORD)
+        + EVENT_RING_ALIGNMENT - 1) & ~(EVENT_RING_ALIGNMENT - 1);
+    size = FIELD_OFFSET(EVENT_RING, Buffer) + EVENT_RING_ALIGNMENT + (size_t)processors * stride;
+
+#ifdef _KERNEL_MODE
+    ring = ExAllocatePoolWithTag(NonPagedPool, size, EVENT_RING_TAG);
+#else
+    ring = (PEVENT_RING)malloc(size);
+#endif
+
+    if (ring == NULL) {
+        return ring;
+    }
+
+    RtlZeroMemory(ring, size);
+
+    ring->Capacity = slots;
+    ring->Processors = processors;
+    ring->Stride = stride;
+    ring->Rows = (PUCHAR)(((ULONG_PTR)ring->Buffer + EVENT_RING_ALIGNMENT - 1)
+        & ~((ULONG_PTR)EVENT_RING_ALIGNMENT - 1));
+
+    return ring;
+}
+
+VOID FORCEINLINE EVENT_RING_DESTROY(EVENT_RING ** ring)
+{
+    if (*ring == NULL)
+        return;
+
+#ifdef _KERNEL_MODE
+    ExFreePoolWithTag(*ring, EVENT_RING_TAG);
+#else
+    free(*ring);
+#endif
+
+    *ring = NULL;
+}
+
+PEVENT_RING_PROCESSOR FORCEINLINE EVENT_RING_ROW(PEVENT_RING ring, ULONG processor)
+{
+    return (PEVENT_RING_PROCESSOR)&ring->Rows[(size_t)processor * ring->Stride];
+}
+
+VOID FORCEINLINE EVENT_RING_WRITE(
+    PEVENT_RING ring,
+    ULONG64 timestamp,
+    USHORT eventId,
+    ULONG deviceHash,
+    ULONG arg0,
+    ULONG arg1,
+    ULONG arg2)
+{
+    PEVENT_RING_PROCESSOR row;
+    PHIDGUARDIAN_EVENT_RECORD record;
+    ULONG processor = KeGetCurrentProcessorNumberEx(NULL);
+    ULONG64 index;
+
+    //
+    // Processors added at runtime share the last ring
+    //
+    if (processor >= ring->Processors)
+        processor = ring->Processors - 1;
+
+    row = EVENT_RING_ROW(ring, processor);
+    index = (ULONG64)InterlockedIncrement64(&row->Head) - 1;
+    record = &row->Records[index & (ring->Capacity - 1)];
+
+    record->Timestamp = timestamp;
+    record->EventId = eventId;
+    record->Processor = (USHORT)processor;
+    record->DeviceHash = deviceHash;
+    record->Args[0] = arg0;
+    record->Args[1] = arg1;
+    record->Args[2] = arg2;
+
+    WriteRelease((volatile LONG*)&record->Sequence, (LONG)(ULONG)(index + 1));
+}
+
+//
+// Copies up to count of the oldest events into buffer, processor by
+// processor. Events a writer is still filling in stay for the next call.
+// Returns the number of events copied.
+//
+ULONG FORCEINLINE EVENT_RING_DRAIN(
+    PEVENT_RING ring,
+    PHIDGUARDIAN_EVENT_RECORD buffer,
+    ULONG count,
+    PULONG64 dropped,
+    PULONG64 remaining)
+{
+    PEVENT_RING_PROCESSOR row;
+    PHIDGUARDIAN_EVENT_RECORD record;
+    ULONG64 head;
+    ULONG expected;
+    ULONG done = 0;
+    ULONG i;
+
+    *dropped = 0;
+    *remaining = 0;
+
+    for (i = 0; i < ring->Processors; i++) {
+        row = EVENT_RING_ROW(ring, i);
+        head = (ULONG64)ReadNoFence64(&row->Head);
+
+        if (head - row->Tail > ring->Capacity) {
+            *dropped += head - ring->Capacity - row->Tail;
+            row->Tail = head - ring->Capacity;
+        }
+
+        while (row->Tail < head && done < count) {
+            record = &row->Records[row->Tail & (ring->Capacity - 1)];
+            expected = (ULONG)(row->Tail + 1);
+
+            if ((ULONG)ReadAcquire((volatile LONG*)&record->Sequence) != expected) {
+                //
+                // Either still being written or already reused by a
+                // writer that lapped the reader
+                //
+                if ((ULONG64)ReadNoFence64(&row->Head) - row->Tail <= ring->Capacity)
+                    break;
+
+                row->Tail++;
+                (*dropped)++;
+                continue;
+            }
+
+            buffer[done] = *record;
+            KeMemoryBarrier();
+
+            //
+            // Slot claimed again while copying, the copy may be torn
+            //
+            if ((ULONG64)ReadNoFence64(&row->Head) - row->Tail > ring->Capacity) {
+                row->Tail++;
+                (*dropped)++;
+                continue;
+            }
+
+            row->Tail++;
+            done++;
+        }
+
+        *remaining += head - row->Tail;
+    }
+
+    return done;
+}
@@ -31,8 +31,25 @@
 #define NTSTRSAFE_LIB
 #include <ntstrsafe.h>
 
+GUARDIAN_CONFIG GuardianConfig = {
+    VERDICT_CACHE_DEFAULT_CAPACITY,
+    0,
+    0,
+    0,
+    0,
+    EVENT_RING_DEFAULT_CAPACITY,
+    SPACE_SAVING_DEFAULT_CAPACITY,
+    GUARD_IDLE_DEFAULT_SECONDS,
+    DEVICE_CHANGE_DEFAULT_CAPACITY,
+    0,
+    OPEN_RATE_DEFAULT_BURST,
+    OPEN_EXCESS_FAIL,
+    PENDING_QUEUE_DEFAULT_LIMIT
+};
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (PAGE, AmIAffected)
+#pragma alloc_text (PAGE, GuardianLoadConfig)
 #endif
 
 //
@@ -43,9 +60,9 @@ NTSTATUS AmIAffected(PDEVICE_CONTEXT DeviceContext)
     WDF_OBJECT_ATTRIBUTES   stringAttributes;
     WDFCOLLECTION           col;
     NTSTATUS                status;
-    ULONG                   i;
+    ULONG                   i, k;
     WDFKEY                  keyParams;
-    BOOLEAN                 affected = TRUE;
+    BOOLEAN                 exempted = FALSE;
     PCWSTR                  szIter = NULL;
 
     DECLARE_CONST_UNICODE_STRING(valueExemptedMultiSz, REG_MULTI_SZ_EXCEMPTED_DEVICES);
@@ -77,6 +94,7 @@ NTSTATUS AmIAffected(PDEVICE_CONTEXT DeviceContext)
         TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_GUARDIAN,
             "WdfDriverOpenParametersRegistryKey failed: %!STATUS!", status);
+        WdfObjectDelete(col);
         return status;
     }
 
@@ -97,8 +115,10 @@ NTSTATUS AmIAffected(PDEVICE_CONTEXT DeviceContext)
         //
         // Walk through devices Hardware IDs
         // 
-        for (szIter = DeviceContext->HardwareIDs; *szIter; szIter += wcslen(szIter) + 1)
+        for (k = 0; k < DeviceContext->Identity->HardwareIDCount && !exempted; k++)
         {
+            szIter = DeviceContext->Identity->HardwareIDs[k];
+
             //
             // Convert wide into Unicode string
             // 
@@ -108,6 +128,8 @@ NTSTATUS AmIAffected(PDEVICE_CONTEXT DeviceContext)
                     TRACE_GUARDIAN,
                     "RtlUnicodeStringInit failed: %!STATUS!", status);
 
+                WdfRegistryClose(keyParams);
+                WdfObjectDelete(col);
                 return status;
             }
 
@@ -122,16 +144,14 @@ NTSTATUS AmIAffected(PDEVICE_CONTEXT DeviceContext)
                     TRACE_GUARDIAN,
                     "My ID %wZ vs current exempted ID %wZ\n", &myHardwareID, &currentHardwareID);
 
-                affected = RtlEqualUnicodeString(&myHardwareID, &currentHardwareID, TRUE);
+                exempted = RtlEqualUnicodeString(&myHardwareID, &currentHardwareID, TRUE);
                 TraceEvents(TRACE_LEVEL_INFORMATION,
                     TRACE_GUARDIAN,
-                    "Are we exempted: %d\n", affected);
+                    "Are we exempted: %d\n", exempted);
 
-                if (affected)
+                if (exempted)
                 {
-                    WdfRegistryClose(keyParams);
-                    WdfObjectDelete(col);
-                    return STATUS_DEVICE_FEATURE_NOT_SUPPORTED;
+                    break;
                 }
             }
         }
@@ -141,15 +161,17 @@ NTSTATUS AmIAffected(PDEVICE_CONTEXT DeviceContext)
     WdfObjectDelete(col);
 
     //
-    // If Hardware ID wasn't found (or Force is disabled), report failure so the filter gets unloaded
+    // Only a Hardware ID listed as exempted reports failure; no entries
+    // or no match leave the device guarded
     // 
-    return (affected) ? STATUS_SUCCESS : STATUS_DEVICE_FEATURE_NOT_SUPPORTED;
+    return (exempted) ? STATUS_DEVICE_FEATURE_NOT_SUPPORTED : STATUS_SUCCESS;
 }
 
 BOOLEAN AmIMaster(PDEVICE_CONTEXT DeviceContext)
 {
     PCWSTR      szIter = NULL;
     NTSTATUS    status;
+    ULONG       i;
 
     DECLARE_CONST_UNICODE_STRING(masterHardwareId, HIDGUARDIAN_HARDWARE_ID);
     DECLARE_UNICODE_STRING_SIZE(myHardwareID, MAX_HARDWARE_ID_SIZE);
@@ -157,8 +179,10 @@ BOOLEAN AmIMaster(PDEVICE_CONTEXT DeviceContext)
     //
     // Walk through devices Hardware IDs
     // 
-    for (szIter = DeviceContext->HardwareIDs; *szIter; szIter += wcslen(szIter) + 1)
+    for (i = 0; i < DeviceContext->Identity->HardwareIDCount; i++)
     {
+        szIter = DeviceContext->Identity->HardwareIDs[i];
+
         //
         // Convert wide into Unicode string
         // 
@@ -180,3 +204,202 @@ BOOLEAN AmIMaster(PDEVICE_CONTEXT DeviceContext)
 
     return FALSE;
 }
+
+//
+// Reads optional tuning values from the Parameters key, keeping defaults for missing ones.
+// 
+VOID GuardianLoadConfig(WDFDRIVER Driver)
+{
+    NTSTATUS    status;
+    WDFKEY      keyParams;
+    ULONG       value;
+
+    DECLARE_CONST_UNICODE_STRING(valueStickyCacheCapacity, REG_DWORD_STICKY_CACHE_CAPACITY);
+    DECLARE_CONST_UNICODE_STRING(valueStickyCacheTtl, REG_DWORD_STICKY_CACHE_TTL);
+    DECLARE_CONST_UNICODE_STRING(valueReconnectGrace, REG_DWORD_RECONNECT_GRACE);
+    DECLARE_CONST_UNICODE_STRING(valueAccessTraceCapacity, REG_DWORD_ACCESS_TRACE_CAPACITY);
+    DECLARE_CONST_UNICODE_STRING(valueStageTraceCapacity, REG_DWORD_STAGE_TRACE_CAPACITY);
+    DECLARE_CONST_UNICODE_STRING(valueEventLogCapacity, REG_DWORD_EVENT_LOG_CAPACITY);
+    DECLARE_CONST_UNICODE_STRING(valueTopOpenersCapacity, REG_DWORD_TOP_OPENERS_CAPACITY);
+    DECLARE_CONST_UNICODE_STRING(valueGuardIdle, REG_DWORD_GUARD_IDLE);
+    DECLARE_CONST_UNICODE_STRING(valueDeviceChangeCapacity, REG_DWORD_DEVICE_CHANGE_CAPACITY);
+    DECLARE_CONST_UNICODE_STRING(valueOpenRateLimit, REG_DWORD_OPEN_RATE_LIMIT);
+    DECLARE_CONST_UNICODE_STRING(valueOpenRateBurst, REG_DWORD_OPEN_RATE_BURST);
+    DECLARE_CONST_UNICODE_STRING(valueOpenExcessAction, REG_DWORD_OPEN_EXCESS_ACTION);
+    DECLARE_CONST_UNICODE_STRING(valuePendingQueueLimit, REG_DWORD_PENDING_QUEUE_LIMIT);
+
+
+    PAGED_CODE();
+
+    status = WdfDriverOpenParametersRegistryKey(Driver, KEY_READ, WDF_NO_OBJECT_ATTRIBUTES, &keyParams);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_WARNING,
+            TRACE_GUARDIAN,
+            "WdfDriverOpenParametersRegistryKey failed: %!STATUS!, using defaults", status);
+        return;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueStickyCacheCapacity, &value);
+    if (NT_SUCCESS(status)) {
+        if (value == 0 || value > VERDICT_CACHE_MAX_CAPACITY) {
+            TraceEvents(TRACE_LEVEL_WARNING,
+                TRACE_GUARDIAN,
+                "Sticky cache capacity %d out of range, clamping", value);
+
+            value = (value == 0) ? 1 : VERDICT_CACHE_MAX_CAPACITY;
+        }
+
+        GuardianConfig.StickyCacheCapacity = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueStickyCacheTtl, &value);
+    if (NT_SUCCESS(status)) {
+        GuardianConfig.StickyCacheTtlSeconds = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueReconnectGrace, &value);
+    if (NT_SUCCESS(status)) {
+        if (value > RECONNECT_GRACE_MAX_SECONDS) {
+            TraceEvents(TRACE_LEVEL_WARNING,
+                TRACE_GUARDIAN,
+                "Reconnect grace %d out of range, clamping", value);
+
+            value = RECONNECT_GRACE_MAX_SECONDS;
+        }
+
+        GuardianConfig.ReconnectGraceSeconds = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueAccessTraceCapacity, &value);
+    if (NT_SUCCESS(status)) {
+        if (value > RECORD_RING_MAX_CAPACITY) {
+            TraceEvents(TRACE_LEVEL_WARNING,
+                TRACE_GUARDIAN,
+                "Access trace capacity %d out of range, clamping", value);
+
+            value = RECORD_RING_MAX_CAPACITY;
+        }
+
+        GuardianConfig.AccessTraceCapacity = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueStageTraceCapacity, &value);
+    if (NT_SUCCESS(status)) {
+        if (value > RECORD_RING_MAX_CAPACITY) {
+            TraceEvents(TRACE_LEVEL_WARNING,
+                TRACE_GUARDIAN,
+                "Stage trace capacity %d out of range, clamping", value);
+
+            value = RECORD_RING_MAX_CAPACITY;
+        }
+
+        GuardianConfig.StageTraceCapacity = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueEventLogCapacity, &value);
+    if (NT_SUCCESS(status)) {
+        if (value > EVENT_RING_MAX_CAPACITY) {
+            TraceEvents(TRACE_LEVEL_WARNING,
+                TRACE_GUARDIAN,
+                "Event log capacity %d out of range, clamping", value);
+
+            value = EVENT_RING_MAX_CAPACITY;
+        }
+
+        GuardianConfig.EventLogCapacity = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueTopOpenersCapacity, &value);
+    if (NT_SUCCESS(status)) {
+        if (value > SPACE_SAVING_MAX_CAPACITY) {
+            TraceEvents(TRACE_LEVEL_WARNING,
+                TRACE_GUARDIAN,
+                "Top openers capacity %d out of range, clamping", value);
+
+            value = SPACE_SAVING_MAX_CAPACITY;
+        }
+
+        GuardianConfig.TopOpenersCapacity = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueGuardIdle, &value);
+    if (NT_SUCCESS(status)) {
+        GuardianConfig.GuardIdleSeconds = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueDeviceChangeCapacity, &value);
+    if (NT_SUCCESS(status)) {
+        if (value > RECORD_RING_MAX_CAPACITY) {
+            TraceEvents(TRACE_LEVEL_WARNING,
+                TRACE_GUARDIAN,
+                "Device change capacity %d out of range, clamping", value);
+
+            value = RECORD_RING_MAX_CAPACITY;
+        }
+
+        GuardianConfig.DeviceChangeCapacity = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueOpenRateLimit, &value);
+    if (NT_SUCCESS(status)) {
+        if (value > TOKEN_BUCKETS_MAX_RATE) {
+            TraceEvents(TRACE_LEVEL_WARNING,
+                TRACE_GUARDIAN,
+                "Open rate limit %d out of range, clamping", value);
+
+            value = TOKEN_BUCKETS_MAX_RATE;
+        }
+
+        GuardianConfig.OpenRateLimit = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueOpenRateBurst, &value);
+    if (NT_SUCCESS(status)) {
+        if (value == 0 || value > TOKEN_BUCKETS_MAX_BURST) {
+            TraceEvents(TRACE_LEVEL_WARNING,
+                TRACE_GUARDIAN,
+                "Open rate burst %d out of range, clamping", value);
+
+            value = (value == 0) ? 1 : TOKEN_BUCKETS_MAX_BURST;
+        }
+
+        GuardianConfig.OpenRateBurst = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueOpenExcessAction, &value);
+    if (NT_SUCCESS(status)) {
+        if (value > OPEN_EXCESS_MAX) {
+            TraceEvents(TRACE_LEVEL_WARNING,
+                TRACE_GUARDIAN,
+                "Open excess action %d unknown, failing excess opens", value);
+
+            value = OPEN_EXCESS_FAIL;
+        }
+
+        GuardianConfig.OpenExcessAction = value;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valuePendingQueueLimit, &value);
+    if (NT_SUCCESS(status)) {
+        GuardianConfig.PendingQueueLimit = value;
+    }
+
+    WdfRegistryClose(keyParams);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_GUARDIAN,
+        "Sticky cache capacity: %d, TTL: %d seconds, reconnect grace: %d seconds, access trace: %d records, stage trace: %d records, event log: %d events per processor, top openers: %d, guard idle: %d seconds, device changes: %d, open rate: %d per second, burst: %d, excess action: %d, pending queue limit: %d",
+        GuardianConfig.StickyCacheCapacity,
+        GuardianConfig.StickyCacheTtlSeconds,
+        GuardianConfig.ReconnectGraceSeconds,
+        GuardianConfig.AccessTraceCapacity,
+        GuardianConfig.StageTraceCapacity,
+        GuardianConfig.EventLogCapacity,
+        GuardianConfig.TopOpenersCapacity,
+        GuardianConfig.GuardIdleSeconds,
+        GuardianConfig.DeviceChangeCapacity,
+        GuardianConfig.OpenRateLimit,
+        GuardianConfig.OpenRateBurst,
+        GuardianConfig.OpenExcessAction,
+        GuardianConfig.PendingQueueLimit);
+}
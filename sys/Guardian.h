@@ -28,6 +28,54 @@
 #pragma once
 
 #define REG_MULTI_SZ_EXCEMPTED_DEVICES      L"ExemptedDevices"
+#define REG_DWORD_STICKY_CACHE_CAPACITY     L"StickyCacheCapacity"
+#define REG_DWORD_STICKY_CACHE_TTL          L"StickyCacheTtlSeconds"
+#define REG_DWORD_RECONNECT_GRACE           L"ReconnectGraceSeconds"
+#define REG_DWORD_ACCESS_TRACE_CAPACITY     L"AccessTraceCapacity"
+#define REG_DWORD_STAGE_TRACE_CAPACITY      L"StageTraceCapacity"
+#define REG_DWORD_EVENT_LOG_CAPACITY        L"EventLogCapacity"
+#define REG_DWORD_TOP_OPENERS_CAPACITY      L"TopOpenersCapacity"
+#define REG_DWORD_GUARD_IDLE                L"GuardIdleSeconds"
+#define REG_DWORD_DEVICE_CHANGE_CAPACITY    L"DeviceChangeCapacity"
+#define REG_DWORD_OPEN_RATE_LIMIT           L"OpenRateLimit"
+#define REG_DWORD_OPEN_RATE_BURST           L"OpenRateBurst"
+#define REG_DWORD_OPEN_EXCESS_ACTION        L"OpenExcessAction"
+#define REG_DWORD_PENDING_QUEUE_LIMIT       L"PendingQueueLimit"
+
+//
+// Upper bound for the reconnect grace window
+// 
+#define RECONNECT_GRACE_MAX_SECONDS         300
+
+//
+// Time an idle guarded device keeps its sticky cache and pending queues
+// 
+#define GUARD_IDLE_DEFAULT_SECONDS          30
+
+//
+// Device arrivals and removals queued for Cerberus
+// 
+#define DEVICE_CHANGE_DEFAULT_CAPACITY      64
+
+//
+// Opens a process may issue at once before its open rate applies
+// 
+#define OPEN_RATE_DEFAULT_BURST             16
+
+//
+// Requests per guarded device waiting for Cerberus' pickup or decision
+// 
+#define PENDING_QUEUE_DEFAULT_LIMIT         256
+
+//
+// What becomes of an open over its process' rate or the device's
+// pending queue limit
+// 
+#define OPEN_EXCESS_FAIL                    0   // Complete with STATUS_DEVICE_BUSY
+#define OPEN_EXCESS_DEFAULT                 1   // Apply the default action
+#define OPEN_EXCESS_DEFER                   2   // Queue for Cerberus, notify it later
+
+#define OPEN_EXCESS_MAX                     OPEN_EXCESS_DEFER
 
 //
 // Hardware ID of (virtual) master device
@@ -36,5 +84,85 @@
 // 
 #define HIDGUARDIAN_HARDWARE_ID             L"Nefarius\\HidGuardian\\Gen4"
 
+//
+// Driver-wide settings read from the Parameters key on load
+// 
+typedef struct _GUARDIAN_CONFIG
+{
+    //
+    // Maximum number of sticky verdicts cached per device
+    // 
+    ULONG StickyCacheCapacity;
+
+    //
+    // Lifetime of a sticky verdict in seconds (0 = until handle cleanup or eviction)
+    // 
+    ULONG StickyCacheTtlSeconds;
+
+    //
+    // Time Cerberus has to reconnect before pending requests and the
+    // system PID whitelist are dropped (0 = drop on disconnect)
+    // 
+    ULONG ReconnectGraceSeconds;
+
+    //
+    // Number of access records buffered for draining (0 = recording off)
+    // 
+    ULONG AccessTraceCapacity;
+
+    //
+    // Number of stage timing records buffered for draining (0 = recording off)
+    // 
+    ULONG StageTraceCapacity;
+
+    //
+    // Number of events buffered per processor (0 = logging off)
+    // 
+    ULONG EventLogCapacity;
+
+    //
+    // Number of processes tracked as frequent openers (0 = tracking off)
+    // 
+    ULONG TopOpenersCapacity;
+
+    //
+    // Time a guarded device keeps its guard state after going idle
+    // (0 = keep it until the device goes away)
+    // 
+    ULONG GuardIdleSeconds;
+
+    //
+    // Number of device arrivals and removals queued until Cerberus picks
+    // them up (0 = only the legacy arrival notification)
+    // 
+    ULONG DeviceChangeCapacity;
+
+    //
+    // Opens of guarded devices per second and process that go to Cerberus
+    // (0 = unlimited)
+    // 
+    ULONG OpenRateLimit;
+
+    //
+    // Opens a process may issue at once on top of OpenRateLimit
+    // 
+    ULONG OpenRateBurst;
+
+    //
+    // OPEN_EXCESS_* for opens over the rate or the pending queue limit
+    // 
+    ULONG OpenExcessAction;
+
+    //
+    // Requests a guarded device holds for Cerberus before further opens
+    // count as excess (0 = unlimited)
+    // 
+    ULONG PendingQueueLimit;
+
+} GUARDIAN_CONFIG, *PGUARDIAN_CONFIG;
+
+extern GUARDIAN_CONFIG GuardianConfig;
+
 NTSTATUS AmIAffected(PDEVICE_CONTEXT DeviceContext);
 BOOLEAN AmIMaster(PDEVICE_CONTEXT DeviceContext);
+VOID GuardianLoadConfig(WDFDRIVER Driver);
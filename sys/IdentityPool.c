@@ -0,0 +1,193 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Driver.h"
+#include "IdentityPool.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, IdentityPoolInitialize)
+#pragma alloc_text (PAGE, IdentityPoolUninitialize)
+#pragma alloc_text (PAGE, IdentityPoolIntern)
+#pragma alloc_text (PAGE, IdentityPoolRelease)
+#pragma alloc_text (PAGE, IdentityPoolReadStats)
+#endif
+
+//
+// Expected number of distinct strings to start with, the pool grows
+// beyond that on its own
+// 
+#define IDENTITY_POOL_BUCKETS       64
+
+//
+// Device, instance and hardware ID strings of all filter devices; pads
+// of the same model and the collections of one pad share most of them
+// 
+static PSTRING_POOL IdentityPool = NULL;
+
+//
+// Serializes access to IdentityPool; devices only come and go at
+// PASSIVE_LEVEL
+// 
+static WDFWAITLOCK IdentityPoolLock = NULL;
+
+//
+// Allocates the pool.
+// 
+_Use_decl_annotations_
+NTSTATUS
+IdentityPoolInitialize(
+    WDFDRIVER Driver
+)
+{
+    NTSTATUS                status;
+    WDF_OBJECT_ATTRIBUTES   attribs;
+
+    PAGED_CODE();
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = Driver;
+
+    status = WdfWaitLockCreate(&attribs, &IdentityPoolLock);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "WdfWaitLockCreate failed with status %!STATUS!", status);
+        return status;
+    }
+
+    IdentityPool = STRING_POOL_CREATE(IDENTITY_POOL_BUCKETS);
+    if (IdentityPool == NULL) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "STRING_POOL_CREATE failed");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Frees the pool on driver unload, by then every device has released
+// its strings.
+// 
+_Use_decl_annotations_
+VOID
+IdentityPoolUninitialize(
+    VOID
+)
+{
+    PAGED_CODE();
+
+    if (IdentityPool != NULL && IdentityPool->References != 0) {
+        TraceEvents(TRACE_LEVEL_WARNING,
+            TRACE_DRIVER,
+            "%d identity strings still referenced", IdentityPool->References);
+    }
+
+    STRING_POOL_DESTROY(&IdentityPool);
+}
+
+//
+// Returns the pooled copy of String, NULL if it can't be allocated. The
+// caller owns one reference and hands it back via IdentityPoolRelease.
+// 
+_Use_decl_annotations_
+PCWSTR
+IdentityPoolIntern(
+    PCWSTR String
+)
+{
+    PCWSTR pooled;
+
+    PAGED_CODE();
+
+    if (IdentityPool == NULL) {
+        return NULL;
+    }
+
+    WdfWaitLockAcquire(IdentityPoolLock, NULL);
+
+    pooled = STRING_POOL_INTERN(IdentityPool, String, (ULONG)wcslen(String));
+
+    WdfWaitLockRelease(IdentityPoolLock);
+
+    return pooled;
+}
+
+//
+// Drops a reference obtained from IdentityPoolIntern.
+// 
+_Use_decl_annotations_
+VOID
+IdentityPoolRelease(
+    PCWSTR String
+)
+{
+    PAGED_CODE();
+
+    if (String == NULL) {
+        return;
+    }
+
+    WdfWaitLockAcquire(IdentityPoolLock, NULL);
+
+    STRING_POOL_RELEASE(IdentityPool, String);
+
+    WdfWaitLockRelease(IdentityPoolLock);
+}
+
+//
+// Reports how much the pool holds and how much sharing saves.
+// 
+_Use_decl_annotations_
+VOID
+IdentityPoolReadStats(
+    PHIDGUARDIAN_IDENTITY_POOL_STATS Stats
+)
+{
+    PAGED_CODE();
+
+    RtlZeroMemory(Stats, sizeof(HIDGUARDIAN_IDENTITY_POOL_STATS));
+
+    Stats->Size = sizeof(HIDGUARDIAN_IDENTITY_POOL_STATS);
+
+    if (IdentityPool == NULL) {
+        return;
+    }
+
+    WdfWaitLockAcquire(IdentityPoolLock, NULL);
+
+    Stats->Strings = IdentityPool->Strings;
+    Stats->References = IdentityPool->References;
+    Stats->Buckets = IdentityPool->BucketMask + 1;
+    Stats->PooledBytes = IdentityPool->PooledBytes;
+    Stats->UnpooledBytes = IdentityPool->UnpooledBytes;
+    Stats->Interns = IdentityPool->Interns;
+    Stats->Hits = IdentityPool->Hits;
+
+    WdfWaitLockRelease(IdentityPoolLock);
+}
@@ -0,0 +1,435 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+
+#include "Driver.h"
+#include "Latency.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, LatencyInitialize)
+#pragma alloc_text (PAGE, LatencyCreateHistograms)
+#pragma alloc_text (PAGE, LatencyRetireHistograms)
+#pragma alloc_text (PAGE, LatencyDestroyHistograms)
+#pragma alloc_text (PAGE, LatencyWriteHistograms)
+#pragma alloc_text (PAGE, LatencyRecordDeviceAdd)
+#pragma alloc_text (PAGE, LatencyRecordIdentity)
+#pragma alloc_text (PAGE, LatencyReadDeviceAddStats)
+#endif
+
+//
+// Performance counter ticks per second
+// 
+static LONGLONG LatencyFrequency = 0;
+
+//
+// Everything recorded by devices that are gone, written under
+// DeviceRegistryLock while the device leaves the registry
+// 
+static HIDGUARDIAN_LATENCY_HISTOGRAM LatencyRetired[HIDGUARDIAN_ACCESS_PATH_COUNT];
+
+//
+// Cost of adding filter devices and of completing their identity,
+// recorded lock-free (aligned, the packed layout alone isn't enough for
+// the interlocked updates)
+// 
+static DECLSPEC_CACHEALIGN HIDGUARDIAN_DEVICE_ADD_STATS LatencyDeviceAdd;
+
+//
+// Cost of resolving pending requests after Cerberus left. A disconnect
+// is in progress while LatencyDisconnectPending is non-zero, devices
+// finishing late fold into it instead of starting a new one.
+// 
+static HIDGUARDIAN_DISCONNECT_STATS LatencyDisconnect;
+static EX_SPIN_LOCK LatencyDisconnectLock = 0;
+static ULONG LatencyDisconnectPending = 0;
+static ULONGLONG LatencyDisconnectStart = 0;
+static ULONG LatencyDisconnectDevices = 0;
+static ULONG LatencyDisconnectRequests = 0;
+
+//
+// Captures the performance counter frequency.
+// 
+_Use_decl_annotations_
+VOID
+LatencyInitialize(
+    VOID
+)
+{
+    LARGE_INTEGER frequency;
+
+    PAGED_CODE();
+
+    KeQueryPerformanceCounter(&frequency);
+
+    LatencyFrequency = frequency.QuadPart;
+
+    RtlZeroMemory(LatencyRetired, sizeof(LatencyRetired));
+    RtlZeroMemory(&LatencyDeviceAdd, sizeof(LatencyDeviceAdd));
+    RtlZeroMemory(&LatencyDisconnect, sizeof(LatencyDisconnect));
+
+    LatencyDisconnectPending = 0;
+}
+
+//
+// Start of a measurement. The performance counter has far better
+// resolution than the interrupt time at about the same cost.
+// 
+ULONGLONG
+LatencyTimestamp(
+    VOID
+)
+{
+    return (ULONGLONG)KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+//
+// Converts a difference of two timestamps to 100ns units without
+// overflowing on long waits.
+// 
+_Use_decl_annotations_
+ULONGLONG
+LatencyTicks(
+    ULONGLONG Elapsed
+)
+{
+    return (Elapsed / LatencyFrequency) * 10000000
+        + (Elapsed % LatencyFrequency) * 10000000 / LatencyFrequency;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+LatencyCreateHistograms(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    PAGED_CODE();
+
+    DeviceContext->LatencyHistograms = ExAllocatePoolWithTag(
+        NonPagedPool,
+        sizeof(HIDGUARDIAN_LATENCY_HISTOGRAM) * HIDGUARDIAN_ACCESS_PATH_COUNT,
+        LATENCY_TAG
+    );
+
+    if (DeviceContext->LatencyHistograms == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(DeviceContext->LatencyHistograms,
+        sizeof(HIDGUARDIAN_LATENCY_HISTOGRAM) * HIDGUARDIAN_ACCESS_PATH_COUNT);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Keeps the measurements of a departing device in the global histograms.
+// Called between DeviceRegistryRemove and DeviceRegistryRemoveDone.
+// 
+_Use_decl_annotations_
+VOID
+LatencyRetireHistograms(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (DeviceContext->LatencyHistograms == NULL) {
+        return;
+    }
+
+    for (i = 0; i < HIDGUARDIAN_ACCESS_PATH_COUNT; i++) {
+        LATENCY_HISTOGRAM_MERGE(&LatencyRetired[i], &DeviceContext->LatencyHistograms[i]);
+    }
+}
+
+_Use_decl_annotations_
+VOID
+LatencyDestroyHistograms(
+    PDEVICE_CONTEXT DeviceContext
+)
+{
+    PAGED_CODE();
+
+    if (DeviceContext->LatencyHistograms == NULL) {
+        return;
+    }
+
+    ExFreePoolWithTag(DeviceContext->LatencyHistograms, LATENCY_TAG);
+    DeviceContext->LatencyHistograms = NULL;
+}
+
+//
+// Records the time since StartTimestamp for the given resolution path.
+// 
+_Use_decl_annotations_
+VOID
+LatencyRecord(
+    PDEVICE_CONTEXT DeviceContext,
+    UCHAR Path,
+    ULONGLONG StartTimestamp
+)
+{
+    if (DeviceContext->LatencyHistograms == NULL || Path >= HIDGUARDIAN_ACCESS_PATH_COUNT) {
+        return;
+    }
+
+    LATENCY_HISTOGRAM_RECORD(
+        &DeviceContext->LatencyHistograms[Path],
+        LatencyTicks(LatencyTimestamp() - StartTimestamp)
+    );
+}
+
+//
+// Records the time since StartTimestamp as the cost of one device add.
+// 
+_Use_decl_annotations_
+VOID
+LatencyRecordDeviceAdd(
+    ULONGLONG StartTimestamp
+)
+{
+    PAGED_CODE();
+
+    LATENCY_HISTOGRAM_RECORD(&LatencyDeviceAdd.Add,
+        LatencyTicks(LatencyTimestamp() - StartTimestamp));
+}
+
+//
+// Records one attempt at looking up Device and Instance ID.
+// 
+_Use_decl_annotations_
+VOID
+LatencyRecordIdentity(
+    ULONGLONG StartTimestamp,
+    BOOLEAN Deferred,
+    NTSTATUS Status
+)
+{
+    PAGED_CODE();
+
+    LATENCY_HISTOGRAM_RECORD(&LatencyDeviceAdd.Identity,
+        LatencyTicks(LatencyTimestamp() - StartTimestamp));
+
+    if (!NT_SUCCESS(Status)) {
+        InterlockedIncrement64((volatile LONG64*)&LatencyDeviceAdd.IdentityFailures);
+    }
+    else if (Deferred) {
+        InterlockedIncrement64((volatile LONG64*)&LatencyDeviceAdd.IdentitiesDeferred);
+    }
+    else {
+        InterlockedIncrement64((volatile LONG64*)&LatencyDeviceAdd.IdentitiesOnDemand);
+    }
+}
+
+_Use_decl_annotations_
+VOID
+LatencyReadDeviceAddStats(
+    PHIDGUARDIAN_DEVICE_ADD_STATS Stats
+)
+{
+    PAGED_CODE();
+
+    RtlZeroMemory(Stats, sizeof(HIDGUARDIAN_DEVICE_ADD_STATS));
+
+    Stats->Size = sizeof(HIDGUARDIAN_DEVICE_ADD_STATS);
+
+    LATENCY_HISTOGRAM_MERGE(&Stats->Add, &LatencyDeviceAdd.Add);
+    LATENCY_HISTOGRAM_MERGE(&Stats->Identity, &LatencyDeviceAdd.Identity);
+
+    Stats->IdentitiesDeferred = (ULONG64)ReadNoFence64((volatile LONG64*)&LatencyDeviceAdd.IdentitiesDeferred);
+    Stats->IdentitiesOnDemand = (ULONG64)ReadNoFence64((volatile LONG64*)&LatencyDeviceAdd.IdentitiesOnDemand);
+    Stats->IdentityFailures = (ULONG64)ReadNoFence64((volatile LONG64*)&LatencyDeviceAdd.IdentityFailures);
+}
+
+//
+// Starts timing a disconnect, paired with LatencyDisconnectEnd once
+// all devices got their work queued.
+// 
+_Use_decl_annotations_
+VOID
+LatencyDisconnectBegin(
+    ULONGLONG StartTimestamp
+)
+{
+    KIRQL oldIrql;
+
+    oldIrql = ExAcquireSpinLockExclusive(&LatencyDisconnectLock);
+
+    if (LatencyDisconnectPending++ == 0) {
+        LatencyDisconnectStart = StartTimestamp;
+        LatencyDisconnectDevices = 0;
+        LatencyDisconnectRequests = 0;
+    }
+
+    ExReleaseSpinLockExclusive(&LatencyDisconnectLock, oldIrql);
+}
+
+//
+// Counts a device resolving its requests on its own, paired with
+// LatencyDisconnectEnd when it's done.
+// 
+_Use_decl_annotations_
+VOID
+LatencyDisconnectAddDevice(
+    VOID
+)
+{
+    KIRQL oldIrql;
+
+    oldIrql = ExAcquireSpinLockExclusive(&LatencyDisconnectLock);
+
+    LatencyDisconnectPending++;
+    LatencyDisconnectDevices++;
+
+    ExReleaseSpinLockExclusive(&LatencyDisconnectLock, oldIrql);
+}
+
+//
+// The last one to finish records the duration of the disconnect.
+// 
+_Use_decl_annotations_
+VOID
+LatencyDisconnectEnd(
+    ULONG Allowed,
+    ULONG Denied
+)
+{
+    ULONGLONG   now = LatencyTimestamp();
+    KIRQL       oldIrql;
+
+    oldIrql = ExAcquireSpinLockExclusive(&LatencyDisconnectLock);
+
+    LatencyDisconnect.RequestsAllowed += Allowed;
+    LatencyDisconnect.RequestsDenied += Denied;
+    LatencyDisconnectRequests += Allowed + Denied;
+
+    if (--LatencyDisconnectPending == 0) {
+        LatencyDisconnect.LastDuration = LatencyTicks(now - LatencyDisconnectStart);
+        LatencyDisconnect.LastDevices = LatencyDisconnectDevices;
+        LatencyDisconnect.LastRequests = LatencyDisconnectRequests;
+        LatencyDisconnect.Disconnects++;
+
+        LATENCY_HISTOGRAM_RECORD(&LatencyDisconnect.Duration, LatencyDisconnect.LastDuration);
+    }
+
+    ExReleaseSpinLockExclusive(&LatencyDisconnectLock, oldIrql);
+}
+
+_Use_decl_annotations_
+VOID
+LatencyReadDisconnectStats(
+    PHIDGUARDIAN_DISCONNECT_STATS Stats
+)
+{
+    KIRQL oldIrql;
+
+    RtlZeroMemory(Stats, sizeof(HIDGUARDIAN_DISCONNECT_STATS));
+
+    oldIrql = ExAcquireSpinLockShared(&LatencyDisconnectLock);
+
+    *Stats = LatencyDisconnect;
+
+    ExReleaseSpinLockShared(&LatencyDisconnectLock, oldIrql);
+
+    Stats->Size = sizeof(HIDGUARDIAN_DISCONNECT_STATS);
+}
+
+//
+// Reports global histograms and those of as many devices as fit.
+// 
+_Use_decl_annotations_
+VOID
+LatencyWriteHistograms(
+    PHIDGUARDIAN_LATENCY_HISTOGRAMS Histograms,
+    ULONG BufferLength
+)
+{
+    PHIDGUARDIAN_DEVICE_LATENCY pEntries = (PHIDGUARDIAN_DEVICE_LATENCY)(Histograms + 1);
+    PDEVICE_CONTEXT             pDeviceCtx;
+    WDFDEVICE                   device;
+    ULONG                       capacity;
+    ULONG                       i, k;
+    LONG                        sequence;
+
+    PAGED_CODE();
+
+    capacity = (BufferLength - sizeof(HIDGUARDIAN_LATENCY_HISTOGRAMS)) / sizeof(HIDGUARDIAN_DEVICE_LATENCY);
+
+    //
+    // A device leaving mid-walk moves its histograms into LatencyRetired,
+    // where they'd be missed or counted twice, so start over then
+    // 
+    do {
+        sequence = DeviceRegistryReadBegin();
+
+        RtlZeroMemory(Histograms, sizeof(HIDGUARDIAN_LATENCY_HISTOGRAMS));
+
+        Histograms->BucketCount = HIDGUARDIAN_LATENCY_BUCKETS;
+        Histograms->SubBucketCount = HIDGUARDIAN_LATENCY_SUB_BUCKETS;
+        Histograms->PathCount = HIDGUARDIAN_ACCESS_PATH_COUNT;
+
+        RtlCopyMemory(Histograms->Global, LatencyRetired, sizeof(LatencyRetired));
+
+        for (i = 0; i < DeviceRegistryBound(); i++)
+        {
+            device = DeviceRegistryAcquire(i);
+            if (device == NULL) {
+                continue;
+            }
+
+            pDeviceCtx = DeviceGetContext(device);
+
+            if (pDeviceCtx->LatencyHistograms != NULL && pDeviceCtx->IsGuarded)
+            {
+                for (k = 0; k < HIDGUARDIAN_ACCESS_PATH_COUNT; k++) {
+                    LATENCY_HISTOGRAM_MERGE(&Histograms->Global[k], &pDeviceCtx->LatencyHistograms[k]);
+                }
+
+                Histograms->DeviceCount++;
+
+                if (Histograms->EntryCount < capacity) {
+                    pEntries[Histograms->EntryCount].DeviceHash = pDeviceCtx->DeviceHash;
+                    pEntries[Histograms->EntryCount].Reserved = 0;
+
+                    RtlZeroMemory(pEntries[Histograms->EntryCount].Paths, sizeof(pEntries->Paths));
+
+                    for (k = 0; k < HIDGUARDIAN_ACCESS_PATH_COUNT; k++) {
+                        LATENCY_HISTOGRAM_MERGE(&pEntries[Histograms->EntryCount].Paths[k], &pDeviceCtx->LatencyHistograms[k]);
+                    }
+
+                    Histograms->EntryCount++;
+                }
+            }
+
+            DeviceRegistryRelease(i);
+        }
+    } while (DeviceRegistryReadRetry(sequence));
+
+    Histograms->Size = sizeof(HIDGUARDIAN_LATENCY_HISTOGRAMS)
+        + Histograms->EntryCount * sizeof(HIDGUARDIAN_DEVICE_LATENCY);
+}
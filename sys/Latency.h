@@ -0,0 +1,125 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+
+#pragma once
+
+EXTERN_C_START
+
+#define LATENCY_TAG     'LHGH'
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+LatencyInitialize(
+    VOID
+);
+
+ULONGLONG
+LatencyTimestamp(
+    VOID
+);
+
+ULONGLONG
+LatencyTicks(
+    _In_ ULONGLONG Elapsed
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+LatencyCreateHistograms(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+LatencyRetireHistograms(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+LatencyDestroyHistograms(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+LatencyRecord(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _In_ UCHAR Path,
+    _In_ ULONGLONG StartTimestamp
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+LatencyRecordDeviceAdd(
+    _In_ ULONGLONG StartTimestamp
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+LatencyRecordIdentity(
+    _In_ ULONGLONG StartTimestamp,
+    _In_ BOOLEAN Deferred,
+    _In_ NTSTATUS Status
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+LatencyReadDeviceAddStats(
+    _Out_ PHIDGUARDIAN_DEVICE_ADD_STATS Stats
+);
+
+VOID
+LatencyDisconnectBegin(
+    _In_ ULONGLONG StartTimestamp
+);
+
+VOID
+LatencyDisconnectAddDevice(
+    VOID
+);
+
+VOID
+LatencyDisconnectEnd(
+    _In_ ULONG Allowed,
+    _In_ ULONG Denied
+);
+
+VOID
+LatencyReadDisconnectStats(
+    _Out_ PHIDGUARDIAN_DISCONNECT_STATS Stats
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+LatencyWriteHistograms(
+    _Out_writes_bytes_(BufferLength) PHIDGUARDIAN_LATENCY_HISTOGRAMS Histograms,
+    _In_ ULONG BufferLength
+);
+
+EXTERN_C_END
@@ -0,0 +1,102 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+
+#pragma once
+
+//
+// Log-linear latency histogram (see HIDGUARDIAN_LATENCY_BUCKETS for the
+// layout). Recording is a handful of interlocked operations and never
+// allocates, so it is safe at any IRQL and from any number of threads.
+//
+
+ULONG FORCEINLINE LATENCY_HISTOGRAM_BUCKET(ULONG64 value)
+{
+    ULONG msb;
+
+    if (value < HIDGUARDIAN_LATENCY_SUB_BUCKETS)
+        return (ULONG)value;
+
+    if (value > MAXULONG)
+        return HIDGUARDIAN_LATENCY_BUCKETS - 1;
+
+    _BitScanReverse(&msb, (ULONG)value);
+
+    return (msb - HIDGUARDIAN_LATENCY_SUB_BUCKET_BITS + 1) * HIDGUARDIAN_LATENCY_SUB_BUCKETS
+        + (ULONG)((value >> (msb - HIDGUARDIAN_LATENCY_SUB_BUCKET_BITS)) & (HIDGUARDIAN_LATENCY_SUB_BUCKETS - 1));
+}
+
+//
+// Smallest value that falls into the given bucket
+//
+ULONG64 FORCEINLINE LATENCY_HISTOGRAM_LOWER_BOUND(ULONG bucket)
+{
+    ULONG shift;
+
+    if (bucket < HIDGUARDIAN_LATENCY_SUB_BUCKETS)
+        return bucket;
+
+    shift = bucket / HIDGUARDIAN_LATENCY_SUB_BUCKETS - 1;
+
+    return (ULONG64)(HIDGUARDIAN_LATENCY_SUB_BUCKETS + bucket % HIDGUARDIAN_LATENCY_SUB_BUCKETS) << shift;
+}
+
+VOID FORCEINLINE LATENCY_HISTOGRAM_RECORD(PHIDGUARDIAN_LATENCY_HISTOGRAM histogram, ULONG64 value)
+{
+    LONG64 max;
+
+    InterlockedIncrement((volatile LONG*)&histogram->Buckets[LATENCY_HISTOGRAM_BUCKET(value)]);
+    InterlockedIncrement64((volatile LONG64*)&histogram->Count);
+    InterlockedAdd64((volatile LONG64*)&histogram->Sum, (LONG64)value);
+
+    max = ReadNoFence64((volatile LONG64*)&histogram->Max);
+
+    while ((ULONG64)max < value) {
+        LONG64 seen = InterlockedCompareExchange64((volatile LONG64*)&histogram->Max, (LONG64)value, max);
+
+        if (seen == max)
+            break;
+
+        max = seen;
+    }
+}
+
+//
+// Adds source to target; not atomic as a whole, concurrent recording
+// into source may or may not be included
+//
+VOID FORCEINLINE LATENCY_HISTOGRAM_MERGE(PHIDGUARDIAN_LATENCY_HISTOGRAM target, PHIDGUARDIAN_LATENCY_HISTOGRAM source)
+{
+    ULONG i;
+
+    target->Count += (ULONG64)ReadNoFence64((volatile LONG64*)&source->Count);
+    target->Sum += (ULONG64)ReadNoFence64((volatile LONG64*)&source->Sum);
+    target->Max = max(target->Max, (ULONG64)ReadNoFence64((volatile LONG64*)&source->Max));
+
+    for (i = 0; i < HIDGUARDIAN_LATENCY_BUCKETS; i++)
+        target->Buckets[i] += (ULONG)ReadNoFence((volatile LONG*)&source->Buckets[i]);
+}
@@ -0,0 +1,213 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+
+#pragma once
+
+#define PER_CPU_COUNTERS_TAG        'CPGH'
+
+//
+// Rows are padded to this so no two processors share a cache line
+//
+#define PER_CPU_COUNTERS_ALIGNMENT  64
+
+#ifndef _KERNEL_MODE
+#include <stdlib.h>
+#endif
+
+//
+// A fixed number of 64-bit counters, replicated once per processor.
+// Writers only touch the row of the processor they run on, so updates
+// never contend on a shared cache line; readers combine all rows.
+//
+// Interlocked updates keep a row consistent when a thread gets moved to
+// another processor halfway through, no lock is needed on either side.
+//
+typedef struct _PER_CPU_COUNTERS
+{
+    //
+    // Counters per row
+    //
+    ULONG Count;
+
+    //
+    // Bytes between two rows
+    //
+    ULONG Stride;
+
+    ULONG Processors;
+
+    PUCHAR Rows;
+
+    UCHAR Buffer[1];
+
+} PER_CPU_COUNTERS, *PPER_CPU_COUNTERS;
+
+typedef volatile LONG64 *PPER_CPU_COUNTER;
+
+PPER_CPU_COUNTERS FORCEINLINE PER_CPU_COUNTERS_CREATE(ULONG count)
+{
+    PPER_CPU_COUNTERS counters;
+    ULONG processors = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    ULONG stride;
+    size_t size;
+
+    if (count == 0 || processors == 0)
+        return NULL;
+
+    stride = (count * sizeof(LONG64) + PER_CPU_COUNTERS_ALIGNMENT - 1) & ~(PER_CPU_COUNTERS_ALIGNMENT - 1);
+    size = FIELD_OFFSET(PER_CPU_COUNTERS, Buffer) + PER_CPU_COUNTERS_ALIGNMENT + (size_t)processors * stride;
+
+#ifdef _KERNEL_MODE
+    counters = ExAllocatePoolWithTag(NonPagedPool, size, PER_CPU_COUNTERS_TAG);
+#else
+    counters = (PPER_CPU_COUNTERS)malloc(size);
+#endif
+
+    if (counters == NULL) {
+        return counters;
+    }
+
+    RtlZeroMemory(counters, size);
+
+    counters->Count = count;
+    counters->Stride = stride;
+    counters->Processors = processors;
+    counters->Rows = (PUCHAR)(((ULONG_PTR)counters->Buffer + PER_CPU_COUNTERS_ALIGNMENT - 1)
+        & ~((ULONG_PTR)PER_CPU_COUNTERS_ALIGNMENT - 1));
+
+    return counters;
+}
+
+//
+// Bytes allocated for the counters
+//
+size_t FORCEINLINE PER_CPU_COUNTERS_FOOTPRINT(PPER_CPU_COUNTERS counters)
+{
+    if (counters == NULL)
+        return 0;
+
+    return FIELD_OFFSET(PER_CPU_COUNTERS, Buffer) + PER_CPU_COUNTERS_ALIGNMENT
+        + (size_t)counters->Processors * counters->Stride;
+}
+
+VOID FORCEINLINE PER_CPU_COUNTERS_DESTROY(PER_CPU_COUNTERS ** counters)
+{
+    if (*counters == NULL)
+        return;
+
+#ifdef _KERNEL_MODE
+    ExFreePoolWithTag(*counters, PER_CPU_COUNTERS_TAG);
+#else
+    free(*counters);
+#endif
+
+    *counters = NULL;
+}
+
+PPER_CPU_COUNTER FORCEINLINE PER_CPU_COUNTERS_ROW(PPER_CPU_COUNTERS counters, ULONG processor)
+{
+    return (PPER_CPU_COUNTER)&counters->Rows[(size_t)processor * counters->Stride];
+}
+
+PPER_CPU_COUNTER FORCEINLINE PER_CPU_COUNTERS_CURRENT(PPER_CPU_COUNTERS counters, ULONG index)
+{
+    ULONG processor = KeGetCurrentProcessorNumberEx(NULL);
+
+    //
+    // Processors added at runtime share the last row
+    //
+    if (processor >= counters->Processors)
+        processor = counters->Processors - 1;
+
+    return &PER_CPU_COUNTERS_ROW(counters, processor)[index];
+}
+
+VOID FORCEINLINE PER_CPU_COUNTERS_ADD(PPER_CPU_COUNTERS counters, ULONG index, LONG64 value)
+{
+    if (counters == NULL)
+        return;
+
+    InterlockedAdd64(PER_CPU_COUNTERS_CURRENT(counters, index), value);
+}
+
+//
+// Raises the counter to value if it is lower (high-water marks)
+//
+VOID FORCEINLINE PER_CPU_COUNTERS_MAX(PPER_CPU_COUNTERS counters, ULONG index, LONG64 value)
+{
+    PPER_CPU_COUNTER counter;
+    LONG64 current;
+
+    if (counters == NULL)
+        return;
+
+    counter = PER_CPU_COUNTERS_CURRENT(counters, index);
+    current = ReadNoFence64(counter);
+
+    while (current < value) {
+        LONG64 seen = InterlockedCompareExchange64(counter, value, current);
+
+        if (seen == current)
+            break;
+
+        current = seen;
+    }
+}
+
+ULONG64 FORCEINLINE PER_CPU_COUNTERS_SUM(PPER_CPU_COUNTERS counters, ULONG index)
+{
+    ULONG64 sum = 0;
+    ULONG i;
+
+    if (counters == NULL)
+        return 0;
+
+    for (i = 0; i < counters->Processors; i++)
+        sum += (ULONG64)ReadNoFence64(&PER_CPU_COUNTERS_ROW(counters, i)[index]);
+
+    return sum;
+}
+
+ULONG64 FORCEINLINE PER_CPU_COUNTERS_HIGHEST(PPER_CPU_COUNTERS counters, ULONG index)
+{
+    LONG64 highest = 0;
+    LONG64 value;
+    ULONG i;
+
+    if (counters == NULL)
+        return 0;
+
+    for (i = 0; i < counters->Processors; i++) {
+        value = ReadNoFence64(&PER_CPU_COUNTERS_ROW(counters, i)[index]);
+
+        if (value > highest)
+            highest = value;
+    }
+
+    return (ULONG64)highest;
+}
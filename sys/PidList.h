@@ -71,7 +71,10 @@ VOID FORCEINLINE PID_LIST_DESTROY(PID_LIST_NODE ** head)
     if (current == NULL)
         return;
 
-    while (current->next != NULL) {
+    //
+    // Free every node including the terminating one
+    //
+    while (current != NULL) {
         temp_node = current;
         current = current->next;
 #ifdef _KERNEL_MODE
@@ -80,6 +83,8 @@ VOID FORCEINLINE PID_LIST_DESTROY(PID_LIST_NODE ** head)
         free(temp_node);
 #endif
     }
+
+    *head = NULL;
 }
 
 BOOLEAN FORCEINLINE PID_LIST_PUSH(PID_LIST_NODE ** head, ULONG pid, BOOLEAN allowed)
@@ -109,26 +114,26 @@ BOOLEAN FORCEINLINE PID_LIST_PUSH(PID_LIST_NODE ** head, ULONG pid, BOOLEAN allo
 
 BOOLEAN FORCEINLINE PID_LIST_REMOVE_BY_PID(PID_LIST_NODE ** head, ULONG pid)
 {
-    PPID_LIST_NODE current = *head;
+    PPID_LIST_NODE* link = head;
     PPID_LIST_NODE temp_node = NULL;
 
-    if (current == NULL)
+    if (*link == NULL)
         return FALSE;
 
     if (pid == SYSTEM_PID)
         return FALSE;
 
     //
-    // Search for PID
+    // Search for PID, the terminating node is never removed
     // 
-    while (current->next != NULL) {
-        if (current->Pid == pid) {
+    while ((*link)->next != NULL) {
+        if ((*link)->Pid == pid) {
             break;
         }
-        current = current->next;
+        link = &(*link)->next;
     }
 
-    if (current->next == NULL) {
+    if ((*link)->next == NULL) {
         //
         // PID wasn't found in the list
         // 
@@ -138,8 +143,8 @@ BOOLEAN FORCEINLINE PID_LIST_REMOVE_BY_PID(PID_LIST_NODE ** head, ULONG pid)
     //
     // Re-link list and free disposed node
     // 
-    temp_node = current->next;
-    current->next = temp_node->next;
+    temp_node = *link;
+    *link = temp_node->next;
 #ifdef _KERNEL_MODE
     ExFreePoolWithTag(temp_node, PID_LIST_TAG);
 #else
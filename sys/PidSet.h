@@ -0,0 +1,319 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#define PID_SET_TAG         'SPGH'
+
+//
+// Upper bound of PIDs accepted in one set
+//
+#define PID_SET_MAX_COUNT   0x10000
+
+//
+// PIDs are multiples of four; the bitmap index covers PIDs below
+// 2^(2 + PID_BITMAP_LEAF_SHIFT + PID_BITMAP_DIRECTORY_SHIFT) = 16M,
+// anything above (or unaligned) is looked up in the sorted array
+//
+#define PID_BITMAP_LEAF_SHIFT       14
+#define PID_BITMAP_DIRECTORY_SHIFT  8
+#define PID_BITMAP_LEAF_BITS        (1UL << PID_BITMAP_LEAF_SHIFT)
+#define PID_BITMAP_LEAF_ULONGS      (PID_BITMAP_LEAF_BITS / 32)
+#define PID_BITMAP_DIRECTORY_SIZE   (1UL << PID_BITMAP_DIRECTORY_SHIFT)
+#define PID_BITMAP_LIMIT            (1UL << (2 + PID_BITMAP_LEAF_SHIFT + PID_BITMAP_DIRECTORY_SHIFT))
+
+#ifndef _KERNEL_MODE
+#include <stdlib.h>
+#endif
+
+//
+// Two-level sparse bitmap: the directory points to 2KB leaves for the
+// ranges that contain at least one PID, empty ranges stay NULL
+//
+typedef struct _PID_BITMAP
+{
+    PULONG Directory[PID_BITMAP_DIRECTORY_SIZE];
+
+    ULONG Leaves[1];
+
+} PID_BITMAP, *PPID_BITMAP;
+
+//
+// Immutable, sorted and duplicate-free array of process IDs.
+//
+// A set is never modified once built; changes produce a new set which
+// replaces the old one, so readers only need to keep the set alive for
+// the duration of a lookup.
+//
+typedef struct _PID_SET
+{
+    ULONG Count;
+
+    //
+    // Membership index for in-range PIDs, NULL if it couldn't be built
+    //
+    PPID_BITMAP Bitmap;
+
+    ULONG Pids[1];
+
+} PID_SET, *PPID_SET;
+
+PPID_SET FORCEINLINE PID_SET_ALLOCATE(ULONG count)
+{
+    PPID_SET set;
+    size_t size = FIELD_OFFSET(PID_SET, Pids) + sizeof(ULONG) * (count ? count : 1);
+
+#ifdef _KERNEL_MODE
+    set = ExAllocatePoolWithTag(NonPagedPool, size, PID_SET_TAG);
+#else
+    set = (PPID_SET)malloc(size);
+#endif
+
+    if (set == NULL) {
+        return set;
+    }
+
+    set->Count = 0;
+    set->Bitmap = NULL;
+
+    return set;
+}
+
+//
+// Builds the bitmap index over a sorted PID array
+//
+PPID_BITMAP FORCEINLINE PID_BITMAP_BUILD(const ULONG* pids, ULONG count)
+{
+    PPID_BITMAP bitmap;
+    PULONG leaf = NULL;
+    ULONG leaves = 0;
+    ULONG last = (ULONG)-1;
+    ULONG index;
+    ULONG i;
+    size_t size;
+
+    //
+    // Sorted input, so leaves are visited in order
+    //
+    for (i = 0; i < count && pids[i] < PID_BITMAP_LIMIT; i++) {
+        if ((pids[i] & 3) == 0 && (pids[i] >> (2 + PID_BITMAP_LEAF_SHIFT)) != last) {
+            last = pids[i] >> (2 + PID_BITMAP_LEAF_SHIFT);
+            leaves++;
+        }
+    }
+
+    size = FIELD_OFFSET(PID_BITMAP, Leaves)
+        + sizeof(ULONG) * PID_BITMAP_LEAF_ULONGS * (leaves ? leaves : 1);
+
+#ifdef _KERNEL_MODE
+    bitmap = ExAllocatePoolWithTag(NonPagedPool, size, PID_SET_TAG);
+#else
+    bitmap = (PPID_BITMAP)malloc(size);
+#endif
+
+    if (bitmap == NULL) {
+        return bitmap;
+    }
+
+    RtlZeroMemory(bitmap, size);
+
+    last = (ULONG)-1;
+    leaves = 0;
+
+    for (i = 0; i < count && pids[i] < PID_BITMAP_LIMIT; i++) {
+        if ((pids[i] & 3) != 0)
+            continue;
+
+        index = pids[i] >> 2;
+
+        if ((index >> PID_BITMAP_LEAF_SHIFT) != last) {
+            last = index >> PID_BITMAP_LEAF_SHIFT;
+            leaf = &bitmap->Leaves[PID_BITMAP_LEAF_ULONGS * leaves++];
+            bitmap->Directory[last] = leaf;
+        }
+
+        index &= PID_BITMAP_LEAF_BITS - 1;
+        leaf[index >> 5] |= 1UL << (index & 31);
+    }
+
+    return bitmap;
+}
+
+VOID FORCEINLINE PID_SET_DESTROY(PID_SET ** set)
+{
+    if (*set == NULL)
+        return;
+
+#ifdef _KERNEL_MODE
+    if ((*set)->Bitmap != NULL)
+        ExFreePoolWithTag((*set)->Bitmap, PID_SET_TAG);
+    ExFreePoolWithTag(*set, PID_SET_TAG);
+#else
+    free((*set)->Bitmap);
+    free(*set);
+#endif
+
+    *set = NULL;
+}
+
+VOID FORCEINLINE PID_SET_SIFT_DOWN(PULONG pids, ULONG root, ULONG count)
+{
+    ULONG child;
+    ULONG temp;
+
+    while ((child = root * 2 + 1) < count) {
+        if (child + 1 < count && pids[child] < pids[child + 1])
+            child++;
+
+        if (pids[root] >= pids[child])
+            return;
+
+        temp = pids[root];
+        pids[root] = pids[child];
+        pids[child] = temp;
+        root = child;
+    }
+}
+
+//
+// In-place heap sort, no recursion and no extra memory
+//
+VOID FORCEINLINE PID_SET_SORT(PULONG pids, ULONG count)
+{
+    ULONG i;
+    ULONG temp;
+
+    if (count < 2)
+        return;
+
+    for (i = count / 2; i > 0; i--) {
+        PID_SET_SIFT_DOWN(pids, i - 1, count);
+    }
+
+    for (i = count - 1; i > 0; i--) {
+        temp = pids[0];
+        pids[0] = pids[i];
+        pids[i] = temp;
+        PID_SET_SIFT_DOWN(pids, 0, i);
+    }
+}
+
+//
+// Builds a new set from the union of an existing set (may be NULL) and
+// an unordered array of PIDs. Zero PIDs are dropped. Fails (NULL) if
+// the union would hold more than PID_SET_MAX_COUNT PIDs.
+//
+PPID_SET FORCEINLINE PID_SET_MERGE(PPID_SET base, const ULONG* pids, ULONG count)
+{
+    PPID_SET set;
+    PULONG incoming;
+    ULONG baseCount = (base != NULL) ? base->Count : 0;
+    ULONG i = 0, j = 0, k = 0, n = 0;
+    ULONG next;
+
+    if (count > PID_SET_MAX_COUNT || baseCount > PID_SET_MAX_COUNT)
+        return NULL;
+
+    set = PID_SET_ALLOCATE(baseCount + count);
+
+    if (set == NULL) {
+        return set;
+    }
+
+    //
+    // Sort the incoming PIDs at the tail of the new array, then merge
+    // both sorted runs into the front (the write cursor never overtakes
+    // the incoming read cursor)
+    //
+    incoming = &set->Pids[baseCount];
+
+    for (i = 0; i < count; i++) {
+        if (pids[i] != 0) {
+            incoming[n++] = pids[i];
+        }
+    }
+
+    PID_SET_SORT(incoming, n);
+
+    for (i = 0; i < baseCount || j < n; ) {
+        if (j >= n || (i < baseCount && base->Pids[i] <= incoming[j]))
+            next = base->Pids[i++];
+        else
+            next = incoming[j++];
+
+        if (k == 0 || set->Pids[k - 1] != next) {
+            set->Pids[k++] = next;
+        }
+    }
+
+    set->Count = k;
+
+    if (set->Count > PID_SET_MAX_COUNT) {
+        PID_SET_DESTROY(&set);
+        return NULL;
+    }
+
+    //
+    // Lookups fall back to the sorted array if this fails
+    //
+    set->Bitmap = PID_BITMAP_BUILD(set->Pids, set->Count);
+
+    return set;
+}
+
+BOOLEAN FORCEINLINE PID_SET_CONTAINS(PPID_SET set, ULONG pid)
+{
+    ULONG low = 0;
+    ULONG high;
+    ULONG mid;
+
+    if (set == NULL)
+        return FALSE;
+
+    if (set->Bitmap != NULL && pid < PID_BITMAP_LIMIT && (pid & 3) == 0) {
+        PULONG leaf = set->Bitmap->Directory[pid >> (2 + PID_BITMAP_LEAF_SHIFT)];
+        ULONG index = (pid >> 2) & (PID_BITMAP_LEAF_BITS - 1);
+
+        return leaf != NULL && (leaf[index >> 5] & (1UL << (index & 31))) != 0;
+    }
+
+    high = set->Count;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+
+        if (set->Pids[mid] == pid)
+            return TRUE;
+
+        if (set->Pids[mid] < pid)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return FALSE;
+}
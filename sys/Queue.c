@@ -28,15 +28,38 @@
 #include "driver.h"
 #include "queue.tmh"
 
+static VOID
+PendingReservationRelease(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _Inout_ PBOOLEAN Reserved
+);
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (PAGE, HidGuardianQueueInitialize)
 #pragma alloc_text (PAGE, PendingAuthQueueInitialize)
 #pragma alloc_text (PAGE, PendingCreateRequestsQueueInitialize)
+#pragma alloc_text (PAGE, DeferredRequestsQueueInitialize)
 #pragma alloc_text (PAGE, CreateRequestsQueueInitialize)
 #pragma alloc_text (PAGE, NotificationsQueueInitialize)
 #pragma alloc_text (PAGE, EvtWdfCreateRequestsQueueIoDefault)
 #endif
 
+//
+// Gives back the pending queue slot a create request reserved, once it
+// got queued or won't be.
+// 
+static VOID
+PendingReservationRelease(
+    PDEVICE_CONTEXT DeviceContext,
+    PBOOLEAN Reserved
+)
+{
+    if (*Reserved) {
+        InterlockedDecrement(&DeviceContext->PendingReservations);
+        *Reserved = FALSE;
+    }
+}
+
 NTSTATUS
 HidGuardianQueueInitialize(
     _In_ WDFDEVICE Device
@@ -121,6 +144,27 @@ PendingCreateRequestsQueueInitialize(
     );
 }
 
+NTSTATUS
+DeferredRequestsQueueInitialize(
+    _In_ WDFDEVICE hDevice
+)
+{
+    WDF_IO_QUEUE_CONFIG     queueConfig;
+    PDEVICE_CONTEXT         pDeviceCtx;
+
+    PAGED_CODE();
+
+    pDeviceCtx = DeviceGetContext(hDevice);
+
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+
+    return WdfIoQueueCreate(hDevice,
+        &queueConfig,
+        WDF_NO_OBJECT_ATTRIBUTES,
+        &pDeviceCtx->DeferredRequestsQueue
+    );
+}
+
 NTSTATUS
 CreateRequestsQueueInitialize(
     _In_ WDFDEVICE hDevice
@@ -134,7 +178,13 @@ CreateRequestsQueueInitialize(
 
     pDeviceCtx = DeviceGetContext(hDevice);
 
-    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchSequential);
+    //
+    // Opens are routed concurrently: the system PID set and the sticky
+    // cache are read under shared locks, counters and logs are
+    // per-processor, and the pending/notification queues synchronize
+    // themselves, so only requests that go to Cerberus ever contend
+    //
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchParallel);
     queueConfig.EvtIoDefault = EvtWdfCreateRequestsQueueIoDefault;
 
     status = WdfIoQueueCreate(hDevice,
@@ -224,30 +274,53 @@ EvtWdfCreateRequestsQueueIoDefault(
     PCREATE_REQUEST_CONTEXT     pRequestCtx;
     PCONTROL_DEVICE_CONTEXT     pControlCtx;
     WDFREQUEST                  notifyReq;
+    BOOLEAN                     hold = FALSE;
+    BOOLEAN                     queueFull = FALSE;
+    BOOLEAN                     reserved = FALSE;
+    LONG                        reservations;
+    BOOLEAN                     deferred = FALSE;
+    NTSTATUS                    refuseStatus = STATUS_DEVICE_BUSY;
+    ULONGLONG                   arrival;
+    ULONGLONG                   start;
+    UCHAR                       path;
+    ULONG                       depth;
+    ULONG                       authDepth;
+    ULONG                       deferredDepth = 0;
 
 
     PAGED_CODE();
 
     UNREFERENCED_PARAMETER(Request);
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_QUEUE, "%!FUNC! Entry");
-
     device = WdfIoQueueGetDevice(Queue);
     pDeviceCtx = DeviceGetContext(device);
     pControlCtx = ControlDeviceGetContext(ControlDevice);
     pid = CURRENT_PROCESS_ID();
+    arrival = KeQueryInterruptTime();
+    start = LatencyTimestamp();
+
+    EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_CREATE_ARRIVAL, pid, 0, 0);
+
+    DEVICE_COUNTER_INCREMENT(pDeviceCtx, Opens);
+
+    //
+    // Always allow SYSTEM PID 4
+    // 
+    if (pid == SYSTEM_PID)
+    {
+        path = HIDGUARDIAN_ACCESS_PATH_SYSTEM;
+        goto allowAccess;
+    }
 
     //
-    // Cerberus present, yet privileged PID, allow
+    // Cerberus present (or expected back), yet privileged PID, allow
     //
-    if (pControlCtx->IsCerberusConnected == TRUE
-        && PID_LIST_CONTAINS(&pControlCtx->SystemPidList, pid, NULL))
+    if ((pControlCtx->IsCerberusConnected == TRUE || pControlCtx->IsInReconnectGrace)
+        && HidGuardianIsSystemPid(pid))
     {
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_QUEUE,
-            "Request belongs to system PID %d, allowing access",
-            pid);
+        DEVICE_COUNTER_INCREMENT(pDeviceCtx, SystemPidHits);
 
+        path = HIDGUARDIAN_ACCESS_PATH_SYSTEM_PID;
         goto allowAccess;
     }
 
@@ -257,22 +330,50 @@ EvtWdfCreateRequestsQueueIoDefault(
     if (pControlCtx->IsCerberusConnected == TRUE
         && pControlCtx->CerberusPid == pid)
     {
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_QUEUE,
-            "Cerberus (PID %d) connected, access granted",
-            pid);
-
+        path = HIDGUARDIAN_ACCESS_PATH_CERBERUS;
         goto allowAccess;
     }
 
     //
-    // Check PID against internal list to speed up validation
+    // Nothing for Cerberus to decide on the master device
     // 
-    if (PID_LIST_CONTAINS(&pDeviceCtx->StickyPidList, pid, &allowed)) {
-        TraceEvents(TRACE_LEVEL_INFORMATION,
+    if (!pDeviceCtx->IsGuarded) {
+        goto defaultAction;
+    }
+
+    //
+    // Cerberus knows devices by Device and Instance ID, which the add
+    // left to a work item; the first open may have to wait for them
+    // 
+    status = DeviceIdentityEnsure(device);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_QUEUE,
-            "Request belongs to sticky PID %d, processing",
-            pid);
+            "DeviceIdentityEnsure failed with status %!STATUS!", status);
+
+        //
+        // Cerberus can't be asked about a device it can't tell apart;
+        // rather than letting the open through unchecked, fail it until
+        // the IDs can be looked up
+        // 
+        if (pControlCtx->IsCerberusConnected || pControlCtx->IsInReconnectGrace) {
+            DEVICE_COUNTER_INCREMENT(pDeviceCtx, NotReady);
+
+            path = HIDGUARDIAN_ACCESS_PATH_LIMITED;
+            refuseStatus = STATUS_DEVICE_NOT_READY;
+            goto refuseAccess;
+        }
+
+        goto defaultAction;
+    }
+
+    //
+    // Check PID against internal cache to speed up validation
+    // 
+    if (StickyCacheLookup(pDeviceCtx, pid, &allowed)) {
+        DEVICE_COUNTER_INCREMENT(pDeviceCtx, StickyHits);
+
+        path = HIDGUARDIAN_ACCESS_PATH_STICKY;
 
         if (allowed) {
             //
@@ -288,15 +389,95 @@ EvtWdfCreateRequestsQueueIoDefault(
         }
     }
 
+    DEVICE_COUNTER_INCREMENT(pDeviceCtx, StickyMisses);
+
     //
-    // No Cerberus, so default actions apply
+    // Only opens Cerberus may have to decide on are counted, the sketch
+    // is shared by all devices and processors
+    // 
+    TopOpenersRecord(pid);
+
+    //
+    // No Cerberus, so default actions apply, unless it's about to come
+    // back in which case the request waits for it
     // 
     if (!pControlCtx->IsCerberusConnected) {
-        TraceEvents(TRACE_LEVEL_VERBOSE,
-            TRACE_QUEUE,
-            "Cerberus not present (PID %d), applying default action",
-            pid);
-        goto defaultAction;
+        if (!pControlCtx->IsInReconnectGrace) {
+            goto defaultAction;
+        }
+
+        hold = TRUE;
+    }
+
+    //
+    // Backpressure: with too many requests waiting for Cerberus already,
+    // more of them only add to everyone's wait. The slot is reserved
+    // before looking at the queues and kept until the request is queued,
+    // so concurrent arrivals count each other in and can't overshoot.
+    // 
+    if (GuardianConfig.PendingQueueLimit != 0) {
+        reservations = InterlockedIncrement(&pDeviceCtx->PendingReservations);
+        reserved = TRUE;
+
+        depth = authDepth = 0;
+
+        if (DeviceGuardReference(pDeviceCtx)) {
+            WdfIoQueueGetState(pDeviceCtx->PendingCreateRequestsQueue, &depth, NULL);
+            WdfIoQueueGetState(pDeviceCtx->PendingAuthQueue, &authDepth, NULL);
+
+            if (pDeviceCtx->DeferredRequestsQueue != NULL) {
+                WdfIoQueueGetState(pDeviceCtx->DeferredRequestsQueue, &deferredDepth, NULL);
+            }
+
+            DeviceGuardRelease(pDeviceCtx);
+        }
+
+        if ((ULONG)reservations - 1 + depth + authDepth + deferredDepth >= GuardianConfig.PendingQueueLimit) {
+            DEVICE_COUNTER_INCREMENT(pDeviceCtx, QueueFull);
+
+            queueFull = TRUE;
+        }
+    }
+
+    //
+    // Admission control: a process opening faster than its rate doesn't
+    // get to keep Cerberus busy
+    // 
+    if (queueFull || !AdmissionTake(pid)) {
+        if (!queueFull) {
+            DEVICE_COUNTER_INCREMENT(pDeviceCtx, RateLimited);
+        }
+
+        path = HIDGUARDIAN_ACCESS_PATH_LIMITED;
+
+        if (GuardianConfig.OpenExcessAction == OPEN_EXCESS_DEFAULT) {
+            DEVICE_COUNTER_INCREMENT(pDeviceCtx, ExcessDefaulted);
+
+            if (pDeviceCtx->AllowByDefault) {
+                goto allowAccess;
+            }
+            else {
+                goto blockAccess;
+            }
+        }
+
+        //
+        // Deferring to a full queue would defeat its limit
+        // 
+        if (GuardianConfig.OpenExcessAction != OPEN_EXCESS_DEFER || queueFull) {
+            DEVICE_COUNTER_INCREMENT(pDeviceCtx, ExcessFailed);
+
+            goto refuseAccess;
+        }
+
+        //
+        // Parked until the process earns an open back, then handed to
+        // Cerberus like any other request
+        // 
+        DEVICE_COUNTER_INCREMENT(pDeviceCtx, ExcessDeferred);
+
+        hold = TRUE;
+        deferred = TRUE;
     }
 
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&requestAttribs, CREATE_REQUEST_CONTEXT);
@@ -319,29 +500,138 @@ EvtWdfCreateRequestsQueueIoDefault(
     }
 
     pRequestCtx->ProcessId = CURRENT_PROCESS_ID();
+    pRequestCtx->ArrivalTime = arrival;
+    pRequestCtx->StageTimes[HIDGUARDIAN_STAGE_ARRIVAL] = start;
 
     //
-    // Grab notification request for Cerberus
+    // Grab notification request for Cerberus; if it has none parked
+    // (busy with concurrent opens) the request waits for the next one
     //
-    status = WdfIoQueueRetrieveNextRequest(pDeviceCtx->NotificationsQueue, &notifyReq);
+    if (!hold) {
+        status = WdfIoQueueRetrieveNextRequest(pDeviceCtx->NotificationsQueue, &notifyReq);
+        if (!NT_SUCCESS(status)) {
+            EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_NOTIFY_MISSED, pid, status, 0);
+
+            DEVICE_COUNTER_INCREMENT(pDeviceCtx, NotificationsMissed);
+
+            hold = TRUE;
+        }
+    }
+
+    if (hold) {
+        //
+        // First request that has to wait for Cerberus brings the pending
+        // queues along
+        // 
+        status = DeviceGuardAcquire(device);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_QUEUE,
+                "DeviceGuardAcquire failed with status %!STATUS!", status);
+
+            goto defaultAction;
+        }
+
+        CREATE_REQUEST_STAMP(pRequestCtx, HIDGUARDIAN_STAGE_PENDING);
+
+        if (deferred) {
+            status = WdfRequestForwardToIoQueue(Request, pDeviceCtx->DeferredRequestsQueue);
+
+            PendingReservationRelease(pDeviceCtx, &reserved);
+
+            if (!NT_SUCCESS(status)) {
+                TraceEvents(TRACE_LEVEL_ERROR,
+                    TRACE_QUEUE,
+                    "WdfRequestForwardToIoQueue failed with status %!STATUS!", status);
+
+                DeviceGuardRelease(pDeviceCtx);
+
+                goto defaultAction;
+            }
+
+            WdfIoQueueGetState(pDeviceCtx->DeferredRequestsQueue, &depth, NULL);
+
+            HidGuardianNotifyDeferredRequests(pDeviceCtx);
+
+            EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_CREATE_HELD, pid, depth, 0);
+
+            DeviceGuardRelease(pDeviceCtx);
+
+            return;
+        }
+
+        status = WdfRequestForwardToIoQueue(Request, pDeviceCtx->PendingCreateRequestsQueue);
+
+        PendingReservationRelease(pDeviceCtx, &reserved);
+
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_QUEUE,
+                "WdfRequestForwardToIoQueue failed with status %!STATUS!", status);
+
+            DeviceGuardRelease(pDeviceCtx);
+
+            goto defaultAction;
+        }
+
+        WdfIoQueueGetState(pDeviceCtx->PendingCreateRequestsQueue, &depth, NULL);
+        DEVICE_COUNTER_HIGH_WATER(pDeviceCtx, PendingHighWater, depth);
+
+        //
+        // Cerberus gets told once it submits notification requests again
+        //
+        InterlockedIncrement(&pDeviceCtx->UnnotifiedCreateRequests);
+
+        //
+        // A notification parked meanwhile didn't see this one yet
+        // 
+        HidGuardianNotifyPendingRequests(pDeviceCtx);
+
+        EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_CREATE_HELD, pid, depth, 0);
+
+        DeviceGuardRelease(pDeviceCtx);
+
+        return;
+    }
+
+    status = DeviceGuardAcquire(device);
     if (!NT_SUCCESS(status)) {
-        TraceEvents(TRACE_LEVEL_WARNING,
+        TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_QUEUE,
-            "Couldn't notify Cerberus (WdfIoQueueRetrieveNextRequest failed with status %!STATUS!)",
-            status);
+            "DeviceGuardAcquire failed with status %!STATUS!", status);
+
+        //
+        // Notify Cerberus of the failure
+        //
+        WdfRequestComplete(notifyReq, status);
 
         goto defaultAction;
     }
 
+    //
+    // Keeps the context around for stamping the notification, Cerberus
+    // may finish the request as soon as it's queued
+    //
+    WdfObjectReference(Request);
+
+    CREATE_REQUEST_STAMP(pRequestCtx, HIDGUARDIAN_STAGE_PENDING);
+
     //
     // Queue this access request
     // 
     status = WdfRequestForwardToIoQueue(Request, pDeviceCtx->PendingCreateRequestsQueue);
+
+    PendingReservationRelease(pDeviceCtx, &reserved);
+
     if (!NT_SUCCESS(status)) {
         TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_QUEUE,
             "WdfRequestForwardToIoQueue failed with status %!STATUS!", status);
 
+        WdfObjectDereference(Request);
+
+        DeviceGuardRelease(pDeviceCtx);
+
         //
         // Notify Cerberus of the failure
         //
@@ -350,23 +640,34 @@ EvtWdfCreateRequestsQueueIoDefault(
         goto defaultAction;
     }
 
+    WdfIoQueueGetState(pDeviceCtx->PendingCreateRequestsQueue, &depth, NULL);
+    DEVICE_COUNTER_HIGH_WATER(pDeviceCtx, PendingHighWater, depth);
+
+    CREATE_REQUEST_STAMP(pRequestCtx, HIDGUARDIAN_STAGE_NOTIFIED);
+
+    WdfObjectDereference(Request);
+
     //
     // Notify Cerberus that there are pending access requests
     //
     WdfRequestComplete(notifyReq, STATUS_SUCCESS);
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_QUEUE, "%!FUNC! Exit (access pending)");
+    EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_CREATE_PENDING, pid, depth, 0);
+
+    DeviceGuardRelease(pDeviceCtx);
 
     return;
 
 defaultAction:
 
+    path = HIDGUARDIAN_ACCESS_PATH_DEFAULT;
+
     if (pDeviceCtx->AllowByDefault) {
-        TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_QUEUE, "Default action requested: allow");
+        DEVICE_COUNTER_INCREMENT(pDeviceCtx, DefaultAllowed);
         goto allowAccess;
     }
     else {
-        TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_QUEUE, "Default action requested: deny");
+        DEVICE_COUNTER_INCREMENT(pDeviceCtx, DefaultDenied);
         goto blockAccess;
     }
 
@@ -374,6 +675,14 @@ defaultAction:
 
     allowAccess :
 
+                PendingReservationRelease(pDeviceCtx, &reserved);
+
+                AccessTraceRecord(pDeviceCtx, pid, path, TRUE,
+                    (path == HIDGUARDIAN_ACCESS_PATH_STICKY), arrival, 0);
+                LatencyRecord(pDeviceCtx, path, start);
+
+                EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_CREATE_RESOLVED, pid, path, TRUE);
+
                 WdfRequestFormatRequestUsingCurrentType(Request);
 
                 //
@@ -392,22 +701,47 @@ defaultAction:
                     WdfRequestComplete(Request, status);
                 }
 
-                TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_QUEUE, "%!FUNC! Exit (access granted)");
-
                 return;
 
 #pragma endregion
 
+#pragma region Refuse access
+
+                refuseAccess :
+
+                             PendingReservationRelease(pDeviceCtx, &reserved);
+
+                             //
+                             // Excess open or device not ready, the caller may
+                             // try again later
+                             // 
+                             AccessTraceRecord(pDeviceCtx, pid, path, FALSE, FALSE, arrival, 0);
+                             LatencyRecord(pDeviceCtx, path, start);
+
+                             EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_CREATE_RESOLVED, pid, path, FALSE);
+
+                             WdfRequestComplete(Request, refuseStatus);
+
+                             return;
+
+#pragma endregion
+
 #pragma region Block access
 
                 blockAccess :
 
+                            PendingReservationRelease(pDeviceCtx, &reserved);
+
                             //
                             // If forwarding fails, fall back to blocking access
                             // 
-                            WdfRequestComplete(Request, STATUS_ACCESS_DENIED);
+                            AccessTraceRecord(pDeviceCtx, pid, path, FALSE,
+                                (path == HIDGUARDIAN_ACCESS_PATH_STICKY), arrival, 0);
+                            LatencyRecord(pDeviceCtx, path, start);
 
-                            TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_QUEUE, "%!FUNC! Exit (access blocked)");
+                            EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_CREATE_RESOLVED, pid, path, FALSE);
+
+                            WdfRequestComplete(Request, STATUS_ACCESS_DENIED);
 
 #pragma endregion
 }
@@ -436,16 +770,16 @@ HidGuardianEvtIoDeviceControl(
     BOOLEAN                             ret;
     PCREATE_REQUEST_CONTEXT             pRequestCtx;
     ULONG                               hwidBufferLength;
+    LONG                                unnotified;
+    ULONG                               depth;
 
 
-    UNREFERENCED_PARAMETER(OutputBufferLength);
-    UNREFERENCED_PARAMETER(InputBufferLength);
-
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_QUEUE, "%!FUNC! Entry");
-
     device = WdfIoQueueGetDevice(Queue);
     pDeviceCtx = DeviceGetContext(device);
 
+    EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_DEVICE_CONTROL,
+        IoControlCode, InputBufferLength, OutputBufferLength);
+
     switch (IoControlCode)
     {
 #pragma region IOCTL_HIDGUARDIAN_GET_CREATE_REQUEST
@@ -456,9 +790,6 @@ HidGuardianEvtIoDeviceControl(
         // 
     case IOCTL_HIDGUARDIAN_GET_CREATE_REQUEST:
 
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_QUEUE, ">> IOCTL_HIDGUARDIAN_GET_CREATE_REQUEST");
-
         if (pDeviceCtx->IsShuttingDown) {
             status = STATUS_DEVICE_DOES_NOT_EXIST;
             break;
@@ -486,6 +817,14 @@ HidGuardianEvtIoDeviceControl(
             break;
         }
 
+        //
+        // Without guard state nothing can be pending
+        // 
+        if (!DeviceGuardReference(pDeviceCtx)) {
+            status = STATUS_NO_MORE_ENTRIES;
+            break;
+        }
+
         //
         // Pop pending create request
         // 
@@ -494,38 +833,30 @@ HidGuardianEvtIoDeviceControl(
             TraceEvents(TRACE_LEVEL_WARNING,
                 TRACE_QUEUE,
                 "WdfIoQueueRetrieveNextRequest (PendingCreateRequestsQueue) failed with status %!STATUS!", status);
+
+            DeviceGuardRelease(pDeviceCtx);
             break;
         }
 
         pRequestCtx = CreateRequestGetContext(createRequest);
 
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_DEVICE,
-            "Request ID: %d",
-            pGetCreateRequest->RequestId);
+        CREATE_REQUEST_STAMP(pRequestCtx, HIDGUARDIAN_STAGE_PICKUP);
 
         pGetCreateRequest->ProcessId = pRequestCtx->ProcessId;
 
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_DEVICE,
-            "PID associated to this request: %d",
-            pGetCreateRequest->ProcessId);
-
-        wcscpy_s(pGetCreateRequest->DeviceId, MAX_DEVICE_ID_SIZE, pDeviceCtx->DeviceID);
-        wcscpy_s(pGetCreateRequest->InstanceId, MAX_INSTANCE_ID_SIZE, pDeviceCtx->InstanceID);
+        wcscpy_s(pGetCreateRequest->DeviceId, MAX_DEVICE_ID_SIZE, pDeviceCtx->Identity->DeviceID);
+        wcscpy_s(pGetCreateRequest->InstanceId, MAX_INSTANCE_ID_SIZE, pDeviceCtx->Identity->InstanceID);
 
         hwidBufferLength = pGetCreateRequest->Size - sizeof(HIDGUARDIAN_GET_CREATE_REQUEST);
 
-        TraceEvents(TRACE_LEVEL_VERBOSE,
-            TRACE_DEVICE,
-            "Size for string: %d", hwidBufferLength);
+        EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_PICKUP,
+            pGetCreateRequest->RequestId, pGetCreateRequest->ProcessId, hwidBufferLength);
 
-        if (hwidBufferLength >= pDeviceCtx->HardwareIDsLength)
+        if (hwidBufferLength >= pDeviceCtx->Identity->HardwareIDsLength)
         {
-            RtlCopyMemory(
-                pGetCreateRequest->HardwareIds,
-                pDeviceCtx->HardwareIDs,
-                pDeviceCtx->HardwareIDsLength
+            DeviceIdentityWriteHardwareIDs(
+                pDeviceCtx->Identity,
+                pGetCreateRequest->HardwareIds
             );
         }
 
@@ -534,6 +865,9 @@ HidGuardianEvtIoDeviceControl(
         // 
         pRequestCtx->ProcessId = pGetCreateRequest->ProcessId;
         pRequestCtx->RequestId = pGetCreateRequest->RequestId;
+        pRequestCtx->PickupTime = KeQueryInterruptTime();
+
+        CREATE_REQUEST_STAMP(pRequestCtx, HIDGUARDIAN_STAGE_AUTH_QUEUED);
 
         //
         // Information has been passed to user-land, queue this request for 
@@ -545,9 +879,15 @@ HidGuardianEvtIoDeviceControl(
                 TRACE_DEVICE,
                 "WdfRequestForwardToIoQueue failed with status %!STATUS!", status);
 
+            DeviceGuardRelease(pDeviceCtx);
             break;
         }
 
+        WdfIoQueueGetState(pDeviceCtx->PendingAuthQueue, &depth, NULL);
+        DEVICE_COUNTER_HIGH_WATER(pDeviceCtx, AuthHighWater, depth);
+
+        DeviceGuardRelease(pDeviceCtx);
+
         WdfRequestCompleteWithInformation(Request, status, bufferLength);
 
         return;
@@ -561,9 +901,6 @@ HidGuardianEvtIoDeviceControl(
         // 
     case IOCTL_HIDGUARDIAN_SET_CREATE_REQUEST:
 
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_QUEUE, ">> IOCTL_HIDGUARDIAN_SET_CREATE_REQUEST");
-
         if (pDeviceCtx->IsShuttingDown) {
             status = STATUS_DEVICE_DOES_NOT_EXIST;
             break;
@@ -589,6 +926,14 @@ HidGuardianEvtIoDeviceControl(
             break;
         }
 
+        //
+        // Without guard state nothing can be waiting for the verdict
+        // 
+        if (!DeviceGuardReference(pDeviceCtx)) {
+            status = STATUS_NO_MORE_ENTRIES;
+            break;
+        }
+
         prevTagRequest = tagRequest = NULL;
 
         //
@@ -655,20 +1000,13 @@ HidGuardianEvtIoDeviceControl(
             // 
             pRequestCtx = CreateRequestGetContext(tagRequest);
 
-            TraceEvents(TRACE_LEVEL_INFORMATION,
-                TRACE_QUEUE,
-                "Found request with ID %d (while looking for %d)",
-                pRequestCtx->RequestId,
-                pSetCreateRequest->RequestId);
+            EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_VERDICT_SCAN,
+                pSetCreateRequest->RequestId, pRequestCtx->RequestId, 0);
 
             //
             // Validate the request ID
             // 
             if (pSetCreateRequest->RequestId == pRequestCtx->RequestId) {
-                TraceEvents(TRACE_LEVEL_INFORMATION,
-                    TRACE_QUEUE,
-                    "Request found, acquiring ownership");
-
                 //
                 // Found a match. Retrieve the request from the queue.
                 //
@@ -699,48 +1037,65 @@ HidGuardianEvtIoDeviceControl(
                     break;
                 }
 
-                TraceEvents(TRACE_LEVEL_INFORMATION,
-                    TRACE_QUEUE,
-                    "Ownership acquired, processing access request");
-
                 //
                 // Found the request.
                 //
                 status = STATUS_SUCCESS;
                 pRequestCtx = CreateRequestGetContext(authRequest);
 
+                CREATE_REQUEST_STAMP(pRequestCtx, HIDGUARDIAN_STAGE_VERDICT);
+
+                EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_VERDICT,
+                    pRequestCtx->RequestId, pRequestCtx->ProcessId,
+                    (pSetCreateRequest->IsAllowed ? HIDGUARDIAN_EVENT_VERDICT_ALLOWED : 0)
+                    | (pSetCreateRequest->IsSticky ? HIDGUARDIAN_EVENT_VERDICT_STICKY : 0));
+
                 //
                 // Cache result in driver to improve speed
                 // 
                 if (pSetCreateRequest->IsSticky) {
-                    if (!PID_LIST_CONTAINS(
-                        &pDeviceCtx->StickyPidList,
+                    StickyCacheInsert(
+                        pDeviceCtx,
                         pRequestCtx->ProcessId,
-                        NULL
-                    )) {
-                        PID_LIST_PUSH(
-                            &pDeviceCtx->StickyPidList,
-                            pRequestCtx->ProcessId,
-                            pSetCreateRequest->IsAllowed
-                        );
-                    }
-                    else {
-                        TraceEvents(TRACE_LEVEL_WARNING,
-                            TRACE_QUEUE,
-                            "Sticky PID %d already present in cache", pRequestCtx->ProcessId);
-                    }
+                        pSetCreateRequest->IsAllowed
+                    );
                 }
 
+                DEVICE_COUNTER_INCREMENT(pDeviceCtx, VerdictsReceived);
+
+                AccessTraceRecord(
+                    pDeviceCtx,
+                    pRequestCtx->ProcessId,
+                    HIDGUARDIAN_ACCESS_PATH_VERDICT,
+                    pSetCreateRequest->IsAllowed,
+                    pSetCreateRequest->IsSticky,
+                    pRequestCtx->ArrivalTime,
+                    pRequestCtx->PickupTime
+                );
+
+                LatencyRecord(
+                    pDeviceCtx,
+                    HIDGUARDIAN_ACCESS_PATH_VERDICT,
+                    pRequestCtx->StageTimes[HIDGUARDIAN_STAGE_ARRIVAL]
+                );
+
+                //
+                // Last chance to look at the context, the request
+                // belongs to someone else once sent or completed
+                // 
+                CREATE_REQUEST_STAMP(pRequestCtx, HIDGUARDIAN_STAGE_COMPLETED);
+
+                StageTraceRecord(
+                    pDeviceCtx,
+                    pRequestCtx,
+                    HIDGUARDIAN_ACCESS_PATH_VERDICT,
+                    pSetCreateRequest->IsAllowed
+                );
+
                 //
                 // Request was permitted, pass it down the stack
                 // 
                 if (pSetCreateRequest->IsAllowed) {
-                    TraceEvents(TRACE_LEVEL_INFORMATION,
-                        TRACE_QUEUE,
-                        "!! Request %d from PID %d is allowed",
-                        pRequestCtx->RequestId,
-                        pRequestCtx->ProcessId);
-
                     WdfRequestFormatRequestUsingCurrentType(authRequest);
 
                     //
@@ -763,12 +1118,6 @@ HidGuardianEvtIoDeviceControl(
                     }
                 }
                 else {
-                    TraceEvents(TRACE_LEVEL_INFORMATION,
-                        TRACE_QUEUE,
-                        "!! Request %d from PID %d is not allowed",
-                        pRequestCtx->RequestId,
-                        pRequestCtx->ProcessId);
-
                     //
                     // Request was denied, complete it with failure
                     // 
@@ -778,10 +1127,6 @@ HidGuardianEvtIoDeviceControl(
                 break;
             }
 
-            TraceEvents(TRACE_LEVEL_INFORMATION,
-                TRACE_QUEUE,
-                "Request ID didn't match, continuing iteration");
-
             //
             // This request is not the correct one. Drop the reference 
             // on the tagRequest after the driver obtains the next request.
@@ -791,6 +1136,8 @@ HidGuardianEvtIoDeviceControl(
 
         } while (TRUE);
 
+        DeviceGuardRelease(pDeviceCtx);
+
         //
         // Trace error
         // 
@@ -812,14 +1159,35 @@ HidGuardianEvtIoDeviceControl(
 
     case IOCTL_HIDGUARDIAN_SUBMIT_NOTIFICATION:
 
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_QUEUE, ">> IOCTL_HIDGUARDIAN_SUBMIT_NOTIFICATION");
-
         if (pDeviceCtx->IsShuttingDown) {
             status = STATUS_DEVICE_DOES_NOT_EXIST;
             break;
         }
 
+        if (!pDeviceCtx->IsGuarded) {
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+
+        //
+        // Requests held over from before a reconnect are waiting already,
+        // report them right away
+        // 
+        for (unnotified = pDeviceCtx->UnnotifiedCreateRequests; unnotified > 0; unnotified = pDeviceCtx->UnnotifiedCreateRequests)
+        {
+            if (InterlockedCompareExchange(&pDeviceCtx->UnnotifiedCreateRequests, unnotified - 1, unnotified) == unnotified)
+            {
+                break;
+            }
+        }
+
+        if (unnotified > 0) {
+            EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_NOTIFICATION, unnotified - 1, FALSE, 0);
+
+            status = STATUS_SUCCESS;
+            break;
+        }
+
         status = WdfRequestForwardToIoQueue(Request, pDeviceCtx->NotificationsQueue);
         if (!NT_SUCCESS(status)) {
             TraceEvents(TRACE_LEVEL_ERROR,
@@ -829,6 +1197,14 @@ HidGuardianEvtIoDeviceControl(
             break;
         }
 
+        EVENT_LOG(pDeviceCtx, HIDGUARDIAN_EVENT_NOTIFICATION, 0, TRUE, 0);
+
+        //
+        // An open that just missed a notification may have been held
+        // after the check above
+        // 
+        HidGuardianNotifyPendingRequests(pDeviceCtx);
+
         status = STATUS_PENDING;
 
         break;
@@ -857,7 +1233,5 @@ HidGuardianEvtIoDeviceControl(
     if (status != STATUS_PENDING) {
         WdfRequestComplete(Request, status);
     }
-
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_QUEUE, "%!FUNC! Exit (default)");
 }
 
@@ -44,6 +44,11 @@ PendingCreateRequestsQueueInitialize(
     _In_ WDFDEVICE hDevice
 );
 
+NTSTATUS
+DeferredRequestsQueueInitialize(
+    _In_ WDFDEVICE hDevice
+);
+
 NTSTATUS
 CreateRequestsQueueInitialize(
     _In_ WDFDEVICE hDevice
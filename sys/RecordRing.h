@@ -0,0 +1,184 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#define RECORD_RING_TAG             'RRGH'
+
+//
+// Upper bound of records in one ring
+//
+#define RECORD_RING_MAX_CAPACITY    0x40000
+
+#ifndef _KERNEL_MODE
+#include <stdlib.h>
+#endif
+
+//
+// Fixed-size records in a power-of-two ring. When full, new records
+// overwrite the oldest ones and the loss is counted. Allocated once, so
+// pushing never allocates and is safe with a spin lock held.
+//
+// Not synchronized; callers serialize access.
+//
+typedef struct _RECORD_RING
+{
+    ULONG RecordSize;
+
+    ULONG Capacity;
+
+    //
+    // Records ever written / ever consumed (or overwritten)
+    //
+    ULONG64 Head;
+
+    ULONG64 Tail;
+
+    //
+    // Records overwritten before they were consumed
+    //
+    ULONG64 Dropped;
+
+    UCHAR Records[1];
+
+} RECORD_RING, *PRECORD_RING;
+
+PRECORD_RING FORCEINLINE RECORD_RING_CREATE(ULONG capacity, ULONG recordSize)
+{
+    PRECORD_RING ring;
+    ULONG slots = 1;
+    size_t size;
+
+    if (capacity == 0 || capacity > RECORD_RING_MAX_CAPACITY || recordSize == 0)
+        return NULL;
+
+    while (slots < capacity)
+        slots <<= 1;
+
+    size = FIELD_OFFSET(RECORD_RING, Records) + (size_t)slots * recordSize;
+
+#ifdef _KERNEL_MODE
+    ring = ExAllocatePoolWithTag(NonPagedPool, size, RECORD_RING_TAG);
+#else
+    ring = (PRECORD_RING)malloc(size);
+#endif
+
+    if (ring == NULL) {
+        return ring;
+    }
+
+    RtlZeroMemory(ring, FIELD_OFFSET(RECORD_RING, Records));
+
+    ring->RecordSize = recordSize;
+    ring->Capacity = slots;
+
+    return ring;
+}
+
+VOID FORCEINLINE RECORD_RING_DESTROY(RECORD_RING ** ring)
+{
+    if (*ring == NULL)
+        return;
+
+#ifdef _KERNEL_MODE
+    ExFreePoolWithTag(*ring, RECORD_RING_TAG);
+#else
+    free(*ring);
+#endif
+
+    *ring = NULL;
+}
+
+ULONG FORCEINLINE RECORD_RING_COUNT(PRECORD_RING ring)
+{
+    return (ring != NULL) ? (ULONG)(ring->Head - ring->Tail) : 0;
+}
+
+//
+// Returns the slot for a new record, which the caller fills in
+//
+PVOID FORCEINLINE RECORD_RING_PUSH(PRECORD_RING ring)
+{
+    PUCHAR slot;
+
+    if (ring->Head - ring->Tail == ring->Capacity) {
+        ring->Tail++;
+        ring->Dropped++;
+    }
+
+    slot = &ring->Records[(size_t)(ring->Head & (ring->Capacity - 1)) * ring->RecordSize];
+
+    ring->Head++;
+
+    return slot;
+}
+
+//
+// Returns the oldest record without consuming it, NULL if empty
+//
+PVOID FORCEINLINE RECORD_RING_PEEK(PRECORD_RING ring)
+{
+    if (ring->Head == ring->Tail)
+        return NULL;
+
+    return &ring->Records[(size_t)(ring->Tail & (ring->Capacity - 1)) * ring->RecordSize];
+}
+
+//
+// Moves up to count of the oldest records into buffer, returns the
+// number of records copied
+//
+ULONG FORCEINLINE RECORD_RING_POP(PRECORD_RING ring, PVOID buffer, ULONG count)
+{
+    PUCHAR out = (PUCHAR)buffer;
+    ULONG available = RECORD_RING_COUNT(ring);
+    ULONG index;
+    ULONG chunk;
+    ULONG done = 0;
+
+    if (count > available)
+        count = available;
+
+    //
+    // At most two contiguous runs, before and after the wrap
+    //
+    while (done < count) {
+        index = (ULONG)(ring->Tail & (ring->Capacity - 1));
+        chunk = ring->Capacity - index;
+
+        if (chunk > count - done)
+            chunk = count - done;
+
+        RtlCopyMemory(out, &ring->Records[(size_t)index * ring->RecordSize], (size_t)chunk * ring->RecordSize);
+
+        out += (size_t)chunk * ring->RecordSize;
+        ring->Tail += chunk;
+        done += chunk;
+    }
+
+    return done;
+}
@@ -30,8 +30,7 @@
 #include <wdmsec.h>
 
 
-WDFCOLLECTION   FilterDeviceCollection;
-WDFWAITLOCK     FilterDeviceCollectionLock;
+WDFWAITLOCK     DeviceRegistryLock;
 WDFDEVICE       ControlDevice = NULL;
 
 #ifdef ALLOC_PRAGMA
@@ -39,8 +38,47 @@ WDFDEVICE       ControlDevice = NULL;
 #pragma alloc_text (PAGE, HidGuardianDeleteControlDevice)
 #pragma alloc_text (PAGE, HidGuardianSidebandDeviceFileCreate)
 #pragma alloc_text (PAGE, HidGuardianSidebandFileCleanup)
+#pragma alloc_text (PAGE, HidGuardianSidebandDeviceContextCleanup)
+#pragma alloc_text (PAGE, HidGuardianSidebandReconnectGraceExpired)
 #endif
 
+static VOID
+HidGuardianPublishSystemPidSet(
+    PCONTROL_DEVICE_CONTEXT ControlContext,
+    PPID_SET Set
+);
+
+static NTSTATUS
+HidGuardianWriteVerdictSnapshot(
+    PCONTROL_DEVICE_CONTEXT ControlContext,
+    PHIDGUARDIAN_VERDICT_SNAPSHOT Snapshot,
+    ULONG BufferLength
+);
+
+static NTSTATUS
+HidGuardianRestoreVerdictSnapshot(
+    PCONTROL_DEVICE_CONTEXT ControlContext,
+    PHIDGUARDIAN_VERDICT_SNAPSHOT Snapshot,
+    size_t BufferLength
+);
+
+static VOID
+HidGuardianWritePerfCounters(
+    PHIDGUARDIAN_PERF_COUNTERS Counters,
+    ULONG BufferLength
+);
+
+static NTSTATUS
+HidGuardianWriteDeviceList(
+    PHIDGUARDIAN_DEVICE_LIST List,
+    ULONG BufferLength
+);
+
+static VOID
+HidGuardianResolveAllPendingRequests(
+    ULONGLONG StartTimestamp
+);
+
 //
 // Creates the control device for sideband communication.
 // 
@@ -53,6 +91,9 @@ HidGuardianCreateControlDevice(
     PWDFDEVICE_INIT             pInit;
     WDFDEVICE                   controlDevice = NULL;
     WDF_OBJECT_ATTRIBUTES       controlAttributes;
+    WDF_OBJECT_ATTRIBUTES       lockAttributes;
+    WDF_OBJECT_ATTRIBUTES       timerAttributes;
+    WDF_TIMER_CONFIG            timerConfig;
     WDF_IO_QUEUE_CONFIG         ioQueueConfig;
     BOOLEAN                     bCreate = FALSE;
     NTSTATUS                    status;
@@ -70,16 +111,16 @@ HidGuardianCreateControlDevice(
 
     //
     // First find out whether any ControlDevice has been created. If the
-    // collection has more than one device then we know somebody has already
+    // registry has more than one device then we know somebody has already
     // created or in the process of creating the device.
     //
-    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+    WdfWaitLockAcquire(DeviceRegistryLock, NULL);
 
-    if (WdfCollectionGetCount(FilterDeviceCollection) == 1) {
+    if (DeviceRegistryCount() == 1) {
         bCreate = TRUE;
     }
 
-    WdfWaitLockRelease(FilterDeviceCollectionLock);
+    WdfWaitLockRelease(DeviceRegistryLock);
 
     if (!bCreate) {
         //
@@ -143,6 +184,7 @@ HidGuardianCreateControlDevice(
     // context to handle global data.
     // 
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&controlAttributes, CONTROL_DEVICE_CONTEXT);
+    controlAttributes.EvtCleanupCallback = HidGuardianSidebandDeviceContextCleanup;
 
     status = WdfDeviceCreate(&pInit,
         &controlAttributes,
@@ -196,12 +238,35 @@ HidGuardianCreateControlDevice(
         TRACE_SIDEBAND,
         "ControlDeviceGetContext = 0x%p", pControlCtx);
 
-    pControlCtx->SystemPidList = PID_LIST_CREATE();
-    if (pControlCtx->SystemPidList == NULL) {
-        status = STATUS_INSUFFICIENT_RESOURCES;
+    //
+    // Whitelist starts out empty (NULL set)
+    // 
+    WDF_OBJECT_ATTRIBUTES_INIT(&lockAttributes);
+    lockAttributes.ParentObject = controlDevice;
+
+    status = WdfWaitLockCreate(&lockAttributes, &pControlCtx->SystemPidSetWriteLock);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_SIDEBAND,
+            "WdfWaitLockCreate failed with %!STATUS!", status);
+        goto Error;
+    }
+
+    //
+    // One-shot timer for the reconnect grace window
+    // 
+    WDF_TIMER_CONFIG_INIT(&timerConfig, HidGuardianSidebandReconnectGraceExpired);
+    timerConfig.AutomaticSerialization = FALSE;
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+    timerAttributes.ParentObject = controlDevice;
+    timerAttributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+    status = WdfTimerCreate(&timerConfig, &timerAttributes, &pControlCtx->ReconnectGraceTimer);
+    if (!NT_SUCCESS(status)) {
         TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_SIDEBAND,
-            "PID_LIST_CREATE failed with %!STATUS!", status);
+            "WdfTimerCreate failed with %!STATUS!", status);
         goto Error;
     }
 
@@ -221,6 +286,20 @@ HidGuardianCreateControlDevice(
         goto Error;
     }
 
+    status = WdfIoQueueCreate(controlDevice,
+        &ioQueueConfig,
+        WDF_NO_OBJECT_ATTRIBUTES,
+        &pControlCtx->DeviceChangesQueue
+    );
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_SIDEBAND,
+            "WdfIoQueueCreate failed with status %!STATUS!",
+            status);
+        goto Error;
+    }
+
     //
     // Control devices must notify WDF when they are done initializing.   I/O is
     // rejected until this call is made.
@@ -271,6 +350,12 @@ HidGuardianDeleteControlDevice(
         "Deleting Control Device");
 
     if (ControlDevice) {
+        //
+        // Makes a pending grace timer callback back off (see
+        // HidGuardianSidebandReconnectGraceExpired)
+        // 
+        InterlockedExchange(&ControlDeviceGetContext(ControlDevice)->IsInReconnectGrace, 0);
+
         WdfObjectDelete(ControlDevice);
         ControlDevice = NULL;
     }
@@ -292,9 +377,26 @@ VOID HidGuardianSidebandIoDeviceControl(
 {
     NTSTATUS                            status = STATUS_INVALID_PARAMETER;
     PHIDGUARDIAN_SUBMIT_SYSTEM_PID      pSubmitPid;
+    PHIDGUARDIAN_SUBMIT_SYSTEM_PIDS     pSubmitPids;
+    PPID_SET                            pNewPidSet;
+    PHIDGUARDIAN_VERDICT_SNAPSHOT       pSnapshot;
+    PHIDGUARDIAN_STICKY_CACHE_STATS     pCacheStats;
+    PHIDGUARDIAN_ACCESS_TRACE           pAccessTrace;
+    PHIDGUARDIAN_PERF_COUNTERS          pPerfCounters;
+    PHIDGUARDIAN_LATENCY_HISTOGRAMS     pLatency;
+    PHIDGUARDIAN_STAGE_TRACE            pStageTrace;
+    PHIDGUARDIAN_EVENT_TRACE            pEventTrace;
+    PHIDGUARDIAN_TOP_OPENERS            pTopOpeners;
+    PHIDGUARDIAN_IDENTITY_POOL_STATS    pPoolStats;
+    PHIDGUARDIAN_DEVICE_ADD_STATS       pAddStats;
+    PHIDGUARDIAN_DEVICE_LIST            pDeviceList;
+    PHIDGUARDIAN_DISCONNECT_STATS       pDisconnectStats;
+    WDFDEVICE                           device;
+    ULONG                               flags;
     size_t                              bufferLength;
     PCONTROL_DEVICE_CONTEXT             pControlCtx;
     ULONG                               pid;
+    ULONG                               i;
 
     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_SIDEBAND, "%!FUNC! Entry");
 
@@ -345,28 +447,127 @@ VOID HidGuardianSidebandIoDeviceControl(
             break;
         }
 
-        if (!PID_LIST_CONTAINS(&pControlCtx->SystemPidList, pid, NULL))
+        WdfWaitLockAcquire(pControlCtx->SystemPidSetWriteLock, NULL);
+
+        //
+        // Only writers replace the set and we hold the write lock,
+        // so it can be read without the spin lock here
+        // 
+        if (PID_SET_CONTAINS(pControlCtx->SystemPidSet, pid))
+        {
+            TraceEvents(TRACE_LEVEL_VERBOSE,
+                TRACE_SIDEBAND,
+                "System PID %d already in list", pid);
+        }
+        else if (pControlCtx->SystemPidSet != NULL
+            && pControlCtx->SystemPidSet->Count >= PID_SET_MAX_COUNT)
         {
-            if (PID_LIST_PUSH(&pControlCtx->SystemPidList, pid, TRUE))
+            status = STATUS_INSUFFICIENT_RESOURCES;
+
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "System PID list full, can't whitelist PID: %d", pid);
+        }
+        else
+        {
+            pNewPidSet = PID_SET_MERGE(pControlCtx->SystemPidSet, &pid, 1);
+
+            if (pNewPidSet != NULL)
             {
+                HidGuardianPublishSystemPidSet(pControlCtx, pNewPidSet);
+
                 TraceEvents(TRACE_LEVEL_INFORMATION,
                     TRACE_SIDEBAND,
                     "Whitelisted system PID: %d", pid);
             }
             else
             {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+
                 TraceEvents(TRACE_LEVEL_ERROR,
                     TRACE_SIDEBAND,
                     "Failed to whitelist system PID: %d", pid);
             }
         }
+
+        WdfWaitLockRelease(pControlCtx->SystemPidSetWriteLock);
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_SUBMIT_SYSTEM_PIDS
+
+    case IOCTL_HIDGUARDIAN_SUBMIT_SYSTEM_PIDS:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_SUBMIT_SYSTEM_PIDS");
+
+        status = WdfRequestRetrieveInputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_SUBMIT_SYSTEM_PIDS),
+            (void*)&pSubmitPids,
+            &bufferLength);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        //
+        // Validate packet, the PID array must fit exactly
+        // 
+        if (pSubmitPids->Size != bufferLength
+            || pSubmitPids->Count > PID_SET_MAX_COUNT
+            || bufferLength != sizeof(HIDGUARDIAN_SUBMIT_SYSTEM_PIDS)
+            + (size_t)pSubmitPids->Count * sizeof(ULONG)
+            || (pSubmitPids->Flags & ~HIDGUARDIAN_SYSTEM_PIDS_MERGE) != 0)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "Invalid packet (size %d, count %d, flags 0x%X)",
+                (ULONG)bufferLength, pSubmitPids->Count, pSubmitPids->Flags);
+
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        WdfWaitLockAcquire(pControlCtx->SystemPidSetWriteLock, NULL);
+
+        //
+        // Build the new set off to the side; readers keep using
+        // the current one until it gets swapped
+        // 
+        pNewPidSet = PID_SET_MERGE(
+            (pSubmitPids->Flags & HIDGUARDIAN_SYSTEM_PIDS_MERGE) ? pControlCtx->SystemPidSet : NULL,
+            pSubmitPids->ProcessIds,
+            pSubmitPids->Count
+        );
+
+        if (pNewPidSet != NULL)
+        {
+            HidGuardianPublishSystemPidSet(pControlCtx, pNewPidSet);
+
+            TraceEvents(TRACE_LEVEL_INFORMATION,
+                TRACE_SIDEBAND,
+                "Whitelist now contains %d system PIDs", pNewPidSet->Count);
+        }
         else
         {
-            TraceEvents(TRACE_LEVEL_VERBOSE,
+            status = STATUS_INSUFFICIENT_RESOURCES;
+
+            TraceEvents(TRACE_LEVEL_ERROR,
                 TRACE_SIDEBAND,
-                "System PID %d already in list", pid);
+                "Failed to build system PID set");
         }
 
+        WdfWaitLockRelease(pControlCtx->SystemPidSetWriteLock);
+
         break;
 
 #pragma endregion
@@ -378,84 +579,1175 @@ VOID HidGuardianSidebandIoDeviceControl(
         TraceEvents(TRACE_LEVEL_INFORMATION,
             TRACE_QUEUE, ">> IOCTL_HIDGUARDIAN_ARRIVAL_NOTIFICATION");
 
-        status = WdfRequestForwardToIoQueue(Request, pControlCtx->DeviceArrivalNotificationQueue);
-        if (!NT_SUCCESS(status)) {
+        status = DeviceChangesSubmit(Request);
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_GET_STICKY_CACHE_STATS
+
+    case IOCTL_HIDGUARDIAN_GET_STICKY_CACHE_STATS:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_STICKY_CACHE_STATS");
+
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_STICKY_CACHE_STATS),
+            (void*)&pCacheStats,
+            &bufferLength);
+
+        if (!NT_SUCCESS(status))
+        {
             TraceEvents(TRACE_LEVEL_ERROR,
-                TRACE_QUEUE,
-                "WdfRequestForwardToIoQueue (DeviceArrivalNotificationQueue) failed with status %!STATUS!",
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
                 status);
+
             break;
         }
 
-        status = STATUS_PENDING;
+        RtlZeroMemory(pCacheStats, sizeof(HIDGUARDIAN_STICKY_CACHE_STATS));
+
+        pCacheStats->Size = sizeof(HIDGUARDIAN_STICKY_CACHE_STATS);
+        pCacheStats->Capacity = GuardianConfig.StickyCacheCapacity;
+        pCacheStats->TtlSeconds = GuardianConfig.StickyCacheTtlSeconds;
+
+        for (i = 0; i < DeviceRegistryBound(); i++)
+        {
+            device = DeviceRegistryAcquire(i);
+            if (device == NULL) {
+                continue;
+            }
+
+            StickyCacheAccumulateStats(DeviceGetContext(device), pCacheStats);
+
+            DeviceRegistryRelease(i);
+        }
+
+        WdfRequestSetInformation(Request, sizeof(HIDGUARDIAN_STICKY_CACHE_STATS));
 
         break;
 
 #pragma endregion
-    }
 
-    if (status != STATUS_PENDING) {
-        WdfRequestComplete(Request, status);
-    }
+#pragma region IOCTL_HIDGUARDIAN_GET_VERDICT_SNAPSHOT
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_SIDEBAND, "%!FUNC! Exit");
-}
-#pragma warning(pop) // enable 28118 again
+    case IOCTL_HIDGUARDIAN_GET_VERDICT_SNAPSHOT:
 
-//
-// Gets called when somebody connects to the control device.
-// 
-_Use_decl_annotations_
-VOID
-HidGuardianSidebandDeviceFileCreate(
-    WDFDEVICE  Device,
-    WDFREQUEST  Request,
-    WDFFILEOBJECT  FileObject
-)
-{
-    PCONTROL_DEVICE_CONTEXT pControlCtx;
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_VERDICT_SNAPSHOT");
 
-    UNREFERENCED_PARAMETER(Device);
-    UNREFERENCED_PARAMETER(FileObject);
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT),
+            (void*)&pSnapshot,
+            &bufferLength);
 
-    PAGED_CODE();
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_SIDEBAND, "%!FUNC! Entry");
+            break;
+        }
 
-    pControlCtx = ControlDeviceGetContext(ControlDevice);
+        status = HidGuardianWriteVerdictSnapshot(
+            pControlCtx,
+            pSnapshot,
+            (bufferLength > MAXULONG) ? MAXULONG : (ULONG)bufferLength);
 
-    pControlCtx->IsCerberusConnected = TRUE;
-    pControlCtx->CerberusPid = CURRENT_PROCESS_ID();
+        //
+        // On overflow only the header (with the required size) is valid
+        // 
+        if (status == STATUS_BUFFER_OVERFLOW) {
+            WdfRequestSetInformation(Request, sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT));
+        }
+        else if (NT_SUCCESS(status)) {
+            WdfRequestSetInformation(Request, pSnapshot->Size);
+        }
 
-    WdfRequestComplete(Request, STATUS_SUCCESS);
+        break;
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_SIDEBAND, "%!FUNC! Exit");
-}
+#pragma endregion
 
-//
-// Gets called when somebody disconnects from the control device.
-// 
-_Use_decl_annotations_
-VOID
-HidGuardianSidebandFileCleanup(
-    WDFFILEOBJECT  FileObject
-)
-{
-    PCONTROL_DEVICE_CONTEXT     pControlCtx;
+#pragma region IOCTL_HIDGUARDIAN_RESTORE_VERDICT_SNAPSHOT
 
-    UNREFERENCED_PARAMETER(FileObject);
+    case IOCTL_HIDGUARDIAN_RESTORE_VERDICT_SNAPSHOT:
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_SIDEBAND, "%!FUNC! Entry");
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_RESTORE_VERDICT_SNAPSHOT");
 
-    pControlCtx = ControlDeviceGetContext(ControlDevice);
+        status = WdfRequestRetrieveInputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT),
+            (void*)&pSnapshot,
+            &bufferLength);
 
-    pControlCtx->IsCerberusConnected = FALSE;
-    PID_LIST_DESTROY(&pControlCtx->SystemPidList);
-    pControlCtx->SystemPidList = PID_LIST_CREATE();
-    
-    WdfIoQueuePurgeSynchronously(pControlCtx->DeviceArrivalNotificationQueue);
-    WdfIoQueueStart(pControlCtx->DeviceArrivalNotificationQueue);
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+                status);
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_SIDEBAND, "%!FUNC! Exit");
-}
+            break;
+        }
+
+        status = HidGuardianRestoreVerdictSnapshot(pControlCtx, pSnapshot, bufferLength);
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_GET_ACCESS_TRACE
+
+    case IOCTL_HIDGUARDIAN_GET_ACCESS_TRACE:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_ACCESS_TRACE");
+
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_ACCESS_TRACE),
+            (void*)&pAccessTrace,
+            &bufferLength);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        status = AccessTraceDrain(
+            pAccessTrace,
+            (bufferLength > MAXULONG) ? MAXULONG : (ULONG)bufferLength);
+
+        if (NT_SUCCESS(status)) {
+            WdfRequestSetInformation(Request, pAccessTrace->Size);
+        }
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_GET_PERF_COUNTERS
+
+    case IOCTL_HIDGUARDIAN_GET_PERF_COUNTERS:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_PERF_COUNTERS");
+
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_PERF_COUNTERS),
+            (void*)&pPerfCounters,
+            &bufferLength);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        HidGuardianWritePerfCounters(
+            pPerfCounters,
+            (bufferLength > MAXULONG) ? MAXULONG : (ULONG)bufferLength);
+
+        WdfRequestSetInformation(Request, pPerfCounters->Size);
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_GET_LATENCY_HISTOGRAMS
+
+    case IOCTL_HIDGUARDIAN_GET_LATENCY_HISTOGRAMS:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_LATENCY_HISTOGRAMS");
 
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_LATENCY_HISTOGRAMS),
+            (void*)&pLatency,
+            &bufferLength);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        LatencyWriteHistograms(
+            pLatency,
+            (bufferLength > MAXULONG) ? MAXULONG : (ULONG)bufferLength);
+
+        WdfRequestSetInformation(Request, pLatency->Size);
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_GET_STAGE_TRACE
+
+    case IOCTL_HIDGUARDIAN_GET_STAGE_TRACE:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_STAGE_TRACE");
+
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_STAGE_TRACE),
+            (void*)&pStageTrace,
+            &bufferLength);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        status = StageTraceDrain(
+            pStageTrace,
+            (bufferLength > MAXULONG) ? MAXULONG : (ULONG)bufferLength);
+
+        if (NT_SUCCESS(status)) {
+            WdfRequestSetInformation(Request, pStageTrace->Size);
+        }
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_GET_EVENTS
+
+    case IOCTL_HIDGUARDIAN_GET_EVENTS:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_EVENTS");
+
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_EVENT_TRACE),
+            (void*)&pEventTrace,
+            &bufferLength);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        status = EventLogDrain(
+            pEventTrace,
+            (bufferLength > MAXULONG) ? MAXULONG : (ULONG)bufferLength);
+
+        if (NT_SUCCESS(status)) {
+            WdfRequestSetInformation(Request, pEventTrace->Size);
+        }
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_GET_TOP_OPENERS
+
+    case IOCTL_HIDGUARDIAN_GET_TOP_OPENERS:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_TOP_OPENERS");
+
+        status = WdfRequestRetrieveInputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_TOP_OPENERS),
+            (void*)&pTopOpeners,
+            NULL);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        //
+        // Input and output share the buffer, take the flags first
+        // 
+        flags = pTopOpeners->Flags;
+
+        if ((flags & ~HIDGUARDIAN_TOP_OPENERS_RESET) != 0)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "Invalid flags 0x%X", flags);
+
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_TOP_OPENERS),
+            (void*)&pTopOpeners,
+            &bufferLength);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        status = TopOpenersRead(
+            pTopOpeners,
+            (bufferLength > MAXULONG) ? MAXULONG : (ULONG)bufferLength,
+            flags);
+
+        if (NT_SUCCESS(status)) {
+            WdfRequestSetInformation(Request, pTopOpeners->Size);
+        }
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_GET_IDENTITY_POOL_STATS
+
+    case IOCTL_HIDGUARDIAN_GET_IDENTITY_POOL_STATS:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_IDENTITY_POOL_STATS");
+
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_IDENTITY_POOL_STATS),
+            (void*)&pPoolStats,
+            NULL);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        IdentityPoolReadStats(pPoolStats);
+
+        WdfRequestSetInformation(Request, sizeof(HIDGUARDIAN_IDENTITY_POOL_STATS));
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_GET_DEVICE_ADD_STATS
+
+    case IOCTL_HIDGUARDIAN_GET_DEVICE_ADD_STATS:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_DEVICE_ADD_STATS");
+
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_DEVICE_ADD_STATS),
+            (void*)&pAddStats,
+            NULL);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        LatencyReadDeviceAddStats(pAddStats);
+
+        WdfRequestSetInformation(Request, sizeof(HIDGUARDIAN_DEVICE_ADD_STATS));
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_GET_DEVICES
+
+    case IOCTL_HIDGUARDIAN_GET_DEVICES:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_DEVICES");
+
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_DEVICE_LIST),
+            (void*)&pDeviceList,
+            &bufferLength);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        status = HidGuardianWriteDeviceList(
+            pDeviceList,
+            (bufferLength > MAXULONG) ? MAXULONG : (ULONG)bufferLength);
+
+        //
+        // On overflow only the header (with the required size) is valid
+        // 
+        if (status == STATUS_BUFFER_OVERFLOW) {
+            WdfRequestSetInformation(Request, sizeof(HIDGUARDIAN_DEVICE_LIST));
+        }
+        else if (NT_SUCCESS(status)) {
+            WdfRequestSetInformation(Request, pDeviceList->Size);
+        }
+
+        break;
+
+#pragma endregion
+
+#pragma region IOCTL_HIDGUARDIAN_GET_DISCONNECT_STATS
+
+    case IOCTL_HIDGUARDIAN_GET_DISCONNECT_STATS:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND, ">> IOCTL_HIDGUARDIAN_GET_DISCONNECT_STATS");
+
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(HIDGUARDIAN_DISCONNECT_STATS),
+            (void*)&pDisconnectStats,
+            NULL);
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+
+            break;
+        }
+
+        LatencyReadDisconnectStats(pDisconnectStats);
+
+        WdfRequestSetInformation(Request, sizeof(HIDGUARDIAN_DISCONNECT_STATS));
+
+        break;
+
+#pragma endregion
+    }
+
+    if (status != STATUS_PENDING) {
+        WdfRequestComplete(Request, status);
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_SIDEBAND, "%!FUNC! Exit");
+}
+#pragma warning(pop) // enable 28118 again
+
+//
+// Gets called when somebody connects to the control device.
+// 
+_Use_decl_annotations_
+VOID
+HidGuardianSidebandDeviceFileCreate(
+    WDFDEVICE  Device,
+    WDFREQUEST  Request,
+    WDFFILEOBJECT  FileObject
+)
+{
+    PCONTROL_DEVICE_CONTEXT pControlCtx;
+
+    UNREFERENCED_PARAMETER(Device);
+    UNREFERENCED_PARAMETER(FileObject);
+
+    PAGED_CODE();
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_SIDEBAND, "%!FUNC! Entry");
+
+    pControlCtx = ControlDeviceGetContext(ControlDevice);
+
+    pControlCtx->CerberusPid = CURRENT_PROCESS_ID();
+    pControlCtx->IsCerberusConnected = TRUE;
+
+    //
+    // Back within the grace window, everything held is still valid
+    // 
+    if (InterlockedExchange(&pControlCtx->IsInReconnectGrace, 0)) {
+        WdfTimerStop(pControlCtx->ReconnectGraceTimer, FALSE);
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND,
+            "Cerberus (PID %d) reconnected within grace window",
+            pControlCtx->CerberusPid);
+    }
+
+    WdfRequestComplete(Request, STATUS_SUCCESS);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_SIDEBAND, "%!FUNC! Exit");
+}
+
+//
+// Gets called when somebody disconnects from the control device.
+// 
+_Use_decl_annotations_
+VOID
+HidGuardianSidebandFileCleanup(
+    WDFFILEOBJECT  FileObject
+)
+{
+    PCONTROL_DEVICE_CONTEXT     pControlCtx;
+    ULONGLONG                   start = LatencyTimestamp();
+    WDFDEVICE                   device;
+    ULONG                       i;
+
+    UNREFERENCED_PARAMETER(FileObject);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_SIDEBAND, "%!FUNC! Entry");
+
+    pControlCtx = ControlDeviceGetContext(ControlDevice);
+
+    if (GuardianConfig.ReconnectGraceSeconds > 0)
+    {
+        //
+        // Keep whitelist and held requests, give Cerberus some time
+        // to come back (e.g. service restart or upgrade)
+        // 
+        // The expiry of an earlier window may still be resolving what it
+        // took over; let it finish before holding requests again.
+        // 
+        WdfTimerStop(pControlCtx->ReconnectGraceTimer, TRUE);
+
+        InterlockedExchange(&pControlCtx->IsInReconnectGrace, 1);
+        pControlCtx->IsCerberusConnected = FALSE;
+
+        for (i = 0; i < DeviceRegistryBound(); i++)
+        {
+            device = DeviceRegistryAcquire(i);
+            if (device == NULL) {
+                continue;
+            }
+
+            HidGuardianHoldPendingRequests(DeviceGetContext(device));
+
+            DeviceRegistryRelease(i);
+        }
+
+        WdfTimerStart(pControlCtx->ReconnectGraceTimer,
+            WDF_REL_TIMEOUT_IN_SEC(GuardianConfig.ReconnectGraceSeconds));
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_SIDEBAND,
+            "Cerberus disconnected, waiting %d seconds for reconnect",
+            GuardianConfig.ReconnectGraceSeconds);
+    }
+    else
+    {
+        pControlCtx->IsCerberusConnected = FALSE;
+
+        //
+        // Whitelist is only valid for the lifetime of the connection
+        // 
+        WdfWaitLockAcquire(pControlCtx->SystemPidSetWriteLock, NULL);
+        HidGuardianPublishSystemPidSet(pControlCtx, NULL);
+        WdfWaitLockRelease(pControlCtx->SystemPidSetWriteLock);
+
+        HidGuardianResolveAllPendingRequests(start);
+    }
+
+    WdfIoQueuePurgeSynchronously(pControlCtx->DeviceArrivalNotificationQueue);
+    WdfIoQueueStart(pControlCtx->DeviceArrivalNotificationQueue);
+
+    WdfIoQueuePurgeSynchronously(pControlCtx->DeviceChangesQueue);
+    WdfIoQueueStart(pControlCtx->DeviceChangesQueue);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_SIDEBAND, "%!FUNC! Exit");
+}
+
+//
+// Frees resources bound to the control device.
+// 
+_Use_decl_annotations_
+VOID
+HidGuardianSidebandDeviceContextCleanup(
+    WDFOBJECT Object
+)
+{
+    PCONTROL_DEVICE_CONTEXT     pControlCtx;
+
+    PAGED_CODE();
+
+    pControlCtx = ControlDeviceGetContext(Object);
+
+    PID_SET_DESTROY(&pControlCtx->SystemPidSet);
+}
+
+//
+// Cerberus didn't reconnect in time, drop whatever was kept for it.
+// 
+_Use_decl_annotations_
+VOID
+HidGuardianSidebandReconnectGraceExpired(
+    WDFTIMER Timer
+)
+{
+    PCONTROL_DEVICE_CONTEXT     pControlCtx;
+    ULONGLONG                   start = LatencyTimestamp();
+
+    PAGED_CODE();
+
+    pControlCtx = ControlDeviceGetContext(WdfTimerGetParentObject(Timer));
+
+    //
+    // Whoever clears the grace flag owns the held state: a reconnect
+    // (which just stops the timer), the delete path, or this callback.
+    // Nothing here waits on a lock the other paths hold while stopping
+    // or deleting the timer.
+    // 
+    if (!InterlockedExchange(&pControlCtx->IsInReconnectGrace, 0)) {
+        return;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_SIDEBAND,
+        "Reconnect grace window expired, purging held state");
+
+    WdfWaitLockAcquire(pControlCtx->SystemPidSetWriteLock, NULL);
+    HidGuardianPublishSystemPidSet(pControlCtx, NULL);
+    WdfWaitLockRelease(pControlCtx->SystemPidSetWriteLock);
+
+    HidGuardianResolveAllPendingRequests(start);
+}
+
+//
+// Replaces the current system PID set and frees the old one.
+// 
+// Caller must hold SystemPidSetWriteLock.
+// 
+static VOID
+HidGuardianPublishSystemPidSet(
+    PCONTROL_DEVICE_CONTEXT ControlContext,
+    PPID_SET Set
+)
+{
+    KIRQL       oldIrql;
+    PPID_SET    oldSet;
+
+    oldIrql = ExAcquireSpinLockExclusive(&ControlContext->SystemPidSetLock);
+    oldSet = ControlContext->SystemPidSet;
+    ControlContext->SystemPidSet = Set;
+    ExReleaseSpinLockExclusive(&ControlContext->SystemPidSetLock, oldIrql);
+
+    //
+    // Readers only touch the set while holding the lock shared,
+    // so nobody can still be looking at the old one
+    // 
+    PID_SET_DESTROY(&oldSet);
+}
+
+//
+// Checks if the supplied PID is a whitelisted system process.
+// 
+_Use_decl_annotations_
+BOOLEAN
+HidGuardianIsSystemPid(
+    ULONG Pid
+)
+{
+    PCONTROL_DEVICE_CONTEXT     pControlCtx;
+    KIRQL                       oldIrql;
+    BOOLEAN                     found;
+
+    if (ControlDevice == NULL) {
+        return FALSE;
+    }
+
+    pControlCtx = ControlDeviceGetContext(ControlDevice);
+
+    oldIrql = ExAcquireSpinLockShared(&pControlCtx->SystemPidSetLock);
+    found = PID_SET_CONTAINS(pControlCtx->SystemPidSet, Pid);
+    ExReleaseSpinLockShared(&pControlCtx->SystemPidSetLock, oldIrql);
+
+    return found;
+}
+
+//
+// Serializes system PIDs and all device caches into a snapshot.
+// 
+// Returns STATUS_BUFFER_OVERFLOW with Snapshot->Size set to the required
+// size if the buffer is too small. Each device cache is copied under its
+// own lock, so every record is consistent in itself.
+// 
+static NTSTATUS
+HidGuardianWriteVerdictSnapshot(
+    PCONTROL_DEVICE_CONTEXT ControlContext,
+    PHIDGUARDIAN_VERDICT_SNAPSHOT Snapshot,
+    ULONG BufferLength
+)
+{
+    PUCHAR          pBuffer = (PUCHAR)Snapshot;
+    ULONG64         required = sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT);
+    WDFDEVICE       device;
+    LARGE_INTEGER   timestamp;
+    ULONG           pidCount = 0;
+    ULONG           deviceCount = 0;
+    ULONG           i;
+
+    KeQuerySystemTime(&timestamp);
+
+    //
+    // Holding the write lock keeps the set from being replaced
+    // 
+    WdfWaitLockAcquire(ControlContext->SystemPidSetWriteLock, NULL);
+
+    if (ControlContext->SystemPidSet != NULL) {
+        pidCount = ControlContext->SystemPidSet->Count;
+
+        if (required + pidCount * sizeof(ULONG) <= BufferLength) {
+            RtlCopyMemory(pBuffer + required, ControlContext->SystemPidSet->Pids, pidCount * sizeof(ULONG));
+        }
+    }
+
+    required += pidCount * sizeof(ULONG);
+
+    WdfWaitLockRelease(ControlContext->SystemPidSetWriteLock);
+
+    //
+    // Records are keyed by Device and Instance ID; a device whose IDs
+    // can't be looked up is left out
+    // 
+    DeviceIdentityEnsureAll();
+
+    for (i = 0; i < DeviceRegistryBound(); i++)
+    {
+        device = DeviceRegistryAcquire(i);
+        if (device == NULL) {
+            continue;
+        }
+
+        if (ReadAcquire(&DeviceGetContext(device)->IdentityReady))
+        {
+            required += StickyCacheExport(
+                DeviceGetContext(device),
+                (required < BufferLength) ? pBuffer + required : NULL,
+                (required < BufferLength) ? BufferLength - (ULONG)required : 0
+            );
+
+            deviceCount++;
+        }
+
+        DeviceRegistryRelease(i);
+    }
+
+    if (required > MAXULONG) {
+        return STATUS_INTEGER_OVERFLOW;
+    }
+
+    Snapshot->Size = (ULONG)required;
+    Snapshot->Version = HIDGUARDIAN_VERDICT_SNAPSHOT_VERSION;
+    Snapshot->Flags = 0;
+    Snapshot->SystemPidCount = pidCount;
+    Snapshot->DeviceCount = deviceCount;
+    Snapshot->Reserved = 0;
+    Snapshot->Timestamp = (ULONG64)timestamp.QuadPart;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_SIDEBAND,
+        "Snapshot of %d system PIDs and %d devices needs %d bytes (buffer: %d)",
+        pidCount, deviceCount, (ULONG)required, BufferLength);
+
+    return (required > BufferLength) ? STATUS_BUFFER_OVERFLOW : STATUS_SUCCESS;
+}
+
+//
+// Re-seeds system PIDs and device caches from a snapshot.
+// 
+// The whole packet is validated before anything gets applied. Records
+// of devices not present (anymore) are skipped.
+// 
+static NTSTATUS
+HidGuardianRestoreVerdictSnapshot(
+    PCONTROL_DEVICE_CONTEXT ControlContext,
+    PHIDGUARDIAN_VERDICT_SNAPSHOT Snapshot,
+    size_t BufferLength
+)
+{
+    PUCHAR                                  pBuffer = (PUCHAR)Snapshot;
+    PHIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE    pRecord;
+    PCWSTR                                  pDeviceId;
+    PCWSTR                                  pInstanceId;
+    WDFDEVICE                               device;
+    PDEVICE_CONTEXT                         pDeviceCtx;
+    BOOLEAN                                 matched;
+    PPID_SET                                pNewPidSet;
+    size_t                                  offset;
+    ULONG64                                 recordSize;
+    ULONG64                                 elapsed;
+    LARGE_INTEGER                           now;
+    ULONG                                   restored = 0;
+    ULONG                                   d, i;
+
+    if (Snapshot->Size != BufferLength
+        || Snapshot->Version != HIDGUARDIAN_VERDICT_SNAPSHOT_VERSION
+        || (Snapshot->Flags & ~HIDGUARDIAN_SYSTEM_PIDS_MERGE) != 0
+        || Snapshot->Reserved != 0
+        || Snapshot->SystemPidCount > PID_SET_MAX_COUNT)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_SIDEBAND,
+            "Invalid snapshot header (size %d, version %d, flags 0x%X)",
+            Snapshot->Size, Snapshot->Version, Snapshot->Flags);
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // Walk all records once to make sure they're well-formed
+    // 
+    offset = sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT) + Snapshot->SystemPidCount * sizeof(ULONG);
+
+    for (d = 0; d < Snapshot->DeviceCount; d++)
+    {
+        if (offset > BufferLength
+            || BufferLength - offset < sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE))
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        pRecord = (PHIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE)(pBuffer + offset);
+
+        recordSize = sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE)
+            + ((ULONG64)pRecord->DeviceIdLength + pRecord->InstanceIdLength) * sizeof(WCHAR)
+            + (ULONG64)pRecord->EntryCount * sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT_ENTRY);
+
+        if (pRecord->Size != recordSize
+            || recordSize > BufferLength - offset
+            || pRecord->DeviceIdLength >= MAX_DEVICE_ID_SIZE
+            || pRecord->InstanceIdLength >= MAX_INSTANCE_ID_SIZE)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "Invalid snapshot record %d at offset %d", d, (ULONG)offset);
+
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        offset += pRecord->Size;
+    }
+
+    if (offset != BufferLength) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // Verdicts age while the snapshot is stored; a clock set back since
+    // doesn't make them any younger than they were
+    // 
+    KeQuerySystemTime(&now);
+
+    elapsed = ((ULONG64)now.QuadPart > Snapshot->Timestamp) ? (ULONG64)now.QuadPart - Snapshot->Timestamp : 0;
+
+    //
+    // System PIDs
+    // 
+    WdfWaitLockAcquire(ControlContext->SystemPidSetWriteLock, NULL);
+
+    pNewPidSet = PID_SET_MERGE(
+        (Snapshot->Flags & HIDGUARDIAN_SYSTEM_PIDS_MERGE) ? ControlContext->SystemPidSet : NULL,
+        (PULONG)(Snapshot + 1),
+        Snapshot->SystemPidCount
+    );
+
+    if (pNewPidSet != NULL) {
+        HidGuardianPublishSystemPidSet(ControlContext, pNewPidSet);
+    }
+
+    WdfWaitLockRelease(ControlContext->SystemPidSetWriteLock);
+
+    if (pNewPidSet == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    //
+    // Device caches, matched by Device and Instance ID; those get looked
+    // up once per device here, so matching only has to compare them
+    // 
+    DeviceIdentityEnsureAll();
+
+    offset = sizeof(HIDGUARDIAN_VERDICT_SNAPSHOT) + Snapshot->SystemPidCount * sizeof(ULONG);
+
+    for (d = 0; d < Snapshot->DeviceCount; d++)
+    {
+        pRecord = (PHIDGUARDIAN_VERDICT_SNAPSHOT_DEVICE)(pBuffer + offset);
+        pDeviceId = (PCWSTR)(pRecord + 1);
+        pInstanceId = pDeviceId + pRecord->DeviceIdLength;
+
+        for (i = 0; i < DeviceRegistryBound(); i++)
+        {
+            device = DeviceRegistryAcquire(i);
+            if (device == NULL) {
+                continue;
+            }
+
+            pDeviceCtx = DeviceGetContext(device);
+
+            matched = ReadAcquire(&pDeviceCtx->IdentityReady)
+                && wcslen(pDeviceCtx->Identity->DeviceID) == pRecord->DeviceIdLength
+                && wcslen(pDeviceCtx->Identity->InstanceID) == pRecord->InstanceIdLength
+                && RtlCompareMemory(pDeviceCtx->Identity->DeviceID, pDeviceId,
+                    pRecord->DeviceIdLength * sizeof(WCHAR)) == pRecord->DeviceIdLength * sizeof(WCHAR)
+                && RtlCompareMemory(pDeviceCtx->Identity->InstanceID, pInstanceId,
+                    pRecord->InstanceIdLength * sizeof(WCHAR)) == pRecord->InstanceIdLength * sizeof(WCHAR);
+
+            if (matched)
+            {
+                //
+                // Verdicts need a cache to go to, so restoring counts as use
+                // 
+                if (pRecord->EntryCount > 0 && NT_SUCCESS(DeviceGuardAcquire(device)))
+                {
+                    StickyCacheImport(
+                        pDeviceCtx,
+                        (PHIDGUARDIAN_VERDICT_SNAPSHOT_ENTRY)(pInstanceId + pRecord->InstanceIdLength),
+                        pRecord->EntryCount,
+                        elapsed
+                    );
+
+                    DeviceGuardRelease(pDeviceCtx);
+                }
+
+                restored++;
+            }
+
+            DeviceRegistryRelease(i);
+
+            if (matched) {
+                break;
+            }
+        }
+
+        offset += pRecord->Size;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_SIDEBAND,
+        "Restored %d system PIDs and %d of %d device records",
+        pNewPidSet->Count, restored, Snapshot->DeviceCount);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Reports the request path counters of every guarded device.
+// 
+// The totals are always filled in; per-device entries follow the header
+// for as many devices as fit into the buffer, so a header-sized buffer
+// is enough for a cheap scrape of the totals.
+// 
+static VOID
+HidGuardianWritePerfCounters(
+    PHIDGUARDIAN_PERF_COUNTERS Counters,
+    ULONG BufferLength
+)
+{
+    PHIDGUARDIAN_DEVICE_COUNTERS_ENTRY  pEntries = (PHIDGUARDIAN_DEVICE_COUNTERS_ENTRY)(Counters + 1);
+    HIDGUARDIAN_DEVICE_COUNTERS         device;
+    WDFDEVICE                           filterDevice;
+    PDEVICE_CONTEXT                     pDeviceCtx;
+    PULONG64                            pTotals = (PULONG64)&Counters->Totals;
+    PULONG64                            pValues = (PULONG64)&device;
+    ULONG64                             pendingHighWater = 0;
+    ULONG64                             authHighWater = 0;
+    ULONG                               memoryUsage;
+    ULONG                               capacity;
+    ULONG                               i, k;
+
+    capacity = (BufferLength - sizeof(HIDGUARDIAN_PERF_COUNTERS)) / sizeof(HIDGUARDIAN_DEVICE_COUNTERS_ENTRY);
+
+    RtlZeroMemory(Counters, sizeof(HIDGUARDIAN_PERF_COUNTERS));
+
+    for (i = 0; i < DeviceRegistryBound(); i++)
+    {
+        filterDevice = DeviceRegistryAcquire(i);
+        if (filterDevice == NULL) {
+            continue;
+        }
+
+        pDeviceCtx = DeviceGetContext(filterDevice);
+
+        memoryUsage = DeviceMemoryUsage(pDeviceCtx);
+        Counters->MemoryUsage += memoryUsage;
+
+        //
+        // The master device never sees guarded requests
+        // 
+        if (!pDeviceCtx->IsGuarded) {
+            DeviceRegistryRelease(i);
+            continue;
+        }
+
+        DeviceCountersRead(pDeviceCtx, &device);
+
+        for (k = 0; k < DEVICE_COUNTER_COUNT; k++) {
+            pTotals[k] += pValues[k];
+        }
+
+        //
+        // High-water marks don't add up across devices
+        // 
+        pendingHighWater = max(pendingHighWater, device.PendingHighWater);
+        authHighWater = max(authHighWater, device.AuthHighWater);
+
+        Counters->DeviceCount++;
+
+        if (Counters->EntryCount < capacity) {
+            pEntries[Counters->EntryCount].DeviceHash = pDeviceCtx->DeviceHash;
+            pEntries[Counters->EntryCount].MemoryUsage = memoryUsage;
+            pEntries[Counters->EntryCount].Counters = device;
+            Counters->EntryCount++;
+        }
+
+        DeviceRegistryRelease(i);
+    }
+
+    Counters->Totals.PendingHighWater = pendingHighWater;
+    Counters->Totals.AuthHighWater = authHighWater;
+
+    Counters->Size = sizeof(HIDGUARDIAN_PERF_COUNTERS)
+        + Counters->EntryCount * sizeof(HIDGUARDIAN_DEVICE_COUNTERS_ENTRY);
+}
+
+//
+// Lists every filtered device (the master included) in
+// one pass over the device registry.
+// 
+static NTSTATUS
+HidGuardianWriteDeviceList(
+    PHIDGUARDIAN_DEVICE_LIST List,
+    ULONG BufferLength
+)
+{
+    PUCHAR      pBuffer = (PUCHAR)List;
+    ULONG64     required = sizeof(HIDGUARDIAN_DEVICE_LIST);
+    WDFDEVICE   device;
+    ULONG       deviceCount = 0;
+    ULONG       i;
+
+    //
+    // A device whose IDs can't be looked up is left out, it shows up as
+    // an arrival once they can
+    // 
+    DeviceIdentityEnsureAll();
+
+    for (i = 0; i < DeviceRegistryBound(); i++)
+    {
+        device = DeviceRegistryAcquire(i);
+        if (device == NULL) {
+            continue;
+        }
+
+        if (ReadAcquire(&DeviceGetContext(device)->IdentityReady))
+        {
+            required += DeviceInfoExport(
+                DeviceGetContext(device),
+                (required < BufferLength) ? pBuffer + required : NULL,
+                (required < BufferLength) ? BufferLength - (ULONG)required : 0
+            );
+
+            deviceCount++;
+        }
+
+        DeviceRegistryRelease(i);
+    }
+
+    if (required > MAXULONG) {
+        return STATUS_INTEGER_OVERFLOW;
+    }
+
+    List->Size = (ULONG)required;
+    List->Version = HIDGUARDIAN_DEVICE_LIST_VERSION;
+    List->DeviceCount = deviceCount;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_SIDEBAND,
+        "List of %d devices needs %d bytes (buffer: %d)",
+        deviceCount, (ULONG)required, BufferLength);
+
+    return (required > BufferLength) ? STATUS_BUFFER_OVERFLOW : STATUS_SUCCESS;
+}
+
+//
+// Has every device resolve the requests that were waiting for Cerberus,
+// in parallel. The registry is walked without a lock, so this doesn't
+// hold up the control device deletion that waits for the grace timer.
+// 
+static VOID
+HidGuardianResolveAllPendingRequests(
+    ULONGLONG StartTimestamp
+)
+{
+    WDFDEVICE   device;
+    ULONG       queued = 0;
+    ULONG       i;
+
+    LatencyDisconnectBegin(StartTimestamp);
+
+    for (i = 0; i < DeviceRegistryBound(); i++)
+    {
+        device = DeviceRegistryAcquire(i);
+        if (device == NULL) {
+            continue;
+        }
+
+        if (HidGuardianResolvePendingRequests(DeviceGetContext(device))) {
+            queued++;
+        }
+
+        DeviceRegistryRelease(i);
+    }
+
+    LatencyDisconnectEnd(0, 0);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_SIDEBAND,
+        "Resolving pending requests on %d devices", queued);
+}
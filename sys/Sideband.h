@@ -43,15 +43,40 @@ typedef struct _CONTROL_DEVICE_CONTEXT
     BOOLEAN         IsCerberusConnected;
 
     //
-    // List if privileged processes who will never get blocked
+    // Set of privileged processes who will never get blocked
     //
-    PPID_LIST_NODE  SystemPidList;
+    PPID_SET        SystemPidSet;
+
+    //
+    // Guards reads and the swap of SystemPidSet
+    //
+    EX_SPIN_LOCK    SystemPidSetLock;
+
+    //
+    // Serializes builders of a new SystemPidSet
+    //
+    WDFWAITLOCK     SystemPidSetWriteLock;
 
     //
     // Queue for pending arrivals of guarded devices
     // 
     WDFQUEUE        DeviceArrivalNotificationQueue;
 
+    //
+    // Arrival notifications waiting for a batch of device changes
+    // 
+    WDFQUEUE        DeviceChangesQueue;
+
+    //
+    // Non-zero while waiting for Cerberus to reconnect
+    // 
+    volatile LONG   IsInReconnectGrace;
+
+    //
+    // Fires when the reconnect grace window ran out
+    // 
+    WDFTIMER        ReconnectGraceTimer;
+
 } CONTROL_DEVICE_CONTEXT, *PCONTROL_DEVICE_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(CONTROL_DEVICE_CONTEXT, ControlDeviceGetContext)
@@ -60,6 +85,8 @@ WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(CONTROL_DEVICE_CONTEXT, ControlDeviceGetConte
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL HidGuardianSidebandIoDeviceControl;
 EVT_WDF_DEVICE_FILE_CREATE HidGuardianSidebandDeviceFileCreate;
 EVT_WDF_FILE_CLEANUP HidGuardianSidebandFileCleanup;
+EVT_WDF_OBJECT_CONTEXT_CLEANUP HidGuardianSidebandDeviceContextCleanup;
+EVT_WDF_TIMER HidGuardianSidebandReconnectGraceExpired;
 
 _Must_inspect_result_
 _Success_(return == STATUS_SUCCESS)
@@ -74,3 +101,9 @@ VOID
 HidGuardianDeleteControlDevice(
     WDFDEVICE Device
 );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+HidGuardianIsSystemPid(
+    ULONG Pid
+);
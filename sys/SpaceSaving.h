@@ -0,0 +1,305 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#define SPACE_SAVING_TAG                'SSGH'
+
+#define SPACE_SAVING_DEFAULT_CAPACITY   64
+#define SPACE_SAVING_MAX_CAPACITY       0x1000
+
+#ifndef _KERNEL_MODE
+#include <stdlib.h>
+#endif
+
+//
+// A monitored key and how often it has been seen
+//
+typedef struct _SPACE_SAVING_COUNTER
+{
+    ULONG Key;
+
+    //
+    // Position in the min-heap
+    //
+    ULONG HeapIndex;
+
+    //
+    // Upper bound of the occurrences of Key
+    //
+    ULONG64 Count;
+
+    //
+    // Overestimation inherited from the evicted key, Count - Error is a
+    // lower bound of the occurrences
+    //
+    ULONG64 Error;
+
+    //
+    // Hash bucket chain
+    //
+    struct _SPACE_SAVING_COUNTER* HashNext;
+
+} SPACE_SAVING_COUNTER, *PSPACE_SAVING_COUNTER;
+
+typedef PSPACE_SAVING_COUNTER *PPSPACE_SAVING_COUNTER;
+
+//
+// Space-Saving heavy hitters sketch (Metwally et al.) over ULONG keys.
+// Capacity counters monitor the most frequent keys seen; a key not being
+// monitored takes over the counter with the smallest count and inherits
+// that count as its error. Every key occurring more than Total / Capacity
+// times is guaranteed to be monitored. Memory is fixed at creation and
+// every update is O(log Capacity), so it can sit in the create path with
+// a spin lock held.
+//
+// Not synchronized; callers serialize access.
+//
+typedef struct _SPACE_SAVING
+{
+    ULONG Capacity;
+
+    //
+    // Counters in use
+    //
+    ULONG Used;
+
+    ULONG BucketShift;
+
+    ULONG BucketMask;
+
+    //
+    // Updates since creation or the last reset
+    //
+    ULONG64 Total;
+
+    PSPACE_SAVING_COUNTER* Buckets;
+
+    //
+    // Counters ordered as a min-heap by Count
+    //
+    PSPACE_SAVING_COUNTER* Heap;
+
+    //
+    // Scratch space for SPACE_SAVING_SORT
+    //
+    PSPACE_SAVING_COUNTER* Sorted;
+
+    PSPACE_SAVING_COUNTER Counters;
+
+} SPACE_SAVING, *PSPACE_SAVING;
+
+ULONG FORCEINLINE SPACE_SAVING_HASH(PSPACE_SAVING sketch, ULONG key)
+{
+    //
+    // PIDs are multiples of four, drop the constant bits before mixing
+    // and take the well-mixed upper bits
+    //
+    return ((ULONG)((key >> 2) * 0x9E3779B1) >> sketch->BucketShift) & sketch->BucketMask;
+}
+
+PSPACE_SAVING FORCEINLINE SPACE_SAVING_CREATE(ULONG capacity)
+{
+    PSPACE_SAVING sketch;
+    ULONG buckets = 2;
+    ULONG bits = 1;
+    size_t size;
+
+    if (capacity == 0 || capacity > SPACE_SAVING_MAX_CAPACITY)
+        return NULL;
+
+    while (buckets < capacity) {
+        buckets <<= 1;
+        bits++;
+    }
+
+    size = sizeof(SPACE_SAVING)
+        + sizeof(SPACE_SAVING_COUNTER) * capacity
+        + sizeof(PSPACE_SAVING_COUNTER) * (buckets + 2 * (size_t)capacity);
+
+#ifdef _KERNEL_MODE
+    sketch = ExAllocatePoolWithTag(NonPagedPool, size, SPACE_SAVING_TAG);
+#else
+    sketch = (PSPACE_SAVING)malloc(size);
+#endif
+
+    if (sketch == NULL) {
+        return sketch;
+    }
+
+    RtlZeroMemory(sketch, size);
+
+    sketch->Capacity = capacity;
+    sketch->BucketShift = 32 - bits;
+    sketch->BucketMask = buckets - 1;
+    sketch->Counters = (PSPACE_SAVING_COUNTER)(sketch + 1);
+    sketch->Buckets = (PSPACE_SAVING_COUNTER*)(sketch->Counters + capacity);
+    sketch->Heap = sketch->Buckets + buckets;
+    sketch->Sorted = sketch->Heap + capacity;
+
+    return sketch;
+}
+
+VOID FORCEINLINE SPACE_SAVING_DESTROY(SPACE_SAVING ** sketch)
+{
+    if (*sketch == NULL)
+        return;
+
+#ifdef _KERNEL_MODE
+    ExFreePoolWithTag(*sketch, SPACE_SAVING_TAG);
+#else
+    free(*sketch);
+#endif
+
+    *sketch = NULL;
+}
+
+VOID FORCEINLINE SPACE_SAVING_RESET(PSPACE_SAVING sketch)
+{
+    RtlZeroMemory(sketch->Buckets, sizeof(PSPACE_SAVING_COUNTER) * (sketch->BucketMask + 1));
+
+    sketch->Used = 0;
+    sketch->Total = 0;
+}
+
+VOID FORCEINLINE SPACE_SAVING_HEAP_SET(PSPACE_SAVING sketch, ULONG index, PSPACE_SAVING_COUNTER counter)
+{
+    sketch->Heap[index] = counter;
+    counter->HeapIndex = index;
+}
+
+//
+// Moves a counter whose count grew towards the bottom of the heap
+//
+VOID FORCEINLINE SPACE_SAVING_SIFT_DOWN(PSPACE_SAVING sketch, PSPACE_SAVING_COUNTER counter)
+{
+    ULONG index = counter->HeapIndex;
+    ULONG child;
+
+    for (;;) {
+        child = 2 * index + 1;
+
+        if (child >= sketch->Used)
+            break;
+
+        if (child + 1 < sketch->Used && sketch->Heap[child + 1]->Count < sketch->Heap[child]->Count)
+            child++;
+
+        if (sketch->Heap[child]->Count >= counter->Count)
+            break;
+
+        SPACE_SAVING_HEAP_SET(sketch, index, sketch->Heap[child]);
+        index = child;
+    }
+
+    SPACE_SAVING_HEAP_SET(sketch, index, counter);
+}
+
+VOID FORCEINLINE SPACE_SAVING_UNLINK(PSPACE_SAVING sketch, PSPACE_SAVING_COUNTER counter)
+{
+    PSPACE_SAVING_COUNTER* link = &sketch->Buckets[SPACE_SAVING_HASH(sketch, counter->Key)];
+
+    while (*link != counter)
+        link = &(*link)->HashNext;
+
+    *link = counter->HashNext;
+}
+
+VOID FORCEINLINE SPACE_SAVING_LINK(PSPACE_SAVING sketch, PSPACE_SAVING_COUNTER counter)
+{
+    ULONG bucket = SPACE_SAVING_HASH(sketch, counter->Key);
+
+    counter->HashNext = sketch->Buckets[bucket];
+    sketch->Buckets[bucket] = counter;
+}
+
+//
+// Counts one occurrence of key
+//
+VOID FORCEINLINE SPACE_SAVING_UPDATE(PSPACE_SAVING sketch, ULONG key)
+{
+    PSPACE_SAVING_COUNTER counter;
+
+    sketch->Total++;
+
+    for (counter = sketch->Buckets[SPACE_SAVING_HASH(sketch, key)]; counter != NULL; counter = counter->HashNext) {
+        if (counter->Key == key) {
+            counter->Count++;
+            SPACE_SAVING_SIFT_DOWN(sketch, counter);
+            return;
+        }
+    }
+
+    if (sketch->Used < sketch->Capacity) {
+        //
+        // A new counter of count 1 is a valid heap leaf as is
+        //
+        counter = &sketch->Counters[sketch->Used];
+        counter->Key = key;
+        counter->Count = 1;
+        counter->Error = 0;
+
+        SPACE_SAVING_LINK(sketch, counter);
+        SPACE_SAVING_HEAP_SET(sketch, sketch->Used++, counter);
+        return;
+    }
+
+    //
+    // Take over the least frequent key's counter
+    //
+    counter = sketch->Heap[0];
+
+    SPACE_SAVING_UNLINK(sketch, counter);
+
+    counter->Key = key;
+    counter->Error = counter->Count;
+    counter->Count++;
+
+    SPACE_SAVING_LINK(sketch, counter);
+    SPACE_SAVING_SIFT_DOWN(sketch, counter);
+}
+
+//
+// Returns the counters in use ordered by descending count, valid until
+// the next update
+//
+PPSPACE_SAVING_COUNTER FORCEINLINE SPACE_SAVING_SORT(PSPACE_SAVING sketch)
+{
+    PSPACE_SAVING_COUNTER counter;
+    ULONG i, k;
+
+    for (i = 0; i < sketch->Used; i++) {
+        counter = sketch->Heap[i];
+
+        for (k = i; k > 0 && sketch->Sorted[k - 1]->Count < counter->Count; k--)
+            sketch->Sorted[k] = sketch->Sorted[k - 1];
+
+        sketch->Sorted[k] = counter;
+    }
+
+    return sketch->Sorted;
+}
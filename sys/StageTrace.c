@@ -0,0 +1,206 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+
+#include "Driver.h"
+#include "StageTrace.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, StageTraceInitialize)
+#pragma alloc_text (PAGE, StageTraceUninitialize)
+#endif
+
+//
+// Stage timings of finished requests, NULL if recording is off
+// 
+static PRECORD_RING StageTraceRing = NULL;
+
+//
+// Serializes access to StageTraceRing
+// 
+static WDFSPINLOCK StageTraceLock = NULL;
+
+//
+// Allocates the record buffer if enabled in the configuration.
+// 
+_Use_decl_annotations_
+NTSTATUS
+StageTraceInitialize(
+    WDFDRIVER Driver
+)
+{
+    NTSTATUS                status;
+    WDF_OBJECT_ATTRIBUTES   attribs;
+
+    PAGED_CODE();
+
+    if (GuardianConfig.StageTraceCapacity == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = Driver;
+
+    status = WdfSpinLockCreate(&attribs, &StageTraceLock);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "WdfSpinLockCreate failed with status %!STATUS!", status);
+        return status;
+    }
+
+    StageTraceRing = RECORD_RING_CREATE(
+        GuardianConfig.StageTraceCapacity,
+        sizeof(HIDGUARDIAN_STAGE_RECORD)
+    );
+    if (StageTraceRing == NULL) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "RECORD_RING_CREATE failed");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DRIVER,
+        "Recording stage timings of up to %d requests", StageTraceRing->Capacity);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Frees the record buffer on driver unload.
+// 
+_Use_decl_annotations_
+VOID
+StageTraceUninitialize(
+    VOID
+)
+{
+    PAGED_CODE();
+
+    RECORD_RING_DESTROY(&StageTraceRing);
+}
+
+//
+// Appends the stage timings of a request about to be completed (or sent
+// down). The caller stamps HIDGUARDIAN_STAGE_COMPLETED beforehand.
+// 
+_Use_decl_annotations_
+VOID
+StageTraceRecord(
+    PDEVICE_CONTEXT DeviceContext,
+    PCREATE_REQUEST_CONTEXT RequestContext,
+    UCHAR Path,
+    BOOLEAN IsAllowed
+)
+{
+    PHIDGUARDIAN_STAGE_RECORD   pRecord;
+    ULONG                       offsets[HIDGUARDIAN_STAGE_COUNT];
+    ULONGLONG                   arrival;
+    UCHAR                       mask = 0;
+    ULONG                       i;
+
+    if (StageTraceRing == NULL) {
+        return;
+    }
+
+    arrival = RequestContext->StageTimes[HIDGUARDIAN_STAGE_ARRIVAL];
+
+    //
+    // Convert outside of the lock
+    // 
+    for (i = 0; i < HIDGUARDIAN_STAGE_COUNT; i++) {
+        if (RequestContext->StageTimes[i] != 0 && RequestContext->StageTimes[i] >= arrival) {
+            offsets[i] = (ULONG)min(LatencyTicks(RequestContext->StageTimes[i] - arrival), MAXULONG);
+            mask |= (UCHAR)(1 << i);
+        }
+        else {
+            offsets[i] = 0;
+        }
+    }
+
+    WdfSpinLockAcquire(StageTraceLock);
+
+    pRecord = RECORD_RING_PUSH(StageTraceRing);
+
+    pRecord->ArrivalTime = RequestContext->ArrivalTime;
+    pRecord->DeviceHash = DeviceContext->DeviceHash;
+    pRecord->ProcessId = RequestContext->ProcessId;
+    pRecord->RequestId = RequestContext->RequestId;
+    pRecord->Path = Path;
+    pRecord->IsAllowed = IsAllowed;
+    pRecord->StageMask = mask;
+    pRecord->Reserved = 0;
+    RtlCopyMemory(pRecord->StageOffsets, offsets, sizeof(offsets));
+
+    WdfSpinLockRelease(StageTraceLock);
+}
+
+//
+// Moves as many records as fit into the supplied buffer, oldest first.
+// 
+_Use_decl_annotations_
+NTSTATUS
+StageTraceDrain(
+    PHIDGUARDIAN_STAGE_TRACE Trace,
+    ULONG BufferLength
+)
+{
+    ULONG count;
+
+    if (StageTraceRing == NULL) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if (BufferLength < sizeof(HIDGUARDIAN_STAGE_TRACE)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    count = (BufferLength - sizeof(HIDGUARDIAN_STAGE_TRACE)) / sizeof(HIDGUARDIAN_STAGE_RECORD);
+
+    WdfSpinLockAcquire(StageTraceLock);
+
+    count = RECORD_RING_POP(StageTraceRing, Trace + 1, count);
+
+    Trace->DroppedCount = (ULONG)min(StageTraceRing->Dropped, MAXULONG);
+    Trace->RemainingCount = RECORD_RING_COUNT(StageTraceRing);
+    StageTraceRing->Dropped = 0;
+
+    WdfSpinLockRelease(StageTraceLock);
+
+    Trace->Size = sizeof(HIDGUARDIAN_STAGE_TRACE) + count * sizeof(HIDGUARDIAN_STAGE_RECORD);
+    Trace->Version = HIDGUARDIAN_STAGE_TRACE_VERSION;
+    Trace->RecordSize = sizeof(HIDGUARDIAN_STAGE_RECORD);
+    Trace->RecordCount = count;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE,
+        TRACE_DRIVER,
+        "Drained %d stage records (%d dropped, %d remaining)",
+        count, Trace->DroppedCount, Trace->RemainingCount);
+
+    return STATUS_SUCCESS;
+}
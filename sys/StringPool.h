@@ -0,0 +1,322 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#define STRING_POOL_TAG                 'PSGH'
+
+#define STRING_POOL_MIN_BUCKETS         16
+
+//
+// Average chain length that makes the pool double its buckets
+//
+#define STRING_POOL_MAX_LOAD            2
+
+#ifndef _KERNEL_MODE
+#include <stdlib.h>
+#endif
+
+//
+// One interned string, shared by every holder of an equal string
+//
+typedef struct _STRING_POOL_ENTRY
+{
+    //
+    // Hash bucket chain
+    //
+    struct _STRING_POOL_ENTRY* Next;
+
+    ULONG Hash;
+
+    //
+    // Holders of String, the entry goes away with the last one
+    //
+    ULONG References;
+
+    //
+    // Characters, the terminator excluded
+    //
+    ULONG Length;
+
+    WCHAR String[1];
+
+} STRING_POOL_ENTRY, *PSTRING_POOL_ENTRY;
+
+//
+// Reference counted, hash-consed pool of wide strings. Interning a
+// string returns the pooled copy of an equal string if there is one and
+// allocates a new entry otherwise; each intern is matched by a release
+// of the returned pointer. Buckets double once the average chain grows
+// beyond STRING_POOL_MAX_LOAD; if that allocation fails the pool keeps
+// working with longer chains.
+//
+// Not synchronized; callers serialize access.
+//
+typedef struct _STRING_POOL
+{
+    ULONG BucketMask;
+
+    //
+    // Distinct strings held
+    //
+    ULONG Strings;
+
+    //
+    // Outstanding interns over all strings
+    //
+    ULONG References;
+
+    ULONG Reserved;
+
+    //
+    // Bytes allocated for the pool, its buckets and its entries
+    //
+    ULONG64 PooledBytes;
+
+    //
+    // Bytes the outstanding interns would take as private copies
+    //
+    ULONG64 UnpooledBytes;
+
+    //
+    // Interns since creation and how many found an equal string
+    //
+    ULONG64 Interns;
+
+    ULONG64 Hits;
+
+    PSTRING_POOL_ENTRY* Buckets;
+
+} STRING_POOL, *PSTRING_POOL;
+
+ULONG FORCEINLINE STRING_POOL_HASH(const WCHAR* string, ULONG length)
+{
+    ULONG hash = 2166136261;
+    ULONG i;
+
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ string[i]) * 16777619;
+    }
+
+    return hash;
+}
+
+PVOID FORCEINLINE STRING_POOL_ALLOCATE(size_t size)
+{
+#ifdef _KERNEL_MODE
+    return ExAllocatePoolWithTag(NonPagedPool, size, STRING_POOL_TAG);
+#else
+    return malloc(size);
+#endif
+}
+
+VOID FORCEINLINE STRING_POOL_FREE(PVOID memory)
+{
+#ifdef _KERNEL_MODE
+    ExFreePoolWithTag(memory, STRING_POOL_TAG);
+#else
+    free(memory);
+#endif
+}
+
+size_t FORCEINLINE STRING_POOL_ENTRY_SIZE(ULONG length)
+{
+    return FIELD_OFFSET(STRING_POOL_ENTRY, String) + ((size_t)length + 1) * sizeof(WCHAR);
+}
+
+PSTRING_POOL FORCEINLINE STRING_POOL_CREATE(ULONG buckets)
+{
+    PSTRING_POOL pool;
+    ULONG count = STRING_POOL_MIN_BUCKETS;
+
+    while (count < buckets && count < 0x10000) {
+        count <<= 1;
+    }
+
+    pool = (PSTRING_POOL)STRING_POOL_ALLOCATE(sizeof(STRING_POOL));
+
+    if (pool == NULL) {
+        return pool;
+    }
+
+    RtlZeroMemory(pool, sizeof(STRING_POOL));
+
+    pool->Buckets = (PSTRING_POOL_ENTRY*)STRING_POOL_ALLOCATE(sizeof(PSTRING_POOL_ENTRY) * count);
+
+    if (pool->Buckets == NULL) {
+        STRING_POOL_FREE(pool);
+        return NULL;
+    }
+
+    RtlZeroMemory(pool->Buckets, sizeof(PSTRING_POOL_ENTRY) * count);
+
+    pool->BucketMask = count - 1;
+    pool->PooledBytes = sizeof(STRING_POOL) + sizeof(PSTRING_POOL_ENTRY) * count;
+
+    return pool;
+}
+
+//
+// Frees the pool along with any strings still interned
+//
+VOID FORCEINLINE STRING_POOL_DESTROY(STRING_POOL ** pool)
+{
+    PSTRING_POOL_ENTRY entry;
+    ULONG i;
+
+    if (*pool == NULL)
+        return;
+
+    for (i = 0; i <= (*pool)->BucketMask; i++) {
+        while ((entry = (*pool)->Buckets[i]) != NULL) {
+            (*pool)->Buckets[i] = entry->Next;
+            STRING_POOL_FREE(entry);
+        }
+    }
+
+    STRING_POOL_FREE((*pool)->Buckets);
+    STRING_POOL_FREE(*pool);
+
+    *pool = NULL;
+}
+
+//
+// Doubles the buckets, silently staying put if memory is short
+//
+VOID FORCEINLINE STRING_POOL_GROW(PSTRING_POOL pool)
+{
+    PSTRING_POOL_ENTRY* buckets;
+    PSTRING_POOL_ENTRY entry;
+    ULONG count = (pool->BucketMask + 1) * 2;
+    ULONG i;
+
+    buckets = (PSTRING_POOL_ENTRY*)STRING_POOL_ALLOCATE(sizeof(PSTRING_POOL_ENTRY) * count);
+
+    if (buckets == NULL) {
+        return;
+    }
+
+    RtlZeroMemory(buckets, sizeof(PSTRING_POOL_ENTRY) * count);
+
+    for (i = 0; i <= pool->BucketMask; i++) {
+        while ((entry = pool->Buckets[i]) != NULL) {
+            pool->Buckets[i] = entry->Next;
+            entry->Next = buckets[entry->Hash & (count - 1)];
+            buckets[entry->Hash & (count - 1)] = entry;
+        }
+    }
+
+    STRING_POOL_FREE(pool->Buckets);
+
+    pool->PooledBytes += sizeof(PSTRING_POOL_ENTRY) * (count - (pool->BucketMask + 1));
+    pool->Buckets = buckets;
+    pool->BucketMask = count - 1;
+}
+
+//
+// Returns the pooled copy of the length characters at string, a new
+// terminated copy if no equal string is pooled yet, NULL if that can't
+// be allocated
+//
+PCWSTR FORCEINLINE STRING_POOL_INTERN(PSTRING_POOL pool, const WCHAR* string, ULONG length)
+{
+    PSTRING_POOL_ENTRY entry;
+    ULONG hash = STRING_POOL_HASH(string, length);
+    size_t size = STRING_POOL_ENTRY_SIZE(length);
+
+    pool->Interns++;
+
+    for (entry = pool->Buckets[hash & pool->BucketMask]; entry != NULL; entry = entry->Next) {
+        if (entry->Hash == hash
+            && entry->Length == length
+            && RtlEqualMemory(entry->String, string, length * sizeof(WCHAR)))
+            break;
+    }
+
+    if (entry != NULL) {
+        pool->Hits++;
+    }
+    else {
+        entry = (PSTRING_POOL_ENTRY)STRING_POOL_ALLOCATE(size);
+
+        if (entry == NULL) {
+            return NULL;
+        }
+
+        entry->Hash = hash;
+        entry->References = 0;
+        entry->Length = length;
+        RtlCopyMemory(entry->String, string, length * sizeof(WCHAR));
+        entry->String[length] = L'\0';
+
+        entry->Next = pool->Buckets[hash & pool->BucketMask];
+        pool->Buckets[hash & pool->BucketMask] = entry;
+
+        pool->Strings++;
+        pool->PooledBytes += size;
+
+        if (pool->Strings > STRING_POOL_MAX_LOAD * (pool->BucketMask + 1)) {
+            STRING_POOL_GROW(pool);
+        }
+    }
+
+    entry->References++;
+
+    pool->References++;
+    pool->UnpooledBytes += ((size_t)length + 1) * sizeof(WCHAR);
+
+    return entry->String;
+}
+
+//
+// Drops a reference taken by STRING_POOL_INTERN, freeing the string
+// once nobody holds it anymore
+//
+VOID FORCEINLINE STRING_POOL_RELEASE(PSTRING_POOL pool, PCWSTR string)
+{
+    PSTRING_POOL_ENTRY entry;
+    PSTRING_POOL_ENTRY* link;
+
+    entry = (PSTRING_POOL_ENTRY)((UCHAR*)string - FIELD_OFFSET(STRING_POOL_ENTRY, String));
+
+    pool->References--;
+    pool->UnpooledBytes -= ((size_t)entry->Length + 1) * sizeof(WCHAR);
+
+    if (--entry->References > 0) {
+        return;
+    }
+
+    for (link = &pool->Buckets[entry->Hash & pool->BucketMask]; *link != entry; link = &(*link)->Next)
+        ;
+
+    *link = entry->Next;
+
+    pool->Strings--;
+    pool->PooledBytes -= STRING_POOL_ENTRY_SIZE(entry->Length);
+
+    STRING_POOL_FREE(entry);
+}
@@ -0,0 +1,217 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#define TOKEN_BUCKETS_TAG               'BTGH'
+
+#define TOKEN_BUCKETS_DEFAULT_CAPACITY  256
+#define TOKEN_BUCKETS_MAX_CAPACITY      0x1000
+
+//
+// Slots a key may occupy, probed on every take
+//
+#define TOKEN_BUCKETS_WAYS              4
+
+//
+// Time base of the buckets (KeQueryInterruptTime, 100ns units)
+//
+#define TOKEN_BUCKETS_TICKS_PER_SECOND  10000000ULL
+
+#define TOKEN_BUCKETS_MAX_RATE          100000
+#define TOKEN_BUCKETS_MAX_BURST         0x10000
+
+#ifndef _KERNEL_MODE
+#include <stdlib.h>
+#endif
+
+//
+// A key and the time its bucket is full again
+//
+typedef struct _TOKEN_BUCKET
+{
+    ULONG Key;
+
+    ULONG Reserved;
+
+    //
+    // Theoretical arrival time: each token taken pushes it Cost ticks
+    // further, a bucket whose time lies in the past is full
+    //
+    ULONG64 Full;
+
+} TOKEN_BUCKET, *PTOKEN_BUCKET;
+
+//
+// Per-key token buckets over ULONG keys, kept as a generic cell rate
+// algorithm: instead of a token count every bucket stores the time it
+// will be full again, so refilling is a comparison against the current
+// time and a take costs neither division nor timer. Every key may spend
+// Burst tokens at once and gets Rate tokens per second back.
+//
+// Buckets live in a set-associative table of fixed size; a key not in
+// its set takes over the bucket that is full the earliest (preferably
+// one full already, which loses nothing) and starts out full itself.
+// Keys beyond the capacity thus get throttled less, never more.
+//
+// Not synchronized; callers serialize access.
+//
+typedef struct _TOKEN_BUCKETS
+{
+    ULONG Capacity;
+
+    ULONG SetShift;
+
+    ULONG SetMask;
+
+    ULONG Reserved;
+
+    //
+    // Ticks each token is worth
+    //
+    ULONG64 Cost;
+
+    //
+    // Ticks a bucket may run ahead of the current time, (Burst - 1) * Cost
+    //
+    ULONG64 Tolerance;
+
+    TOKEN_BUCKET Buckets[1];
+
+} TOKEN_BUCKETS, *PTOKEN_BUCKETS;
+
+PTOKEN_BUCKETS FORCEINLINE TOKEN_BUCKETS_CREATE(ULONG capacity, ULONG rate, ULONG burst)
+{
+    PTOKEN_BUCKETS buckets;
+    ULONG sets = 1;
+    ULONG bits = 0;
+    size_t size;
+
+    if (capacity == 0 || capacity > TOKEN_BUCKETS_MAX_CAPACITY
+        || rate == 0 || rate > TOKEN_BUCKETS_MAX_RATE
+        || burst == 0 || burst > TOKEN_BUCKETS_MAX_BURST)
+        return NULL;
+
+    while (sets * TOKEN_BUCKETS_WAYS < capacity) {
+        sets <<= 1;
+        bits++;
+    }
+
+    capacity = sets * TOKEN_BUCKETS_WAYS;
+    size = sizeof(TOKEN_BUCKETS) + sizeof(TOKEN_BUCKET) * (capacity - 1);
+
+#ifdef _KERNEL_MODE
+    buckets = ExAllocatePoolWithTag(NonPagedPool, size, TOKEN_BUCKETS_TAG);
+#else
+    buckets = (PTOKEN_BUCKETS)malloc(size);
+#endif
+
+    if (buckets == NULL) {
+        return buckets;
+    }
+
+    RtlZeroMemory(buckets, size);
+
+    buckets->Capacity = capacity;
+    buckets->SetShift = 32 - bits;
+    buckets->SetMask = sets - 1;
+    buckets->Cost = TOKEN_BUCKETS_TICKS_PER_SECOND / rate;
+    buckets->Tolerance = buckets->Cost * (burst - 1);
+
+    return buckets;
+}
+
+VOID FORCEINLINE TOKEN_BUCKETS_DESTROY(TOKEN_BUCKETS ** buckets)
+{
+    if (*buckets == NULL)
+        return;
+
+#ifdef _KERNEL_MODE
+    ExFreePoolWithTag(*buckets, TOKEN_BUCKETS_TAG);
+#else
+    free(*buckets);
+#endif
+
+    *buckets = NULL;
+}
+
+PTOKEN_BUCKET FORCEINLINE TOKEN_BUCKETS_SET(PTOKEN_BUCKETS buckets, ULONG key)
+{
+    ULONG set;
+
+    //
+    // PIDs are multiples of four, drop the constant bits before mixing
+    // and take the well-mixed upper bits (a shift by 32 is undefined)
+    //
+    set = buckets->SetMask
+        ? ((ULONG)((key >> 2) * 0x9E3779B1) >> buckets->SetShift) & buckets->SetMask
+        : 0;
+
+    return &buckets->Buckets[set * TOKEN_BUCKETS_WAYS];
+}
+
+//
+// Takes a token from the bucket of key at time now, returns FALSE if
+// there is none left
+//
+BOOLEAN FORCEINLINE TOKEN_BUCKETS_TAKE(PTOKEN_BUCKETS buckets, ULONG key, ULONG64 now)
+{
+    PTOKEN_BUCKET set = TOKEN_BUCKETS_SET(buckets, key);
+    PTOKEN_BUCKET bucket = NULL;
+    ULONG64 full;
+    ULONG i;
+
+    for (i = 0; i < TOKEN_BUCKETS_WAYS; i++) {
+        if (set[i].Key == key && set[i].Full != 0) {
+            bucket = &set[i];
+            break;
+        }
+    }
+
+    if (bucket == NULL) {
+        bucket = &set[0];
+
+        for (i = 1; i < TOKEN_BUCKETS_WAYS; i++) {
+            if (set[i].Full < bucket->Full) {
+                bucket = &set[i];
+            }
+        }
+
+        bucket->Key = key;
+        bucket->Full = 0;
+    }
+
+    full = (bucket->Full > now) ? bucket->Full : now;
+
+    if (full - now > buckets->Tolerance) {
+        return FALSE;
+    }
+
+    bucket->Full = full + buckets->Cost;
+
+    return TRUE;
+}
@@ -0,0 +1,180 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+
+#include "Driver.h"
+#include "TopOpeners.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, TopOpenersInitialize)
+#pragma alloc_text (PAGE, TopOpenersUninitialize)
+#endif
+
+//
+// Processes most often sending opens of guarded devices on towards
+// Cerberus, NULL if tracking is off
+// 
+static PSPACE_SAVING TopOpenersSketch = NULL;
+
+//
+// Serializes access to TopOpenersSketch
+// 
+static WDFSPINLOCK TopOpenersLock = NULL;
+
+//
+// Allocates the sketch unless disabled in the configuration.
+// 
+_Use_decl_annotations_
+NTSTATUS
+TopOpenersInitialize(
+    WDFDRIVER Driver
+)
+{
+    NTSTATUS                status;
+    WDF_OBJECT_ATTRIBUTES   attribs;
+
+    PAGED_CODE();
+
+    if (GuardianConfig.TopOpenersCapacity == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = Driver;
+
+    status = WdfSpinLockCreate(&attribs, &TopOpenersLock);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "WdfSpinLockCreate failed with status %!STATUS!", status);
+        return status;
+    }
+
+    TopOpenersSketch = SPACE_SAVING_CREATE(GuardianConfig.TopOpenersCapacity);
+    if (TopOpenersSketch == NULL) {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "SPACE_SAVING_CREATE failed");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DRIVER,
+        "Tracking the top %d openers", TopOpenersSketch->Capacity);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Frees the sketch on driver unload.
+// 
+_Use_decl_annotations_
+VOID
+TopOpenersUninitialize(
+    VOID
+)
+{
+    PAGED_CODE();
+
+    SPACE_SAVING_DESTROY(&TopOpenersSketch);
+}
+
+//
+// Counts an open attempt of a guarded device by the given process that
+// isn't settled by the system PID set or the sticky cache.
+// 
+_Use_decl_annotations_
+VOID
+TopOpenersRecord(
+    ULONG ProcessId
+)
+{
+    if (TopOpenersSketch == NULL) {
+        return;
+    }
+
+    WdfSpinLockAcquire(TopOpenersLock);
+
+    SPACE_SAVING_UPDATE(TopOpenersSketch, ProcessId);
+
+    WdfSpinLockRelease(TopOpenersLock);
+}
+
+//
+// Copies as many of the most frequent openers as fit into the supplied
+// buffer, optionally starting over afterwards.
+// 
+_Use_decl_annotations_
+NTSTATUS
+TopOpenersRead(
+    PHIDGUARDIAN_TOP_OPENERS TopOpeners,
+    ULONG BufferLength,
+    ULONG Flags
+)
+{
+    PHIDGUARDIAN_TOP_OPENER     pEntry;
+    PPSPACE_SAVING_COUNTER      sorted;
+    ULONG                       count;
+    ULONG                       i;
+
+    if (TopOpenersSketch == NULL) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if (BufferLength < sizeof(HIDGUARDIAN_TOP_OPENERS)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    count = (BufferLength - sizeof(HIDGUARDIAN_TOP_OPENERS)) / sizeof(HIDGUARDIAN_TOP_OPENER);
+    pEntry = (PHIDGUARDIAN_TOP_OPENER)(TopOpeners + 1);
+
+    WdfSpinLockAcquire(TopOpenersLock);
+
+    sorted = SPACE_SAVING_SORT(TopOpenersSketch);
+    count = min(count, TopOpenersSketch->Used);
+
+    for (i = 0; i < count; i++) {
+        pEntry[i].ProcessId = sorted[i]->Key;
+        pEntry[i].Reserved = 0;
+        pEntry[i].Count = sorted[i]->Count;
+        pEntry[i].Error = sorted[i]->Error;
+    }
+
+    TopOpeners->Capacity = TopOpenersSketch->Capacity;
+    TopOpeners->TotalOpens = TopOpenersSketch->Total;
+
+    if (Flags & HIDGUARDIAN_TOP_OPENERS_RESET) {
+        SPACE_SAVING_RESET(TopOpenersSketch);
+    }
+
+    WdfSpinLockRelease(TopOpenersLock);
+
+    TopOpeners->Size = sizeof(HIDGUARDIAN_TOP_OPENERS) + count * sizeof(HIDGUARDIAN_TOP_OPENER);
+    TopOpeners->EntryCount = count;
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,442 @@
+/*
+* Windows kernel-mode driver for controlling access to various input devices.
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#define VERDICT_CACHE_TAG               'CVGH'
+
+#define VERDICT_CACHE_DEFAULT_CAPACITY  256
+#define VERDICT_CACHE_MAX_CAPACITY      0x4000
+
+//
+// Cache time is measured in 100ns units (interrupt time)
+//
+#define VERDICT_CACHE_TICKS_PER_SECOND  10000000ULL
+
+#ifndef _KERNEL_MODE
+#include <stdlib.h>
+#endif
+
+//
+// A cached access decision for a process ID
+//
+typedef struct _VERDICT_CACHE_ENTRY
+{
+    ULONG Pid;
+
+    BOOLEAN IsAllowed;
+
+    //
+    // Hit by VERDICT_CACHE_PEEK since it was last moved to the front
+    //
+    volatile BOOLEAN Referenced;
+
+    //
+    // Time of insertion, used for TTL expiry
+    //
+    ULONGLONG InsertTime;
+
+    //
+    // Hash bucket chain
+    //
+    struct _VERDICT_CACHE_ENTRY* HashNext;
+
+    //
+    // Recently used list (head is most recent), doubles as free list
+    //
+    struct _VERDICT_CACHE_ENTRY* LruPrev;
+
+    struct _VERDICT_CACHE_ENTRY* LruNext;
+
+} VERDICT_CACHE_ENTRY, *PVERDICT_CACHE_ENTRY;
+
+//
+// Fixed-capacity PID to verdict map with LRU eviction and an optional
+// time-to-live. All memory is allocated up front so no operation ever
+// allocates, which keeps them safe to call with a spin lock held.
+//
+// Not synchronized; callers serialize access. VERDICT_CACHE_PEEK is the
+// exception, it may run concurrently with other peeks (but nothing else),
+// e.g. under a reader/writer lock held shared.
+//
+typedef struct _VERDICT_CACHE
+{
+    ULONG Capacity;
+
+    ULONG Occupancy;
+
+    //
+    // Entry lifetime in 100ns units, 0 for unlimited
+    //
+    ULONGLONG Ttl;
+
+    ULONG BucketMask;
+
+    PVERDICT_CACHE_ENTRY* Buckets;
+
+    PVERDICT_CACHE_ENTRY Entries;
+
+    PVERDICT_CACHE_ENTRY LruHead;
+
+    PVERDICT_CACHE_ENTRY LruTail;
+
+    PVERDICT_CACHE_ENTRY FreeList;
+
+    ULONG64 Hits;
+
+    ULONG64 Misses;
+
+    ULONG64 Insertions;
+
+    ULONG64 Evictions;
+
+    ULONG64 Expirations;
+
+} VERDICT_CACHE, *PVERDICT_CACHE;
+
+ULONG FORCEINLINE VERDICT_CACHE_HASH(PVERDICT_CACHE cache, ULONG pid)
+{
+    //
+    // PIDs are multiples of four, drop the constant bits before mixing
+    //
+    return ((pid >> 2) * 0x9E3779B1) & cache->BucketMask;
+}
+
+PVERDICT_CACHE FORCEINLINE VERDICT_CACHE_CREATE(ULONG capacity, ULONGLONG ttl)
+{
+    PVERDICT_CACHE cache;
+    ULONG buckets = 1;
+    ULONG i;
+    size_t size;
+
+    if (capacity == 0 || capacity > VERDICT_CACHE_MAX_CAPACITY)
+        return NULL;
+
+    while (buckets < capacity) {
+        buckets <<= 1;
+    }
+
+    size = sizeof(VERDICT_CACHE)
+        + sizeof(VERDICT_CACHE_ENTRY) * capacity
+        + sizeof(PVERDICT_CACHE_ENTRY) * buckets;
+
+#ifdef _KERNEL_MODE
+    cache = ExAllocatePoolWithTag(NonPagedPool, size, VERDICT_CACHE_TAG);
+#else
+    cache = (PVERDICT_CACHE)malloc(size);
+#endif
+
+    if (cache == NULL) {
+        return cache;
+    }
+
+    RtlZeroMemory(cache, size);
+
+    cache->Capacity = capacity;
+    cache->Ttl = ttl;
+    cache->BucketMask = buckets - 1;
+    cache->Entries = (PVERDICT_CACHE_ENTRY)(cache + 1);
+    cache->Buckets = (PVERDICT_CACHE_ENTRY*)(cache->Entries + capacity);
+
+    for (i = 0; i < capacity; i++) {
+        cache->Entries[i].LruNext = cache->FreeList;
+        cache->FreeList = &cache->Entries[i];
+    }
+
+    return cache;
+}
+
+//
+// Bytes allocated for the cache
+//
+size_t FORCEINLINE VERDICT_CACHE_FOOTPRINT(PVERDICT_CACHE cache)
+{
+    if (cache == NULL)
+        return 0;
+
+    return sizeof(VERDICT_CACHE)
+        + sizeof(VERDICT_CACHE_ENTRY) * cache->Capacity
+        + sizeof(PVERDICT_CACHE_ENTRY) * ((size_t)cache->BucketMask + 1);
+}
+
+VOID FORCEINLINE VERDICT_CACHE_DESTROY(VERDICT_CACHE ** cache)
+{
+    if (*cache == NULL)
+        return;
+
+#ifdef _KERNEL_MODE
+    ExFreePoolWithTag(*cache, VERDICT_CACHE_TAG);
+#else
+    free(*cache);
+#endif
+
+    *cache = NULL;
+}
+
+VOID FORCEINLINE VERDICT_CACHE_LRU_UNLINK(PVERDICT_CACHE cache, PVERDICT_CACHE_ENTRY entry)
+{
+    if (entry->LruPrev)
+        entry->LruPrev->LruNext = entry->LruNext;
+    else
+        cache->LruHead = entry->LruNext;
+
+    if (entry->LruNext)
+        entry->LruNext->LruPrev = entry->LruPrev;
+    else
+        cache->LruTail = entry->LruPrev;
+
+    entry->LruPrev = entry->LruNext = NULL;
+}
+
+VOID FORCEINLINE VERDICT_CACHE_LRU_PUSH(PVERDICT_CACHE cache, PVERDICT_CACHE_ENTRY entry)
+{
+    entry->LruPrev = NULL;
+    entry->LruNext = cache->LruHead;
+
+    if (cache->LruHead)
+        cache->LruHead->LruPrev = entry;
+    else
+        cache->LruTail = entry;
+
+    cache->LruHead = entry;
+}
+
+//
+// Unlinks an entry from its bucket and the LRU list and returns it to the free list
+//
+VOID FORCEINLINE VERDICT_CACHE_RELEASE(PVERDICT_CACHE cache, PVERDICT_CACHE_ENTRY entry)
+{
+    PVERDICT_CACHE_ENTRY* link = &cache->Buckets[VERDICT_CACHE_HASH(cache, entry->Pid)];
+
+    while (*link != entry) {
+        link = &(*link)->HashNext;
+    }
+
+    *link = entry->HashNext;
+    entry->HashNext = NULL;
+
+    VERDICT_CACHE_LRU_UNLINK(cache, entry);
+
+    entry->LruNext = cache->FreeList;
+    cache->FreeList = entry;
+    cache->Occupancy--;
+}
+
+PVERDICT_CACHE_ENTRY FORCEINLINE VERDICT_CACHE_FIND(PVERDICT_CACHE cache, ULONG pid)
+{
+    PVERDICT_CACHE_ENTRY entry;
+
+    for (entry = cache->Buckets[VERDICT_CACHE_HASH(cache, pid)]; entry != NULL; entry = entry->HashNext) {
+        if (entry->Pid == pid) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+//
+// Returns TRUE and the cached verdict if an unexpired entry exists
+//
+BOOLEAN FORCEINLINE VERDICT_CACHE_LOOKUP(PVERDICT_CACHE cache, ULONG pid, ULONGLONG now, BOOLEAN* allowed)
+{
+    PVERDICT_CACHE_ENTRY entry;
+
+    if (cache == NULL)
+        return FALSE;
+
+    entry = VERDICT_CACHE_FIND(cache, pid);
+
+    if (entry == NULL) {
+        cache->Misses++;
+        return FALSE;
+    }
+
+    if (cache->Ttl != 0 && now - entry->InsertTime >= cache->Ttl) {
+        VERDICT_CACHE_RELEASE(cache, entry);
+        cache->Expirations++;
+        cache->Misses++;
+        return FALSE;
+    }
+
+    //
+    // Move to front of the recently used list
+    //
+    if (cache->LruHead != entry) {
+        VERDICT_CACHE_LRU_UNLINK(cache, entry);
+        VERDICT_CACHE_LRU_PUSH(cache, entry);
+    }
+
+    entry->Referenced = FALSE;
+    cache->Hits++;
+
+    if (allowed != NULL) {
+        *allowed = entry->IsAllowed;
+    }
+
+    return TRUE;
+}
+
+//
+// Number of entries that haven't expired yet
+//
+ULONG FORCEINLINE VERDICT_CACHE_LIVE(PVERDICT_CACHE cache, ULONGLONG now)
+{
+    PVERDICT_CACHE_ENTRY entry;
+    ULONG live = 0;
+
+    if (cache == NULL)
+        return 0;
+
+    if (cache->Ttl == 0)
+        return cache->Occupancy;
+
+    for (entry = cache->LruHead; entry != NULL; entry = entry->LruNext) {
+        if (now - entry->InsertTime < cache->Ttl) {
+            live++;
+        }
+    }
+
+    return live;
+}
+
+//
+// Lookup for concurrent readers: leaves the lists alone and only marks
+// the entry referenced, so it gets a second chance at eviction instead of
+// moving to the front. Hits and misses aren't counted (callers keep their
+// own counters) and expired entries stay until an insertion reclaims them.
+//
+BOOLEAN FORCEINLINE VERDICT_CACHE_PEEK(PVERDICT_CACHE cache, ULONG pid, ULONGLONG now, BOOLEAN* allowed)
+{
+    PVERDICT_CACHE_ENTRY entry;
+
+    if (cache == NULL)
+        return FALSE;
+
+    entry = VERDICT_CACHE_FIND(cache, pid);
+
+    if (entry == NULL || (cache->Ttl != 0 && now - entry->InsertTime >= cache->Ttl))
+        return FALSE;
+
+    //
+    // Only the first hit dirties the cache line
+    //
+    if (!entry->Referenced) {
+        entry->Referenced = TRUE;
+    }
+
+    if (allowed != NULL) {
+        *allowed = entry->IsAllowed;
+    }
+
+    return TRUE;
+}
+
+//
+// Stores or refreshes a verdict, evicting the least recently used entry if full
+//
+BOOLEAN FORCEINLINE VERDICT_CACHE_INSERT(PVERDICT_CACHE cache, ULONG pid, BOOLEAN allowed, ULONGLONG now)
+{
+    PVERDICT_CACHE_ENTRY entry;
+    ULONG bucket;
+    ULONG i;
+
+    if (cache == NULL)
+        return FALSE;
+
+    entry = VERDICT_CACHE_FIND(cache, pid);
+
+    if (entry != NULL) {
+        entry->IsAllowed = allowed;
+        entry->InsertTime = now;
+        entry->Referenced = FALSE;
+
+        if (cache->LruHead != entry) {
+            VERDICT_CACHE_LRU_UNLINK(cache, entry);
+            VERDICT_CACHE_LRU_PUSH(cache, entry);
+        }
+
+        return TRUE;
+    }
+
+    if (cache->FreeList == NULL) {
+        entry = cache->LruTail;
+
+        //
+        // Entries peeked at since they were last moved get a second chance
+        //
+        for (i = cache->Occupancy; i > 0 && entry->Referenced; i--) {
+            entry->Referenced = FALSE;
+            VERDICT_CACHE_LRU_UNLINK(cache, entry);
+            VERDICT_CACHE_LRU_PUSH(cache, entry);
+            entry = cache->LruTail;
+        }
+
+        if (cache->Ttl != 0 && now - entry->InsertTime >= cache->Ttl)
+            cache->Expirations++;
+        else
+            cache->Evictions++;
+
+        VERDICT_CACHE_RELEASE(cache, entry);
+    }
+
+    entry = cache->FreeList;
+    cache->FreeList = entry->LruNext;
+
+    entry->Pid = pid;
+    entry->IsAllowed = allowed;
+    entry->Referenced = FALSE;
+    entry->InsertTime = now;
+
+    bucket = VERDICT_CACHE_HASH(cache, pid);
+    entry->HashNext = cache->Buckets[bucket];
+    cache->Buckets[bucket] = entry;
+
+    VERDICT_CACHE_LRU_PUSH(cache, entry);
+
+    cache->Occupancy++;
+    cache->Insertions++;
+
+    return TRUE;
+}
+
+BOOLEAN FORCEINLINE VERDICT_CACHE_REMOVE(PVERDICT_CACHE cache, ULONG pid)
+{
+    PVERDICT_CACHE_ENTRY entry;
+
+    if (cache == NULL)
+        return FALSE;
+
+    entry = VERDICT_CACHE_FIND(cache, pid);
+
+    if (entry == NULL)
+        return FALSE;
+
+    VERDICT_CACHE_RELEASE(cache, entry);
+
+    return TRUE;
+}